@@ -9,8 +9,53 @@
 
 #define CRUISE_STREAM_BUFSIZE   ( 1 * 1024 * 1024 )
 
+/* size of the first private buffer we give a stream */
+#define CRUISE_STREAM_BUFSIZE_MIN ( 4 * 1024 )
+
+/* attempts to take a busy stream lock before yielding the cpu */
+#define CRUISE_STREAM_LOCK_SPINS ( 100 )
+
+/* bytes fprintf formats on the stack before allocating a string */
+#define CRUISE_STREAM_PRINTF_BUFSIZE ( 1024 )
+
 #define CRUISE_CHUNK_BITS       ( 24 )
 
+/* number of threads that split large reads and writes, 0 disables */
+#define CRUISE_COPY_THREADS     ( 0 )
+
+/* smallest read or write we split across the copy threads */
+#define CRUISE_COPY_THRESHOLD   ( 64 * 1024 * 1024 )
+
+/* smallest write into chunk memory that bypasses the cache */
+#define CRUISE_STREAM_COPY_MIN  ( 256 * 1024 )
+
+/* whether whole chunks of zeros are kept as holes, 0 disables */
+#define CRUISE_ZERO_CHUNKS      ( 0 )
+
+/* whether chunks of closed files are compressed when free memory
+ * chunks run low, 0 disables */
+#define CRUISE_COMPRESS         ( 0 )
+
+/* percent of memory chunks the packer keeps free */
+#define CRUISE_COMPRESS_FREE    ( 12 )
+
+/* whether whole chunks are compressed on their way to spill over,
+ * 0 disables */
+#define CRUISE_COMPRESS_SPILLOVER ( 0 )
+
+/* whether full chunks of closed files are shared with identical
+ * chunks of other files, 0 disables */
+#define CRUISE_DEDUP            ( 0 )
+
+/* whether a CRC32C of each chunk is kept up to date as writes land,
+ * 0 disables */
+#define CRUISE_CHECKSUM         ( 0 )
+
+/* whether reads and fsync check data against the chunk checksums,
+ * which turns on the checksums and makes writes take the file lock
+ * exclusive, 0 disables */
+#define CRUISE_CHECKSUM_VERIFY  ( 0 )
+
 #ifdef MACHINE_BGQ
   #define CRUISE_CHUNK_MEM      ( 64 * 1024 * 1024 )
 #else /* MACHINE_BGQ */
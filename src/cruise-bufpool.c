@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+/* implements a pool of page-aligned stream buffers in size classes
+ * that grow by a factor of 4, each thread keeps a few released
+ * buffers per class for itself, the rest go to a shared free list
+ * protected by a mutex, and the pool holds on to a bounded number of
+ * bytes per class beyond which buffers are freed */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cruise-bufpool.h"
+
+/* smallest class is 2^12 = 4KB, each class is 4x the previous */
+#define CRUISE_BUFPOOL_MIN_BITS ( 12 )
+#define CRUISE_BUFPOOL_CLASSES  ( 5 )
+
+/* number of buffers per class a thread keeps for itself */
+#define CRUISE_BUFPOOL_THREAD_KEEP ( 2 )
+
+/* bytes per class held on the shared free list */
+#define CRUISE_BUFPOOL_SHARED_KEEP ( 4 * 1024 * 1024 )
+
+/* free buffers are linked through their first bytes */
+typedef struct cruise_bufpool_entry {
+    struct cruise_bufpool_entry* next;
+} cruise_bufpool_entry;
+
+/* shared free lists */
+static pthread_mutex_t cruise_bufpool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cruise_bufpool_entry* cruise_bufpool_shared[CRUISE_BUFPOOL_CLASSES];
+static size_t cruise_bufpool_shared_count[CRUISE_BUFPOOL_CLASSES];
+
+/* per-thread free lists, a key with a destructor hands them back to
+ * the shared lists when the thread exits */
+static __thread cruise_bufpool_entry* cruise_bufpool_cache[CRUISE_BUFPOOL_CLASSES];
+static __thread int cruise_bufpool_cache_count[CRUISE_BUFPOOL_CLASSES];
+static __thread int cruise_bufpool_cache_registered = 0;
+static pthread_key_t cruise_bufpool_key;
+static pthread_once_t cruise_bufpool_once = PTHREAD_ONCE_INIT;
+
+static size_t cruise_bufpool_page_size = 4096;
+
+/* returns the class holding buffers of size bytes, or -1 if size is
+ * larger than our biggest class */
+static int cruise_bufpool_class(size_t size)
+{
+    size_t class_size = (size_t)1 << CRUISE_BUFPOOL_MIN_BITS;
+    int c;
+    for (c = 0; c < CRUISE_BUFPOOL_CLASSES; c++) {
+        if (size <= class_size) {
+            return c;
+        }
+        class_size <<= 2;
+    }
+    return -1;
+}
+
+/* returns size in bytes of buffers in the given class */
+static size_t cruise_bufpool_class_size(int c)
+{
+    return (size_t)1 << (CRUISE_BUFPOOL_MIN_BITS + 2 * c);
+}
+
+/* pushes buffer onto shared list if there is room, frees it otherwise */
+static void cruise_bufpool_release(cruise_bufpool_entry* entry, int c)
+{
+    size_t limit = CRUISE_BUFPOOL_SHARED_KEEP / cruise_bufpool_class_size(c);
+
+    pthread_mutex_lock(&cruise_bufpool_mutex);
+    if (cruise_bufpool_shared_count[c] < limit) {
+        entry->next = cruise_bufpool_shared[c];
+        cruise_bufpool_shared[c] = entry;
+        cruise_bufpool_shared_count[c]++;
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&cruise_bufpool_mutex);
+
+    if (entry != NULL) {
+        free(entry);
+    }
+}
+
+/* called at thread exit to hand the thread's buffers back */
+static void cruise_bufpool_thread_exit(void* arg)
+{
+    int c;
+    for (c = 0; c < CRUISE_BUFPOOL_CLASSES; c++) {
+        while (cruise_bufpool_cache[c] != NULL) {
+            cruise_bufpool_entry* entry = cruise_bufpool_cache[c];
+            cruise_bufpool_cache[c] = entry->next;
+            cruise_bufpool_release(entry, c);
+        }
+        cruise_bufpool_cache_count[c] = 0;
+    }
+    cruise_bufpool_cache_registered = 0;
+}
+
+static void cruise_bufpool_init(void)
+{
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (page_size > 0) {
+        cruise_bufpool_page_size = (size_t) page_size;
+    }
+    pthread_key_create(&cruise_bufpool_key, cruise_bufpool_thread_exit);
+}
+
+/* allocates a new page-aligned buffer and touches each of its pages
+ * so the stream doesn't take the faults one at a time later */
+static void* cruise_bufpool_alloc(size_t size)
+{
+    void* buf;
+    if (posix_memalign(&buf, cruise_bufpool_page_size, size) != 0) {
+        return NULL;
+    }
+
+    volatile char* ptr = (volatile char*) buf;
+    size_t offset;
+    for (offset = 0; offset < size; offset += cruise_bufpool_page_size) {
+        ptr[offset] = 0;
+    }
+
+    return buf;
+}
+
+/* returns a page-aligned buffer of at least size bytes, or NULL if
+ * we're out of memory */
+void* cruise_bufpool_get(size_t size)
+{
+    pthread_once(&cruise_bufpool_once, cruise_bufpool_init);
+
+    /* allocate oversized requests directly */
+    int c = cruise_bufpool_class(size);
+    if (c < 0) {
+        return cruise_bufpool_alloc(size);
+    }
+
+    /* check our own cache first */
+    cruise_bufpool_entry* entry = cruise_bufpool_cache[c];
+    if (entry != NULL) {
+        cruise_bufpool_cache[c] = entry->next;
+        cruise_bufpool_cache_count[c]--;
+        return entry;
+    }
+
+    /* then the shared list */
+    pthread_mutex_lock(&cruise_bufpool_mutex);
+    entry = cruise_bufpool_shared[c];
+    if (entry != NULL) {
+        cruise_bufpool_shared[c] = entry->next;
+        cruise_bufpool_shared_count[c]--;
+    }
+    pthread_mutex_unlock(&cruise_bufpool_mutex);
+    if (entry != NULL) {
+        return entry;
+    }
+
+    /* pool is empty, allocate a new buffer */
+    return cruise_bufpool_alloc(cruise_bufpool_class_size(c));
+}
+
+/* returns a buffer obtained from cruise_bufpool_get to the pool,
+ * size must be the value passed to cruise_bufpool_get */
+void cruise_bufpool_put(void* buf, size_t size)
+{
+    if (buf == NULL) {
+        return;
+    }
+
+    /* free oversized buffers directly */
+    int c = cruise_bufpool_class(size);
+    if (c < 0) {
+        free(buf);
+        return;
+    }
+
+    /* keep a few buffers for this thread */
+    cruise_bufpool_entry* entry = (cruise_bufpool_entry*) buf;
+    if (cruise_bufpool_cache_count[c] < CRUISE_BUFPOOL_THREAD_KEEP) {
+        /* register the thread so its cache is drained on exit */
+        if (! cruise_bufpool_cache_registered) {
+            pthread_once(&cruise_bufpool_once, cruise_bufpool_init);
+            pthread_setspecific(cruise_bufpool_key, (void*) 1);
+            cruise_bufpool_cache_registered = 1;
+        }
+        entry->next = cruise_bufpool_cache[c];
+        cruise_bufpool_cache[c] = entry;
+        cruise_bufpool_cache_count[c]++;
+        return;
+    }
+
+    /* hand the rest to the shared list */
+    cruise_bufpool_release(entry, c);
+}
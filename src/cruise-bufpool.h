@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+#ifndef CRUISE_BUFPOOL_H
+#define CRUISE_BUFPOOL_H
+
+/* implements a pool of page-aligned stream buffers, buffers come in
+ * size classes of 4KB, 16KB, 64KB, 256KB, and 1MB, pages are touched
+ * when a buffer is first allocated, and released buffers are kept on
+ * a small per-thread cache backed by a shared free list per class so
+ * that streams opened and closed in a loop reuse warm memory instead
+ * of going through malloc and page faults each time, requests larger
+ * than the biggest class are allocated and freed directly */
+
+#include <stddef.h>
+
+/* returns a page-aligned buffer of at least size bytes, or NULL if
+ * we're out of memory */
+void* cruise_bufpool_get(size_t size);
+
+/* returns a buffer obtained from cruise_bufpool_get to the pool,
+ * size must be the value passed to cruise_bufpool_get */
+void cruise_bufpool_put(void* buf, size_t size);
+
+#endif /* CRUISE_BUFPOOL_H */
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+/* implements the chunk codec on top of zlib and the background packer,
+ * the packer sleeps on a generation count like the copy pool workers
+ * and runs the reclaim function once for each time it is woken,
+ * wakeups that come in while it is busy fold into one more pass */
+
+#include "cruise-runtime-config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "cruise-compress.h"
+
+/* function the packer runs when woken */
+static void (*cruise_compress_reclaim)(void) = NULL;
+
+static pthread_once_t cruise_compress_once = PTHREAD_ONCE_INIT;
+static int cruise_compress_started = 0;
+
+/* protects the generation count, the packer waits on work for it
+ * to change */
+static pthread_mutex_t cruise_compress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cruise_compress_work  = PTHREAD_COND_INITIALIZER;
+static unsigned long   cruise_compress_generation = 0;
+
+/* returns the most bytes that compressing count bytes can take */
+size_t cruise_compress_bound(size_t count)
+{
+    return (size_t) compressBound((uLong) count);
+}
+
+/* compresses count bytes from src into dst, which has room for *size
+ * bytes, sets *size to the number of bytes used, returns 0 on
+ * success and -1 if the data didn't fit */
+int cruise_compress(const void* src, size_t count, void* dst, size_t* size)
+{
+    uLongf len = (uLongf) *size;
+    int rc = compress2((Bytef*) dst, &len, (const Bytef*) src, (uLong) count, Z_BEST_SPEED);
+    if (rc != Z_OK) {
+        return -1;
+    }
+    *size = (size_t) len;
+    return 0;
+}
+
+/* decompresses data from src, which holds at most size bytes, into
+ * the count bytes at dst, returns 0 on success and -1 if src doesn't
+ * hold exactly count bytes of compressed data, compressed data may be
+ * followed by unused bytes, inflate stops at the end of the stream */
+int cruise_decompress(const void* src, size_t size, void* dst, size_t count)
+{
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit(&strm) != Z_OK) {
+        return -1;
+    }
+
+    strm.next_in   = (Bytef*) src;
+    strm.avail_in  = (uInt) size;
+    strm.next_out  = (Bytef*) dst;
+    strm.avail_out = (uInt) count;
+    int rc = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+
+    if (rc != Z_STREAM_END || strm.avail_out != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void* cruise_compress_worker(void* arg)
+{
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&cruise_compress_mutex);
+    while (1) {
+        /* wait to be woken */
+        while (cruise_compress_generation == seen) {
+            pthread_cond_wait(&cruise_compress_work, &cruise_compress_mutex);
+        }
+        seen = cruise_compress_generation;
+        pthread_mutex_unlock(&cruise_compress_mutex);
+
+        cruise_compress_reclaim();
+
+        pthread_mutex_lock(&cruise_compress_mutex);
+    }
+
+    return NULL;
+}
+
+/* start the packer with all signals blocked so they're always
+ * delivered to application threads */
+static void cruise_compress_start(void)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    if (pthread_create(&thread, &attr, cruise_compress_worker, NULL) == 0) {
+        cruise_compress_started = 1;
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* sets the function the packer calls each time it is woken */
+void cruise_compress_init(void (*reclaim)(void))
+{
+    cruise_compress_reclaim = reclaim;
+}
+
+/* wakes the packer, returns at once */
+void cruise_compress_wake(void)
+{
+    if (cruise_compress_reclaim == NULL) {
+        return;
+    }
+
+    pthread_once(&cruise_compress_once, cruise_compress_start);
+    if (! cruise_compress_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&cruise_compress_mutex);
+    cruise_compress_generation++;
+    pthread_cond_signal(&cruise_compress_work);
+    pthread_mutex_unlock(&cruise_compress_mutex);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+#ifndef CRUISE_COMPRESS_H
+#define CRUISE_COMPRESS_H
+
+/* implements the codec used to compress chunks, zlib at its fastest
+ * level, and a background packer thread that is woken when free
+ * memory chunks run low and calls back into the file system to
+ * compress chunks of closed files, the thread is started the first
+ * time it is woken */
+
+#include <stddef.h>
+
+/* returns the most bytes that compressing count bytes can take */
+size_t cruise_compress_bound(size_t count);
+
+/* compresses count bytes from src into dst, which has room for *size
+ * bytes, sets *size to the number of bytes used, returns 0 on
+ * success and -1 if the data didn't fit */
+int cruise_compress(const void* src, size_t count, void* dst, size_t* size);
+
+/* decompresses data from src, which holds at most size bytes, into
+ * the count bytes at dst, returns 0 on success and -1 if src doesn't
+ * hold exactly count bytes of compressed data */
+int cruise_decompress(const void* src, size_t size, void* dst, size_t count);
+
+/* sets the function the packer calls each time it is woken */
+void cruise_compress_init(void (*reclaim)(void));
+
+/* wakes the packer, returns at once */
+void cruise_compress_wake(void);
+
+#endif /* CRUISE_COMPRESS_H */
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+/* implements the copy pool, each transfer publishes its list of tasks
+ * and bumps a generation count to wake the workers, then everyone
+ * including the caller takes tasks off the list with an atomic
+ * increment until it runs dry, the caller waits for the workers to
+ * check in before returning so the list stays valid while in use */
+
+#include "cruise-runtime-config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#ifdef ENABLE_NUMA_POLICY
+#include <numa.h>
+#endif
+
+#include "cruise-copypool.h"
+#include "cruise-memcpy.h"
+
+/* settings given to cruise_copypool_init */
+static int    cruise_copypool_threads   = 0;
+static size_t cruise_copypool_threshold = 0;
+static int    cruise_copypool_node      = CRUISE_COPYPOOL_NODE_ANY;
+
+/* number of workers actually running */
+static int cruise_copypool_started = 0;
+static pthread_once_t cruise_copypool_once = PTHREAD_ONCE_INIT;
+
+/* held by the transfer that is using the workers */
+static pthread_mutex_t cruise_copypool_busy = PTHREAD_MUTEX_INITIALIZER;
+
+/* protects the generation and active counts, workers wait on work
+ * for a new generation and the caller waits on done for them */
+static pthread_mutex_t cruise_copypool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cruise_copypool_work  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  cruise_copypool_done  = PTHREAD_COND_INITIALIZER;
+static unsigned long   cruise_copypool_generation = 0;
+static int             cruise_copypool_active = 0;
+
+/* task list of the current transfer and index of next task to take */
+static const cruise_copy_task_t* cruise_copypool_tasks = NULL;
+static int cruise_copypool_ntasks = 0;
+static int cruise_copypool_next   = 0;
+
+/* copy one task with the kernel for its direction */
+static void cruise_copypool_copy(const cruise_copy_task_t* task)
+{
+    if (task->write) {
+        cruise_memcpy_write(task->dst, task->src, task->count);
+    } else {
+        cruise_memcpy_read(task->dst, task->src, task->count);
+    }
+}
+
+/* copy tasks off the current list until none are left */
+static void cruise_copypool_drain(void)
+{
+    const cruise_copy_task_t* tasks = cruise_copypool_tasks;
+    int ntasks = cruise_copypool_ntasks;
+    while (1) {
+        int i = __sync_fetch_and_add(&cruise_copypool_next, 1);
+        if (i >= ntasks) {
+            break;
+        }
+        cruise_copypool_copy(&tasks[i]);
+    }
+}
+
+/* bind the calling worker to its NUMA node */
+static void cruise_copypool_bind(long id)
+{
+#ifdef ENABLE_NUMA_POLICY
+    if (numa_available() < 0) {
+        return;
+    }
+    if (cruise_copypool_node >= 0) {
+        numa_run_on_node(cruise_copypool_node);
+    } else if (cruise_copypool_node == CRUISE_COPYPOOL_NODE_SPREAD) {
+        int nodes = numa_max_node() + 1;
+        numa_run_on_node((int) (id % nodes));
+    }
+#endif
+}
+
+static void* cruise_copypool_worker(void* arg)
+{
+    cruise_copypool_bind((long) arg);
+
+    /* workers are started before the first transfer is published,
+     * so the first one we need to take part in is generation 1 */
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&cruise_copypool_mutex);
+    while (1) {
+        /* wait for the next transfer */
+        while (cruise_copypool_generation == seen) {
+            pthread_cond_wait(&cruise_copypool_work, &cruise_copypool_mutex);
+        }
+        seen = cruise_copypool_generation;
+        pthread_mutex_unlock(&cruise_copypool_mutex);
+
+        cruise_copypool_drain();
+
+        /* check in, the last one to finish wakes the caller */
+        pthread_mutex_lock(&cruise_copypool_mutex);
+        cruise_copypool_active--;
+        if (cruise_copypool_active == 0) {
+            pthread_cond_signal(&cruise_copypool_done);
+        }
+    }
+
+    return NULL;
+}
+
+/* start the workers, the caller copies too so we need one less than
+ * the configured count, workers block all signals so they're always
+ * delivered to application threads */
+static void cruise_copypool_start(void)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    long i;
+    for (i = 0; i < cruise_copypool_threads - 1; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, cruise_copypool_worker, (void*) i) != 0) {
+            break;
+        }
+        cruise_copypool_started++;
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* configures the pool to use threads workers for transfers of at
+ * least threshold bytes, with workers bound to NUMA node node or one
+ * of the CRUISE_COPYPOOL_NODE values, the workers are started on the
+ * first transfer that needs them, threads of 0 disables the pool */
+void cruise_copypool_init(int threads, size_t threshold, int node)
+{
+    cruise_copypool_threads   = threads;
+    cruise_copypool_threshold = threshold;
+    cruise_copypool_node      = node;
+}
+
+/* returns 1 if a transfer of count bytes should be split across the
+ * pool and 0 if the caller should copy it itself */
+int cruise_copypool_wanted(size_t count)
+{
+    return (cruise_copypool_threads > 1 && count >= cruise_copypool_threshold);
+}
+
+/* copies each of the ntasks tasks, using the workers if they're free
+ * and copying on the calling thread otherwise, returns once all bytes
+ * have been copied */
+void cruise_copypool_run(const cruise_copy_task_t* tasks, int ntasks)
+{
+    int i;
+
+    /* use the workers if there's something to split and no one else
+     * has them */
+    int parallel = 0;
+    if (ntasks > 1 && cruise_copypool_threads > 1) {
+        if (pthread_mutex_trylock(&cruise_copypool_busy) == 0) {
+            pthread_once(&cruise_copypool_once, cruise_copypool_start);
+            if (cruise_copypool_started > 0) {
+                parallel = 1;
+            } else {
+                pthread_mutex_unlock(&cruise_copypool_busy);
+            }
+        }
+    }
+
+    if (! parallel) {
+        for (i = 0; i < ntasks; i++) {
+            cruise_copypool_copy(&tasks[i]);
+        }
+        return;
+    }
+
+    /* publish our tasks and wake the workers */
+    pthread_mutex_lock(&cruise_copypool_mutex);
+    cruise_copypool_tasks  = tasks;
+    cruise_copypool_ntasks = ntasks;
+    cruise_copypool_next   = 0;
+    cruise_copypool_active = cruise_copypool_started;
+    cruise_copypool_generation++;
+    pthread_cond_broadcast(&cruise_copypool_work);
+    pthread_mutex_unlock(&cruise_copypool_mutex);
+
+    /* lend a hand */
+    cruise_copypool_drain();
+
+    /* wait for every worker to check in, only then is no one looking
+     * at our task list anymore */
+    pthread_mutex_lock(&cruise_copypool_mutex);
+    while (cruise_copypool_active > 0) {
+        pthread_cond_wait(&cruise_copypool_done, &cruise_copypool_mutex);
+    }
+    cruise_copypool_tasks  = NULL;
+    cruise_copypool_ntasks = 0;
+    pthread_mutex_unlock(&cruise_copypool_mutex);
+
+    pthread_mutex_unlock(&cruise_copypool_busy);
+}
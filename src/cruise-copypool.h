@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+#ifndef CRUISE_COPYPOOL_H
+#define CRUISE_COPYPOOL_H
+
+/* implements an optional pool of worker threads that split very large
+ * reads and writes by chunk, so that a single thread writing a
+ * checkpoint can use the memory bandwidth of the whole node, the
+ * calling thread copies alongside the workers, only one transfer uses
+ * the pool at a time and any other large transfer that comes along
+ * meanwhile is copied by its own thread as before */
+
+#include <stddef.h>
+
+/* workers are not bound to any NUMA node */
+#define CRUISE_COPYPOOL_NODE_ANY    ( -1 )
+
+/* workers are spread round-robin over all NUMA nodes */
+#define CRUISE_COPYPOOL_NODE_SPREAD ( -2 )
+
+/* one piece of a transfer, lies within a single chunk */
+typedef struct {
+    void* dst;       /* where to copy to */
+    const void* src; /* where to copy from */
+    size_t count;    /* number of bytes to copy */
+    int write;       /* whether dst is chunk memory */
+} cruise_copy_task_t;
+
+/* configures the pool to use threads workers for transfers of at
+ * least threshold bytes, with workers bound to NUMA node node or one
+ * of the CRUISE_COPYPOOL_NODE values, the workers are started on the
+ * first transfer that needs them, threads of 0 disables the pool */
+void cruise_copypool_init(int threads, size_t threshold, int node);
+
+/* returns 1 if a transfer of count bytes should be split across the
+ * pool and 0 if the caller should copy it itself */
+int cruise_copypool_wanted(size_t count);
+
+/* copies each of the ntasks tasks, using the workers if they're free
+ * and copying on the calling thread otherwise, returns once all bytes
+ * have been copied */
+void cruise_copypool_run(const cruise_copy_task_t* tasks, int ntasks);
+
+#endif /* CRUISE_COPYPOOL_H */
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+/* implements CRC32C, the crc32 instruction has a latency of three
+ * cycles but can start one every cycle, so long runs are split into
+ * three blocks that are checksummed side by side and combined, the
+ * combine multiplies a checksum by x to the power of eight times the
+ * bytes that follow it modulo the polynomial, as zlib's crc32_combine
+ * does, with the powers of x we need computed once, the kernel and
+ * tables are set up the first time any function is called */
+
+#include "cruise-runtime-config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRUISE_CRC32C_X86
+#include <immintrin.h>
+#endif
+
+#include "cruise-crc32c.h"
+
+/* the Castagnoli polynomial, bit reflected */
+#define CRUISE_CRC32C_POLY ( 0x82f63b78u )
+
+/* bytes in each of the three blocks the kernel works on side by side */
+#define CRUISE_CRC32C_BLOCK ( 4096 )
+
+typedef uint32_t (*cruise_crc32c_fn)(uint32_t, const char*, size_t);
+
+static pthread_once_t cruise_crc32c_once = PTHREAD_ONCE_INIT;
+
+/* table for the byte at a time kernel */
+static uint32_t cruise_crc32c_table[256];
+
+/* x to the power of 2^n modulo the polynomial */
+static uint32_t cruise_crc32c_x2n[32];
+
+/* multipliers that shift a checksum over one and two blocks */
+static uint32_t cruise_crc32c_block1;
+static uint32_t cruise_crc32c_block2;
+
+/* multiply a and b modulo the polynomial */
+static uint32_t cruise_crc32c_multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRUISE_CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x to the power of n * 2^k modulo the polynomial */
+static uint32_t cruise_crc32c_x2nmodp(size_t n, unsigned k)
+{
+    uint32_t p = 1u << 31;
+    while (n) {
+        if (n & 1) {
+            p = cruise_crc32c_multmodp(cruise_crc32c_x2n[k & 31], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+/* update the crc register a byte at a time, no inversions */
+static uint32_t cruise_crc32c_bytes(uint32_t crc, const char* p, size_t n)
+{
+    while (n > 0) {
+        crc = cruise_crc32c_table[(crc ^ (unsigned char) *p) & 0xff] ^ (crc >> 8);
+        p++;
+        n--;
+    }
+    return crc;
+}
+
+/* kernel that updates the crc register */
+static cruise_crc32c_fn cruise_crc32c_kernel = cruise_crc32c_bytes;
+
+#ifdef CRUISE_CRC32C_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t cruise_crc32c_sse42(uint32_t crc, const char* p, size_t n)
+{
+    uint64_t c0 = crc;
+
+    /* three blocks side by side, the second and third start from
+     * zero and are shifted into place after */
+    while (n >= 3 * CRUISE_CRC32C_BLOCK) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        const char* end = p + CRUISE_CRC32C_BLOCK;
+        while (p < end) {
+            uint64_t a, b, c;
+            memcpy(&a, p, sizeof(a));
+            memcpy(&b, p + CRUISE_CRC32C_BLOCK, sizeof(b));
+            memcpy(&c, p + 2 * CRUISE_CRC32C_BLOCK, sizeof(c));
+            c0 = _mm_crc32_u64(c0, a);
+            c1 = _mm_crc32_u64(c1, b);
+            c2 = _mm_crc32_u64(c2, c);
+            p += sizeof(a);
+        }
+        c0 = cruise_crc32c_multmodp(cruise_crc32c_block2, (uint32_t) c0) ^
+             cruise_crc32c_multmodp(cruise_crc32c_block1, (uint32_t) c1) ^
+             (uint32_t) c2;
+        p += 2 * CRUISE_CRC32C_BLOCK;
+        n -= 3 * CRUISE_CRC32C_BLOCK;
+    }
+
+    while (n >= sizeof(uint64_t)) {
+        uint64_t a;
+        memcpy(&a, p, sizeof(a));
+        c0 = _mm_crc32_u64(c0, a);
+        p += sizeof(a);
+        n -= sizeof(a);
+    }
+
+    uint32_t c = (uint32_t) c0;
+    while (n > 0) {
+        c = _mm_crc32_u8(c, (unsigned char) *p);
+        p++;
+        n--;
+    }
+    return c;
+}
+
+#endif /* CRUISE_CRC32C_X86 */
+
+/* build the tables and pick the kernel */
+static void cruise_crc32c_setup(void)
+{
+    uint32_t i;
+    for (i = 0; i < 256; i++) {
+        uint32_t c = i;
+        int bit;
+        for (bit = 0; bit < 8; bit++) {
+            c = (c & 1) ? (c >> 1) ^ CRUISE_CRC32C_POLY : c >> 1;
+        }
+        cruise_crc32c_table[i] = c;
+    }
+
+    /* x^1, then square for each next power */
+    uint32_t p = 1u << 30;
+    cruise_crc32c_x2n[0] = p;
+    for (i = 1; i < 32; i++) {
+        p = cruise_crc32c_multmodp(p, p);
+        cruise_crc32c_x2n[i] = p;
+    }
+    cruise_crc32c_block1 = cruise_crc32c_x2nmodp(CRUISE_CRC32C_BLOCK, 3);
+    cruise_crc32c_block2 = cruise_crc32c_x2nmodp(2 * CRUISE_CRC32C_BLOCK, 3);
+
+#ifdef CRUISE_CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        cruise_crc32c_kernel = cruise_crc32c_sse42;
+    }
+#endif
+}
+
+/* returns crc updated with count bytes at buf */
+unsigned int cruise_crc32c(unsigned int crc, const void* buf, size_t count)
+{
+    pthread_once(&cruise_crc32c_once, cruise_crc32c_setup);
+    return ~cruise_crc32c_kernel(~(uint32_t) crc, (const char*) buf, count);
+}
+
+/* returns crc updated with count bytes of zeros, zeros shift the
+ * register along without adding anything to it */
+unsigned int cruise_crc32c_zeros(unsigned int crc, size_t count)
+{
+    pthread_once(&cruise_crc32c_once, cruise_crc32c_setup);
+    return ~cruise_crc32c_multmodp(cruise_crc32c_x2nmodp(count, 3), ~(uint32_t) crc);
+}
+
+/* returns the checksum of two runs of bytes one after the other */
+unsigned int cruise_crc32c_combine(unsigned int crc1, unsigned int crc2, size_t count2)
+{
+    pthread_once(&cruise_crc32c_once, cruise_crc32c_setup);
+    return cruise_crc32c_multmodp(cruise_crc32c_x2nmodp(count2, 3), crc1) ^ crc2;
+}
+
+/* returns delta shifted over count bytes, the checksums of two runs of
+ * the same length differ by a value that depends only on the bytes
+ * that differ, and bytes that follow move it along just like zeros */
+unsigned int cruise_crc32c_shift(unsigned int delta, size_t count)
+{
+    pthread_once(&cruise_crc32c_once, cruise_crc32c_setup);
+    return cruise_crc32c_multmodp(cruise_crc32c_x2nmodp(count, 3), delta);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+#ifndef CRUISE_CRC32C_H
+#define CRUISE_CRC32C_H
+
+/* implements CRC32C (the Castagnoli polynomial used by iSCSI and
+ * ext4) for the per chunk checksums, with the SSE4.2 crc32
+ * instruction when the processor has it and a table otherwise, and
+ * the operations to extend and combine checksums without the data,
+ * which let a chunk checksum follow writes that land in any order */
+
+#include <stddef.h>
+
+/* returns crc updated with count bytes at buf, start from 0, the
+ * result of one call can be passed to the next to checksum data that
+ * comes in pieces */
+unsigned int cruise_crc32c(unsigned int crc, const void* buf, size_t count);
+
+/* returns crc updated with count bytes of zeros, without touching
+ * any memory */
+unsigned int cruise_crc32c_zeros(unsigned int crc, size_t count);
+
+/* returns the checksum of a run of bytes with checksum crc1 followed
+ * by count2 bytes with checksum crc2 */
+unsigned int cruise_crc32c_combine(unsigned int crc1, unsigned int crc2, size_t count2);
+
+/* returns the change in the checksum of a run of bytes when bytes
+ * whose old and new checksums differ by delta are overwritten, with
+ * count bytes following them to the end of the run, the two checksums
+ * must cover the same number of bytes */
+unsigned int cruise_crc32c_shift(unsigned int delta, size_t count);
+
+#endif /* CRUISE_CRC32C_H */
@@ -36,6 +36,68 @@
 #include "cruise-internal.h"
 
 extern int cruise_spillover_max_chunks;
+
+/* number of chunks held as holes and number of bytes of zeros that
+ * were written without being copied, reported by cruise_get_stats */
+static unsigned long long cruise_zero_holes = 0;
+static unsigned long long cruise_zero_bytes = 0;
+
+/* number of chunks held compressed and number of bytes of pack slots
+ * they take, reported by cruise_get_stats */
+static unsigned long long cruise_packed_chunks = 0;
+static unsigned long long cruise_packed_bytes  = 0;
+
+/* same for chunks compressed on their way to spill over */
+static unsigned long long cruise_spill_packed_chunks = 0;
+static unsigned long long cruise_spill_packed_bytes  = 0;
+
+/* marks an entry of the pack map as a pack chunk, the low bits record
+ * which of its slots are in use */
+#define CRUISE_PACK_CHUNK ( 0x80000000u )
+
+/* the id of a packed chunk records the pack chunk holding its data,
+ * the first slot, and the number of slots, which together give the
+ * offset and length of the compressed data, for chunks packed in
+ * spill over the pack chunk is its index in the spill over file */
+#define CRUISE_PACK_ID(pack, first, nslots) \
+    (((off_t) (pack) << 16) | ((off_t) (first) << 8) | (off_t) (nslots))
+#define CRUISE_PACK_CHUNK_OF(id) ((int) ((id) >> 16))
+#define CRUISE_PACK_FIRST_OF(id) ((int) (((id) >> 8) & 0xff))
+#define CRUISE_PACK_SLOTS_OF(id) ((int) ((id) & 0xff))
+
+/* last packed chunk we decompressed for reads, so that a run of small
+ * reads through one packed chunk decompresses it once */
+static pthread_mutex_t cruise_unpacked_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const cruise_filemeta_t* cruise_unpacked_meta = NULL;
+static int   cruise_unpacked_chunk = -1;
+static char* cruise_unpacked_buf = NULL;
+
+/* references to shared chunks that a pinned file has written its own
+ * copy of, a view may still point at the old chunk, so we drop them
+ * once the last pin goes */
+typedef struct {
+    const cruise_filemeta_t* meta;
+    int id;
+} cruise_chunk_deferred_t;
+
+static pthread_mutex_t cruise_deferred_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cruise_chunk_deferred_t* cruise_deferred = NULL;
+static int cruise_deferred_count = 0;
+static int cruise_deferred_size  = 0;
+
+/* spin locks that serialize updates to chunk checksums, a chunk takes
+ * the one its chunk meta data hashes to, writers holding the file lock
+ * shared checksum their data beforehand and hold it just long enough
+ * to fold the result in */
+#define CRUISE_CRC_LOCKS (64)
+static int cruise_crc_locks[CRUISE_CRC_LOCKS];
+
+/* last chunk this thread verified and the checksum it had then, so a
+ * run of small reads through a chunk checks it once */
+static __thread const cruise_chunkmeta_t* cruise_crc_verified = NULL;
+static __thread unsigned int cruise_crc_verified_crc = 0;
+static __thread unsigned int cruise_crc_verified_len = 0;
+
 /* given a file id and logical chunk id, return pointer to meta data
  * for specified chunk, return NULL if not found */
 static cruise_chunkmeta_t* cruise_get_chunkmeta(int fid, int cid)
@@ -115,6 +177,226 @@ static inline off_t cruise_compute_spill_offset(
     return buf;
 }
 
+/* bytes in one slot of a pack chunk */
+static inline size_t cruise_pack_slot_size(void)
+{
+    return (size_t) cruise_chunk_size / CRUISE_PACK_SLOTS;
+}
+
+/* returns pointer to the first byte of a chunk packed in memory */
+static inline char* cruise_pack_buf(off_t packed_id)
+{
+    char* start = cruise_chunks + ((off_t) CRUISE_PACK_CHUNK_OF(packed_id) << cruise_chunk_bits);
+    return start + CRUISE_PACK_FIRST_OF(packed_id) * cruise_pack_slot_size();
+}
+
+/* returns offset of the first byte of a chunk packed in spill over */
+static inline off_t cruise_pack_spill_offset(off_t packed_id)
+{
+    off_t start = (off_t) CRUISE_PACK_CHUNK_OF(packed_id) << cruise_chunk_bits;
+    return start + CRUISE_PACK_FIRST_OF(packed_id) * cruise_pack_slot_size();
+}
+
+/* number of bytes of slots a packed chunk takes */
+static inline size_t cruise_pack_size(off_t packed_id)
+{
+    return CRUISE_PACK_SLOTS_OF(packed_id) * cruise_pack_slot_size();
+}
+
+/* mark nslots slots in a row of some pack chunk of the tier given by
+ * location as used, if none has room turn victim, a chunk of that
+ * tier, into a pack chunk, returns the index of the pack chunk and
+ * sets first to the first slot */
+static int cruise_pack_slots_alloc(int location, int nslots, int victim, int* first)
+{
+    unsigned int* map = cruise_pack_map;
+    int count = cruise_max_chunks;
+    if (location == CHUNK_LOCATION_SPILLZ) {
+        map   = cruise_spill_pack_map;
+        count = cruise_spillover_max_chunks;
+    }
+
+    unsigned int run = (1u << nslots) - 1;
+    int pack = -1;
+
+    cruise_stack_lock();
+    int i;
+    for (i = 0; i < count && pack < 0; i++) {
+        unsigned int entry = map[i];
+        if (! (entry & CRUISE_PACK_CHUNK)) {
+            continue;
+        }
+        int slot;
+        for (slot = 0; slot + nslots <= CRUISE_PACK_SLOTS; slot++) {
+            if ((entry & (run << slot)) == 0) {
+                map[i] = entry | (run << slot);
+                pack  = i;
+                *first = slot;
+                break;
+            }
+        }
+    }
+    if (pack < 0) {
+        map[victim] = CRUISE_PACK_CHUNK | run;
+        pack  = victim;
+        *first = 0;
+    }
+    cruise_stack_unlock();
+
+    if (location == CHUNK_LOCATION_SPILLZ) {
+        __sync_add_and_fetch(&cruise_spill_packed_chunks, 1);
+        __sync_add_and_fetch(&cruise_spill_packed_bytes,
+            (unsigned long long) (nslots * cruise_pack_slot_size()));
+    } else {
+        __sync_add_and_fetch(&cruise_packed_chunks, 1);
+        __sync_add_and_fetch(&cruise_packed_bytes,
+            (unsigned long long) (nslots * cruise_pack_slot_size()));
+    }
+
+    return pack;
+}
+
+/* give back the slots of a chunk packed in the tier given by
+ * location, a pack chunk whose last slot is freed goes back on the
+ * free stack of its tier */
+static void cruise_pack_slots_free(int location, off_t packed_id)
+{
+    unsigned int* map = cruise_pack_map;
+    void* stack = free_chunk_stack;
+    if (location == CHUNK_LOCATION_SPILLZ) {
+        map   = cruise_spill_pack_map;
+        stack = free_spillchunk_stack;
+    }
+
+    int pack   = CRUISE_PACK_CHUNK_OF(packed_id);
+    int first  = CRUISE_PACK_FIRST_OF(packed_id);
+    int nslots = CRUISE_PACK_SLOTS_OF(packed_id);
+    unsigned int run = ((1u << nslots) - 1) << first;
+
+    cruise_stack_lock();
+    unsigned int entry = map[pack] & ~run;
+    if (entry == CRUISE_PACK_CHUNK) {
+        entry = 0;
+        cruise_stack_push(stack, pack);
+    }
+    map[pack] = entry;
+    cruise_stack_unlock();
+
+    if (location == CHUNK_LOCATION_SPILLZ) {
+        __sync_sub_and_fetch(&cruise_spill_packed_chunks, 1);
+        __sync_sub_and_fetch(&cruise_spill_packed_bytes,
+            (unsigned long long) (nslots * cruise_pack_slot_size()));
+    } else {
+        __sync_sub_and_fetch(&cruise_packed_chunks, 1);
+        __sync_sub_and_fetch(&cruise_packed_bytes,
+            (unsigned long long) (nslots * cruise_pack_slot_size()));
+    }
+}
+
+/* decompress a chunk packed in memory or spill over into the chunk
+ * size bytes at buf */
+static int cruise_pack_inflate(const cruise_chunkmeta_t* chunk_meta, void* buf)
+{
+    off_t packed_id = chunk_meta->id;
+    size_t size = cruise_pack_size(packed_id);
+    if (chunk_meta->location == CHUNK_LOCATION_PACKED) {
+        if (cruise_decompress(cruise_pack_buf(packed_id), size, buf, cruise_chunk_size) != 0) {
+            return CRUISE_ERR_IO;
+        }
+        return CRUISE_SUCCESS;
+    }
+
+    /* read the compressed bytes from spill over first */
+    char* packed = (char*) malloc(size);
+    if (packed == NULL) {
+        return CRUISE_ERR_NOMEM;
+    }
+    int rc = CRUISE_SUCCESS;
+    ssize_t nread = pread(cruise_spilloverblock, packed, size, cruise_pack_spill_offset(packed_id));
+    if (nread != (ssize_t) size ||
+        cruise_decompress(packed, size, buf, cruise_chunk_size) != 0)
+    {
+        rc = CRUISE_ERR_IO;
+    }
+    free(packed);
+    return rc;
+}
+
+/* forget the decompressed copy of a chunk whose packed data is about
+ * to go away */
+static void cruise_pack_forget(const cruise_filemeta_t* meta, int chunk_id)
+{
+    pthread_mutex_lock(&cruise_unpacked_mutex);
+    if (cruise_unpacked_meta == meta && cruise_unpacked_chunk == chunk_id) {
+        cruise_unpacked_meta  = NULL;
+        cruise_unpacked_chunk = -1;
+    }
+    pthread_mutex_unlock(&cruise_unpacked_mutex);
+}
+
+/* take memory chunk id out of the dedup index, caller holds the
+ * stack lock */
+static void cruise_dedup_unhash(int id)
+{
+    cruise_chunkref_t* ref = &cruise_chunk_refs[id];
+    int* link = &cruise_dedup_index[ref->hash % (unsigned long long) cruise_max_chunks];
+    while (*link >= 0) {
+        if (*link == id) {
+            *link = ref->next;
+            break;
+        }
+        link = &cruise_chunk_refs[*link].next;
+    }
+    ref->hashed = 0;
+    ref->next   = -1;
+}
+
+/* drop one reference to memory chunk id, returns 1 if it was the
+ * last one, in which case the caller gives the chunk back, caller
+ * holds the stack lock */
+static int cruise_chunk_unref(int id)
+{
+    cruise_chunkref_t* ref = &cruise_chunk_refs[id];
+    ref->refs--;
+    if (ref->refs > 0) {
+        return 0;
+    }
+    if (ref->hashed) {
+        cruise_dedup_unhash(id);
+    }
+    return 1;
+}
+
+/* returns 1 if the memory chunk of a file is shared with other files
+ * or in the dedup index, either way its data must not change in place,
+ * only files that were cloned may share chunks when dedup is off */
+static inline int cruise_chunk_is_shared(const cruise_filemeta_t* meta, int chunk_id)
+{
+    if (! cruise_dedup_chunks && ! meta->shared) {
+        return 0;
+    }
+    const cruise_chunkref_t* ref = &cruise_chunk_refs[meta->chunk_meta[chunk_id].id];
+    return (ref->refs > 1 || ref->hashed);
+}
+
+/* marks the chunks holding count bytes at pos as written in the
+ * current epoch of the file, the caller holds the file lock, and
+ * writers holding it shared all store the same value */
+static void cruise_chunk_dirty(cruise_filemeta_t* meta, off_t pos, off_t count)
+{
+    if (count <= 0) {
+        return;
+    }
+    unsigned long long epoch = meta->epoch;
+    int chunk_id = (int) (pos >> cruise_chunk_bits);
+    int last_id  = (int) ((pos + count - 1) >> cruise_chunk_bits);
+    for (; chunk_id <= last_id; chunk_id++) {
+        if (meta->chunk_meta[chunk_id].epoch != epoch) {
+            meta->chunk_meta[chunk_id].epoch = epoch;
+        }
+    }
+}
+
 /* allocate a new chunk for the specified file and logical chunk id */
 static int cruise_chunk_alloc(int fid, cruise_filemeta_t* meta, int chunk_id)
 {
@@ -126,13 +408,30 @@ static int cruise_chunk_alloc(int fid, cruise_filemeta_t* meta, int chunk_id)
         /* allocate a new chunk from memory */
         cruise_stack_lock();
         int id = cruise_stack_pop(free_chunk_stack);
+        int free_chunks = cruise_stack_count(free_chunk_stack);
         cruise_stack_unlock();
 
+        if (cruise_compress_chunks) {
+            if (id < 0) {
+                /* make room by compressing before we spill or give up */
+                cruise_fid_reclaim(cruise_compress_free);
+                cruise_stack_lock();
+                id = cruise_stack_pop(free_chunk_stack);
+                cruise_stack_unlock();
+            } else if (free_chunks < cruise_compress_free) {
+                /* running low, have the packer make room */
+                cruise_compress_wake();
+            }
+        }
+
         /* if we got one return, otherwise try spill over */
         if (id >= 0) {
-            /* got a chunk from memory */
+            /* got a chunk from memory, no one else points at it */
             chunk_meta->location = CHUNK_LOCATION_MEMFS;
             chunk_meta->id = id;
+            cruise_chunk_refs[id].refs   = 1;
+            cruise_chunk_refs[id].hashed = 0;
+            cruise_chunk_refs[id].next   = -1;
         } else if (cruise_use_spillover) {
             /* shm segment out of space, grab a block from spill-over device */
             debug("getting blocks from spill-over device\n");
@@ -194,11 +493,25 @@ static int cruise_chunk_free(int fid, cruise_filemeta_t* meta, int chunk_id)
 
     /* determine location of chunk */
     if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
+        /* other files may still share the chunk */
         cruise_stack_lock();
-        cruise_stack_push(free_chunk_stack, id);
+        if (cruise_chunk_unref(id)) {
+            cruise_stack_push(free_chunk_stack, id);
+        }
         cruise_stack_unlock();
     } else if (chunk_meta->location == CHUNK_LOCATION_SPILLOVER) {
-        /* TODO: free spill over chunk */
+        /* ids of spill over chunks start after those in memory */
+        cruise_stack_lock();
+        cruise_stack_push(free_spillchunk_stack, id - cruise_max_chunks);
+        cruise_stack_unlock();
+    } else if (chunk_meta->location == CHUNK_LOCATION_ZERO) {
+        /* a hole has no storage to give back */
+        __sync_sub_and_fetch(&cruise_zero_holes, 1);
+    } else if (chunk_meta->location == CHUNK_LOCATION_PACKED ||
+               chunk_meta->location == CHUNK_LOCATION_SPILLZ)
+    {
+        cruise_pack_forget(meta, chunk_id);
+        cruise_pack_slots_free(chunk_meta->location, chunk_meta->id);
     } else {
         /* unkwown chunk location */
         debug("unknown chunk location %d\n", chunk_meta->location);
@@ -227,13 +540,43 @@ static int cruise_chunk_read(
     if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
         /* just need a memcpy to read data */
         void* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, chunk_offset);
-        memcpy(buf, chunk_buf, count);
+        cruise_memcpy_read(buf, chunk_buf, count);
     } else if (chunk_meta->location == CHUNK_LOCATION_SPILLOVER) {
         /* spill over to a file, so read from file descriptor */
         //MAP_OR_FAIL(pread);
         off_t spill_offset = cruise_compute_spill_offset(meta, chunk_id, chunk_offset);
         ssize_t rc = pread(cruise_spilloverblock, buf, count, spill_offset);
         /* TODO: check return code for errors */
+    } else if (chunk_meta->location == CHUNK_LOCATION_ZERO) {
+        /* a hole reads as zeros */
+        memset(buf, 0, count);
+    } else if (chunk_meta->location == CHUNK_LOCATION_PACKED ||
+               chunk_meta->location == CHUNK_LOCATION_SPILLZ)
+    {
+        /* decompress the chunk unless we did so for the last read */
+        int rc = CRUISE_SUCCESS;
+        pthread_mutex_lock(&cruise_unpacked_mutex);
+        if (cruise_unpacked_meta != meta || cruise_unpacked_chunk != chunk_id) {
+            if (cruise_unpacked_buf == NULL) {
+                cruise_unpacked_buf = (char*) malloc(cruise_chunk_size);
+            }
+            cruise_unpacked_meta  = NULL;
+            cruise_unpacked_chunk = -1;
+            if (cruise_unpacked_buf == NULL) {
+                rc = CRUISE_ERR_NOMEM;
+            } else {
+                rc = cruise_pack_inflate(chunk_meta, cruise_unpacked_buf);
+            }
+            if (rc == CRUISE_SUCCESS) {
+                cruise_unpacked_meta  = meta;
+                cruise_unpacked_chunk = chunk_id;
+            }
+        }
+        if (rc == CRUISE_SUCCESS) {
+            memcpy(buf, cruise_unpacked_buf + chunk_offset, count);
+        }
+        pthread_mutex_unlock(&cruise_unpacked_mutex);
+        return rc;
     } else {
         /* unknown chunk type */
         debug("unknown chunk type in read\n");
@@ -258,20 +601,19 @@ static int cruise_chunk_write(
 
     /* determine location of chunk */
     if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
-        /* just need a memcpy to write data */
+        /* just need a memcpy to write data, large writes go around
+         * the cache */
         void* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, chunk_offset);
-        memcpy(chunk_buf, buf, count);
-//        _intel_fast_memcpy(chunk_buf, buf, count);
-//        cruise_memcpy(chunk_buf, buf, count);
+        cruise_memcpy_write(chunk_buf, buf, count);
     } else if (chunk_meta->location == CHUNK_LOCATION_SPILLOVER) {
         /* spill over to a file, so write to file descriptor */
         //MAP_OR_FAIL(pwrite);
         off_t spill_offset = cruise_compute_spill_offset(meta, chunk_id, chunk_offset);
         ssize_t rc = pwrite(cruise_spilloverblock, buf, count, spill_offset);
-        if (rc < 0)  {
+        if (rc != (ssize_t) count)  {
             perror("pwrite failed");
+            return CRUISE_ERR_IO;
         }
-        /* TODO: check return code for errors */
     } else {
         /* unknown chunk type */
         debug("unknown chunk type in read\n");
@@ -282,6 +624,580 @@ static int cruise_chunk_write(
     return CRUISE_SUCCESS;
 }
 
+/* write zeros over count bytes of a chunk with storage starting at
+ * chunk_offset */
+static int cruise_chunk_zero(
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  off_t chunk_offset,
+  size_t count)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
+        void* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, chunk_offset);
+        memset(chunk_buf, 0, count);
+        return CRUISE_SUCCESS;
+    }
+
+    /* otherwise write from a buffer of zeros */
+    size_t buf_size = 1024 * 1024;
+    if (buf_size > count) {
+        buf_size = count;
+    }
+    void* buf = calloc(1, buf_size);
+    if (buf == NULL) {
+        return CRUISE_ERR_NOMEM;
+    }
+    int rc = CRUISE_SUCCESS;
+    size_t written = 0;
+    while (written < count && rc == CRUISE_SUCCESS) {
+        size_t num = count - written;
+        if (num > buf_size) {
+            num = buf_size;
+        }
+        rc = cruise_chunk_write(meta, chunk_id, chunk_offset + (off_t) written, buf, num);
+        written += num;
+    }
+    free(buf);
+    return rc;
+}
+
+/* take the checksum lock of a chunk */
+static int* cruise_crc_lock(const cruise_chunkmeta_t* chunk_meta)
+{
+    uintptr_t slot = (uintptr_t) chunk_meta / sizeof(cruise_chunkmeta_t);
+    int* lock = &cruise_crc_locks[slot % CRUISE_CRC_LOCKS];
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*(volatile int*) lock) {
+        }
+    }
+    return lock;
+}
+
+static void cruise_crc_unlock(int* lock)
+{
+    __sync_lock_release(lock);
+}
+
+/* compute the checksum of count bytes of a chunk starting at
+ * chunk_offset */
+static int cruise_chunk_crc_range(
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  off_t chunk_offset,
+  size_t count,
+  unsigned int* crc)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    if (count == 0) {
+        *crc = 0;
+        return CRUISE_SUCCESS;
+    }
+    if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
+        void* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, chunk_offset);
+        *crc = cruise_crc32c(0, chunk_buf, count);
+        return CRUISE_SUCCESS;
+    }
+    if (chunk_meta->location == CHUNK_LOCATION_ZERO) {
+        *crc = cruise_crc32c_zeros(0, count);
+        return CRUISE_SUCCESS;
+    }
+
+    /* read data held outside of memory a piece at a time */
+    size_t buf_size = 1024 * 1024;
+    if (buf_size > count) {
+        buf_size = count;
+    }
+    char* buf = (char*) malloc(buf_size);
+    if (buf == NULL) {
+        return CRUISE_ERR_NOMEM;
+    }
+    int rc = CRUISE_SUCCESS;
+    unsigned int c = 0;
+    size_t done = 0;
+    while (done < count && rc == CRUISE_SUCCESS) {
+        size_t num = count - done;
+        if (num > buf_size) {
+            num = buf_size;
+        }
+        rc = cruise_chunk_read(meta, chunk_id, chunk_offset + (off_t) done, buf, num);
+        c = cruise_crc32c(c, buf, num);
+        done += num;
+    }
+    free(buf);
+    *crc = c;
+    return rc;
+}
+
+/* fold count bytes at buf, or zeros if buf is NULL, that are about to
+ * be written at chunk_offset into the checksum of a chunk, this must
+ * come before the data lands, since bytes the checksum already covers
+ * are taken out by checksumming them too, writes that start where the
+ * checksum ends extend it, and writes past that leave it as it is,
+ * which cruise_chunk_crc_complete catches up on later */
+static void cruise_chunk_crc_update(
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  off_t chunk_offset,
+  const void* buf,
+  size_t count)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    const char* ptr = (const char*) buf;
+    off_t end = chunk_offset + (off_t) count;
+    int* lock;
+
+    /* a whole chunk replaces whatever the checksum held */
+    if (chunk_offset == 0 && count == (size_t) cruise_chunk_size) {
+        unsigned int crc = ptr ? cruise_crc32c(0, ptr, count) : cruise_crc32c_zeros(0, count);
+        lock = cruise_crc_lock(chunk_meta);
+        chunk_meta->crc     = crc;
+        chunk_meta->crc_len = (unsigned int) count;
+        cruise_crc_unlock(lock);
+        return;
+    }
+
+    /* the checksum only grows while we hold the file lock, so bytes
+     * it covers now it still covers when we fold them in */
+    off_t len = (off_t) chunk_meta->crc_len;
+
+    /* the difference between the old and new bytes it covers */
+    off_t over_end = chunk_offset;
+    unsigned int delta = 0;
+    if (chunk_offset < len) {
+        over_end = (end < len) ? end : len;
+        size_t num = (size_t) (over_end - chunk_offset);
+        unsigned int old_crc;
+        if (cruise_chunk_crc_range(meta, chunk_id, chunk_offset, num, &old_crc) != CRUISE_SUCCESS) {
+            /* start over from nothing */
+            lock = cruise_crc_lock(chunk_meta);
+            chunk_meta->crc     = 0;
+            chunk_meta->crc_len = 0;
+            cruise_crc_unlock(lock);
+            return;
+        }
+        unsigned int new_crc = ptr ? cruise_crc32c(0, ptr, num) : cruise_crc32c_zeros(0, num);
+        delta = old_crc ^ new_crc;
+    }
+
+    /* the checksum of the bytes that extend it */
+    unsigned int ext_crc = 0;
+    int extend = (chunk_offset <= len && end > len);
+    if (extend) {
+        size_t skip = (size_t) (len - chunk_offset);
+        size_t num  = (size_t) (end - len);
+        ext_crc = ptr ? cruise_crc32c(0, ptr + skip, num) : cruise_crc32c_zeros(0, num);
+    }
+
+    lock = cruise_crc_lock(chunk_meta);
+    off_t cur = (off_t) chunk_meta->crc_len;
+    if (over_end > chunk_offset && over_end <= cur) {
+        chunk_meta->crc ^= cruise_crc32c_shift(delta, (size_t) (cur - over_end));
+    }
+    if (extend && cur == len) {
+        chunk_meta->crc = cruise_crc32c_combine(chunk_meta->crc, ext_crc, (size_t) (end - len));
+        chunk_meta->crc_len = (unsigned int) end;
+    }
+    cruise_crc_unlock(lock);
+}
+
+/* bring the checksum of a chunk up to its first count bytes, the
+ * caller holds the file lock exclusive, sets crc to the checksum */
+static int cruise_chunk_crc_complete(
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  size_t count,
+  unsigned int* crc)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+
+    /* a checksum can't shrink, so one running past a truncated end
+     * starts over */
+    if ((size_t) chunk_meta->crc_len > count) {
+        chunk_meta->crc     = 0;
+        chunk_meta->crc_len = 0;
+    }
+
+    /* checksum what writes past the end of the checksum left out */
+    size_t len = (size_t) chunk_meta->crc_len;
+    if (len < count) {
+        unsigned int ext_crc;
+        int rc = cruise_chunk_crc_range(meta, chunk_id, (off_t) len, count - len, &ext_crc);
+        if (rc != CRUISE_SUCCESS) {
+            return rc;
+        }
+        chunk_meta->crc     = cruise_crc32c_combine(chunk_meta->crc, ext_crc, count - len);
+        chunk_meta->crc_len = (unsigned int) count;
+    }
+
+    *crc = chunk_meta->crc;
+    return CRUISE_SUCCESS;
+}
+
+/* check the data of a chunk against its checksum, returns
+ * CRUISE_ERR_IO if they differ */
+static int cruise_chunk_crc_verify(cruise_filemeta_t* meta, int chunk_id)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    unsigned int len = chunk_meta->crc_len;
+    unsigned int expected = chunk_meta->crc;
+    if (len == 0 ||
+        (cruise_crc_verified == chunk_meta && cruise_crc_verified_len == len &&
+         cruise_crc_verified_crc == expected))
+    {
+        return CRUISE_SUCCESS;
+    }
+
+    unsigned int crc;
+    int rc = cruise_chunk_crc_range(meta, chunk_id, 0, (size_t) len, &crc);
+    if (rc != CRUISE_SUCCESS) {
+        return rc;
+    }
+    if (crc != expected) {
+        debug("checksum of chunk %d is %08x expected %08x\n", chunk_id, crc, expected);
+        return CRUISE_ERR_IO;
+    }
+
+    cruise_crc_verified     = chunk_meta;
+    cruise_crc_verified_crc = expected;
+    cruise_crc_verified_len = len;
+    return CRUISE_SUCCESS;
+}
+
+/* give back the storage of a chunk and keep it as a hole */
+static void cruise_chunk_punch(int fid, cruise_filemeta_t* meta, int chunk_id)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    if (chunk_meta->location == CHUNK_LOCATION_ZERO) {
+        return;
+    }
+    cruise_chunk_free(fid, meta, chunk_id);
+    chunk_meta->location = CHUNK_LOCATION_ZERO;
+    chunk_meta->id = -1;
+    __sync_add_and_fetch(&cruise_zero_holes, 1);
+
+    /* the chunk now reads as zeros all the way through */
+    if (cruise_checksum_chunks) {
+        cruise_chunk_crc_update(meta, chunk_id, 0, NULL, (size_t) cruise_chunk_size);
+    }
+}
+
+/* give a hole storage before count bytes are written to it at
+ * chunk_offset, and zero the rest of the chunk */
+static int cruise_chunk_fill(
+  int fid,
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  off_t chunk_offset,
+  size_t count)
+{
+    int rc = cruise_chunk_alloc(fid, meta, chunk_id);
+    if (rc != CRUISE_SUCCESS) {
+        /* still a hole */
+        meta->chunk_meta[chunk_id].location = CHUNK_LOCATION_ZERO;
+        return rc;
+    }
+    __sync_sub_and_fetch(&cruise_zero_holes, 1);
+
+    /* zero the bytes before and after the range to be written, and
+     * the range itself when the checksum is to take the zeros out
+     * again as the data lands */
+    off_t end = chunk_offset + (off_t) count;
+    if (cruise_checksum_chunks) {
+        chunk_offset = 0;
+        end = 0;
+    }
+    if (chunk_offset > 0) {
+        rc = cruise_chunk_zero(meta, chunk_id, 0, (size_t) chunk_offset);
+    }
+    if (rc == CRUISE_SUCCESS && end < cruise_chunk_size) {
+        rc = cruise_chunk_zero(meta, chunk_id, end, (size_t) (cruise_chunk_size - end));
+    }
+    return rc;
+}
+
+/* give a packed chunk storage of its own before it is written to,
+ * decompresses the data into it if keep is set, which the caller
+ * leaves unset when it is about to overwrite the whole chunk */
+static int cruise_chunk_unpack(int fid, cruise_filemeta_t* meta, int chunk_id, int keep)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    cruise_chunkmeta_t packed = *chunk_meta;
+
+    int rc = cruise_chunk_alloc(fid, meta, chunk_id);
+    if (rc != CRUISE_SUCCESS) {
+        /* still packed */
+        *chunk_meta = packed;
+        return rc;
+    }
+
+    if (! keep) {
+        /* nothing to copy */
+    } else if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
+        void* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, 0);
+        rc = cruise_pack_inflate(&packed, chunk_buf);
+    } else {
+        /* decompress into a buffer and write it out */
+        char* buf = (char*) malloc(cruise_chunk_size);
+        if (buf == NULL) {
+            rc = CRUISE_ERR_NOMEM;
+        } else {
+            rc = cruise_pack_inflate(&packed, buf);
+        }
+        if (rc == CRUISE_SUCCESS) {
+            rc = cruise_chunk_write(meta, chunk_id, 0, buf, cruise_chunk_size);
+        }
+        free(buf);
+    }
+
+    if (rc != CRUISE_SUCCESS) {
+        /* give back the new storage and keep the packed copy */
+        cruise_chunk_free(fid, meta, chunk_id);
+        *chunk_meta = packed;
+        return rc;
+    }
+
+    cruise_pack_forget(meta, chunk_id);
+    cruise_pack_slots_free(packed.location, packed.id);
+    return CRUISE_SUCCESS;
+}
+
+/* give a memory chunk that is shared with other files or in the
+ * dedup index storage of its own before it is written to, copies the
+ * data over if keep is set, which the caller leaves unset when it is
+ * about to overwrite the whole chunk */
+static int cruise_chunk_own(int fid, cruise_filemeta_t* meta, int chunk_id, int keep)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    cruise_chunkmeta_t shared = *chunk_meta;
+    int id = (int) shared.id;
+
+    /* no one else points at an indexed chunk of ours yet, so it's
+     * enough to take it out of the index */
+    cruise_stack_lock();
+    if (cruise_chunk_refs[id].refs == 1) {
+        if (cruise_chunk_refs[id].hashed) {
+            cruise_dedup_unhash(id);
+        }
+        cruise_stack_unlock();
+        return CRUISE_SUCCESS;
+    }
+    cruise_stack_unlock();
+
+    int rc = cruise_chunk_alloc(fid, meta, chunk_id);
+    if (rc != CRUISE_SUCCESS) {
+        /* still shared */
+        *chunk_meta = shared;
+        return rc;
+    }
+    if (keep) {
+        const char* src = cruise_chunks + ((off_t) id << cruise_chunk_bits);
+        rc = cruise_chunk_write(meta, chunk_id, 0, src, cruise_chunk_size);
+        if (rc != CRUISE_SUCCESS) {
+            cruise_chunk_free(fid, meta, chunk_id);
+            *chunk_meta = shared;
+            return rc;
+        }
+    }
+
+    /* a view of a pinned file may still point at the shared chunk */
+    if (meta->pins > 0) {
+        pthread_mutex_lock(&cruise_deferred_mutex);
+        if (cruise_deferred_count == cruise_deferred_size) {
+            int size = cruise_deferred_size ? 2 * cruise_deferred_size : 16;
+            void* list = realloc(cruise_deferred, size * sizeof(cruise_chunk_deferred_t));
+            if (list != NULL) {
+                cruise_deferred = (cruise_chunk_deferred_t*) list;
+                cruise_deferred_size = size;
+            }
+        }
+        if (cruise_deferred_count < cruise_deferred_size) {
+            cruise_deferred[cruise_deferred_count].meta = meta;
+            cruise_deferred[cruise_deferred_count].id   = id;
+            cruise_deferred_count++;
+            id = -1;
+        }
+        pthread_mutex_unlock(&cruise_deferred_mutex);
+        if (id < 0) {
+            return CRUISE_SUCCESS;
+        }
+    }
+
+    /* the others may have dropped theirs meanwhile */
+    cruise_stack_lock();
+    if (cruise_chunk_unref(id)) {
+        cruise_stack_push(free_chunk_stack, id);
+    }
+    cruise_stack_unlock();
+    return CRUISE_SUCCESS;
+}
+
+/* drop the references to shared chunks a file kept while it was
+ * pinned */
+static void cruise_chunk_release_deferred(const cruise_filemeta_t* meta)
+{
+    pthread_mutex_lock(&cruise_deferred_mutex);
+    int i = 0;
+    while (i < cruise_deferred_count) {
+        if (cruise_deferred[i].meta != meta) {
+            i++;
+            continue;
+        }
+        int id = cruise_deferred[i].id;
+        cruise_deferred[i] = cruise_deferred[--cruise_deferred_count];
+        cruise_stack_lock();
+        if (cruise_chunk_unref(id)) {
+            cruise_stack_push(free_chunk_stack, id);
+        }
+        cruise_stack_unlock();
+    }
+    pthread_mutex_unlock(&cruise_deferred_mutex);
+}
+
+/* point chunk dst_chunk of dst at the storage of chunk src_chunk of
+ * src, which is held in memory or a hole, and give back whatever dst
+ * had there, dst_chunk is at most one past the last chunk of dst */
+static void cruise_chunk_share(
+  cruise_filemeta_t* src_meta,
+  int src_chunk,
+  int dst_fid,
+  cruise_filemeta_t* dst_meta,
+  int dst_chunk)
+{
+    cruise_chunkmeta_t* chunk_meta = &(src_meta->chunk_meta[src_chunk]);
+
+    /* take our reference first, dst may already point at the chunk */
+    if (chunk_meta->location == CHUNK_LOCATION_MEMFS) {
+        cruise_stack_lock();
+        cruise_chunk_refs[chunk_meta->id].refs++;
+        cruise_stack_unlock();
+        src_meta->shared = 1;
+        dst_meta->shared = 1;
+    } else {
+        __sync_add_and_fetch(&cruise_zero_holes, 1);
+    }
+
+    if (dst_chunk < dst_meta->chunks) {
+        cruise_chunk_free(dst_fid, dst_meta, dst_chunk);
+    } else {
+        dst_meta->chunks++;
+    }
+    dst_meta->chunk_meta[dst_chunk] = *chunk_meta;
+    dst_meta->chunk_meta[dst_chunk].epoch = dst_meta->epoch;
+}
+
+/* write a whole chunk of data to a chunk in spill over, compressed
+ * into a run of pack slots of the spill over file if that saves at
+ * least one slot and as is otherwise */
+static int cruise_chunk_spill_pack(
+  int fid,
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  const void* buf)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    int id = (int) chunk_meta->id - cruise_max_chunks;
+
+    size_t size = cruise_compress_bound(cruise_chunk_size);
+    char* scratch = (char*) malloc(size);
+    size_t slot_size = cruise_pack_slot_size();
+    int nslots = CRUISE_PACK_SLOTS;
+    if (scratch != NULL && cruise_compress(buf, cruise_chunk_size, scratch, &size) == 0) {
+        nslots = (int) ((size + slot_size - 1) / slot_size);
+    }
+    if (nslots >= CRUISE_PACK_SLOTS) {
+        /* incompressible, keep it raw */
+        free(scratch);
+        return cruise_chunk_write(meta, chunk_id, 0, buf, cruise_chunk_size);
+    }
+
+    /* if no pack chunk in spill over has room ours becomes one */
+    int first;
+    int pack = cruise_pack_slots_alloc(CHUNK_LOCATION_SPILLZ, nslots, id, &first);
+    off_t packed_id = CRUISE_PACK_ID(pack, first, nslots);
+    ssize_t nwrite = pwrite(cruise_spilloverblock, scratch, size, cruise_pack_spill_offset(packed_id));
+    free(scratch);
+    if (nwrite != (ssize_t) size) {
+        /* the chunk keeps its raw storage, but if it just became a
+         * pack chunk, it must not go back on the free stack */
+        if (pack == id) {
+            cruise_stack_lock();
+            cruise_spill_pack_map[id] = 0;
+            cruise_stack_unlock();
+            __sync_sub_and_fetch(&cruise_spill_packed_chunks, 1);
+            __sync_sub_and_fetch(&cruise_spill_packed_bytes,
+                (unsigned long long) (nslots * slot_size));
+        } else {
+            cruise_pack_slots_free(CHUNK_LOCATION_SPILLZ, packed_id);
+        }
+        return CRUISE_ERR_IO;
+    }
+
+    chunk_meta->location = CHUNK_LOCATION_SPILLZ;
+    chunk_meta->id = packed_id;
+    if (pack != id) {
+        cruise_stack_lock();
+        cruise_stack_push(free_spillchunk_stack, id);
+        cruise_stack_unlock();
+    }
+    return CRUISE_SUCCESS;
+}
+
+/* compress a chunk held in memory into a run of pack slots, scratch
+ * has room for size bytes of compressed data, returns 1 if this
+ * freed a memory chunk and 0 otherwise */
+static int cruise_chunk_pack(
+  int fid,
+  cruise_filemeta_t* meta,
+  int chunk_id,
+  char* scratch,
+  size_t size)
+{
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    int id = (int) chunk_meta->id;
+
+    /* leave chunks other files share, and keep dedup from finding a
+     * chunk whose memory is about to be reused */
+    cruise_stack_lock();
+    if (cruise_chunk_refs[id].refs > 1) {
+        cruise_stack_unlock();
+        return 0;
+    }
+    if (cruise_chunk_refs[id].hashed) {
+        cruise_dedup_unhash(id);
+    }
+    cruise_stack_unlock();
+
+    /* leave chunks that don't save at least one slot */
+    void* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, 0);
+    if (cruise_compress(chunk_buf, cruise_chunk_size, scratch, &size) != 0) {
+        return 0;
+    }
+    size_t slot_size = cruise_pack_slot_size();
+    int nslots = (int) ((size + slot_size - 1) / slot_size);
+    if (nslots >= CRUISE_PACK_SLOTS) {
+        return 0;
+    }
+
+    /* copy into pack slots, if no pack chunk has room the chunk we
+     * just compressed becomes one */
+    int first;
+    int pack = cruise_pack_slots_alloc(CHUNK_LOCATION_PACKED, nslots, id, &first);
+    off_t packed_id = CRUISE_PACK_ID(pack, first, nslots);
+    memcpy(cruise_pack_buf(packed_id), scratch, size);
+
+    chunk_meta->location = CHUNK_LOCATION_PACKED;
+    chunk_meta->id = packed_id;
+
+    if (pack == id) {
+        return 0;
+    }
+    cruise_stack_lock();
+    cruise_stack_push(free_chunk_stack, id);
+    cruise_stack_unlock();
+    return 1;
+}
+
 /* ---------------------------------------
  * Operations on file storage
  * --------------------------------------- */
@@ -301,12 +1217,15 @@ int cruise_fid_store_fixed_extend(int fid, cruise_filemeta_t* meta, off_t length
                 return CRUISE_ERR_NOSPC;
             }
 
-            /* allocate a new chunk */
+            /* allocate a new chunk, nothing is written to it yet */
             int rc = cruise_chunk_alloc(fid, meta, meta->chunks);
             if (rc != CRUISE_SUCCESS) {
                 debug("failed to allocate chunk\n");
                 return CRUISE_ERR_NOSPC;
             }
+            meta->chunk_meta[meta->chunks].crc     = 0;
+            meta->chunk_meta[meta->chunks].crc_len = 0;
+            meta->chunk_meta[meta->chunks].epoch   = 0;
 
             /* increase chunk count and subtract bytes from the number we need */
             meta->chunks++;
@@ -320,6 +1239,15 @@ int cruise_fid_store_fixed_extend(int fid, cruise_filemeta_t* meta, off_t length
 /* if length is shorter than reserved space, give back space down to length */
 int cruise_fid_store_fixed_shrink(int fid, cruise_filemeta_t* meta, off_t length)
 {
+    /* a read view may be pointing into our chunks, so hold on to them
+     * until the last view is released, cruise_fid_unpin shrinks again */
+    if (meta->pins > 0) {
+        return CRUISE_SUCCESS;
+    }
+
+    /* same for shared chunks we wrote our own copy of */
+    cruise_chunk_release_deferred(meta);
+
     /* determine the number of chunks to leave after truncating */
     off_t num_chunks = 0;
     if (length > 0) {
@@ -332,6 +1260,11 @@ int cruise_fid_store_fixed_shrink(int fid, cruise_filemeta_t* meta, off_t length
         cruise_chunk_free(fid, meta, meta->chunks);
     }
 
+    /* with no chunks left there's nothing shared to copy on write */
+    if (meta->chunks == 0) {
+        meta->shared = 0;
+    }
+
     return CRUISE_SUCCESS;
 }
 
@@ -340,6 +1273,18 @@ int cruise_fid_store_fixed_read(int fid, cruise_filemeta_t* meta, off_t pos, voi
 {
     int rc;
 
+    /* hand large reads to the vector path, which splits them across
+     * the copy pool, and any read when it has to check checksums */
+    if (cruise_copypool_wanted(count) || cruise_checksum_verify) {
+        struct iovec iov;
+        iov.iov_base = buf;
+        iov.iov_len  = count;
+        return cruise_fid_store_fixed_iov(fid, meta, pos, &iov, 1, count, 0);
+    }
+
+    /* note the chunks we're about to change */
+    cruise_chunk_dirty(meta, pos, (off_t) count);
+
     /* get pointer to position within first chunk */
     int chunk_id = pos >> cruise_chunk_bits;
     off_t chunk_offset = pos & cruise_chunk_mask;
@@ -384,6 +1329,20 @@ int cruise_fid_store_fixed_write(int fid, cruise_filemeta_t* meta, off_t pos, co
 {
     int rc;
 
+    /* hand large writes to the vector path, which splits them across
+     * the copy pool, and any write when zero chunks are kept as holes,
+     * chunks may be compressed, chunks may be shared, or checksums are
+     * kept, since only that path looks after them */
+    if (cruise_copypool_wanted(count) || cruise_zero_chunks ||
+        cruise_compress_chunks || cruise_compress_spillover ||
+        cruise_dedup_chunks || meta->shared || cruise_checksum_chunks)
+    {
+        struct iovec iov;
+        iov.iov_base = (void*) buf;
+        iov.iov_len  = count;
+        return cruise_fid_store_fixed_iov(fid, meta, pos, &iov, 1, count, 1);
+    }
+
     /* get pointer to position within first chunk */
     int chunk_id = pos >> cruise_chunk_bits;
     off_t chunk_offset = pos & cruise_chunk_mask;
@@ -423,3 +1382,647 @@ int cruise_fid_store_fixed_write(int fid, cruise_filemeta_t* meta, off_t pos, co
 
     return rc;
 }
+
+/* copy count bytes between the buffers of iov and file stored as
+ * fixed-size chunks starting at pos, walks the vector and the chunks
+ * together so that each piece lying within one buffer and one chunk
+ * takes a single copy, writes to the file if write is set and reads
+ * from it otherwise */
+int cruise_fid_store_fixed_iov(
+  int fid,
+  cruise_filemeta_t* meta,
+  off_t pos,
+  const struct iovec* iov,
+  int iovcnt,
+  size_t count,
+  int write)
+{
+    int rc = CRUISE_SUCCESS;
+
+    /* note the chunks we're about to change */
+    if (write) {
+        cruise_chunk_dirty(meta, pos, (off_t) count);
+    }
+
+    /* get pointer to position within first chunk */
+    int chunk_id = pos >> cruise_chunk_bits;
+    off_t chunk_offset = pos & cruise_chunk_mask;
+
+    /* large transfers are split across the copy pool, we collect the
+     * pieces that lie in memory as tasks and copy them all at the end,
+     * if we can't get room for the list we just copy as we go */
+    cruise_copy_task_t* tasks = NULL;
+    int ntasks = 0;
+    if (cruise_copypool_wanted(count)) {
+        size_t max_tasks = (count >> cruise_chunk_bits) + 2 + (size_t) iovcnt;
+        tasks = (cruise_copy_task_t*) malloc(max_tasks * sizeof(cruise_copy_task_t));
+    }
+
+    int i = 0;
+    size_t iov_offset = 0;
+    size_t processed = 0;
+    while (processed < count && i < iovcnt && rc == CRUISE_SUCCESS) {
+        /* move on to the next buffer once we've used this one up */
+        if (iov_offset == iov[i].iov_len) {
+            i++;
+            iov_offset = 0;
+            continue;
+        }
+
+        /* copy up to the end of the buffer or the chunk, whichever
+         * comes first */
+        size_t num = iov[i].iov_len - iov_offset;
+        size_t chunk_remaining = cruise_chunk_size - chunk_offset;
+        if (num > chunk_remaining) {
+            num = chunk_remaining;
+        }
+        if (num > count - processed) {
+            num = count - processed;
+        }
+
+        char* ptr = (char*) iov[i].iov_base + iov_offset;
+        int location = meta->chunk_meta[chunk_id].location;
+        int whole = (num == (size_t) cruise_chunk_size);
+        int stored = 0;
+        if (write && cruise_zero_chunks && whole &&
+            meta->pins == 0 && cruise_memcpy_is_zero(ptr, num))
+        {
+            /* a whole chunk of zeros needs no storage, views and
+             * streams hold chunk memory so we leave pinned files be */
+            cruise_chunk_punch(fid, meta, chunk_id);
+            __sync_add_and_fetch(&cruise_zero_bytes, (unsigned long long) num);
+            stored = 1;
+        } else if (write && location == CHUNK_LOCATION_ZERO) {
+            /* writing data into a hole, it needs storage again */
+            rc = cruise_chunk_fill(fid, meta, chunk_id, chunk_offset, num);
+            location = meta->chunk_meta[chunk_id].location;
+        } else if (write && (location == CHUNK_LOCATION_PACKED ||
+                             location == CHUNK_LOCATION_SPILLZ))
+        {
+            /* writing into a compressed chunk, decompress it first
+             * unless we're about to replace all of it */
+            rc = cruise_chunk_unpack(fid, meta, chunk_id, ! whole);
+            location = meta->chunk_meta[chunk_id].location;
+        } else if (write && location == CHUNK_LOCATION_MEMFS &&
+                   cruise_chunk_is_shared(meta, chunk_id))
+        {
+            /* writing into a chunk others share, copy it first unless
+             * we're about to replace all of it */
+            rc = cruise_chunk_own(fid, meta, chunk_id, ! whole);
+            location = meta->chunk_meta[chunk_id].location;
+        }
+
+        if (write && ! stored && rc == CRUISE_SUCCESS && cruise_checksum_chunks) {
+            /* account for the data before it lands */
+            cruise_chunk_crc_update(meta, chunk_id, chunk_offset, ptr, num);
+        } else if (! write && cruise_checksum_verify) {
+            rc = cruise_chunk_crc_verify(meta, chunk_id);
+        }
+
+        if (write && whole && ! stored && rc == CRUISE_SUCCESS &&
+            location == CHUNK_LOCATION_SPILLOVER && cruise_compress_spillover)
+        {
+            /* a whole chunk going to spill over may be compressed */
+            rc = cruise_chunk_spill_pack(fid, meta, chunk_id, ptr);
+            stored = 1;
+        }
+
+        if (rc != CRUISE_SUCCESS || stored) {
+            /* nothing to copy */
+        } else if (tasks != NULL && location == CHUNK_LOCATION_MEMFS) {
+            char* chunk_buf = cruise_compute_chunk_buf(meta, chunk_id, chunk_offset);
+            cruise_copy_task_t* task = &tasks[ntasks];
+            task->dst   = write ? (void*) chunk_buf : (void*) ptr;
+            task->src   = write ? (const void*) ptr : (const void*) chunk_buf;
+            task->count = num;
+            task->write = write;
+            ntasks++;
+        } else if (write) {
+            rc = cruise_chunk_write(meta, chunk_id, chunk_offset, ptr, num);
+        } else {
+            rc = cruise_chunk_read(meta, chunk_id, chunk_offset, ptr, num);
+        }
+
+        /* advance both cursors */
+        processed    += num;
+        iov_offset   += num;
+        chunk_offset += num;
+        if (chunk_offset == cruise_chunk_size) {
+            chunk_id++;
+            chunk_offset = 0;
+        }
+    }
+
+    /* now copy the pieces we collected */
+    if (tasks != NULL) {
+        if (rc == CRUISE_SUCCESS) {
+            cruise_copypool_run(tasks, ntasks);
+        }
+        free(tasks);
+    }
+
+    return rc;
+}
+
+/* fill in iov with pointers to file data stored as fixed-size chunks,
+ * chunks in spill over are read into a single staging buffer, which
+ * is returned in staged and must be freed by the caller */
+int cruise_fid_store_fixed_view(
+  int fid,
+  cruise_filemeta_t* meta,
+  off_t pos,
+  size_t count,
+  struct iovec* iov,
+  int* iovcnt,
+  void** staged)
+{
+    int i;
+    *iovcnt = 0;
+    *staged = NULL;
+
+    /* get position within first chunk */
+    int first_id = pos >> cruise_chunk_bits;
+    off_t first_offset = pos & cruise_chunk_mask;
+
+    /* count the bytes we'll need to stage from spill over */
+    size_t stage_bytes = 0;
+    int chunk_id = first_id;
+    off_t chunk_offset = first_offset;
+    size_t processed = 0;
+    while (processed < count) {
+        size_t num = cruise_chunk_size - chunk_offset;
+        if (num > count - processed) {
+            num = count - processed;
+        }
+        if (meta->chunk_meta[chunk_id].location != CHUNK_LOCATION_MEMFS) {
+            stage_bytes += num;
+        }
+        processed += num;
+        chunk_offset = 0;
+        chunk_id++;
+    }
+
+    /* allocate staging buffer for chunks that aren't in memory */
+    char* stage = NULL;
+    if (stage_bytes > 0) {
+        stage = (char*) malloc(stage_bytes);
+        if (stage == NULL) {
+            return CRUISE_ERR_NOMEM;
+        }
+    }
+
+    /* now walk the chunks again and fill in the vector */
+    char* stage_ptr = stage;
+    chunk_id = first_id;
+    chunk_offset = first_offset;
+    processed = 0;
+    i = 0;
+    while (processed < count) {
+        size_t num = cruise_chunk_size - chunk_offset;
+        if (num > count - processed) {
+            num = count - processed;
+        }
+
+        if (cruise_checksum_verify) {
+            int rc = cruise_chunk_crc_verify(meta, chunk_id);
+            if (rc != CRUISE_SUCCESS) {
+                free(stage);
+                return rc;
+            }
+        }
+
+        void* base;
+        if (meta->chunk_meta[chunk_id].location == CHUNK_LOCATION_MEMFS) {
+            /* point directly at chunk memory */
+            base = cruise_compute_chunk_buf(meta, chunk_id, chunk_offset);
+        } else {
+            /* copy data from spill over into staging buffer */
+            int rc = cruise_chunk_read(meta, chunk_id, chunk_offset, stage_ptr, num);
+            if (rc != CRUISE_SUCCESS) {
+                free(stage);
+                return rc;
+            }
+            base = stage_ptr;
+            stage_ptr += num;
+        }
+
+        /* merge with previous entry if regions are adjacent */
+        if (i > 0 && (char*)iov[i-1].iov_base + iov[i-1].iov_len == (char*)base) {
+            iov[i-1].iov_len += num;
+        } else {
+            iov[i].iov_base = base;
+            iov[i].iov_len  = num;
+            i++;
+        }
+
+        processed += num;
+        chunk_offset = 0;
+        chunk_id++;
+    }
+
+    *iovcnt = i;
+    *staged = stage;
+    return CRUISE_SUCCESS;
+}
+
+/* get pointer to memory of the chunk holding pos, the chunk must
+ * already be reserved, a shared chunk is copied first if write is
+ * set, returns CRUISE_ERR_IO if the chunk is not held in memory */
+int cruise_fid_store_fixed_chunk(int fid, cruise_filemeta_t* meta, off_t pos, int write, void** chunkbuf)
+{
+    /* check that chunk has been reserved */
+    int chunk_id = pos >> cruise_chunk_bits;
+    if (chunk_id >= meta->chunks) {
+        return CRUISE_ERR_IO;
+    }
+
+    /* we can only hand out memory for chunks in memory, and not when
+     * we keep checksums, since we wouldn't see the writes */
+    cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+    if (chunk_meta->location != CHUNK_LOCATION_MEMFS || cruise_checksum_chunks) {
+        return CRUISE_ERR_IO;
+    }
+
+    /* a writer needs a chunk of its own, readers may look at one
+     * shared with other files as it is */
+    if (write && cruise_chunk_is_shared(meta, chunk_id)) {
+        int rc = cruise_chunk_own(fid, meta, chunk_id, 1);
+        if (rc != CRUISE_SUCCESS) {
+            return rc;
+        }
+        if (chunk_meta->location != CHUNK_LOCATION_MEMFS) {
+            return CRUISE_ERR_IO;
+        }
+    }
+
+    *chunkbuf = cruise_compute_chunk_buf(meta, chunk_id, 0);
+    return CRUISE_SUCCESS;
+}
+
+/* returns 1 if count bytes at pos can be written with the file lock
+ * held shared, the range must lie within reserved space, and when
+ * zero chunks are kept as holes, chunks may be compressed, or chunks
+ * may be shared it must not touch a hole, a packed chunk, or a shared
+ * chunk, nor cover a whole chunk that may become a hole or packed,
+ * since each of those changes the chunk map */
+int cruise_fid_store_fixed_shared(int fid, cruise_filemeta_t* meta, off_t pos, off_t count)
+{
+    if (pos + count > (meta->chunks << cruise_chunk_bits)) {
+        return 0;
+    }
+    if (cruise_checksum_verify) {
+        /* readers checking checksums must not see a write half done */
+        return 0;
+    }
+    if ((! cruise_zero_chunks && ! cruise_compress_chunks && ! cruise_compress_spillover &&
+         ! cruise_dedup_chunks && ! meta->shared) || count == 0)
+    {
+        return 1;
+    }
+    if ((cruise_zero_chunks || cruise_compress_spillover) && count >= cruise_chunk_size) {
+        return 0;
+    }
+
+    int chunk_id = pos >> cruise_chunk_bits;
+    int last_id  = (pos + count - 1) >> cruise_chunk_bits;
+    for (; chunk_id <= last_id; chunk_id++) {
+        int location = meta->chunk_meta[chunk_id].location;
+        if (location == CHUNK_LOCATION_ZERO || location == CHUNK_LOCATION_PACKED ||
+            location == CHUNK_LOCATION_SPILLZ)
+        {
+            return 0;
+        }
+        if (location == CHUNK_LOCATION_MEMFS && cruise_chunk_is_shared(meta, chunk_id)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* write zeros to count bytes at pos, the space must be reserved,
+ * when zero chunks are kept as holes whole chunks become holes and
+ * holes are left as they are */
+int cruise_fid_store_fixed_zero(int fid, cruise_filemeta_t* meta, off_t pos, off_t count)
+{
+    int rc = CRUISE_SUCCESS;
+
+    /* note the chunks we're about to change */
+    cruise_chunk_dirty(meta, pos, count);
+
+    int chunk_id = pos >> cruise_chunk_bits;
+    off_t chunk_offset = pos & cruise_chunk_mask;
+    off_t processed = 0;
+    while (processed < count && rc == CRUISE_SUCCESS) {
+        off_t num = cruise_chunk_size - chunk_offset;
+        if (num > count - processed) {
+            num = count - processed;
+        }
+
+        int location = meta->chunk_meta[chunk_id].location;
+        if (cruise_zero_chunks && num == cruise_chunk_size && meta->pins == 0) {
+            cruise_chunk_punch(fid, meta, chunk_id);
+            __sync_add_and_fetch(&cruise_zero_bytes, (unsigned long long) num);
+        } else if (location != CHUNK_LOCATION_ZERO) {
+            /* a packed or shared chunk needs storage of its own first */
+            if (location == CHUNK_LOCATION_PACKED || location == CHUNK_LOCATION_SPILLZ) {
+                rc = cruise_chunk_unpack(fid, meta, chunk_id, 1);
+            } else if (location == CHUNK_LOCATION_MEMFS &&
+                       cruise_chunk_is_shared(meta, chunk_id))
+            {
+                rc = cruise_chunk_own(fid, meta, chunk_id, num < cruise_chunk_size);
+            }
+            if (rc == CRUISE_SUCCESS && cruise_checksum_chunks) {
+                cruise_chunk_crc_update(meta, chunk_id, chunk_offset, NULL, (size_t) num);
+            }
+            if (rc == CRUISE_SUCCESS) {
+                rc = cruise_chunk_zero(meta, chunk_id, chunk_offset, (size_t) num);
+            }
+        }
+
+        processed += num;
+        chunk_offset = 0;
+        chunk_id++;
+    }
+
+    return rc;
+}
+
+/* compress chunks of the file held in memory until want memory
+ * chunks have been freed, the caller holds the file lock exclusive,
+ * returns the number of chunks freed */
+int cruise_fid_store_fixed_pack(int fid, cruise_filemeta_t* meta, int want)
+{
+    size_t size = cruise_compress_bound(cruise_chunk_size);
+    char* scratch = (char*) malloc(size);
+    if (scratch == NULL) {
+        return 0;
+    }
+
+    int freed = 0;
+    int chunk_id;
+    for (chunk_id = 0; chunk_id < meta->chunks && freed < want; chunk_id++) {
+        if (meta->chunk_meta[chunk_id].location == CHUNK_LOCATION_MEMFS) {
+            freed += cruise_chunk_pack(fid, meta, chunk_id, scratch, size);
+        }
+    }
+
+    free(scratch);
+    return freed;
+}
+
+/* fill in crcs with the checksum of the data in each chunk, at most
+ * max entries, the caller holds the file lock exclusive, returns the
+ * number of chunks holding data or a negative CRUISE error code */
+int cruise_fid_store_fixed_checksums(int fid, cruise_filemeta_t* meta, unsigned int* crcs, int max)
+{
+    int count = (int) ((meta->size + cruise_chunk_size - 1) >> cruise_chunk_bits);
+    int chunk_id;
+    for (chunk_id = 0; chunk_id < count; chunk_id++) {
+        size_t num = (size_t) cruise_chunk_size;
+        off_t left = meta->size - ((off_t) chunk_id << cruise_chunk_bits);
+        if (left < (off_t) num) {
+            num = (size_t) left;
+        }
+
+        unsigned int crc;
+        int rc = cruise_chunk_crc_complete(meta, chunk_id, num, &crc);
+        if (rc != CRUISE_SUCCESS) {
+            return rc;
+        }
+        if (chunk_id < max) {
+            crcs[chunk_id] = crc;
+        }
+    }
+    return count;
+}
+
+/* check the data in each chunk against its checksum, the caller holds
+ * the file lock, returns CRUISE_ERR_IO on a mismatch */
+int cruise_fid_store_fixed_verify(int fid, cruise_filemeta_t* meta)
+{
+    int chunk_id;
+    for (chunk_id = 0; chunk_id < meta->chunks; chunk_id++) {
+        int rc = cruise_chunk_crc_verify(meta, chunk_id);
+        if (rc != CRUISE_SUCCESS) {
+            return rc;
+        }
+    }
+    return CRUISE_SUCCESS;
+}
+
+/* share full chunks of the file held in memory with identical chunks
+ * in the dedup index and add the others to it, the caller holds the
+ * file lock exclusive, returns the number of chunks freed */
+int cruise_fid_store_fixed_dedup(int fid, cruise_filemeta_t* meta)
+{
+    int freed = 0;
+
+    /* the last chunk may still grow, so leave it out */
+    off_t full = meta->size >> cruise_chunk_bits;
+    if (full > meta->chunks) {
+        full = meta->chunks;
+    }
+
+    int chunk_id;
+    for (chunk_id = 0; chunk_id < full; chunk_id++) {
+        cruise_chunkmeta_t* chunk_meta = &(meta->chunk_meta[chunk_id]);
+        if (chunk_meta->location != CHUNK_LOCATION_MEMFS) {
+            continue;
+        }
+
+        /* chunks we already shared or indexed have been looked at */
+        int id = (int) chunk_meta->id;
+        cruise_chunkref_t* ref = &cruise_chunk_refs[id];
+        if (ref->refs > 1 || ref->hashed) {
+            continue;
+        }
+
+        const char* buf = cruise_chunks + ((off_t) id << cruise_chunk_bits);
+        unsigned long long hash = cruise_memcpy_hash(buf, cruise_chunk_size);
+        int* bucket = &cruise_dedup_index[hash % (unsigned long long) cruise_max_chunks];
+
+        /* look for a chunk with the same fingerprint, our reference
+         * keeps its owner from changing it while we compare */
+        cruise_stack_lock();
+        int match = *bucket;
+        while (match >= 0 && cruise_chunk_refs[match].hash != hash) {
+            match = cruise_chunk_refs[match].next;
+        }
+        if (match >= 0) {
+            cruise_chunk_refs[match].refs++;
+        }
+        cruise_stack_unlock();
+
+        int same = 0;
+        if (match >= 0) {
+            const char* other = cruise_chunks + ((off_t) match << cruise_chunk_bits);
+            same = (memcmp(buf, other, cruise_chunk_size) == 0);
+        }
+
+        cruise_stack_lock();
+        if (same) {
+            /* point at the match and give back our copy */
+            chunk_meta->id = match;
+            ref->refs = 0;
+            cruise_stack_push(free_chunk_stack, id);
+            freed++;
+        } else {
+            /* a different chunk that happens to have the same
+             * fingerprint, drop our reference and index ours too */
+            if (match >= 0 && cruise_chunk_unref(match)) {
+                cruise_stack_push(free_chunk_stack, match);
+            }
+            ref->hash   = hash;
+            ref->hashed = 1;
+            ref->next   = *bucket;
+            *bucket     = id;
+        }
+        cruise_stack_unlock();
+    }
+
+    return freed;
+}
+
+/* fill in ranges with the runs of chunks of the file written in epoch
+ * since or later, up to the end of the file, at most max entries, the
+ * caller holds the file lock, returns the number of runs */
+int cruise_fid_store_fixed_dirty(
+  int fid,
+  cruise_filemeta_t* meta,
+  unsigned long long since,
+  cruise_range_t* ranges,
+  int max)
+{
+    off_t size = meta->size;
+    off_t chunks = (size + cruise_chunk_size - 1) >> cruise_chunk_bits;
+    if (chunks > meta->chunks) {
+        chunks = meta->chunks;
+    }
+
+    int count = 0;
+    off_t chunk_id = 0;
+    while (chunk_id < chunks) {
+        if (meta->chunk_meta[chunk_id].epoch < since) {
+            chunk_id++;
+            continue;
+        }
+
+        /* merge the run of dirty chunks starting here */
+        off_t first = chunk_id;
+        while (chunk_id < chunks && meta->chunk_meta[chunk_id].epoch >= since) {
+            chunk_id++;
+        }
+        if (count < max) {
+            off_t start = first << cruise_chunk_bits;
+            off_t end   = chunk_id << cruise_chunk_bits;
+            if (end > size) {
+                end = size;
+            }
+            ranges[count].offset = start;
+            ranges[count].length = end - start;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/* mark the chunks holding count bytes at pos as written in the
+ * current epoch of the file, the caller holds the file lock */
+void cruise_fid_store_fixed_dirty_mark(int fid, cruise_filemeta_t* meta, off_t pos, off_t count)
+{
+    if (pos + count > (meta->chunks << cruise_chunk_bits)) {
+        count = (meta->chunks << cruise_chunk_bits) - pos;
+    }
+    cruise_chunk_dirty(meta, pos, count);
+}
+
+/* clone count bytes at src_pos of src to dst_pos of dst, a chunk of
+ * src held in memory or as a hole is shared when both positions are
+ * at the start of a chunk and it is cloned whole, or it is the last
+ * chunk of src and lands at the end of dst, the rest is copied, the
+ * caller holds both file locks exclusive and has extended dst up to
+ * dst_pos, and raises the size of dst once we're done */
+int cruise_fid_store_fixed_clone(
+  int src_fid,
+  cruise_filemeta_t* src_meta,
+  off_t src_pos,
+  int dst_fid,
+  cruise_filemeta_t* dst_meta,
+  off_t dst_pos,
+  off_t count)
+{
+    int rc = CRUISE_SUCCESS;
+    char* buf = NULL;
+
+    off_t done = 0;
+    while (done < count && rc == CRUISE_SUCCESS) {
+        off_t spos = src_pos + done;
+        off_t dpos = dst_pos + done;
+        off_t num = cruise_chunk_size - (spos & cruise_chunk_mask);
+        if (num > count - done) {
+            num = count - done;
+        }
+
+        /* views and streams hold chunk memory, so a pinned file gets
+         * a copy, as does a chunk that is spilled or compressed */
+        int src_chunk = (int) (spos >> cruise_chunk_bits);
+        int dst_chunk = (int) (dpos >> cruise_chunk_bits);
+        int location = src_meta->chunk_meta[src_chunk].location;
+        if ((spos & cruise_chunk_mask) == 0 && (dpos & cruise_chunk_mask) == 0 &&
+            (num == cruise_chunk_size ||
+             (spos + num == src_meta->size && dpos + num >= dst_meta->size)) &&
+            (location == CHUNK_LOCATION_MEMFS || location == CHUNK_LOCATION_ZERO) &&
+            src_meta->pins == 0 && dst_meta->pins == 0 &&
+            dst_chunk <= dst_meta->chunks)
+        {
+            cruise_chunk_share(src_meta, src_chunk, dst_fid, dst_meta, dst_chunk);
+        } else {
+            if (buf == NULL) {
+                buf = (char*) malloc(cruise_chunk_size);
+                if (buf == NULL) {
+                    rc = CRUISE_ERR_NOMEM;
+                    break;
+                }
+            }
+            rc = cruise_fid_store_fixed_extend(dst_fid, dst_meta, dpos + num);
+            if (rc == CRUISE_SUCCESS) {
+                rc = cruise_fid_store_fixed_read(src_fid, src_meta, spos, buf, (size_t) num);
+            }
+            if (rc == CRUISE_SUCCESS) {
+                rc = cruise_fid_store_fixed_write(dst_fid, dst_meta, dpos, buf, (size_t) num);
+            }
+        }
+
+        done += num;
+    }
+
+    free(buf);
+    return rc;
+}
+
+/* fill in the counters kept by fixed-size chunk storage */
+void cruise_fid_store_fixed_stats(cruise_stats_t* stats)
+{
+    stats->zero_chunks   = cruise_zero_holes;
+    stats->zero_bytes    = cruise_zero_bytes;
+    stats->packed_chunks = cruise_packed_chunks;
+    stats->packed_bytes  = cruise_packed_bytes;
+    stats->spill_packed_chunks = cruise_spill_packed_chunks;
+    stats->spill_packed_bytes  = cruise_spill_packed_bytes;
+
+    /* each reference beyond the first to a chunk saves a chunk */
+    unsigned long long saved = 0;
+    if (cruise_chunk_refs != NULL) {
+        cruise_stack_lock();
+        int id;
+        for (id = 0; id < cruise_max_chunks; id++) {
+            if (cruise_chunk_refs[id].refs > 1) {
+                saved += (unsigned long long) (cruise_chunk_refs[id].refs - 1);
+            }
+        }
+        cruise_stack_unlock();
+    }
+    stats->dedup_chunks = saved;
+    stats->dedup_bytes  = saved * (unsigned long long) cruise_chunk_size;
+}
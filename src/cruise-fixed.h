@@ -53,4 +53,132 @@ int cruise_fid_store_fixed_write(
   size_t count             /* number of bytes to write */
 );
 
+/* copy data between iov and file stored as fixed-size chunks,
+ * returns CRUISE error code */
+int cruise_fid_store_fixed_iov(
+  int fid,                 /* file id to access */
+  cruise_filemeta_t* meta, /* meta data for file */
+  off_t pos,               /* position within file to start from */
+  const struct iovec* iov, /* user buffers */
+  int iovcnt,              /* number of entries in iov */
+  size_t count,            /* number of bytes to copy */
+  int write                /* write to file if set, read from it otherwise */
+);
+
+/* fill in iov with pointers to file data stored as fixed-size chunks,
+ * returns CRUISE error code */
+int cruise_fid_store_fixed_view(
+  int fid,                 /* file id to map */
+  cruise_filemeta_t* meta, /* meta data for file */
+  off_t pos,               /* position within file to start from */
+  size_t count,            /* number of bytes to map */
+  struct iovec* iov,       /* array of at least one entry per chunk in range */
+  int* iovcnt,             /* number of entries filled in */
+  void** staged            /* staging buffer for spilled chunks, caller frees */
+);
+
+/* get pointer to memory of the chunk holding pos, the chunk must
+ * already be reserved, a chunk shared with other files is copied
+ * first if the caller will write into it, the file lock must be held
+ * exclusive in that case, returns CRUISE_ERR_IO if the chunk is not
+ * held in memory */
+int cruise_fid_store_fixed_chunk(
+  int fid,                 /* file id to look up */
+  cruise_filemeta_t* meta, /* meta data for file */
+  off_t pos,               /* position within file */
+  int write,               /* whether caller writes into the chunk */
+  void** chunkbuf          /* pointer to first byte of chunk */
+);
+
+/* returns 1 if count bytes at pos can be written with the file lock
+ * held shared, and 0 if the write needs it exclusive */
+int cruise_fid_store_fixed_shared(
+  int fid,                 /* file id to write to */
+  cruise_filemeta_t* meta, /* meta data for file */
+  off_t pos,               /* position within file to write to */
+  off_t count              /* number of bytes to write */
+);
+
+/* write zeros to file stored as fixed-size chunks, whole chunks may
+ * become holes, returns CRUISE error code */
+int cruise_fid_store_fixed_zero(
+  int fid,                 /* file id to write to */
+  cruise_filemeta_t* meta, /* meta data for file */
+  off_t pos,               /* position within file to write to */
+  off_t count              /* number of bytes to zero */
+);
+
+/* compress chunks of file stored as fixed-size chunks, the file lock
+ * must be held exclusive, returns number of memory chunks freed */
+int cruise_fid_store_fixed_pack(
+  int fid,                 /* file id to compress */
+  cruise_filemeta_t* meta, /* meta data for file */
+  int want                 /* number of memory chunks to free */
+);
+
+/* fill in crcs with the checksum of the data in each chunk of file
+ * stored as fixed-size chunks, the file lock must be held exclusive,
+ * returns number of chunks holding data or CRUISE error code */
+int cruise_fid_store_fixed_checksums(
+  int fid,                 /* file id to checksum */
+  cruise_filemeta_t* meta, /* meta data for file */
+  unsigned int* crcs,      /* checksum of each chunk */
+  int max                  /* number of entries in crcs */
+);
+
+/* check the data of file stored as fixed-size chunks against the
+ * chunk checksums, returns CRUISE_ERR_IO on a mismatch */
+int cruise_fid_store_fixed_verify(
+  int fid,                 /* file id to check */
+  cruise_filemeta_t* meta  /* meta data for file */
+);
+
+/* share full chunks of file stored as fixed-size chunks with
+ * identical chunks of other files, the file lock must be held
+ * exclusive, returns number of memory chunks freed */
+int cruise_fid_store_fixed_dedup(
+  int fid,                 /* file id to dedup */
+  cruise_filemeta_t* meta  /* meta data for file */
+);
+
+/* fill in ranges with the runs of chunks of file stored as fixed-size
+ * chunks written in epoch since or later, the file lock must be held,
+ * returns the number of runs, which may be more than max */
+int cruise_fid_store_fixed_dirty(
+  int fid,                 /* file id to look at */
+  cruise_filemeta_t* meta, /* meta data for file */
+  unsigned long long since, /* first epoch to count as dirty */
+  cruise_range_t* ranges,  /* runs of dirty chunks */
+  int max                  /* number of entries in ranges */
+);
+
+/* mark the chunks holding count bytes at pos of file stored as
+ * fixed-size chunks as written in the current epoch, the file lock
+ * must be held */
+void cruise_fid_store_fixed_dirty_mark(
+  int fid,                 /* file id to mark */
+  cruise_filemeta_t* meta, /* meta data for file */
+  off_t pos,               /* position within file of first byte */
+  off_t count              /* number of bytes written */
+);
+
+/* clone count bytes at src_pos of a file stored as fixed-size chunks
+ * to dst_pos of another, whole chunks are shared and the rest copied,
+ * both file locks must be held exclusive and dst must already reach
+ * dst_pos, returns CRUISE error code */
+int cruise_fid_store_fixed_clone(
+  int src_fid,                 /* file id to clone from */
+  cruise_filemeta_t* src_meta, /* meta data for source file */
+  off_t src_pos,               /* position within source to start from */
+  int dst_fid,                 /* file id to clone to */
+  cruise_filemeta_t* dst_meta, /* meta data for destination file */
+  off_t dst_pos,               /* position within destination to start from */
+  off_t count                  /* number of bytes to clone */
+);
+
+/* fill in the counters kept by fixed-size chunk storage */
+void cruise_fid_store_fixed_stats(
+  cruise_stats_t* stats    /* counters to fill in */
+);
+
 #endif /* CRUISE_FIXED_H */
@@ -0,0 +1,781 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+/* implements a printf formatter for the common integer, string, and
+ * floating-point conversions, see cruise-format.h for what is covered
+ *
+ * Integers are printed two digits at a time from a table.  A double
+ * is printed by computing x * 10^s rounded to an integer exactly from
+ * its binary representation, x = m * 2^e, so x * 10^s = m * 5^s * 2^(e+s),
+ * which we evaluate in 128-bit arithmetic and round to nearest with
+ * ties to even like glibc does.  Conversions that would need more
+ * than 128 bits report failure so the caller can use vsnprintf. */
+
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "cruise-format.h"
+
+typedef unsigned __int128 cruise_u128;
+
+/* two ASCII digits for each value from 0 to 99 */
+static const char cruise_format_digit_pairs[200] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const uint64_t cruise_format_pow10[20] = {
+    1ULL,                 10ULL,
+    100ULL,               1000ULL,
+    10000ULL,             100000ULL,
+    1000000ULL,           10000000ULL,
+    100000000ULL,         1000000000ULL,
+    10000000000ULL,       100000000000ULL,
+    1000000000000ULL,     10000000000000ULL,
+    100000000000000ULL,   1000000000000000ULL,
+    10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/* 5^0 through 5^27, the largest power of 5 that fits in 64 bits */
+static const uint64_t cruise_format_pow5[28] = {
+    1ULL,                   5ULL,
+    25ULL,                  125ULL,
+    625ULL,                 3125ULL,
+    15625ULL,               78125ULL,
+    390625ULL,              1953125ULL,
+    9765625ULL,             48828125ULL,
+    244140625ULL,           1220703125ULL,
+    6103515625ULL,          30517578125ULL,
+    152587890625ULL,        762939453125ULL,
+    3814697265625ULL,       19073486328125ULL,
+    95367431640625ULL,      476837158203125ULL,
+    2384185791015625ULL,    11920928955078125ULL,
+    59604644775390625ULL,   298023223876953125ULL,
+    1490116119384765625ULL, 7450580596923828125ULL
+};
+
+/* largest precision we handle for %e and %g (significant digits - 1),
+ * keeps the significant digits within 64 bits */
+#define CRUISE_FORMAT_MAX_EPREC (17)
+
+/* largest precision we handle for %f */
+#define CRUISE_FORMAT_MAX_FPREC (19)
+
+/* largest width or precision we accept */
+#define CRUISE_FORMAT_MAX_FIELD (1 << 20)
+
+/* parsed conversion specification */
+typedef struct {
+    int left;  /* '-' flag */
+    int plus;  /* '+' flag */
+    int space; /* ' ' flag */
+    int zero;  /* '0' flag */
+    int alt;   /* '#' flag */
+    int width; /* minimum field width */
+    int prec;  /* precision, -1 if not given */
+} cruise_format_spec;
+
+/* output cursor, end points one past the last byte we may write */
+typedef struct {
+    char* p;
+    char* end;
+} cruise_format_out;
+
+/* writes digits of value so they end just before end,
+ * returns pointer to the first digit */
+static char* cruise_format_utoa(char* end, uint64_t value)
+{
+    while (value >= 100) {
+        unsigned int idx = (unsigned int) (value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        end[0] = cruise_format_digit_pairs[idx];
+        end[1] = cruise_format_digit_pairs[idx + 1];
+    }
+    if (value >= 10) {
+        unsigned int idx = (unsigned int) value * 2;
+        end -= 2;
+        end[0] = cruise_format_digit_pairs[idx];
+        end[1] = cruise_format_digit_pairs[idx + 1];
+    } else {
+        *--end = (char) ('0' + value);
+    }
+    return end;
+}
+
+/* writes exactly count digits of value to dst, padding with leading
+ * zeros, value must be less than 10^count */
+static void cruise_format_fixed(char* dst, uint64_t value, int count)
+{
+    char* end = dst + count;
+    while (end - dst >= 2) {
+        unsigned int idx = (unsigned int) (value % 100) * 2;
+        value /= 100;
+        end -= 2;
+        end[0] = cruise_format_digit_pairs[idx];
+        end[1] = cruise_format_digit_pairs[idx + 1];
+    }
+    if (end > dst) {
+        *--end = (char) ('0' + value);
+    }
+}
+
+/* writes one converted field, padded to width with spaces on the
+ * left, or on the right for left, followed by prefix, zeros, and body,
+ * returns -1 if it doesn't fit */
+static int cruise_format_field(
+    cruise_format_out* out,
+    const cruise_format_spec* spec,
+    const char* prefix,
+    size_t prefixlen,
+    size_t zeros,
+    const char* body,
+    size_t bodylen)
+{
+    size_t total = prefixlen + zeros + bodylen;
+    size_t pad = 0;
+    if ((size_t) spec->width > total) {
+        pad = (size_t) spec->width - total;
+    }
+
+    if (total + pad > (size_t) (out->end - out->p)) {
+        return -1;
+    }
+
+    if (! spec->left) {
+        memset(out->p, ' ', pad);
+        out->p += pad;
+    }
+    memcpy(out->p, prefix, prefixlen);
+    out->p += prefixlen;
+    memset(out->p, '0', zeros);
+    out->p += zeros;
+    memcpy(out->p, body, bodylen);
+    out->p += bodylen;
+    if (spec->left) {
+        memset(out->p, ' ', pad);
+        out->p += pad;
+    }
+
+    return 0;
+}
+
+/* sets *p5 to 5^n, returns -1 if it does not fit in 128 bits */
+static int cruise_format_pow5_128(int n, cruise_u128* p5)
+{
+    if (n < 28) {
+        *p5 = cruise_format_pow5[n];
+        return 0;
+    }
+    if (n < 55) {
+        *p5 = (cruise_u128) cruise_format_pow5[27] * cruise_format_pow5[n - 27];
+        return 0;
+    }
+    return -1;
+}
+
+/* sets *out to m * 2^e * 10^s rounded to the nearest integer with
+ * ties to even, returns -1 if that needs more than 128 bits or the
+ * result does not fit in 64 bits */
+static int cruise_format_scale(uint64_t m, int e, int s, uint64_t* out)
+{
+    if (m == 0) {
+        *out = 0;
+        return 0;
+    }
+
+    /* split 10^s into 5^s * 2^s, and fold the 2^s into 2^e */
+    cruise_u128 num, den, p5;
+    if (cruise_format_pow5_128(s >= 0 ? s : -s, &p5) != 0) {
+        return -1;
+    }
+    if (s >= 0) {
+        /* m is less than 2^53, so this keeps num below 2^128 */
+        if ((p5 >> 75) != 0) {
+            return -1;
+        }
+        num = m * p5;
+        den = 1;
+    } else {
+        num = m;
+        den = p5;
+    }
+    int t = e + s;
+
+    cruise_u128 q;
+    if (t >= 0) {
+        if (t >= 127 || (num >> (127 - t)) != 0) {
+            return -1;
+        }
+        num <<= t;
+        q = num / den;
+        if (den > 1) {
+            cruise_u128 r = num - q * den;
+            if (r > den - r || (r == den - r && (q & 1))) {
+                q++;
+            }
+        }
+    } else if (den == 1) {
+        /* divide by a power of two */
+        int k = -t;
+        if (k > 128) {
+            /* num < 2^128 < 2^(k-1), rounds down to zero */
+            q = 0;
+        } else if (k == 128) {
+            cruise_u128 half = (cruise_u128) 1 << 127;
+            q = (num > half) ? 1 : 0;
+        } else {
+            cruise_u128 half = (cruise_u128) 1 << (k - 1);
+            cruise_u128 r = num & (((cruise_u128) 1 << k) - 1);
+            q = num >> k;
+            if (r > half || (r == half && (q & 1))) {
+                q++;
+            }
+        }
+    } else {
+        int k = -t;
+        if (k >= 127 || (den >> (127 - k)) != 0) {
+            return -1;
+        }
+        den <<= k;
+        q = num / den;
+        cruise_u128 r = num - q * den;
+        if (r > den - r || (r == den - r && (q & 1))) {
+            q++;
+        }
+    }
+
+    if ((q >> 64) != 0) {
+        return -1;
+    }
+    *out = (uint64_t) q;
+    return 0;
+}
+
+/* finds the decimal exponent *exp10 and the prec+1 leading decimal
+ * digits *digits of m * 2^e rounded to prec digits after the first,
+ * returns -1 if we can't compute them exactly */
+static int cruise_format_sig(
+    uint64_t m,
+    int e,
+    int prec,
+    uint64_t* digits,
+    int* exp10)
+{
+    if (m == 0) {
+        *digits = 0;
+        *exp10  = 0;
+        return 0;
+    }
+
+    /* estimate floor(log10(x)) from the position of the top bit,
+     * 78913 / 2^18 is log10(2), the estimate is exact or one too low */
+    int e2 = e + 63 - __builtin_clzll(m);
+    int x10 = (e2 * 78913) >> 18;
+
+    /* adjust the exponent until we get exactly prec+1 digits, a carry
+     * out of the top digit on rounding moves it up by one */
+    int i;
+    for (i = 0; i < 4; i++) {
+        uint64_t n;
+        if (cruise_format_scale(m, e, prec - x10, &n) != 0) {
+            return -1;
+        }
+        if (n < cruise_format_pow10[prec]) {
+            x10--;
+        } else if (n >= cruise_format_pow10[prec + 1]) {
+            x10++;
+        } else {
+            *digits = n;
+            *exp10  = x10;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* writes an exponent like e+05 or E-123 to dst, returns its length */
+static size_t cruise_format_exponent(char* dst, char e, int exp10)
+{
+    dst[0] = e;
+    dst[1] = '+';
+    if (exp10 < 0) {
+        dst[1] = '-';
+        exp10 = -exp10;
+    }
+    int count = (exp10 >= 100) ? 3 : 2;
+    cruise_format_fixed(dst + 2, (uint64_t) exp10, count);
+    return (size_t) (2 + count);
+}
+
+/* formats a %f, %e, or %g conversion of x */
+static int cruise_format_double(
+    cruise_format_out* out,
+    const cruise_format_spec* spec,
+    char conv,
+    double x)
+{
+    /* pull apart the double */
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int neg = (int) (bits >> 63);
+    int biased = (int) ((bits >> 52) & 0x7ff);
+    uint64_t m = bits & ((1ULL << 52) - 1);
+    int e;
+    if (biased == 0x7ff) {
+        /* leave inf and nan to vsnprintf */
+        return -1;
+    } else if (biased == 0) {
+        e = -1074;
+    } else {
+        m |= (1ULL << 52);
+        e = biased - 1075;
+    }
+
+    /* body holds the formatted number without its sign */
+    char body[64];
+    size_t len = 0;
+
+    char digits[CRUISE_FORMAT_MAX_EPREC + 1];
+    uint64_t n;
+    int x10;
+    int prec = spec->prec;
+    if (conv == 'f' || conv == 'F') {
+        if (prec < 0) {
+            prec = 6;
+        }
+        if (prec > CRUISE_FORMAT_MAX_FPREC) {
+            return -1;
+        }
+        if (cruise_format_scale(m, e, prec, &n) != 0) {
+            return -1;
+        }
+
+        /* integer part, decimal point, and fraction */
+        char* start = cruise_format_utoa(body + 24, n / cruise_format_pow10[prec]);
+        len = (size_t) (body + 24 - start);
+        memmove(body, start, len);
+        if (prec > 0 || spec->alt) {
+            body[len++] = '.';
+        }
+        cruise_format_fixed(body + len, n % cruise_format_pow10[prec], prec);
+        len += (size_t) prec;
+    } else if (conv == 'e' || conv == 'E') {
+        if (prec < 0) {
+            prec = 6;
+        }
+        if (prec > CRUISE_FORMAT_MAX_EPREC) {
+            return -1;
+        }
+        if (cruise_format_sig(m, e, prec, &n, &x10) != 0) {
+            return -1;
+        }
+        cruise_format_fixed(digits, n, prec + 1);
+
+        /* d.ddde+xx */
+        body[len++] = digits[0];
+        if (prec > 0 || spec->alt) {
+            body[len++] = '.';
+        }
+        memcpy(body + len, digits + 1, (size_t) prec);
+        len += (size_t) prec;
+        len += cruise_format_exponent(body + len, conv, x10);
+    } else {
+        /* %g counts significant digits, with 0 meaning 1 */
+        if (prec < 0) {
+            prec = 6;
+        } else if (prec == 0) {
+            prec = 1;
+        }
+        if (prec - 1 > CRUISE_FORMAT_MAX_EPREC) {
+            return -1;
+        }
+        if (cruise_format_sig(m, e, prec - 1, &n, &x10) != 0) {
+            return -1;
+        }
+        cruise_format_fixed(digits, n, prec);
+
+        /* the fraction runs from frac to the end of body */
+        size_t frac;
+        if (x10 < prec && x10 >= -4) {
+            /* fixed notation with prec - 1 - x10 digits after the point */
+            if (x10 >= 0) {
+                memcpy(body, digits, (size_t) (x10 + 1));
+                len = (size_t) (x10 + 1);
+                body[len++] = '.';
+                frac = len;
+                memcpy(body + len, digits + x10 + 1, (size_t) (prec - 1 - x10));
+                len += (size_t) (prec - 1 - x10);
+            } else {
+                body[len++] = '0';
+                body[len++] = '.';
+                frac = len;
+                memset(body + len, '0', (size_t) (-x10 - 1));
+                len += (size_t) (-x10 - 1);
+                memcpy(body + len, digits, (size_t) prec);
+                len += (size_t) prec;
+            }
+        } else {
+            /* glibc drops trailing zeros from %#g in exponential
+             * notation for some values, leave those to it */
+            if (spec->alt) {
+                return -1;
+            }
+
+            /* exponential notation with prec - 1 digits after the point */
+            body[len++] = digits[0];
+            body[len++] = '.';
+            frac = len;
+            memcpy(body + len, digits + 1, (size_t) (prec - 1));
+            len += (size_t) (prec - 1);
+        }
+
+        /* drop trailing zeros, and the point if nothing follows it */
+        if (! spec->alt) {
+            while (len > frac && body[len - 1] == '0') {
+                len--;
+            }
+            if (len == frac) {
+                len--;
+            }
+        }
+
+        if (! (x10 < prec && x10 >= -4)) {
+            len += cruise_format_exponent(body + len, (conv == 'G') ? 'E' : 'e', x10);
+        }
+    }
+
+    /* sign */
+    const char* prefix = "";
+    if (neg) {
+        prefix = "-";
+    } else if (spec->plus) {
+        prefix = "+";
+    } else if (spec->space) {
+        prefix = " ";
+    }
+    size_t prefixlen = strlen(prefix);
+
+    /* the 0 flag fills the width with zeros after the sign */
+    size_t zeros = 0;
+    if (spec->zero && ! spec->left && (size_t) spec->width > prefixlen + len) {
+        zeros = (size_t) spec->width - prefixlen - len;
+    }
+
+    return cruise_format_field(out, spec, prefix, prefixlen, zeros, body, len);
+}
+
+/* formats a %d, %i, %u, %o, %x, or %X conversion of value */
+static int cruise_format_integer(
+    cruise_format_out* out,
+    const cruise_format_spec* spec,
+    char conv,
+    uint64_t value,
+    int neg)
+{
+    /* convert digits right to left into the end of body */
+    char body[24];
+    char* end = body + sizeof(body);
+    char* start = end;
+    if (value == 0 && spec->prec == 0) {
+        /* no digits at all */
+    } else if (conv == 'o') {
+        do {
+            *--start = (char) ('0' + (value & 7));
+            value >>= 3;
+        } while (value != 0);
+    } else if (conv == 'x' || conv == 'X') {
+        const char* hex = (conv == 'x') ? "0123456789abcdef" : "0123456789ABCDEF";
+        do {
+            *--start = hex[value & 15];
+            value >>= 4;
+        } while (value != 0);
+    } else {
+        start = cruise_format_utoa(end, value);
+    }
+    size_t len = (size_t) (end - start);
+
+    /* zeros up to the precision */
+    size_t zeros = 0;
+    if (spec->prec >= 0 && (size_t) spec->prec > len) {
+        zeros = (size_t) spec->prec - len;
+    }
+
+    /* sign or radix prefix */
+    const char* prefix = "";
+    if (conv == 'd' || conv == 'i') {
+        if (neg) {
+            prefix = "-";
+        } else if (spec->plus) {
+            prefix = "+";
+        } else if (spec->space) {
+            prefix = " ";
+        }
+    } else if (spec->alt) {
+        if (conv == 'o') {
+            /* # forces a leading zero digit */
+            if (zeros == 0 && (len == 0 || *start != '0')) {
+                zeros = 1;
+            }
+        } else if ((conv == 'x' || conv == 'X') && len > 0 && ! (len == 1 && *start == '0')) {
+            prefix = (conv == 'x') ? "0x" : "0X";
+        }
+    }
+    size_t prefixlen = strlen(prefix);
+
+    /* the 0 flag fills the width with zeros unless there is a precision */
+    if (spec->zero && ! spec->left && spec->prec < 0 &&
+        (size_t) spec->width > prefixlen + zeros + len)
+    {
+        zeros = (size_t) spec->width - prefixlen - len;
+    }
+
+    return cruise_format_field(out, spec, prefix, prefixlen, zeros, start, len);
+}
+
+/* parses a decimal field width or precision, returns -1 if it's
+ * unreasonably large */
+static int cruise_format_number(const char** f)
+{
+    int value = 0;
+    while (**f >= '0' && **f <= '9') {
+        value = value * 10 + (**f - '0');
+        if (value > CRUISE_FORMAT_MAX_FIELD) {
+            return -1;
+        }
+        (*f)++;
+    }
+    return value;
+}
+
+int cruise_format(char* buf, size_t size, const char* format, va_list ap)
+{
+    cruise_format_out out;
+    out.p   = buf;
+    out.end = buf + size;
+
+    const char* f = format;
+    while (*f != '\0') {
+        /* copy everything up to the next conversion */
+        if (*f != '%') {
+            const char* next = strchr(f, '%');
+            size_t count = (next != NULL) ? (size_t) (next - f) : strlen(f);
+            if (count > (size_t) (out.end - out.p)) {
+                return -1;
+            }
+            memcpy(out.p, f, count);
+            out.p += count;
+            f += count;
+            continue;
+        }
+        f++;
+
+        if (*f == '%') {
+            if (out.p == out.end) {
+                return -1;
+            }
+            *out.p++ = '%';
+            f++;
+            continue;
+        }
+
+        /* flags */
+        cruise_format_spec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.prec = -1;
+        for (;; f++) {
+            if (*f == '-') {
+                spec.left = 1;
+            } else if (*f == '+') {
+                spec.plus = 1;
+            } else if (*f == ' ') {
+                spec.space = 1;
+            } else if (*f == '0') {
+                spec.zero = 1;
+            } else if (*f == '#') {
+                spec.alt = 1;
+            } else {
+                break;
+            }
+        }
+
+        /* field width, a digit string followed by $ is a positional
+         * argument which we leave to vsnprintf */
+        if (*f == '*') {
+            f++;
+            if (*f >= '0' && *f <= '9') {
+                return -1;
+            }
+            int width = va_arg(ap, int);
+            if (width < 0) {
+                spec.left = 1;
+                if (width < -CRUISE_FORMAT_MAX_FIELD) {
+                    return -1;
+                }
+                width = -width;
+            }
+            if (width > CRUISE_FORMAT_MAX_FIELD) {
+                return -1;
+            }
+            spec.width = width;
+        } else {
+            spec.width = cruise_format_number(&f);
+            if (spec.width < 0 || *f == '$') {
+                return -1;
+            }
+        }
+
+        /* precision, a negative one counts as not given */
+        if (*f == '.') {
+            f++;
+            if (*f == '*') {
+                f++;
+                if (*f >= '0' && *f <= '9') {
+                    return -1;
+                }
+                int prec = va_arg(ap, int);
+                if (prec > CRUISE_FORMAT_MAX_FIELD) {
+                    return -1;
+                }
+                spec.prec = (prec < 0) ? -1 : prec;
+            } else {
+                spec.prec = cruise_format_number(&f);
+                if (spec.prec < 0) {
+                    return -1;
+                }
+            }
+        }
+
+        /* length modifier */
+        char length = '\0';
+        if (*f == 'h') {
+            f++;
+            length = 'h';
+            if (*f == 'h') {
+                f++;
+                length = 'H';
+            }
+        } else if (*f == 'l') {
+            f++;
+            length = 'l';
+            if (*f == 'l') {
+                f++;
+                length = 'q';
+            }
+        } else if (*f == 'z' || *f == 'j' || *f == 't') {
+            length = *f;
+            f++;
+        }
+
+        char conv = *f++;
+        int rc;
+        switch (conv) {
+        case 'd':
+        case 'i':
+        {
+            long long value;
+            switch (length) {
+            case 'H':  value = (signed char) va_arg(ap, int); break;
+            case 'h':  value = (short) va_arg(ap, int);       break;
+            case 'l':  value = va_arg(ap, long);              break;
+            case 'q':  value = va_arg(ap, long long);         break;
+            case 'z':  value = va_arg(ap, ssize_t);           break;
+            case 'j':  value = va_arg(ap, intmax_t);          break;
+            case 't':  value = va_arg(ap, ptrdiff_t);         break;
+            default:   value = va_arg(ap, int);               break;
+            }
+            if (spec.alt) {
+                return -1;
+            }
+            int neg = (value < 0);
+            uint64_t mag = neg ? - (uint64_t) value : (uint64_t) value;
+            rc = cruise_format_integer(&out, &spec, conv, mag, neg);
+            break;
+        }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        {
+            uint64_t value;
+            switch (length) {
+            case 'H':  value = (unsigned char) va_arg(ap, unsigned int);  break;
+            case 'h':  value = (unsigned short) va_arg(ap, unsigned int); break;
+            case 'l':  value = va_arg(ap, unsigned long);                 break;
+            case 'q':  value = va_arg(ap, unsigned long long);            break;
+            case 'z':  value = va_arg(ap, size_t);                        break;
+            case 'j':  value = va_arg(ap, uintmax_t);                     break;
+            case 't':  value = (size_t) va_arg(ap, ptrdiff_t);            break;
+            default:   value = va_arg(ap, unsigned int);                  break;
+            }
+            if (conv == 'u' && spec.alt) {
+                return -1;
+            }
+            rc = cruise_format_integer(&out, &spec, conv, value, 0);
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        {
+            /* %lf is the same as %f, anything else like %Lf is not ours */
+            if (length != '\0' && length != 'l') {
+                return -1;
+            }
+            double value = va_arg(ap, double);
+            rc = cruise_format_double(&out, &spec, conv, value);
+            break;
+        }
+        case 'c':
+        {
+            if (length != '\0' || spec.zero || spec.alt) {
+                return -1;
+            }
+            char c = (char) (unsigned char) va_arg(ap, int);
+            rc = cruise_format_field(&out, &spec, "", 0, 0, &c, 1);
+            break;
+        }
+        case 's':
+        {
+            if (length != '\0' || spec.zero || spec.alt) {
+                return -1;
+            }
+            const char* str = va_arg(ap, const char*);
+            if (str == NULL) {
+                /* let vsnprintf decide how to print a NULL */
+                return -1;
+            }
+            size_t len = (spec.prec >= 0) ? strnlen(str, (size_t) spec.prec) : strlen(str);
+            rc = cruise_format_field(&out, &spec, "", 0, 0, str, len);
+            break;
+        }
+        default:
+            /* %p, %n, %a, %ls, and friends */
+            return -1;
+        }
+
+        if (rc != 0) {
+            return -1;
+        }
+    }
+
+    return (int) (out.p - buf);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+#ifndef CRUISE_FORMAT_H
+#define CRUISE_FORMAT_H
+
+/* implements a printf formatter for the conversions that dominate
+ * text output from applications:
+ *   %d %i %u %o %x %X with hh, h, l, ll, z, j, t lengths
+ *   %f %F %e %E %g %G on finite doubles
+ *   %c %s %%
+ * with flags, width, and precision including '*', output is meant
+ * to match glibc byte for byte, anything else (positional arguments,
+ * long double, wide characters, %p, %n, %a, nan and inf, values too
+ * large for 128-bit arithmetic, ...) is left to vsnprintf */
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/* formats arguments from ap according to format into buf, which has
+ * room for size bytes, does not write a terminating NUL, returns the
+ * number of bytes written, or -1 if format uses a conversion we do
+ * not handle or the output does not fit in size bytes, in which
+ * case the contents of buf are undefined and the caller should
+ * start over with vsnprintf on a fresh copy of its va_list */
+int cruise_format(char* buf, size_t size, const char* format, va_list ap);
+
+#endif /* CRUISE_FORMAT_H */
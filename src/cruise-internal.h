@@ -134,16 +134,21 @@
 #define CRUISE_ERR_BADF   -12
 #define CRUISE_ERR_ISDIR  -13
 #define CRUISE_ERR_NOMEM  -14
+#define CRUISE_ERR_MFILE  -15
 
 #ifndef HAVE_OFF64_T
 typedef int64_t off64_t;
 #endif
 
-/* structure to represent file descriptors */
+/* structure to represent an open file, each open gets its own and
+ * file descriptors made by dup share it */
 typedef struct {
     off_t pos;   /* current file pointer */
     int   read;  /* whether file is opened for read */
     int   write; /* whether file is opened for write */
+    int   fid;   /* file id this was opened on */
+    int   flags; /* access mode and status flags given to open */
+    int   refs;  /* number of file descriptors referring to this */
 } cruise_fd_t;
 
 enum cruise_stream_orientation {
@@ -152,28 +157,56 @@ enum cruise_stream_orientation {
     CRUISE_STREAM_ORIENTATION_WIDE,
 };
 
+/* what the _p pointer of a stream refers to */
+enum cruise_stream_ptr {
+    CRUISE_STREAM_PTR_READ = 0, /* reading from window */
+    CRUISE_STREAM_PTR_WRITE,    /* writing to window */
+    CRUISE_STREAM_PTR_UNGET,    /* reading from push back buffer */
+};
+
 /* structure to represent FILE* streams */
 typedef struct {
+    /* when optimizing, glibc inlines getc_unlocked, putc_unlocked,
+     * feof_unlocked, and the like, which look at these fields where a
+     * glibc FILE keeps them, so they come first in the same layout,
+     * the read and write pointers stay NULL so the inlined code always
+     * calls __uflow or __overflow, and _flags mirrors err and eof */
+    int    _flags;       /* glibc stream flags, only _IO_EOF_SEEN and _IO_ERR_SEEN */
+    char*  _IO_ptrs[6];  /* glibc read and write pointers, always NULL */
+
     int    err;      /* stream error indicator flag */
     int    eof;      /* stream end-of-file indicator flag */
     int    fd;       /* file descriptor associated with stream */
     int    append;   /* whether file is opened in append mode */
     int    orient;   /* stream orientation, CRUISE_STREAM_ORIENTATION_{NULL,BYTE,WIDE} */
 
-    void*  buf;      /* pointer to buffer */
-    int    buffree;  /* whether we need to free buffer */
+    void*  buf;      /* pointer to private buffer */
+    int    buffree;  /* whether buffer comes from our pool */
     int    buftype;  /* _IOFBF fully buffered, _IOLBF line buffered, _IONBF unbuffered */
-    size_t bufsize;  /* size of buffer in bytes */
-    off_t  bufpos;   /* byte offset in file corresponding to start of buffer */
-    size_t buflen;   /* number of bytes active in buffer */
-    size_t bufdirty; /* whether data in buffer needs to be flushed */
+    size_t bufsize;  /* size of stream buffer in bytes */
+    size_t bufalloc; /* size of private buffer in bytes, pool buffers grow up to bufsize */
+    off_t  bufpos;   /* byte offset in file corresponding to start of window */
+    size_t buflen;   /* number of bytes active in window */
+    size_t bufdirty; /* whether data in window needs to be flushed */
+    size_t bufdirtyoff; /* offset in window of first byte to be flushed */
+    size_t bufdirtyend; /* offset in window one past last byte to be flushed */
+
+    unsigned char* win; /* active window, either buf or chunk memory */
+    size_t winsize;     /* capacity of active window in bytes */
+    int    winalias;    /* whether window points directly into chunk memory */
+    int    winwrite;    /* whether aliased chunk memory may take writes */
 
     unsigned char* ubuf; /* ungetc buffer (we store bytes from end) */
     size_t ubufsize;     /* size of ungetc buffer in bytes */
     size_t ubuflen;      /* number of active bytes in buffer */
 
     unsigned char* _p; /* pointer to character in buffer */
-    size_t         _r; /* number of bytes left at pointer */
+    size_t         _r; /* number of bytes left to read at pointer */
+    size_t         _w; /* number of bytes left to write at pointer */
+    int            _mode; /* what _p refers to, CRUISE_STREAM_PTR_{READ,WRITE,UNGET} */
+
+    void* lockowner; /* id of thread holding the stream lock, NULL if free */
+    int   lockcount; /* number of times the owner has taken the lock */
 } cruise_stream_t;
 
 enum flock_enum {
@@ -192,16 +225,38 @@ enum flock_enum {
 #define CHUNK_LOCATION_NULL      0
 #define CHUNK_LOCATION_MEMFS     1
 #define CHUNK_LOCATION_SPILLOVER 2
+#define CHUNK_LOCATION_ZERO      3 /* hole, chunk holds only zeros and has no storage */
+#define CHUNK_LOCATION_PACKED    4 /* compressed into slots of a pack chunk in memory */
+#define CHUNK_LOCATION_SPILLZ    5 /* compressed into slots of a pack chunk in spill over */
+
+/* number of slots a pack chunk is split into, a compressed chunk
+ * takes a run of slots within one pack chunk */
+#define CRUISE_PACK_SLOTS        16
 
 typedef struct {
     int location; /* CHUNK_LOCATION specifies how chunk is stored */
     off_t id;     /* physical id of chunk in its respective storage */
+    unsigned int crc;     /* CRC32C of the first crc_len bytes of the chunk */
+    unsigned int crc_len; /* number of bytes from the start of the chunk the crc covers */
+    unsigned long long epoch; /* epoch of the file in which the chunk was last written, 0 if never */
 } cruise_chunkmeta_t;
 
+/* sharing state of a chunk in memory, several files may point at the
+ * same chunk once dedup found them to hold the same data or one was
+ * cloned from another */
+typedef struct {
+    int refs;   /* number of chunk map entries pointing at the chunk */
+    int hashed; /* whether the chunk is in the dedup index, its data must not change */
+    int next;   /* next chunk in the same bucket of the index, -1 at the end */
+    unsigned long long hash; /* fingerprint of the chunk data while hashed */
+} cruise_chunkref_t;
+
 typedef struct {
     off_t size;                     /* current file size */
+    off_t tail;                     /* end of space claimed by appenders, runs ahead of size while they copy */
     int is_dir;                     /* is this file a directory */
-    pthread_spinlock_t fspinlock;   /* file lock variable */
+    pthread_rwlock_t rwlock;        /* held shared to access data, exclusive to change chunk map */
+    int writers;                    /* number of open files with write access, sealed when 0 */
     enum flock_enum flock_status;   /* file lock status */
 
     int storage;                    /* FILE_STORAGE specifies file data management */
@@ -209,6 +264,11 @@ typedef struct {
     off_t chunks;                   /* number of chunks allocated to file */
     cruise_chunkmeta_t* chunk_meta; /* meta data for chunks */
 
+    int pins;                       /* number of read views holding chunks of this file */
+    int unlinked;                   /* file was unlinked while pinned, free on last release */
+    int shared;                     /* file was cloned to or from, its chunks may be shared */
+    unsigned long long epoch;       /* current epoch, writes mark the chunks they touch with it */
+
 } cruise_filemeta_t;
 
 /* path to fid lookup struct */
@@ -225,6 +285,12 @@ typedef struct {
 /* TODO: move common includes to another file */
 #include "cruise.h"
 #include "cruise-stack.h"
+#include "cruise-bufpool.h"
+#include "cruise-copypool.h"
+#include "cruise-compress.h"
+#include "cruise-crc32c.h"
+#include "cruise-memcpy.h"
+#include "cruise-format.h"
 #include "cruise-fixed.h"
 #include "cruise-sysio.h"
 #include "cruise-stdio.h"
@@ -243,8 +309,9 @@ extern cruise_filename_t* cruise_filelist;
 extern char*  cruise_mount_prefix;
 extern size_t cruise_mount_prefixlen;
 
-/* array of file descriptors */
+/* array of open files and map from file descriptor to open file */
 extern cruise_fd_t cruise_fds[CRUISE_MAX_FILEDESCS];
+extern int cruise_fd_files[CRUISE_MAX_FILEDESCS];
 extern rlim_t cruise_fd_limit;
 
 /* array of file streams */
@@ -252,6 +319,13 @@ extern cruise_stream_t cruise_streams[CRUISE_MAX_FILEDESCS];
 
 extern int cruise_use_memfs;
 extern int cruise_use_spillover;
+extern int cruise_zero_chunks; /* whether whole chunks of zeros are kept as holes */
+extern int cruise_compress_chunks; /* whether chunks of closed files are compressed when memory runs low */
+extern int cruise_compress_free;   /* number of free memory chunks below which the packer runs */
+extern int cruise_compress_spillover; /* whether whole chunks are compressed on their way to spill over */
+extern int cruise_dedup_chunks; /* whether full chunks of closed files are shared with identical chunks */
+extern int cruise_checksum_chunks; /* whether a CRC32C of each chunk follows the writes to it */
+extern int cruise_checksum_verify; /* whether reads and fsync check the data against the chunk checksums */
 
 extern int    cruise_max_files;  /* maximum number of files to store */
 extern size_t cruise_chunk_mem;  /* number of bytes in memory to be used for chunk storage */
@@ -261,6 +335,10 @@ extern off_t  cruise_chunk_mask; /* mask applied to logical offset to determine
 extern int    cruise_max_chunks; /* maximum number of chunks that fit in memory */
 
 extern void* free_chunk_stack;
+extern unsigned int* cruise_pack_map; /* slots in use of each memory chunk, for pack chunks */
+extern unsigned int* cruise_spill_pack_map; /* same for each spill over chunk */
+extern cruise_chunkref_t* cruise_chunk_refs; /* sharing state of each memory chunk */
+extern int* cruise_dedup_index; /* first chunk in each bucket of the dedup index, -1 if empty */
 extern void* free_spillchunk_stack;
 extern char* cruise_chunks;
 int cruise_spilloverblock;
@@ -306,9 +384,28 @@ int cruise_get_fid_from_path(const char* path);
 int cruise_get_fid_from_fd(int fd);
 
 /* return address of file descriptor structure or NULL if fd is out
- * of range */
+ * of range or not open */
 cruise_fd_t* cruise_get_filedesc_from_fd(int fd);
 
+/* allocate a file descriptor with its own file pointer set to pos
+ * for file id fid opened with flags, fills outfd with the descriptor,
+ * returns CRUISE_ERR_MFILE if all descriptors are in use */
+int cruise_fd_alloc(int fid, int flags, off_t pos, int* outfd);
+
+/* allocate a file descriptor referring to the same open file as fd,
+ * takes the lowest free descriptor at or above minfd, fills outfd
+ * with the descriptor, returns CRUISE error code */
+int cruise_fd_dup(int fd, int minfd, int* outfd);
+
+/* make newfd refer to the same open file as fd, closing newfd first
+ * if it's open, returns CRUISE error code */
+int cruise_fd_dup2(int fd, int newfd);
+
+/* close file descriptor, closes its file id once the last
+ * descriptor referring to the open file is gone, returns CRUISE
+ * error code */
+int cruise_fd_free(int fd);
+
 /* given a file id, return a pointer to the meta data,
  * otherwise return NULL */
 inline cruise_filemeta_t* cruise_get_meta_from_fid(int fid);
@@ -332,6 +429,79 @@ int cruise_fid_is_dir_empty(const char * path);
 /* return current size of given file id */
 off_t cruise_fid_size(int fid);
 
+/* return number of bytes of storage reserved for given file id,
+ * writes that end within this need no new chunks */
+off_t cruise_fid_reserved(int fid);
+
+/* returns 1 if count bytes at pos in file id can be written while
+ * holding the file lock shared */
+int cruise_fid_write_shared(int fid, off_t pos, off_t count);
+
+/* compress chunks of closed files until at least want memory chunks
+ * are free, returns the number of chunks freed */
+int cruise_fid_reclaim(int want);
+
+/* share full chunks of file id with identical chunks of other files
+ * once it is sealed, returns the number of memory chunks freed */
+int cruise_fid_dedup(int fid);
+
+/* fills crcs with the CRC32C of the data in each chunk of file id, at
+ * most max entries, and size with the file size they cover, returns
+ * the number of chunks holding data */
+int cruise_fid_checksums(int fid, unsigned int* crcs, int max, off_t* size);
+
+/* checks the data of file id against its chunk checksums, returns
+ * CRUISE_ERR_IO on a mismatch */
+int cruise_fid_verify(int fid);
+
+/* clone up to count bytes at src_pos of file src_fid to dst_pos of
+ * file dst_fid, sharing whole chunks until either file writes to
+ * them, sets outcount to the number of bytes cloned */
+int cruise_fid_clone(int src_fid, off_t src_pos, int dst_fid, off_t dst_pos, off_t count, off_t* outcount);
+
+/* fills ranges with the ranges of file id written in epoch since or
+ * later, at most max entries, and epoch with the current epoch,
+ * returns the number of ranges */
+int cruise_fid_dirty(int fid, unsigned long long since, cruise_range_t* ranges, int max, unsigned long long* epoch);
+
+/* starts a new epoch for file id and sets epoch to it */
+int cruise_fid_dirty_clear(int fid, unsigned long long* epoch);
+
+/* marks the chunks holding count bytes at pos of file id as written
+ * in its current epoch, for data that went into chunk memory without
+ * going through a write */
+int cruise_fid_dirty_mark(int fid, off_t pos, off_t count);
+
+/* lock file id shared, held to read or write data that lies within
+ * the reserved space of the file */
+int cruise_fid_rdlock(int fid);
+
+/* lock file id exclusive, held to change the chunks of the file or
+ * to zero fill a gap before writing past the end */
+int cruise_fid_wrlock(int fid);
+
+/* release the lock on file id taken with rdlock or wrlock */
+int cruise_fid_unlock(int fid);
+
+/* returns 1 if the file is sealed, which is when no open file has
+ * write access to it, and 0 otherwise */
+int cruise_fid_is_sealed(int fid);
+
+/* claim count bytes at the end of file id for an append, caller
+ * holds the file lock shared, concurrent appenders get disjoint
+ * ranges, sets outpos to the start of our range, returns
+ * CRUISE_ERR_NOSPC if the range would run past the reserved space,
+ * in which case the caller should take the lock exclusive and
+ * extend the file instead */
+int cruise_fid_append_reserve(int fid, off_t count, off_t* outpos);
+
+/* gives back the range of count bytes at pos that an append claimed
+ * with cruise_fid_append_reserve but failed to write, returns 1 if the
+ * tail moved back and 0 if a later append claimed space after it, in
+ * which case the range stays part of the file and the caller must
+ * fill it */
+int cruise_fid_append_cancel(int fid, off_t pos, off_t count);
+
 /* fill in limited amount of stat information */
 int cruise_fid_stat(int fid, struct stat* buf);
 
@@ -360,13 +530,22 @@ int cruise_fid_read(int fid, off_t pos, void* buf, size_t count);
  * be extended before calling this routine */
 int cruise_fid_write(int fid, off_t pos, const void* buf, size_t count);
 
+/* read count bytes from file starting from pos into the buffers of
+ * iov in order, all bytes are assumed to exist */
+int cruise_fid_readv(int fid, off_t pos, const struct iovec* iov, int iovcnt, size_t count);
+
+/* write count bytes from the buffers of iov in order into file
+ * starting at offset pos, all bytes are assumed to be allocated */
+int cruise_fid_writev(int fid, off_t pos, const struct iovec* iov, int iovcnt, size_t count);
+
 /* given a file id, write zero bytes to region of specified offset
  * and length, assumes space is already reserved */
 int cruise_fid_write_zero(int fid, off_t pos, off_t count);
 
 /* increase size of file if length is greater than current size,
  * and allocate additional chunks as needed to reserve space for
- * length bytes */
+ * length bytes, caller holds the file lock exclusive unless the
+ * space is already reserved */
 int cruise_fid_extend(int fid, off_t length);
 
 /* truncate file id to given length, frees resources if length is
@@ -384,4 +563,22 @@ int cruise_fid_close(int fid);
 /* delete a file id and return file its resources to free pools */
 int cruise_fid_unlink(int fid);
 
+/* pin file id so that its chunks are not freed by truncate or unlink */
+int cruise_fid_pin(int fid);
+
+/* drop a pin on file id, releases any chunks that were truncated or
+ * unlinked while the file was pinned */
+int cruise_fid_unpin(int fid);
+
+/* fill in iov with pointers to file data for count bytes starting at
+ * pos, data held outside of memory is staged in a buffer returned in
+ * staged, all bytes are assumed to exist */
+int cruise_fid_view(int fid, off_t pos, size_t count, struct iovec* iov, int* iovcnt, void** staged);
+
+/* reserve space for the chunk holding pos and return a pointer to its
+ * memory in chunkbuf and the file offset of its first byte in chunkpos,
+ * does not change the file size, returns CRUISE_ERR_IO if the chunk
+ * is not held in memory */
+int cruise_fid_chunk_map(int fid, off_t pos, int write, void** chunkbuf, off_t* chunkpos);
+
 #endif /* CRUISE_INTERNAL_H */
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+/* implements the chunk copy kernels, each streaming kernel copies
+ * with memcpy up to the first destination address aligned to its
+ * vector width, moves four vectors per iteration with unaligned loads
+ * and non-temporal stores, fences so the stores are visible before we
+ * return, and copies the tail with memcpy, the kernels are compiled
+ * with target attributes so the library itself needs no special
+ * flags, and processors without x86 vector units just use memcpy */
+
+#include "cruise-runtime-config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRUISE_MEMCPY_X86
+#include <immintrin.h>
+#endif
+
+#include "cruise-memcpy.h"
+
+typedef void* (*cruise_memcpy_fn)(void*, const void*, size_t);
+typedef int (*cruise_memcpy_zero_fn)(const void*, size_t);
+typedef void (*cruise_memcpy_hash_fn)(uint64_t*, const char*, size_t);
+
+/* keys xored into the four lanes of the fingerprint, each 32 bytes of
+ * data feed one 64 bit word into each lane, which adds the word and
+ * the product of the two halves of the word xor its key, the vector
+ * kernels compute exactly what the word loop does, so a fingerprint
+ * doesn't depend on which kernel a process picked */
+static const uint64_t cruise_memcpy_hash_keys[4] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+    0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+};
+
+/* fold n bytes, a multiple of 32, into the lanes a word at a time */
+static void cruise_memcpy_hash_words(uint64_t* acc, const char* p, size_t n)
+{
+    while (n >= 32) {
+        int lane;
+        for (lane = 0; lane < 4; lane++) {
+            uint64_t v;
+            memcpy(&v, p + lane * sizeof(v), sizeof(v));
+            uint64_t k = v ^ cruise_memcpy_hash_keys[lane];
+            acc[lane] += v + (k & 0xffffffffULL) * (k >> 32);
+        }
+        p += 32;
+        n -= 32;
+    }
+}
+
+/* mix the bits of a lane so each one moves all the others */
+static inline uint64_t cruise_memcpy_hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* check for zeros a word at a time */
+static int cruise_memcpy_zero_words(const void* buf, size_t n)
+{
+    const char* p = (const char*) buf;
+    while (n >= sizeof(uint64_t)) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        if (v != 0) {
+            return 0;
+        }
+        p += sizeof(v);
+        n -= sizeof(v);
+    }
+    while (n > 0) {
+        if (*p != 0) {
+            return 0;
+        }
+        p++;
+        n--;
+    }
+    return 1;
+}
+
+/* kernel for large writes and the size at which we use it */
+static cruise_memcpy_fn cruise_memcpy_stream = memcpy;
+static const char* cruise_memcpy_name = "memcpy";
+static size_t cruise_memcpy_stream_min = (size_t) -1;
+
+/* kernel to check for zeros */
+static cruise_memcpy_zero_fn cruise_memcpy_zero = cruise_memcpy_zero_words;
+
+/* kernel to fingerprint chunks */
+static cruise_memcpy_hash_fn cruise_memcpy_hash_kernel = cruise_memcpy_hash_words;
+
+#ifdef CRUISE_MEMCPY_X86
+
+/* copy up to the first byte of dst aligned to align bytes, advances
+ * the pointers and count past what we copied */
+static inline void cruise_memcpy_head(char** d, const char** s, size_t* n, size_t align)
+{
+    size_t head = (size_t) (-(uintptr_t) *d) & (align - 1);
+    if (head > *n) {
+        head = *n;
+    }
+    memcpy(*d, *s, head);
+    *d += head;
+    *s += head;
+    *n -= head;
+}
+
+__attribute__((target("sse2")))
+static void* cruise_memcpy_sse2(void* dst, const void* src, size_t n)
+{
+    char* d = (char*) dst;
+    const char* s = (const char*) src;
+    cruise_memcpy_head(&d, &s, &n, 16);
+
+    while (n >= 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (s +  0));
+        __m128i b = _mm_loadu_si128((const __m128i*) (s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*) (s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*) (s + 48));
+        _mm_stream_si128((__m128i*) (d +  0), a);
+        _mm_stream_si128((__m128i*) (d + 16), b);
+        _mm_stream_si128((__m128i*) (d + 32), c);
+        _mm_stream_si128((__m128i*) (d + 48), e);
+        d += 64;
+        s += 64;
+        n -= 64;
+    }
+    _mm_sfence();
+
+    memcpy(d, s, n);
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void* cruise_memcpy_avx2(void* dst, const void* src, size_t n)
+{
+    char* d = (char*) dst;
+    const char* s = (const char*) src;
+    cruise_memcpy_head(&d, &s, &n, 32);
+
+    while (n >= 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (s +  0));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*) (s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i*) (s + 96));
+        _mm256_stream_si256((__m256i*) (d +  0), a);
+        _mm256_stream_si256((__m256i*) (d + 32), b);
+        _mm256_stream_si256((__m256i*) (d + 64), c);
+        _mm256_stream_si256((__m256i*) (d + 96), e);
+        d += 128;
+        s += 128;
+        n -= 128;
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+
+    memcpy(d, s, n);
+    return dst;
+}
+
+__attribute__((target("avx512f")))
+static void* cruise_memcpy_avx512(void* dst, const void* src, size_t n)
+{
+    char* d = (char*) dst;
+    const char* s = (const char*) src;
+    cruise_memcpy_head(&d, &s, &n, 64);
+
+    while (n >= 256) {
+        __m512i a = _mm512_loadu_si512((const void*) (s +   0));
+        __m512i b = _mm512_loadu_si512((const void*) (s +  64));
+        __m512i c = _mm512_loadu_si512((const void*) (s + 128));
+        __m512i e = _mm512_loadu_si512((const void*) (s + 192));
+        _mm512_stream_si512((__m512i*) (d +   0), a);
+        _mm512_stream_si512((__m512i*) (d +  64), b);
+        _mm512_stream_si512((__m512i*) (d + 128), c);
+        _mm512_stream_si512((__m512i*) (d + 192), e);
+        d += 256;
+        s += 256;
+        n -= 256;
+    }
+    _mm_sfence();
+    _mm256_zeroupper();
+
+    memcpy(d, s, n);
+    return dst;
+}
+
+/* or four vectors together and test them at once, the loads are
+ * aligned to the vector width after a word by word head */
+__attribute__((target("sse4.1")))
+static int cruise_memcpy_zero_sse41(const void* buf, size_t n)
+{
+    const char* p = (const char*) buf;
+    size_t head = (size_t) (-(uintptr_t) p) & 15;
+    if (head > n) {
+        head = n;
+    }
+    if (! cruise_memcpy_zero_words(p, head)) {
+        return 0;
+    }
+    p += head;
+    n -= head;
+
+    while (n >= 64) {
+        __m128i a = _mm_load_si128((const __m128i*) (p +  0));
+        __m128i b = _mm_load_si128((const __m128i*) (p + 16));
+        __m128i c = _mm_load_si128((const __m128i*) (p + 32));
+        __m128i e = _mm_load_si128((const __m128i*) (p + 48));
+        __m128i v = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, e));
+        if (! _mm_testz_si128(v, v)) {
+            return 0;
+        }
+        p += 64;
+        n -= 64;
+    }
+
+    return cruise_memcpy_zero_words(p, n);
+}
+
+__attribute__((target("avx2")))
+static int cruise_memcpy_zero_avx2(const void* buf, size_t n)
+{
+    const char* p = (const char*) buf;
+    size_t head = (size_t) (-(uintptr_t) p) & 31;
+    if (head > n) {
+        head = n;
+    }
+    if (! cruise_memcpy_zero_words(p, head)) {
+        return 0;
+    }
+    p += head;
+    n -= head;
+
+    int zero = 1;
+    while (n >= 128) {
+        __m256i a = _mm256_load_si256((const __m256i*) (p +  0));
+        __m256i b = _mm256_load_si256((const __m256i*) (p + 32));
+        __m256i c = _mm256_load_si256((const __m256i*) (p + 64));
+        __m256i e = _mm256_load_si256((const __m256i*) (p + 96));
+        __m256i v = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, e));
+        if (! _mm256_testz_si256(v, v)) {
+            zero = 0;
+            break;
+        }
+        p += 128;
+        n -= 128;
+    }
+    _mm256_zeroupper();
+
+    return zero && cruise_memcpy_zero_words(p, n);
+}
+
+__attribute__((target("sse2")))
+static void cruise_memcpy_hash_sse2(uint64_t* acc, const char* p, size_t n)
+{
+    __m128i lo = _mm_loadu_si128((const __m128i*) (acc + 0));
+    __m128i hi = _mm_loadu_si128((const __m128i*) (acc + 2));
+    const __m128i klo = _mm_loadu_si128((const __m128i*) (cruise_memcpy_hash_keys + 0));
+    const __m128i khi = _mm_loadu_si128((const __m128i*) (cruise_memcpy_hash_keys + 2));
+    while (n >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (p +  0));
+        __m128i b = _mm_loadu_si128((const __m128i*) (p + 16));
+        __m128i ka = _mm_xor_si128(a, klo);
+        __m128i kb = _mm_xor_si128(b, khi);
+        ka = _mm_mul_epu32(ka, _mm_srli_epi64(ka, 32));
+        kb = _mm_mul_epu32(kb, _mm_srli_epi64(kb, 32));
+        lo = _mm_add_epi64(lo, _mm_add_epi64(a, ka));
+        hi = _mm_add_epi64(hi, _mm_add_epi64(b, kb));
+        p += 32;
+        n -= 32;
+    }
+    _mm_storeu_si128((__m128i*) (acc + 0), lo);
+    _mm_storeu_si128((__m128i*) (acc + 2), hi);
+}
+
+__attribute__((target("avx2")))
+static void cruise_memcpy_hash_avx2(uint64_t* acc, const char* p, size_t n)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i*) acc);
+    const __m256i k = _mm256_loadu_si256((const __m256i*) cruise_memcpy_hash_keys);
+    while (n >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) p);
+        __m256i ka = _mm256_xor_si256(a, k);
+        ka = _mm256_mul_epu32(ka, _mm256_srli_epi64(ka, 32));
+        v = _mm256_add_epi64(v, _mm256_add_epi64(a, ka));
+        p += 32;
+        n -= 32;
+    }
+    _mm256_storeu_si256((__m256i*) acc, v);
+    _mm256_zeroupper();
+}
+
+#endif /* CRUISE_MEMCPY_X86 */
+
+/* selects the kernel for large writes, kernel is one of "auto",
+ * "memcpy", "sse2", "avx2", or "avx512", a kernel the processor
+ * doesn't support or NULL means "auto", writes of at least
+ * stream_min bytes use the kernel */
+void cruise_memcpy_init(const char* kernel, size_t stream_min)
+{
+    cruise_memcpy_stream     = memcpy;
+    cruise_memcpy_name       = "memcpy";
+    cruise_memcpy_stream_min = stream_min;
+    cruise_memcpy_zero       = cruise_memcpy_zero_words;
+    cruise_memcpy_hash_kernel = cruise_memcpy_hash_words;
+
+#ifdef CRUISE_MEMCPY_X86
+    __builtin_cpu_init();
+
+    /* checking for zeros and fingerprinting only read, so they
+     * always take the widest vectors we have */
+    if (__builtin_cpu_supports("avx2")) {
+        cruise_memcpy_zero = cruise_memcpy_zero_avx2;
+        cruise_memcpy_hash_kernel = cruise_memcpy_hash_avx2;
+    } else {
+        if (__builtin_cpu_supports("sse4.1")) {
+            cruise_memcpy_zero = cruise_memcpy_zero_sse41;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            cruise_memcpy_hash_kernel = cruise_memcpy_hash_sse2;
+        }
+    }
+#endif
+
+    if (kernel != NULL && strcmp(kernel, "memcpy") == 0) {
+        return;
+    }
+
+#ifdef CRUISE_MEMCPY_X86
+    int avx512 = __builtin_cpu_supports("avx512f");
+    int avx2   = __builtin_cpu_supports("avx2");
+    int sse2   = __builtin_cpu_supports("sse2");
+
+    /* honor an explicit request if we can */
+    if (kernel != NULL) {
+        if (strcmp(kernel, "avx512") == 0 && avx512) {
+            avx2 = sse2 = 0;
+        } else if (strcmp(kernel, "avx2") == 0 && avx2) {
+            avx512 = sse2 = 0;
+        } else if (strcmp(kernel, "sse2") == 0 && sse2) {
+            avx512 = avx2 = 0;
+        }
+    }
+
+    /* otherwise take the widest we have */
+    if (avx512) {
+        cruise_memcpy_stream = cruise_memcpy_avx512;
+        cruise_memcpy_name   = "avx512";
+    } else if (avx2) {
+        cruise_memcpy_stream = cruise_memcpy_avx2;
+        cruise_memcpy_name   = "avx2";
+    } else if (sse2) {
+        cruise_memcpy_stream = cruise_memcpy_sse2;
+        cruise_memcpy_name   = "sse2";
+    }
+#endif
+}
+
+/* returns the name of the kernel used for large writes */
+const char* cruise_memcpy_kernel(void)
+{
+    return cruise_memcpy_name;
+}
+
+/* copies count bytes from a user buffer into chunk memory */
+void* cruise_memcpy_write(void* dst, const void* src, size_t count)
+{
+    if (count >= cruise_memcpy_stream_min) {
+        return cruise_memcpy_stream(dst, src, count);
+    }
+    return memcpy(dst, src, count);
+}
+
+/* copies count bytes from chunk memory into a user buffer */
+void* cruise_memcpy_read(void* dst, const void* src, size_t count)
+{
+    return memcpy(dst, src, count);
+}
+
+/* returns 1 if all count bytes at buf are zero and 0 otherwise */
+int cruise_memcpy_is_zero(const void* buf, size_t count)
+{
+    return cruise_memcpy_zero(buf, count);
+}
+
+/* returns a 64 bit fingerprint of the count bytes at buf */
+unsigned long long cruise_memcpy_hash(const void* buf, size_t count)
+{
+    uint64_t acc[4] = {
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+        0x165667b19e3779f9ULL, 0x27d4eb2f165667c5ULL,
+    };
+
+    /* whole blocks go through the kernel, the tail is padded with
+     * zeros to a block, the length below tells the two apart */
+    const char* p = (const char*) buf;
+    size_t body = count & ~(size_t) 31;
+    cruise_memcpy_hash_kernel(acc, p, body);
+    if (body < count) {
+        char tail[32] = {0};
+        memcpy(tail, p + body, count - body);
+        cruise_memcpy_hash_words(acc, tail, sizeof(tail));
+    }
+
+    uint64_t h = (uint64_t) count * 0x9e3779b97f4a7c15ULL;
+    int lane;
+    for (lane = 0; lane < 4; lane++) {
+        h = (h ^ cruise_memcpy_hash_mix(acc[lane])) * 0xc2b2ae3d27d4eb4fULL;
+        h = (h << 31) | (h >> 33);
+    }
+    return (unsigned long long) cruise_memcpy_hash_mix(h);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2014, Lawrence Livermore National Security, LLC.
+ * Produced at the Lawrence Livermore National Laboratory.
+ * Written by
+ *   Raghunath Rajachandrasekar <rajachan@cse.ohio-state.edu>
+ *   Kathryn Mohror <kathryn@llnl.gov>
+ *   Adam Moody <moody20@llnl.gov>
+ * LLNL-CODE-642432.
+ * All rights reserved.
+ * This file is part of CRUISE.
+ * For details, see https://github.com/hpc/cruise
+ * Please also read this file COPYRIGHT
+*/
+
+#ifndef CRUISE_MEMCPY_H
+#define CRUISE_MEMCPY_H
+
+/* implements the copies between user buffers and chunk memory, data
+ * written to a file is usually not read again for a long time, so
+ * large writes use non-temporal stores that go around the caches
+ * instead of evicting the application's working set, the kernel is
+ * picked at mount time from the best the processor supports (AVX-512,
+ * AVX2, or SSE2), reads and small writes use plain memcpy since the
+ * data is likely to be used again soon, a vector kernel picked the
+ * same way checks whether a buffer holds only zeros, and another
+ * fingerprints chunks for dedup */
+
+#include <stddef.h>
+
+/* selects the kernel for large writes, kernel is one of "auto",
+ * "memcpy", "sse2", "avx2", or "avx512", a kernel the processor
+ * doesn't support or NULL means "auto", writes of at least
+ * stream_min bytes use the kernel */
+void cruise_memcpy_init(const char* kernel, size_t stream_min);
+
+/* returns the name of the kernel used for large writes */
+const char* cruise_memcpy_kernel(void);
+
+/* copies count bytes from a user buffer into chunk memory */
+void* cruise_memcpy_write(void* dst, const void* src, size_t count);
+
+/* copies count bytes from chunk memory into a user buffer */
+void* cruise_memcpy_read(void* dst, const void* src, size_t count);
+
+/* returns 1 if all count bytes at buf are zero and 0 otherwise, stops
+ * at the first nonzero vector so data that isn't zero costs little */
+int cruise_memcpy_is_zero(const void* buf, size_t count);
+
+/* returns a 64 bit fingerprint of the count bytes at buf, equal data
+ * always gets equal fingerprints, whichever kernel computed them, but
+ * different data may too, so callers compare the bytes on a match */
+unsigned long long cruise_memcpy_hash(const void* buf, size_t count);
+
+#endif /* CRUISE_MEMCPY_H */
@@ -89,3 +89,32 @@ void cruise_stack_push(void* start, int value)
     /* freed one too many */
   }
 }
+
+/* returns number of items on the stack */
+int cruise_stack_count(void* start)
+{
+  cruise_stack* stack = (cruise_stack*) start;
+  return stack->last;
+}
+
+/* removes a particular item from stack, returns 0 if found and -1
+ * otherwise, takes time linear in the number of items on the stack */
+int cruise_stack_remove(void* start, int value)
+{
+  cruise_stack* stack = (cruise_stack*) start;
+  int* entries = (int*) ((char*)start + sizeof(cruise_stack));
+
+  /* search from the top since recently freed items are found there */
+  int idx;
+  for (idx = stack->last - 1; idx >= 0; idx--) {
+    if (entries[idx] == value) {
+      /* move the item at the top of the stack into its slot */
+      stack->last--;
+      entries[idx] = entries[stack->last];
+      return 0;
+    }
+  }
+
+  /* item is not on the stack */
+  return -1;
+}
@@ -44,4 +44,11 @@ int cruise_stack_pop(void* start);
 /* pushes item onto free stack */
 void cruise_stack_push(void* start, int value);
 
+/* returns number of items on the stack */
+int cruise_stack_count(void* start);
+
+/* removes a particular item from stack, returns 0 if found and -1
+ * otherwise, takes time linear in the number of items on the stack */
+int cruise_stack_remove(void* start, int value);
+
 #endif /* CRUISE_STACK_H */
@@ -33,10 +33,15 @@
 #include <limits.h>
 #define __USE_GNU
 #include <pthread.h>
+#include <sched.h>
 #include "cruise-internal.h"
 
 static int cruise_fpos_enabled = 1; /* whether we can use fgetpos/fsetpos */
 
+/* glibc defines these as macros when optimizing, we need the functions */
+#undef fread_unlocked
+#undef fwrite_unlocked
+
 /* ---------------------------------------
  * POSIX wrappers: file streams
  * --------------------------------------- */
@@ -46,8 +51,8 @@ static int cruise_fpos_enabled = 1; /* whether we can use fgetpos/fsetpos */
  *  - does not support wide cahracter formatting
  *  - hard coded to use U.S. Locale (decimal point)
  *  - if putc/getc are macros we can't wrap them
- *  - streams are not locked
- *    http://www.gnu.org/software/libc/manual/html_node/Streams-and-Threads.html#Streams-and-Threads
+ *  - *_unlocked calls that glibc inlines into the application when
+ *    optimizing read the FILE structure directly and bypass us
  *  - does not handle %as like GNU C */
 
 /*
@@ -83,12 +88,33 @@ CRUISE_DECL(vfscanf,  int, (FILE* stream, const char* format, va_list ap));
 
 CRUISE_DECL(fgetc,  int,   (FILE *stream));
 CRUISE_DECL(fgets,  char*, (char* s, int n, FILE* stream));
+CRUISE_DECL(getline,  ssize_t, (char** lineptr, size_t* n, FILE* stream));
+CRUISE_DECL(getdelim, ssize_t, (char** lineptr, size_t* n, int delim, FILE* stream));
+CRUISE_DECL(__getdelim, ssize_t, (char** lineptr, size_t* n, int delim, FILE* stream));
 CRUISE_DECL(fputc,  int,   (int c, FILE *stream));
 CRUISE_DECL(fputs,  int,   (const char* s, FILE* stream));
 CRUISE_DECL(getc,   int,   (FILE *stream));
 CRUISE_DECL(putc,   int,   (int c, FILE *stream));
 CRUISE_DECL(ungetc, int,   (int c, FILE *stream));
 
+CRUISE_DECL(flockfile,    void, (FILE *stream));
+CRUISE_DECL(ftrylockfile, int,  (FILE *stream));
+CRUISE_DECL(funlockfile,  void, (FILE *stream));
+
+CRUISE_DECL(fgetc_unlocked,    int,    (FILE *stream));
+CRUISE_DECL(fgets_unlocked,    char*,  (char* s, int n, FILE* stream));
+CRUISE_DECL(fputc_unlocked,    int,    (int c, FILE *stream));
+CRUISE_DECL(fputs_unlocked,    int,    (const char* s, FILE* stream));
+CRUISE_DECL(getc_unlocked,     int,    (FILE *stream));
+CRUISE_DECL(putc_unlocked,     int,    (int c, FILE *stream));
+CRUISE_DECL(fread_unlocked,    size_t, (void *ptr, size_t size, size_t nitems, FILE *stream));
+CRUISE_DECL(fwrite_unlocked,   size_t, (const void *ptr, size_t size, size_t nitems, FILE *stream));
+CRUISE_DECL(fflush_unlocked,   int,    (FILE *stream));
+CRUISE_DECL(clearerr_unlocked, void,   (FILE *stream));
+CRUISE_DECL(feof_unlocked,     int,    (FILE *stream));
+CRUISE_DECL(ferror_unlocked,   int,    (FILE *stream));
+CRUISE_DECL(fileno_unlocked,   int,    (FILE *stream));
+
 CRUISE_DECL(fread,  size_t, (void *ptr, size_t size, size_t nitems, FILE *stream));
 CRUISE_DECL(fwrite, size_t, (const void *ptr, size_t size, size_t nitems, FILE *stream));
 
@@ -121,6 +147,40 @@ CRUISE_DECL(getwc,     wint_t,   (FILE *stream));
 CRUISE_DECL(putwc,     wint_t,   (wchar_t c, FILE *stream));
 CRUISE_DECL(ungetwc,   wint_t,   (wint_t c, FILE *stream));
 
+CRUISE_DECL(__uflow,    int, (FILE *stream));
+CRUISE_DECL(__overflow, int, (FILE *stream, int c));
+
+#ifndef _IO_EOF_SEEN
+#define _IO_EOF_SEEN 0x0010
+#endif
+#ifndef _IO_ERR_SEEN
+#define _IO_ERR_SEEN 0x0020
+#endif
+
+/* set or clear the error indicator of a stream, glibc's inlined
+ * ferror_unlocked reads it from _flags */
+static inline void cruise_stream_set_err(cruise_stream_t* s, int err)
+{
+    s->err = err;
+    if (err) {
+        s->_flags |= _IO_ERR_SEEN;
+    } else {
+        s->_flags &= ~_IO_ERR_SEEN;
+    }
+}
+
+/* set or clear the end-of-file indicator of a stream, glibc's
+ * inlined feof_unlocked reads it from _flags */
+static inline void cruise_stream_set_eof(cruise_stream_t* s, int eof)
+{
+    s->eof = eof;
+    if (eof) {
+        s->_flags |= _IO_EOF_SEEN;
+    } else {
+        s->_flags &= ~_IO_EOF_SEEN;
+    }
+}
+
 /* given a stream, return file name or NULL if invalid */
 static const char* cruise_stream_name(FILE* fp)
 {
@@ -212,41 +272,216 @@ static int cruise_stream_free(int sid)
 }
 #endif
 
-static int cruise_stream_set_pointers(cruise_stream_t* s)
+/* each thread uses the address of its copy as its lock owner id,
+ * the initial-exec model turns the lookup into a single load instead
+ * of a call to __tls_get_addr */
+static __thread char cruise_stream_thread __attribute__((tls_model("initial-exec")));
+
+/* glibc 2.32 and later clear this when a second thread starts, until
+ * then stream locks can be taken without atomic instructions, older
+ * libraries leave the weak reference NULL */
+extern char __libc_single_threaded __attribute__((weak));
+
+/* returns 1 if the process is known to have only one thread */
+static inline int cruise_stream_single_threaded(void)
+{
+    return (&__libc_single_threaded != NULL && __libc_single_threaded);
+}
+
+/* acquire lock on stream, the lock is recursive so that a thread
+ * holding it through flockfile can still call locking functions,
+ * taking a free lock costs a single compare-and-swap, or two plain
+ * stores while the process has only one thread */
+static inline void cruise_stream_lock(FILE* stream)
+{
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* nothing to wait for if we hold it already */
+    void* self = &cruise_stream_thread;
+    if (s->lockowner == self) {
+        s->lockcount++;
+        return;
+    }
+
+    /* no one to race with if we're the only thread */
+    if (cruise_stream_single_threaded() && s->lockowner == NULL) {
+        s->lockowner = self;
+        s->lockcount = 1;
+        return;
+    }
+
+    /* spin for a while, then let the owner run */
+    int spins = 0;
+    while (! __sync_bool_compare_and_swap(&s->lockowner, NULL, self)) {
+        spins++;
+        if (spins == CRUISE_STREAM_LOCK_SPINS) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+    s->lockcount = 1;
+}
+
+/* acquire lock on stream if it's free or we hold it already,
+ * returns 1 if we got it and 0 otherwise */
+static int cruise_stream_trylock(FILE* stream)
+{
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    void* self = &cruise_stream_thread;
+    if (s->lockowner == self) {
+        s->lockcount++;
+        return 1;
+    }
+
+    if (! __sync_bool_compare_and_swap(&s->lockowner, NULL, self)) {
+        return 0;
+    }
+    s->lockcount = 1;
+    return 1;
+}
+
+/* release one hold on the stream lock, caller must hold it */
+static inline void cruise_stream_unlock(FILE* stream)
+{
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    s->lockcount--;
+    if (s->lockcount == 0) {
+        if (cruise_stream_single_threaded()) {
+            s->lockowner = NULL;
+        } else {
+            __sync_lock_release(&s->lockowner);
+        }
+    }
+}
+
+/* commit bytes read or written through the _p pointer to the file
+ * position and close the pointer window, must be called before
+ * anything looks at the file position of the stream */
+static void cruise_stream_sync(cruise_stream_t* s)
+{
+    /* nothing to do if there is no pointer window */
+    if (s->_p == NULL) {
+        return;
+    }
+
+    /* get pointer to file descriptor structure */
+    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
+    if (filedesc != NULL) {
+        if (s->_mode == CRUISE_STREAM_PTR_WRITE) {
+            /* file position follows the pointer, and bytes written past
+             * the end of the window data extend it */
+            size_t offset = (size_t) (s->_p - s->win);
+            filedesc->pos = s->bufpos + (off_t) offset;
+            if (offset > s->buflen) {
+                s->buflen = offset;
+            }
+            if (offset > s->bufdirtyend) {
+                s->bufdirtyend = offset;
+            }
+        } else if (s->_mode == CRUISE_STREAM_PTR_UNGET) {
+            /* drop bytes consumed from the push back buffer */
+            size_t consumed = s->ubuflen - s->_r;
+            s->ubuflen    -= consumed;
+            filedesc->pos += (off_t) consumed;
+        } else {
+            /* read windows run to the end of the window data, go by the
+             * count rather than the pointer since scanf doesn't always
+             * advance the pointer past the last byte */
+            filedesc->pos = s->bufpos + (off_t) (s->buflen - s->_r);
+        }
+    }
+
+    /* close the pointer window */
+    s->_p = NULL;
+    s->_r = 0;
+    s->_w = 0;
+}
+
+/* open a pointer window at the current file position so that getc
+ * and putc can work on the stream buffer directly, opens a window
+ * for writing if write is set and for reading otherwise, leaves the
+ * window closed if the current position is not in the buffer */
+static int cruise_stream_set_pointers(cruise_stream_t* s, int write)
 {
+    /* start with the window closed */
+    s->_p = NULL;
+    s->_r = 0;
+    s->_w = 0;
+
     /* get pointer to file descriptor structure */
     cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
     if (filedesc == NULL) {
         /* ERROR: invalid file descriptor */
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return CRUISE_ERR_BADF;
     }
 
-    /* if we have anything on the push back buffer, that must be
-     * our current file pointer, since any seek would have cleared
-     * the buffer and each read/write/unget keeps it up-to-date */
-    if (s->ubuflen > 0) {
-        s->_p = s->ubuf + s->ubufsize - s->ubuflen;
-        s->_r = s->ubuflen;
+    /* bytes on the push back buffer are handled by the slow path */
+    if (s->win == NULL || s->ubuflen > 0) {
         return CRUISE_SUCCESS;
     }
 
-    /* check that current falls within buffer */
+    /* check that current falls within window */
     off_t current = filedesc->pos;
-    off_t start  = s->bufpos;
-    off_t length = s->buflen;
-    if (current < start || current >= start + length) {
-        /* file position is out of range of current buffer */
-        s->_p = NULL;
-        s->_r = 0;
+    if (current < s->bufpos) {
+        return CRUISE_SUCCESS;
+    }
+    size_t offset = (size_t) (current - s->bufpos);
+
+    if (write) {
+        /* only fully buffered streams can take bytes blindly, line
+         * buffering needs to look at each byte, and appends must
+         * check the end of the file */
+        if (s->buftype != _IOFBF || s->append) {
+            return CRUISE_SUCCESS;
+        }
+
+        /* the window takes data anywhere within the file data it
+         * covers, but we leave a clean private buffer closed so that
+         * reads and seeks don't mark it dirty, a window on chunk
+         * memory only takes bytes that are already in the file since
+         * bytes past the end must raise the size as they go in */
+        size_t limit = s->winsize;
+        if (s->winalias) {
+            limit = s->buflen;
+        }
+        if (offset > s->buflen || offset >= limit) {
+            return CRUISE_SUCCESS;
+        }
+        if (! s->winalias && ! s->bufdirty) {
+            return CRUISE_SUCCESS;
+        }
+
+        /* chunk memory mapped for reading may be shared with other
+         * files, a write maps it again for writing */
+        if (s->winalias && ! s->winwrite) {
+            return CRUISE_SUCCESS;
+        }
+
+        /* whatever goes through the window needs to be flushed */
+        if (! s->bufdirty) {
+            s->bufdirtyoff = offset;
+            s->bufdirtyend = offset;
+        } else if (offset < s->bufdirtyoff) {
+            s->bufdirtyoff = offset;
+        }
+        s->bufdirty = 1;
+
+        s->_p    = s->win + offset;
+        s->_w    = limit - offset;
+        s->_mode = CRUISE_STREAM_PTR_WRITE;
     } else {
-        /* determine number of bytes to copy from stream buffer */
-        size_t stream_offset    = (size_t) (current - s->bufpos);
-        char*  stream_start     = (char*)s->buf + stream_offset;
-        size_t stream_remaining = s->buflen - stream_offset;
-        s->_p = (unsigned char*) stream_start;
-        s->_r = stream_remaining;
+        /* nothing to read if we're at the end of the window data */
+        if (offset >= s->buflen) {
+            return CRUISE_SUCCESS;
+        }
+
+        s->_p    = s->win + offset;
+        s->_r    = s->buflen - offset;
+        s->_mode = CRUISE_STREAM_PTR_READ;
     }
 
     return CRUISE_SUCCESS;
@@ -356,56 +591,69 @@ static int cruise_fopen(
     /* assume default permissions */
     mode_t perms = cruise_getmode(0);
 
-    int open_rc;
-    int fid;
-    off_t pos;
+    /* parse_mode sets exactly one of read, write, and append */
+    int flags = O_RDONLY;
     if (read) {
       /* read shall fail if file does not already exist, cruise_fid_open
        * returns CRUISE_ERR_NOENT if file does not exist w/o O_CREAT */
       if (plus) {
           /* r+ ==> open file for update (reading and writing) */
-          open_rc = cruise_fid_open(path, O_RDWR, perms, &fid, &pos);
+          flags = O_RDWR;
       } else {
           /* r  ==> open file for reading */
-          open_rc = cruise_fid_open(path, O_RDONLY, perms, &fid, &pos);
+          flags = O_RDONLY;
       }
     } else if (write) {
       if (plus) {
           /* w+ ==> truncate to zero length or create file for update
            * (read/write) */
-          open_rc = cruise_fid_open(path, O_RDWR | O_CREAT | O_TRUNC, perms, &fid, &pos);
+          flags = O_RDWR | O_CREAT | O_TRUNC;
       } else {
           /* w  ==> truncate to zero length or create file for
            * writing */
-          open_rc = cruise_fid_open(path, O_WRONLY | O_CREAT | O_TRUNC, perms, &fid, &pos);
+          flags = O_WRONLY | O_CREAT | O_TRUNC;
       }
     } else if (append) {
       /* force all writes to end of file when append is set */
       if (plus) {
           /* a+ ==> append, open or create file for update, at end
            * of file */
-          open_rc = cruise_fid_open(path, O_RDWR | O_CREAT | O_APPEND, perms, &fid, &pos);
+          flags = O_RDWR | O_CREAT | O_APPEND;
       } else {
           /* a  ==> append, open or create file for writing, at end
            * of file */
-          open_rc = cruise_fid_open(path, O_WRONLY | O_CREAT | O_APPEND, perms, &fid, &pos);
+          flags = O_WRONLY | O_CREAT | O_APPEND;
       }
     }
 
+    /* open the file */
+    int fid;
+    off_t pos;
+    int open_rc = cruise_fid_open(path, flags, perms, &fid, &pos);
+
     /* check the open return code */
     if (open_rc != CRUISE_SUCCESS) {
         return open_rc;
     }
 
-    /* allocate a stream for this file */
-    cruise_stream_t* s = &(cruise_streams[fid]);
+    /* allocate a file descriptor with its own file pointer */
+    int fd;
+    int alloc_rc = cruise_fd_alloc(fid, flags, pos, &fd);
+    if (alloc_rc != CRUISE_SUCCESS) {
+        cruise_fid_close(fid);
+        return alloc_rc;
+    }
+
+    /* each file descriptor has a stream of its own */
+    cruise_stream_t* s = &(cruise_streams[fd]);
 
-    /* allocate a file descriptor for this file */
-    int fd = fid;
+    /* send glibc's inlined calls to __uflow and __overflow */
+    s->_flags = 0;
+    memset(s->_IO_ptrs, 0, sizeof(s->_IO_ptrs));
 
     /* clear error and eof indicators and record file descriptor */
-    s->err = 0;
-    s->eof = 0;
+    cruise_stream_set_err(s, 0);
+    cruise_stream_set_eof(s, 0);
     s->fd  = fd;
 
     /* record the access mode for the stream */
@@ -414,39 +662,49 @@ static int cruise_fopen(
     /* set orientation to NULL */
     s->orient = CRUISE_STREAM_ORIENTATION_NULL;
 
-    /* default to fully buffered, set buffer to NULL to indicate
-     * setvbuf has not been called */
+    /* default to fully buffered, the private buffer is taken from
+     * our pool the first time we need it */
     s->buf      = NULL;
-    s->buffree  = 0;
+    s->buffree  = 1;
     s->buftype  = _IOFBF;
-    s->bufsize  = 0;
+    s->bufsize  = CRUISE_STREAM_BUFSIZE;
+    s->bufalloc = 0;
     s->bufpos   = 0;
     s->buflen   = 0;
     s->bufdirty = 0;
+    s->bufdirtyoff = 0;
+    s->bufdirtyend = 0;
+
+    /* no window into the file yet */
+    s->win      = NULL;
+    s->winsize  = 0;
+    s->winalias = 0;
+    s->winwrite = 0;
 
     /* initialize the ungetc buffer */
     s->ubuf     = NULL;
     s->ubufsize = 0;
     s->ubuflen  = 0;
 
-//ATM
-    s->_p = NULL;
-    s->_r = 0;
+    /* no pointer window yet */
+    s->_p    = NULL;
+    s->_r    = 0;
+    s->_w    = 0;
+    s->_mode = CRUISE_STREAM_PTR_READ;
 
-    /* set file pointer and read/write mode in file descriptor */
-    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
-    filedesc->pos   = pos;
-    filedesc->read  = read  || plus;
-    filedesc->write = write || plus;
+    /* nobody holds the stream lock */
+    s->lockowner = NULL;
+    s->lockcount = 0;
 
     /* set return parameter and return */
     *outstream = (FILE*)s;
     return CRUISE_SUCCESS;
 }
 
-/* associate buffer with stream, allocates a buffer of specified size
- * if buf is NULL, otherwise uses buffer passed by caller, also sets
- * stream to fully/line/unbuffered, returns CRUISE error codes */
+/* associate buffer with stream, if buf is NULL a buffer of up to the
+ * specified size is taken from our pool when the stream first needs
+ * it, otherwise uses buffer passed by caller, also sets stream to
+ * fully/line/unbuffered, returns CRUISE error codes */
 static int cruise_setvbuf(
   FILE* stream,
   char* buf,
@@ -459,7 +717,7 @@ static int cruise_setvbuf(
     /* TODO: check that stream is valid */
 
     /* check whether we've already associated a buffer */
-    if (s->buf != NULL) {
+    if ((s->buf != NULL && ! s->buffree) || s->win != NULL) {
         /* ERROR: stream already has buffer */
         return CRUISE_ERR_BADF;
     }
@@ -476,21 +734,23 @@ static int cruise_setvbuf(
         return CRUISE_ERR_INVAL;
     }
 
+    /* give back any pool buffer we picked up before */
+    if (s->buffree && s->buf != NULL) {
+        cruise_bufpool_put(s->buf, s->bufalloc);
+    }
+
     /* associate buffer with stream */
     if (buf == NULL) {
-        /* allocate buffer */
-        s->buf = malloc(size);
-        if (s->buf == NULL) {
-            /* ERROR: no memory */
-            return CRUISE_ERR_NOMEM;
-        }
-        /* remember that we need to free the buffer at the end */
-        s->buffree = 1;
+        /* take a buffer from our pool when we need it */
+        s->buf      = NULL;
+        s->buffree  = 1;
+        s->bufalloc = 0;
     } else {
         /* caller provided buffer, remember that we don't need to
          * free it when closing the stream */
-        s->buf = buf;
-        s->buffree = 0;
+        s->buf      = buf;
+        s->buffree  = 0;
+        s->bufalloc = size;
     }
 
     /* set properties of buffer */
@@ -503,9 +763,10 @@ static int cruise_setvbuf(
     return CRUISE_SUCCESS;
 }
 
-/* calls cruise_fd_write to flush stream if it is dirty,
- * returns CRUISE error codes, sets stream error indicator and errno
- * upon error */
+/* calls cruise_fd_write to flush stream if it is dirty, when the
+ * window aliases chunk memory the data is already in place and the
+ * file size already covers it, returns CRUISE error codes, sets
+ * stream error indicator and errno upon error */
 static int cruise_stream_flush(FILE* stream)
 {
     /* lookup stream */
@@ -513,11 +774,42 @@ static int cruise_stream_flush(FILE* stream)
 
     /* TODO: check that stream is valid */
 
-    /* if buffer is dirty, write data to file */
-    if (s->buf != NULL && s->bufdirty) {
-        int write_rc = cruise_fd_write(s->fd, s->bufpos, s->buf, s->buflen);
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
+
+    /* if window is dirty, write data to file */
+    if (s->win != NULL && s->bufdirty) {
+        int write_rc;
+        if (s->winalias) {
+            /* bytes are already in the chunk and in the file, those
+             * past the end raised its size as they went in, but the
+             * chunk didn't see them as writes */
+            int fid = cruise_get_fid_from_fd(s->fd);
+            if (fid >= 0) {
+                cruise_fid_dirty_mark(fid, s->bufpos + (off_t) s->bufdirtyoff,
+                                      (off_t) (s->bufdirtyend - s->bufdirtyoff));
+            }
+            write_rc = CRUISE_SUCCESS;
+        } else if (s->append) {
+            /* appended bytes land wherever the end of the file is by
+             * now, which may have moved if others append to it too,
+             * so point the buffer at where they went */
+            size_t off = s->bufdirtyoff;
+            size_t len = s->bufdirtyend - off;
+            off_t pos;
+            write_rc = cruise_fd_append(s->fd, s->win + off, len, &pos);
+            if (write_rc == CRUISE_SUCCESS) {
+                s->bufpos = pos - (off_t) off;
+            }
+        } else {
+            /* write back just the bytes we changed, the rest were
+             * read from the file and are still there */
+            size_t off = s->bufdirtyoff;
+            size_t len = s->bufdirtyend - off;
+            write_rc = cruise_fd_write(s->fd, s->bufpos + (off_t) off, s->win + off, len);
+        }
         if (write_rc != CRUISE_SUCCESS) {
-            s->err = 1;
+            cruise_stream_set_err(s, 1);
             errno = cruise_err_map_to_errno(write_rc);
             return write_rc;
         }
@@ -529,6 +821,195 @@ static int cruise_stream_flush(FILE* stream)
     return CRUISE_SUCCESS;
 }
 
+/* flush stream and detach its window, releasing the hold on the
+ * file if the window aliases chunk memory, returns CRUISE error
+ * codes, sets stream error indicator and errno upon error */
+static int cruise_stream_unmap(FILE* stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* write out anything we have buffered */
+    int flush_rc = cruise_stream_flush(stream);
+    if (flush_rc != CRUISE_SUCCESS) {
+        /* ERROR: flush sets error indicator and errno */
+        return flush_rc;
+    }
+
+    /* drop our pin on the chunks we were pointing to */
+    if (s->winalias) {
+        int fid = cruise_get_fid_from_fd(s->fd);
+        if (fid >= 0) {
+            cruise_fid_unpin(fid);
+        }
+    }
+
+    /* clear the window */
+    s->win      = NULL;
+    s->winsize  = 0;
+    s->winalias = 0;
+    s->winwrite = 0;
+    s->bufpos   = 0;
+    s->buflen   = 0;
+    s->bufdirty = 0;
+
+    return CRUISE_SUCCESS;
+}
+
+/* point stream window at the region of the file holding current,
+ * fully buffered streams alias the chunk in memory so data moves
+ * directly between the user and the file, otherwise, when alias is
+ * not set, and for chunks that have spilled over we fall back to the
+ * private buffer, if write is set the window is prepared to accept
+ * data at current, otherwise it's filled with data from current on,
+ * a read window does not cover current if current is at or past the
+ * end of the file, returns CRUISE error codes, sets stream error
+ * indicator and errno upon error */
+static int cruise_stream_map(FILE* stream, off_t current, int write, int alias)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* note whether the stream ran off the end of a full private
+     * buffer, such streams are moving sequentially through the file */
+    int sequential = (s->win != NULL && ! s->winalias &&
+                      s->buflen == s->winsize &&
+                      current == s->bufpos + (off_t) s->buflen);
+
+    /* release our current window */
+    int unmap_rc = cruise_stream_unmap(stream);
+    if (unmap_rc != CRUISE_SUCCESS) {
+        /* ERROR: unmap sets error indicator and errno */
+        return unmap_rc;
+    }
+
+    /* get the file id for this file descriptor */
+    int fid = cruise_get_fid_from_fd(s->fd);
+    if (fid < 0) {
+        cruise_stream_set_err(s, 1);
+        errno = EBADF;
+        return CRUISE_ERR_BADF;
+    }
+
+    /* try to alias chunk memory if fully buffered, appends are the
+     * exception, they gather in our private buffer and go out as one
+     * atomic append when it's flushed */
+    if (alias && s->buftype == _IOFBF && ! (write && s->append)) {
+        /* pin the file so a truncate can't free the chunk under us */
+        cruise_fid_pin(fid);
+
+        /* if writing past the end, extend the file and zero fill up to
+         * current so the window only ever holds file data */
+        off_t filesize = cruise_fid_size(fid);
+        if (write && current > filesize) {
+            int write_rc = cruise_fd_write(s->fd, current, NULL, 0);
+            if (write_rc != CRUISE_SUCCESS) {
+                cruise_fid_unpin(fid);
+                cruise_stream_set_err(s, 1);
+                errno = cruise_err_map_to_errno(write_rc);
+                return write_rc;
+            }
+            filesize = current;
+        }
+
+        /* nothing to map for a read at or past the end of the file */
+        if (! write && current >= filesize) {
+            cruise_fid_unpin(fid);
+            return CRUISE_SUCCESS;
+        }
+
+        /* look up the chunk holding current */
+        void* chunkbuf;
+        off_t chunkpos;
+        int map_rc = cruise_fid_chunk_map(fid, current, write, &chunkbuf, &chunkpos);
+        if (map_rc == CRUISE_SUCCESS) {
+            /* window covers the file data held in this chunk */
+            size_t length = 0;
+            if (filesize > chunkpos) {
+                length = (size_t) (filesize - chunkpos);
+                if (length > (size_t) cruise_chunk_size) {
+                    length = (size_t) cruise_chunk_size;
+                }
+            }
+
+            s->win      = (unsigned char*) chunkbuf;
+            s->winsize  = (size_t) cruise_chunk_size;
+            s->winalias = 1;
+            s->winwrite = write;
+            s->bufpos   = chunkpos;
+            s->buflen   = length;
+            s->bufdirty = 0;
+            return CRUISE_SUCCESS;
+        }
+
+        /* chunk isn't in memory, use our private buffer instead */
+        cruise_fid_unpin(fid);
+    }
+
+    /* size a pool buffer to what the stream is likely to touch, a
+     * first read gets enough for the rest of a small file, a write
+     * starts small, and a stream that keeps running sequentially off
+     * the end of its buffer moves to one four times larger, never
+     * going beyond the stream buffer size */
+    if (s->buffree) {
+        size_t size = s->bufalloc;
+        if (s->buf == NULL) {
+            size = CRUISE_STREAM_BUFSIZE_MIN;
+            if (! write) {
+                off_t filesize = cruise_fid_size(fid);
+                while (size < s->bufsize && current + (off_t) size < filesize) {
+                    size <<= 2;
+                }
+            }
+        } else if (sequential) {
+            size <<= 2;
+        }
+        if (size > s->bufsize) {
+            size = s->bufsize;
+        }
+
+        /* swap buffers if the size changed */
+        if (s->buf != NULL && size != s->bufalloc) {
+            cruise_bufpool_put(s->buf, s->bufalloc);
+            s->buf = NULL;
+        }
+        if (s->buf == NULL) {
+            s->buf = cruise_bufpool_get(size);
+            if (s->buf == NULL) {
+                /* ERROR: no memory */
+                cruise_stream_set_err(s, 1);
+                errno = ENOMEM;
+                return CRUISE_ERR_NOMEM;
+            }
+            s->bufalloc = size;
+        }
+    }
+
+    /* window starts at current in our private buffer */
+    s->win      = (unsigned char*) s->buf;
+    s->winsize  = s->bufalloc;
+    s->winalias = 0;
+    s->winwrite = 0;
+    s->bufpos   = current;
+    s->buflen   = 0;
+    s->bufdirty = 0;
+
+    /* fill buffer with data from file if reading */
+    if (! write) {
+        size_t bufcount;
+        int read_rc = cruise_fd_read(s->fd, current, s->win, s->winsize, &bufcount);
+        if (read_rc != CRUISE_SUCCESS) {
+            /* ERROR: read error, set error indicator and errno */
+            cruise_stream_set_err(s, 1);
+            errno = cruise_err_map_to_errno(read_rc);
+            return read_rc;
+        }
+        s->buflen = bufcount;
+    }
+
+    return CRUISE_SUCCESS;
+}
+
 /* reads count bytes from stream into buf, sets stream EOF and error
  * indicators as appropriate, sets errno if error, updates file
  * position, returns number of bytes read in retcount, returns CRUISE
@@ -542,38 +1023,25 @@ static int cruise_stream_read(
     /* lookup stream */
     cruise_stream_t* s = (cruise_stream_t*) stream;
 
-//ATM
-    /* clear pointers, will force a reset when refill is called */
-    s->_p = NULL;
-    s->_r = 0;
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
 
     /* get pointer to file descriptor structure */
     cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
     if (filedesc == NULL) {
         /* ERROR: invalid file descriptor */
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return CRUISE_ERR_BADF;
     }
 
     /* bail with error if stream not open for reading */
     if (! filedesc->read) {
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return CRUISE_ERR_BADF;
     }
 
-    /* associate buffer with stream if we need to */
-    if (s->buf == NULL) {
-        int setvbuf_rc = cruise_setvbuf(stream, NULL, s->buftype, CRUISE_STREAM_BUFSIZE);
-        if (setvbuf_rc != CRUISE_SUCCESS) {
-            /* ERROR: failed to associate buffer */
-            s->err = 1;
-            errno = cruise_err_map_to_errno(setvbuf_rc);
-            return setvbuf_rc;
-        }
-    }
-
     /* don't attempt read if end-of-file indicator is set */
     if (s->eof) {
         return CRUISE_FAILURE;
@@ -586,7 +1054,7 @@ static int cruise_stream_read(
 
     /* check that current + count doesn't overflow */
     if (cruise_would_overflow_offt(current, (off_t) count)) {
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EOVERFLOW;
         return CRUISE_ERR_OVERFLOW;
     }
@@ -607,51 +1075,68 @@ static int cruise_stream_read(
         /* drop bytes from push back buffer */
         s->ubuflen -= ubuf_chars;
 
-        /* update our current file position and remaining count */
+        /* update our current position and remaining count */
         current   += ubuf_chars;
         remaining -= ubuf_chars;
     }
 
-    /* TODO: if count is large enough, read directly to user's
-     * buffer and be done with it */
-
-    /* read data from file into buffer */
+    /* if the request is at least as large as the stream buffer,
+     * staging it through the buffer only adds a copy, so read
+     * directly into the user's buffer */
     int eof = 0;
+    if (remaining >= s->bufsize) {
+        /* flush buffer so the file holds any bytes we have buffered */
+        int flush_rc = cruise_stream_flush(stream);
+        if (flush_rc != CRUISE_SUCCESS) {
+            /* ERROR: flush sets error indicator and errno */
+            return flush_rc;
+        }
+
+        /* read data from file into user buffer */
+        size_t bufcount;
+        char* buf_start = (char*)buf + (count - remaining);
+        int read_rc = cruise_fd_read(s->fd, current, buf_start, remaining, &bufcount);
+        if (read_rc != CRUISE_SUCCESS) {
+            /* ERROR: read error, set error indicator and errno */
+            cruise_stream_set_err(s, 1);
+            errno = cruise_err_map_to_errno(read_rc);
+            return read_rc;
+        }
+
+        /* update our current position and the number of bytes
+         * left to read */
+        current   += bufcount;
+        remaining -= bufcount;
+
+        /* a short read means we hit the end of the file */
+        if (remaining > 0) {
+            eof = 1;
+        }
+    }
+
+    /* read data from file through window */
     while (remaining > 0 && !eof) {
-        /* check that current falls within buffer */
+        /* check that current falls within window */
         off_t start  = s->bufpos;
         off_t length = s->buflen;
-        if (current < start || current >= start + length) {
-            /* current is outside the range of our buffer */
-
-            /* flush buffer if needed before read */
-            int flush_rc = cruise_stream_flush(stream);
-            if (flush_rc != CRUISE_SUCCESS) {
-                /* ERROR: flush sets error indicator and errno */
-                return flush_rc;
-            }
-
-            /* read data from file into buffer */
-            size_t bufcount;
-            int read_rc = cruise_fd_read(s->fd, current, s->buf, s->bufsize, &bufcount);
-            if (read_rc != CRUISE_SUCCESS) {
-                /* ERROR: read error, set error indicator and errno */
-                s->err = 1;
-                errno = cruise_err_map_to_errno(read_rc);
-                return read_rc;
+        if (s->win == NULL || current < start || current >= start + length) {
+            /* current is outside the range of our window, move it */
+            int map_rc = cruise_stream_map(stream, current, 0, 1);
+            if (map_rc != CRUISE_SUCCESS) {
+                /* ERROR: map sets error indicator and errno */
+                return map_rc;
             }
 
-            /* record new buffer range within file */
-            s->bufpos  = current;
-            s->buflen  = bufcount;
-
-            /* set end-of-file flag if our read was short */
-            if (bufcount < s->bufsize) {
-              eof = 1;
+            /* if window still doesn't cover current, we're at the end */
+            start  = s->bufpos;
+            length = s->buflen;
+            if (s->win == NULL || current < start || current >= start + length) {
+                eof = 1;
+                break;
             }
         }
 
-        /* determine number of bytes to copy from stream buffer */
+        /* determine number of bytes to copy from window */
         size_t stream_offset    = (size_t) (current - s->bufpos);
         size_t stream_remaining = s->buflen - stream_offset;
         size_t bytes = stream_remaining;
@@ -659,12 +1144,10 @@ static int cruise_stream_read(
             bytes = remaining;
         }
 
-        /* copy data from stream buffer to user buffer */
-        if (bytes > 0) {
-            char* buf_start    = (char*)buf + (count - remaining);
-            char* stream_start = (char*)s->buf + stream_offset;
-            memcpy(buf_start, stream_start, bytes);
-        }
+        /* copy data from window to user buffer */
+        char* buf_start    = (char*)buf + (count - remaining);
+        char* stream_start = (char*)s->win + stream_offset;
+        memcpy(buf_start, stream_start, bytes);
 
         /* update our current position and the number of bytes
          * left to read */
@@ -678,12 +1161,12 @@ static int cruise_stream_read(
     /* update file position */
     filedesc->pos += (off_t) *retcount;
 
-//ATM
-//    cruise_stream_set_pointers(s);
+    /* let getc pick up where we left off */
+    cruise_stream_set_pointers(s, 0);
 
     /* set end of file indicator if we hit the end */
     if (*retcount < count) {
-        s->eof = 1;
+        cruise_stream_set_eof(s, 1);
     }
 
     /* return success */
@@ -701,10 +1184,8 @@ static int cruise_stream_write(
     /* lookup stream */
     cruise_stream_t* s = (cruise_stream_t*) stream;
 
-//ATM
-    /* clear pointers, will force a reset when refill is called */
-    s->_p = NULL;
-    s->_r = 0;
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
 
     /* TODO: check that stream is valid */
 
@@ -712,14 +1193,14 @@ static int cruise_stream_write(
     cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
     if (filedesc == NULL) {
         /* ERROR: invalid file descriptor */
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return CRUISE_ERR_BADF;
     }
 
     /* bail with error if stream not open for writing */
     if (! filedesc->write) {
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return CRUISE_ERR_BADF;
     }
@@ -730,17 +1211,31 @@ static int cruise_stream_write(
     /* set the position to write */
     off_t current;
     if (s->append) {
-        /* if in append mode, always write to end of file */
-        int fid = cruise_get_fid_from_fd(s->fd);
-        if (fid < 0) {
-            s->err = 1;
-            errno = EBADF;
-            return CRUISE_ERR_BADF;
+        /* if in append mode, always write to end of file, bytes we've
+         * buffered but not yet flushed go there first, where exactly
+         * is settled when we flush them */
+        if (s->win != NULL && ! s->winalias && s->bufdirty) {
+            current = s->bufpos + (off_t) s->buflen;
+        } else {
+            /* drop any window we've been reading through, appends
+             * only go through our private buffer */
+            int unmap_rc = cruise_stream_unmap(stream);
+            if (unmap_rc != CRUISE_SUCCESS) {
+                /* ERROR: unmap sets error indicator and errno */
+                return unmap_rc;
+            }
+
+            int fid = cruise_get_fid_from_fd(s->fd);
+            if (fid < 0) {
+                cruise_stream_set_err(s, 1);
+                errno = EBADF;
+                return CRUISE_ERR_BADF;
+            }
+            current = cruise_fid_size(fid);
         }
-        current = cruise_fid_size(fid);
 
         /* like a seek, we discard push back bytes */
-        s->ubuflen;
+        s->ubuflen = 0;
     } else {
         /* otherwise, write at current file pointer */
         current = filedesc->pos;
@@ -757,29 +1252,33 @@ static int cruise_stream_write(
 
     /* check that current + count doesn't overflow */
     if (cruise_would_overflow_offt(current, (off_t) count)) {
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EFBIG;
         return CRUISE_ERR_FBIG;
     }
 
-    /* associate buffer with stream if we need to */
-    if (s->buf == NULL) {
-        int setvbuf_rc = cruise_setvbuf(stream, NULL, s->buftype, CRUISE_STREAM_BUFSIZE);
-        if (setvbuf_rc != CRUISE_SUCCESS) {
-            /* ERROR: failed to associate buffer */
-            s->err = 1;
-            errno = cruise_err_map_to_errno(setvbuf_rc);
-            return setvbuf_rc;
+    /* write data directly to file if unbuffered, or if the request is
+     * at least as large as the stream buffer, since staging it through
+     * the buffer only adds a copy */
+    if (s->buftype == _IONBF || count >= s->bufsize) {
+        /* flush what we have buffered so its bytes land before ours,
+         * and drop the window since it may overlap our range */
+        int unmap_rc = cruise_stream_unmap(stream);
+        if (unmap_rc != CRUISE_SUCCESS) {
+            /* ERROR: unmap sets error indicator and errno */
+            return unmap_rc;
         }
-    }
 
-    /* if unbuffered, write data directly to file */
-    if (s->buftype == _IONBF) {
-        /* write data directly to file */
-        int write_rc = cruise_fd_write(s->fd, current, buf, count);
+        /* write data directly to file, appends land at its end */
+        int write_rc;
+        if (s->append) {
+            write_rc = cruise_fd_append(s->fd, buf, count, &current);
+        } else {
+            write_rc = cruise_fd_write(s->fd, current, buf, count);
+        }
         if (write_rc != CRUISE_SUCCESS) {
             /* ERROR: write error, set error indicator and errno */
-            s->err = 1;
+            cruise_stream_set_err(s, 1);
             errno = cruise_err_map_to_errno(write_rc);
             return write_rc;
         }
@@ -787,73 +1286,141 @@ static int cruise_stream_write(
         /* update file position */
         filedesc->pos = current + (off_t) count;
 
-//ATM
-//        cruise_stream_set_pointers(s);
-
         return CRUISE_SUCCESS;
     }
 
-    /* TODO: if count is large enough, write directly to file
-     * and be done with it */
+    /* a line buffered stream flushes once, after the last newline
+     * in the data, find it with memchr which scans a word or vector
+     * at a time, memrchr would be quicker but needs _GNU_SOURCE */
+    size_t flush_at = 0;
+    if (s->buftype == _IOLBF) {
+        const char* ptr = (const char*) buf;
+        const char* end = ptr + count;
+        const char* newline;
+        while (ptr < end && (newline = memchr(ptr, '\n', (size_t) (end - ptr))) != NULL) {
+            flush_at = (size_t) (newline - (const char*) buf) + 1;
+            ptr = newline + 1;
+        }
+    }
 
-    /* write data from buffer to file */
+    /* write data through window to file */
     size_t remaining = count;
     while (remaining > 0) {
-        /* if buffer is clean, set start of buffer to current */
-        if (! s->bufdirty) {
-            s->bufpos = current;
-            s->buflen = 0;
-        }
-
-        /* determine number of bytes to copy to buffer and whether
-         * we need to flush the stream after the write */
-        size_t bytes;
-        int need_flush = 0;
-        size_t stream_offset    = s->buflen;
-        size_t stream_remaining = s->bufsize - stream_offset;
-        if (s->buftype == _IOLBF) {
-            /* line buffered, scan to first newline or end of
-             * user buffer and counts bytes as we go */
-            bytes = 0;
-            const char* ptr = (const char*)buf + (count - remaining);
-            while (bytes < remaining) {
-                bytes++;
-                if (*ptr == '\n') {
-                  /* found a newline, write up to and including newline
-                   * then flush stream */
-                  need_flush = 1;
-                  break;
-                }
-                ptr++;
-            }
-
-            /* error if we exhaust buffer before finding a newline */
-            if (bytes > stream_remaining ||
-                (bytes == stream_remaining && !need_flush))
+        /* check whether window can take data at current, it takes
+         * data anywhere within the file data it covers or right after
+         * it, so a stream that switches from reading to writing keeps
+         * the bytes it has cached */
+        int need_map = 0;
+        int upgrade  = 0;
+        if (s->win == NULL) {
+            need_map = 1;
+        } else if (s->winalias) {
+            if (current < s->bufpos ||
+                current > s->bufpos + (off_t) s->buflen ||
+                current >= s->bufpos + (off_t) s->winsize)
             {
-                /* ERROR: write error, set error indicator and errno */
-                s->err = 1;
-                errno = ENOMEM;
-                return CRUISE_ERR_NOMEM;
+                need_map = 1;
+            } else if (remaining < CRUISE_STREAM_BUFSIZE_MIN &&
+                       current + (off_t) remaining > s->bufpos + (off_t) s->buflen)
+            {
+                /* small writes past the end of the file gather in our
+                 * private buffer, bytes going straight into the chunk
+                 * raise the file size with each write */
+                need_map = 1;
+            } else if (! s->winwrite) {
+                /* window was mapped for reading and its chunk may be
+                 * shared with other files, map it again for writing,
+                 * which gives us a copy of our own if it is */
+                need_map = 1;
+                upgrade  = 1;
             }
-        } else {
-            /* fully buffered, write until we hit the buffer limit */
-            bytes = remaining;
-            if (bytes >= stream_remaining) {
-                bytes = stream_remaining;
-                need_flush = 1;
+        } else if (current < s->bufpos ||
+                   current > s->bufpos + (off_t) s->buflen ||
+                   current >= s->bufpos + (off_t) s->winsize)
+        {
+            /* current isn't in our private buffer, flush it if dirty,
+             * otherwise just start it over at current */
+            if (s->bufdirty) {
+                need_map = 1;
+            } else {
+                s->bufpos = current;
+                s->buflen = 0;
             }
         }
 
-        /* copy data from user buffer to stream buffer */
+        /* move window to current if needed */
+        if (need_map) {
+            /* only large writes go straight into chunk memory, small
+             * ones are cheaper to gather in our private buffer, unless
+             * the window already points into the chunk */
+            int alias = (remaining >= CRUISE_STREAM_BUFSIZE_MIN || upgrade);
+            int map_rc = cruise_stream_map(stream, current, 1, alias);
+            if (map_rc != CRUISE_SUCCESS) {
+                /* ERROR: map sets error indicator and errno */
+                return map_rc;
+            }
+        }
+
+        /* determine number of bytes to copy to window and whether
+         * we need to flush the stream after the write */
+        int need_flush = 0;
+        size_t stream_offset    = (size_t) (current - s->bufpos);
+        size_t stream_remaining = s->winsize - stream_offset;
+        size_t bytes = remaining;
+        if (bytes >= stream_remaining) {
+            /* write until we hit the window limit, our private buffer
+             * gets flushed when it fills up, so lines longer than the
+             * buffer just go out in pieces, while chunk memory is
+             * exposed when we move to the next chunk */
+            bytes = stream_remaining;
+            need_flush = ! s->winalias;
+        }
+        size_t written = count - remaining;
+        if (written < flush_at && written + bytes >= flush_at) {
+            /* line buffered, stop after the last newline and flush */
+            bytes = flush_at - written;
+            need_flush = 1;
+        }
+
+        /* copy data from user buffer to window */
         if (bytes > 0) {
             char* buf_start    = (char*)buf + (count - remaining);
-            char* stream_start = (char*)s->buf + stream_offset;
-            memcpy(stream_start, buf_start, bytes);
+            char* stream_start = (char*)s->win + stream_offset;
+            if (s->winalias && stream_offset + bytes > s->buflen) {
+                /* bytes past the end of the file go in through the
+                 * file, which raises its size as they land, so another
+                 * writer zero filling up to a later offset or a
+                 * truncate that extends the file keeps them */
+                int write_rc = cruise_fd_write(s->fd, current, buf_start, bytes);
+                if (write_rc != CRUISE_SUCCESS) {
+                    /* ERROR: write error, set error indicator and errno */
+                    cruise_stream_set_err(s, 1);
+                    errno = cruise_err_map_to_errno(write_rc);
+                    return write_rc;
+                }
+            } else if (s->winalias) {
+                /* window is chunk memory, large copies skip the cache */
+                cruise_memcpy_write(stream_start, buf_start, bytes);
+            } else {
+                memcpy(stream_start, buf_start, bytes);
+            }
 
-            /* mark buffer as dirty and increase number of bytes */
+            /* mark window as dirty and extend the number of bytes */
+            if (! s->bufdirty) {
+                s->bufdirtyoff = stream_offset;
+                s->bufdirtyend = stream_offset + bytes;
+            } else {
+                if (stream_offset < s->bufdirtyoff) {
+                    s->bufdirtyoff = stream_offset;
+                }
+                if (stream_offset + bytes > s->bufdirtyend) {
+                    s->bufdirtyend = stream_offset + bytes;
+                }
+            }
             s->bufdirty = 1;
-            s->buflen += bytes;
+            if (stream_offset + bytes > s->buflen) {
+                s->buflen = stream_offset + bytes;
+            }
         }
 
         /* if we've filled the buffer, flush it */
@@ -879,8 +1446,8 @@ static int cruise_stream_write(
     /* update file position */
     filedesc->pos = current;
 
-//ATM
-//    cruise_stream_set_pointers(s);
+    /* let putc pick up where we left off */
+    cruise_stream_set_pointers(s, 1);
 
     return CRUISE_SUCCESS;
 }
@@ -893,21 +1460,22 @@ static int cruise_fseek(FILE *stream, off_t offset, int whence)
     /* lookup stream */
     cruise_stream_t* s = (cruise_stream_t*) stream;
 
-//ATM
-    /* clear pointers, will force a reset when refill is called */
-    s->_p = NULL;
-    s->_r = 0;
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
 
     /* get pointer to file descriptor structure */
     cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
     if (filedesc == NULL) {
         /* ERROR: invalid file descriptor */
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return -1;
     }
 
-    /* flush stream if we need to */
+    /* write out anything we have buffered, the window stays where
+     * it is so a seek that lands inside it doesn't reread anything,
+     * for a window that aliases chunk memory this only raises the
+     * file size */
     int flush_rc = cruise_stream_flush(stream);
     if (flush_rc != CRUISE_SUCCESS) {
         /* ERROR: flush sets error indicator and errno */
@@ -919,7 +1487,7 @@ static int cruise_fseek(FILE *stream, off_t offset, int whence)
     if (fid < 0) {
         /* couldn't find file id, so assume we're at the end,
          * feof defines to errors */
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return -1;
     }
@@ -938,7 +1506,7 @@ static int cruise_fseek(FILE *stream, off_t offset, int whence)
         case SEEK_CUR:
             /* seek to current position + offset */
             if (cruise_would_overflow_offt(current_pos, offset)) {
-                s->err = 1;
+                cruise_stream_set_err(s, 1);
                 errno  = EOVERFLOW;
                 return -1;
             }
@@ -948,18 +1516,25 @@ static int cruise_fseek(FILE *stream, off_t offset, int whence)
             /* seek to EOF + offset */
             filesize = cruise_fid_size(fid);
             if (cruise_would_overflow_offt(filesize, offset)) {
-                s->err = 1;
+                cruise_stream_set_err(s, 1);
                 errno  = EOVERFLOW;
                 return -1;
             }
             current_pos = filesize + offset;
             break;
         default:
-            s->err = 1;
+            cruise_stream_set_err(s, 1);
             errno = EINVAL;
             return -1;
     }
 
+    /* can't seek before the start of the file */
+    if (current_pos < 0) {
+        cruise_stream_set_err(s, 1);
+        errno = EINVAL;
+        return -1;
+    }
+
     /* discard contents of push back buffer */
     if (s->ubuf != NULL) {
         s->ubuflen = 0;
@@ -970,11 +1545,12 @@ static int cruise_fseek(FILE *stream, off_t offset, int whence)
     /* save new position */
     filedesc->pos = current_pos;
 
-//ATM
-//    cruise_stream_set_pointers(s);
-
     /* clear end-of-file indicator */
-    s->eof = 0;
+    cruise_stream_set_eof(s, 0);
+
+    /* if the new position is in the window, getc and putc can
+     * carry on from there */
+    cruise_stream_set_pointers(s, ! filedesc->read);
 
     return 0;
 }
@@ -1006,7 +1582,7 @@ FILE* CRUISE_WRAP(freopen)(const char *path, const char *mode, FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return NULL;
     } else {
@@ -1020,7 +1596,9 @@ int CRUISE_WRAP(setvbuf)(FILE* stream, char* buf, int type, size_t size)
 {
     /* check whether we should intercept this path */
     if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
         int rc = cruise_setvbuf(stream, buf, type, size);
+        cruise_stream_unlock(stream);
         if (rc != CRUISE_SUCCESS) {
             errno = cruise_err_map_to_errno(rc);
             return 1;
@@ -1037,11 +1615,13 @@ void CRUISE_WRAP(setbuf)(FILE* stream, char* buf)
 {
     /* check whether we should intercept this path */
     if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
         if (buf != NULL) {
             cruise_setvbuf(stream, buf, _IOFBF, BUFSIZ);
         } else {
             cruise_setvbuf(stream, buf, _IONBF, BUFSIZ);
         }
+        cruise_stream_unlock(stream);
         return;
     } else {
         MAP_OR_FAIL(setbuf);
@@ -1050,87 +1630,139 @@ void CRUISE_WRAP(setbuf)(FILE* stream, char* buf)
     }
 }
 
-int CRUISE_WRAP(ungetc)(int c, FILE *stream)
+/* the stdio functions lock the stream for each call, flockfile lets
+ * the application hold it across several calls, typically to use the
+ * *_unlocked functions in between */
+void CRUISE_WRAP(flockfile)(FILE* stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* operation shall fail and input stream left unchanged */
-        if (c == EOF) {
-            return EOF;
+        cruise_stream_lock(stream);
+        return;
+    } else {
+        MAP_OR_FAIL(flockfile);
+        CRUISE_REAL(flockfile)(stream);
+        return;
+    }
+}
+
+int CRUISE_WRAP(ftrylockfile)(FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        if (! cruise_stream_trylock(stream)) {
+            /* lock is held by another thread */
+            return 1;
         }
+        return 0;
+    } else {
+        MAP_OR_FAIL(ftrylockfile);
+        int ret = CRUISE_REAL(ftrylockfile)(stream);
+        return ret;
+    }
+}
 
-        /* convert int to unsigned char */
-        unsigned char uc = (unsigned char) c;
+void CRUISE_WRAP(funlockfile)(FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_unlock(stream);
+        return;
+    } else {
+        MAP_OR_FAIL(funlockfile);
+        CRUISE_REAL(funlockfile)(stream);
+        return;
+    }
+}
 
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+/* pushes c back onto stream, caller holds the stream lock */
+static int cruise_ungetc(int c, FILE *stream)
+{
+    /* operation shall fail and input stream left unchanged */
+    if (c == EOF) {
+        return EOF;
+    }
 
-        /* get filedescriptor and check that stream is valid */
-        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
-        if (filedesc == NULL) {
-            return EOF;
-        }
+    /* convert int to unsigned char */
+    unsigned char uc = (unsigned char) c;
 
-        /* check that pos > 0 */
-        if (filedesc->pos <= 0) {
-            return EOF;
-        }
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* allocate bigger push-back buffer if needed */
-        size_t oldsize = s->ubufsize;
-        size_t len     = s->ubuflen;
-        size_t remaining = oldsize - len;
-        if (remaining == 0) {
-            /* start with a 32-byte push-back buffer,
-             * but double current size if we already have one */
-            size_t newsize = 1;
-            if (oldsize > 0) {
-                newsize = oldsize * 2;
-            }
+    /* get filedescriptor and check that stream is valid */
+    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
+    if (filedesc == NULL) {
+        return EOF;
+    }
 
-            /* make sure we don't get to big */
-            if (newsize > 1024) {
-                return EOF;
-            }
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
 
-            /* allocate new buffer */
-            unsigned char* newbuf = (unsigned char*) malloc(newsize);
-            if (newbuf == NULL) {
-                return EOF;
-            }
+    /* check that pos > 0 */
+    if (filedesc->pos <= 0) {
+        return EOF;
+    }
 
-            /* copy old bytes to new buffer and free old buffer */
-            if (len > 0) {
-                unsigned char* oldbuf = s->ubuf;
-                unsigned char* oldstart = oldbuf + oldsize - len;
-                unsigned char* newstart = newbuf + newsize - len;
-                memcpy(newstart, oldstart, len);
-                free(s->ubuf);
-            }
+    /* allocate bigger push-back buffer if needed */
+    size_t oldsize = s->ubufsize;
+    size_t len     = s->ubuflen;
+    size_t remaining = oldsize - len;
+    if (remaining == 0) {
+        /* start with a 32-byte push-back buffer,
+         * but double current size if we already have one */
+        size_t newsize = 1;
+        if (oldsize > 0) {
+            newsize = oldsize * 2;
+        }
+
+        /* make sure we don't get to big */
+        if (newsize > 1024) {
+            return EOF;
+        }
 
-            /* record details of new buffer */
-            s->ubuf     = newbuf;
-            s->ubufsize = newsize;
-            s->ubuflen  = len;
+        /* allocate new buffer */
+        unsigned char* newbuf = (unsigned char*) malloc(newsize);
+        if (newbuf == NULL) {
+            return EOF;
+        }
+
+        /* copy old bytes to new buffer and free old buffer */
+        if (len > 0) {
+            unsigned char* oldbuf = s->ubuf;
+            unsigned char* oldstart = oldbuf + oldsize - len;
+            unsigned char* newstart = newbuf + newsize - len;
+            memcpy(newstart, oldstart, len);
+            free(s->ubuf);
         }
 
-        /* push char onto buffer */
-        s->ubuflen++;
-        unsigned char* pos = s->ubuf + s->ubufsize - s->ubuflen;
-        *pos = uc;
+        /* record details of new buffer */
+        s->ubuf     = newbuf;
+        s->ubufsize = newsize;
+        s->ubuflen  = len;
+    }
 
-        /* decrement file position */
-        filedesc->pos--;
+    /* push char onto buffer */
+    s->ubuflen++;
+    unsigned char* pos = s->ubuf + s->ubufsize - s->ubuflen;
+    *pos = uc;
 
-// ATM
-        /* update buffer pointer and remaining count */
-        s->_p = pos;
-        s->_r = s->ubuflen;
+    /* decrement file position */
+    filedesc->pos--;
 
-        /* clear end-of-file flag */
-        s->eof = 0;
+    /* clear end-of-file flag */
+    cruise_stream_set_eof(s, 0);
+
+    return (int) uc;
+}
 
-        return (int) uc;
+int CRUISE_WRAP(ungetc)(int c, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_ungetc(c, stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(ungetc);
         int ret = CRUISE_REAL(ungetc)(c, stream);
@@ -1138,23 +1770,39 @@ int CRUISE_WRAP(ungetc)(int c, FILE *stream)
     }
 }
 
+/* reads the next byte from stream, caller holds the stream lock */
+static inline int cruise_fgetc(FILE *stream)
+{
+    /* take the next byte straight from the buffer if we can */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+    if (s->_r > 0) {
+        s->_r--;
+        return (int) *s->_p++;
+    }
+
+    /* read next character from file */
+    unsigned char charbuf;
+    size_t count = 1;
+    size_t retcount;
+    int read_rc = cruise_stream_read(stream, &charbuf, count, &retcount);
+    if (read_rc != CRUISE_SUCCESS || retcount == 0) {
+        /* stream read sets error indicator, EOF indicator,
+         * and errno for us */
+        return EOF;
+    }
+
+    /* return byte read cast as an int */
+    return (int) charbuf;
+}
+
 int CRUISE_WRAP(fgetc)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* read next character from file */
-        unsigned char charbuf;
-        size_t count = 1;
-        size_t retcount;
-        int read_rc = cruise_stream_read(stream, &charbuf, count, &retcount);
-        if (read_rc != CRUISE_SUCCESS || retcount == 0) {
-            /* stream read sets error indicator, EOF indicator,
-             * and errno for us */
-            return EOF;
-        }
-
-        /* return byte read cast as an int */
-        return (int) charbuf;
+        cruise_stream_lock(stream);
+        int ret = cruise_fgetc(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fgetc);
         int ret = CRUISE_REAL(fgetc)(stream);
@@ -1162,22 +1810,51 @@ int CRUISE_WRAP(fgetc)(FILE *stream)
     }
 }
 
-int CRUISE_WRAP(fputc)(int c, FILE *stream)
+int CRUISE_WRAP(fgetc_unlocked)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* write data to file */
-        unsigned char charbuf = (unsigned char) c;
-        size_t count = 1;
-        int write_rc = cruise_stream_write(stream, &charbuf, count);
-        if (write_rc != CRUISE_SUCCESS) {
-            /* stream write sets error indicator, EOF indicator,
-             * and errno for us */
-            return EOF;
-        }
+        return cruise_fgetc(stream);
+    } else {
+        MAP_OR_FAIL(fgetc_unlocked);
+        int ret = CRUISE_REAL(fgetc_unlocked)(stream);
+        return ret;
+    }
+}
 
-        /* return value written */
+/* writes byte c to stream, caller holds the stream lock */
+static inline int cruise_fputc(int c, FILE *stream)
+{
+    /* drop the byte straight into the buffer if we can */
+    unsigned char charbuf = (unsigned char) c;
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+    if (s->_w > 0) {
+        s->_w--;
+        *s->_p++ = charbuf;
         return (int) charbuf;
+    }
+
+    /* write data to file */
+    size_t count = 1;
+    int write_rc = cruise_stream_write(stream, &charbuf, count);
+    if (write_rc != CRUISE_SUCCESS) {
+        /* stream write sets error indicator, EOF indicator,
+         * and errno for us */
+        return EOF;
+    }
+
+    /* return value written */
+    return (int) charbuf;
+}
+
+int CRUISE_WRAP(fputc)(int c, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fputc(c, stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fputc);
         int ret = CRUISE_REAL(fputc)(c, stream);
@@ -1185,23 +1862,26 @@ int CRUISE_WRAP(fputc)(int c, FILE *stream)
     }
 }
 
-int CRUISE_WRAP(getc)(FILE *stream)
+int CRUISE_WRAP(fputc_unlocked)(int c, FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* read next character from file */
-        unsigned char charbuf;
-        size_t count = 1;
-        size_t retcount;
-        int read_rc = cruise_stream_read(stream, &charbuf, count, &retcount);
-        if (read_rc != CRUISE_SUCCESS || retcount == 0) {
-            /* stream read sets error indicator, EOF indicator,
-             * and errno for us */
-            return EOF;
-        }
+        return cruise_fputc(c, stream);
+    } else {
+        MAP_OR_FAIL(fputc_unlocked);
+        int ret = CRUISE_REAL(fputc_unlocked)(c, stream);
+        return ret;
+    }
+}
 
-        /* return byte read cast as an int */
-        return (int) charbuf;
+int CRUISE_WRAP(getc)(FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fgetc(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(getc);
         int ret = CRUISE_REAL(getc)(stream);
@@ -1209,22 +1889,26 @@ int CRUISE_WRAP(getc)(FILE *stream)
     }
 }
 
-int CRUISE_WRAP(putc)(int c, FILE *stream)
+int CRUISE_WRAP(getc_unlocked)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* write data to file */
-        unsigned char charbuf = (unsigned char) c;
-        size_t count = 1;
-        int write_rc = cruise_stream_write(stream, &charbuf, count);
-        if (write_rc != CRUISE_SUCCESS) {
-            /* stream write sets error indicator, EOF indicator,
-             * and errno for us */
-            return EOF;
-        }
+        return cruise_fgetc(stream);
+    } else {
+        MAP_OR_FAIL(getc_unlocked);
+        int ret = CRUISE_REAL(getc_unlocked)(stream);
+        return ret;
+    }
+}
 
-        /* return value written */
-        return (int) charbuf;
+int CRUISE_WRAP(putc)(int c, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fputc(c, stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(putc);
         int ret = CRUISE_REAL(putc)(c, stream);
@@ -1232,154 +1916,455 @@ int CRUISE_WRAP(putc)(int c, FILE *stream)
     }
 }
 
-char* CRUISE_WRAP(fgets)(char* s, int n, FILE* stream)
+int CRUISE_WRAP(putc_unlocked)(int c, FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* TODO: this isn't the most efficient algorithm, but it works,
-         * would be faster to read a large block of characters then
-         * scan for newline */
-
-        /* lookup stream */
-        cruise_stream_t* stm = (cruise_stream_t*) stream;
+        return cruise_fputc(c, stream);
+    } else {
+        MAP_OR_FAIL(putc_unlocked);
+        int ret = CRUISE_REAL(putc_unlocked)(c, stream);
+        return ret;
+    }
+}
 
-        /* TODO: check that stream is valid */
+/* glibc's inlined getc_unlocked calls __uflow when its read pointer
+ * runs out, which for our streams is always */
+int CRUISE_WRAP(__uflow)(FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        return cruise_fgetc(stream);
+    } else {
+        MAP_OR_FAIL(__uflow);
+        int ret = CRUISE_REAL(__uflow)(stream);
+        return ret;
+    }
+}
 
-        /* check that we got a positive buffer size */
-        if (n <= 0) {
-            /* caller specified a buffer length <= 0 */
-            stm->err = 1;
-            errno = ENOMEM;
-            return NULL;
+/* glibc's inlined putc_unlocked calls __overflow when its write
+ * pointer runs out, which for our streams is always, it also calls
+ * it with EOF just to flush */
+int CRUISE_WRAP(__overflow)(FILE *stream, int c)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        if (c == EOF) {
+            if (cruise_stream_flush(stream) != CRUISE_SUCCESS) {
+                return EOF;
+            }
+            return 0;
         }
+        return cruise_fputc(c, stream);
+    } else {
+        MAP_OR_FAIL(__overflow);
+        int ret = CRUISE_REAL(__overflow)(stream, c);
+        return ret;
+    }
+}
 
-        /* read one character at a time until we hit a newline, read
-         * n-1 characters or hit end of the file (or a read error) */
-        int limit = 0;
-        while (limit < n-1) {
-            /* read the next character from the file */
-            char charbuf;
-            size_t retcount;
-            int read_rc = cruise_stream_read(stream, &charbuf, 1, &retcount);
-            if (read_rc != CRUISE_SUCCESS) {
-                /* if error flag is not set, we must have hit EOF,
-                 * terminate string before returning */
-                if (! stm->err) {
-                    s[limit] = '\0';
-                }
+/* copy bytes from stream into buf up to and including the first
+ * occurrence of delim, stopping after at most count bytes, whole
+ * spans are copied out of the pointer window after scanning it with
+ * memchr, sets found if delim was copied, sets stream EOF and error
+ * indicators as appropriate, returns number of bytes copied in
+ * retcount, returns CRUISE error codes */
+static int cruise_stream_scan(
+  FILE* stream,
+  int delim,
+  char* buf,
+  size_t count,
+  size_t* retcount,
+  int* found)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-                /* stream read sets error indicator, EOF indicator,
-                 * and errno for us */
-                return NULL;
+    *retcount = 0;
+    *found    = 0;
+
+    size_t copied = 0;
+    while (copied < count) {
+        /* if the pointer window is empty, take one byte through the
+         * slow path, which refills the window */
+        if (s->_r == 0) {
+            unsigned char charbuf;
+            size_t bytes;
+            int read_rc = cruise_stream_read(stream, &charbuf, 1, &bytes);
+            if (read_rc != CRUISE_SUCCESS || bytes == 0) {
+                /* hit end of file or an error, stream read sets error
+                 * indicator, EOF indicator, and errno for us */
+                *retcount = copied;
+                if (s->err) {
+                    return read_rc;
+                }
+                return CRUISE_SUCCESS;
             }
 
             /* copy character to buffer */
-            s[limit] = charbuf;
-            limit++;
+            buf[copied] = (char) charbuf;
+            copied++;
 
-            /* if we hit a newline, break after copying it */
-            if (charbuf == '\n') {
+            /* stop if we hit the delimiter */
+            if (charbuf == (unsigned char) delim) {
+                *found = 1;
                 break;
             }
+            continue;
         }
 
-        /* terminate string with a NUL */
-        s[limit] = '\0';
+        /* scan the window for the delimiter */
+        size_t avail = s->_r;
+        if (avail > count - copied) {
+            avail = count - copied;
+        }
+        unsigned char* end = (unsigned char*) memchr(s->_p, delim, avail);
+        size_t bytes = avail;
+        if (end != NULL) {
+            bytes = (size_t) (end - s->_p) + 1;
+        }
 
-        return s;
-    } else {
-        MAP_OR_FAIL(fgets);
-        char* ret = CRUISE_REAL(fgets)(s, n, stream);
-        return ret;
+        /* copy span to buffer and consume it from the window */
+        memcpy(buf + copied, s->_p, bytes);
+        s->_p  += bytes;
+        s->_r  -= bytes;
+        copied += bytes;
+
+        /* stop if we hit the delimiter */
+        if (end != NULL) {
+            *found = 1;
+            break;
+        }
     }
+
+    *retcount = copied;
+    return CRUISE_SUCCESS;
 }
 
-int CRUISE_WRAP(fputs)(const char* s, FILE* stream)
+/* reads a line of at most n-1 bytes from stream into s, caller holds the stream lock */
+static char* cruise_fgets(char* s, int n, FILE* stream)
 {
-    /* check whether we should intercept this stream */
-    if (cruise_intercept_stream(stream)) {
-        /* TODO: check that s is not NULL */
+    /* lookup stream */
+    cruise_stream_t* stm = (cruise_stream_t*) stream;
 
-        /* get length of string, less the NUL-terminating byte */
-        size_t count = strlen(s);
+    /* TODO: check that stream is valid */
 
-        /* write data to file */
-        int write_rc = cruise_stream_write(stream, (const void*)s, count);
-        if (write_rc != CRUISE_SUCCESS) {
-            /* stream write sets error indicator, EOF indicator,
-             * and errno for us */
-            return EOF;
-        }
+    /* check that we got a positive buffer size */
+    if (n <= 0) {
+        /* caller specified a buffer length <= 0 */
+        cruise_stream_set_err(stm, 1);
+        errno = ENOMEM;
+        return NULL;
+    }
 
-        /* return success */
-        return 0;
-    } else {
-        MAP_OR_FAIL(fputs);
-        int ret = CRUISE_REAL(fputs)(s, stream);
-        return ret;
+    /* read characters until we hit a newline, read n-1
+     * characters or hit end of the file (or a read error) */
+    size_t limit;
+    int found;
+    int scan_rc = cruise_stream_scan(stream, '\n', s, (size_t) (n - 1), &limit, &found);
+    if (scan_rc != CRUISE_SUCCESS) {
+        /* stream read sets error indicator, EOF indicator,
+         * and errno for us */
+        return NULL;
+    }
+
+    /* if we hit the end of the file before reading anything,
+     * leave the buffer alone and return NULL */
+    if (limit == 0 && n > 1) {
+        return NULL;
     }
+
+    /* terminate string with a NUL */
+    s[limit] = '\0';
+
+    return s;
 }
 
-size_t CRUISE_WRAP(fread)(void *ptr, size_t size, size_t nitems, FILE *stream)
+char* CRUISE_WRAP(fgets)(char* s, int n, FILE* stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* must return 0 and do nothing if size or nitems is zero */
-        if (size == 0 || nitems == 0) {
-            return 0;
-        }
-
-        /* TODO: need to call fgetc size times? */
-        /* compute total number of bytes that we'll write */
-        size_t count = size * nitems;
-
-        /* read next character from file */
-        size_t retcount;
-        int read_rc = cruise_stream_read(stream, ptr, count, &retcount);
-        if (read_rc != CRUISE_SUCCESS) {
-            /* stream read sets error indicator, EOF indicator,
-             * and errno for us */
-            return 0;
-        }
-
-        /* return number of items read */
-        if (retcount < count) {
-            /* adjust return value if read less data than requested */
-            size_t nitems_read = retcount / size;
-            return nitems_read;
-        } else {
-            return nitems;
-        }
+        cruise_stream_lock(stream);
+        char* ret = cruise_fgets(s, n, stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
-        MAP_OR_FAIL(fread);
-        size_t ret = CRUISE_REAL(fread)(ptr, size, nitems, stream);
+        MAP_OR_FAIL(fgets);
+        char* ret = CRUISE_REAL(fgets)(s, n, stream);
         return ret;
     }
 }
 
-size_t CRUISE_WRAP(fwrite)(const void *ptr, size_t size, size_t nitems, FILE *stream)
+char* CRUISE_WRAP(fgets_unlocked)(char* s, int n, FILE* stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* must return 0 and do nothing if size or nitems is zero */
-        if (size == 0 || nitems == 0) {
-            return 0;
-        }
+        return cruise_fgets(s, n, stream);
+    } else {
+        MAP_OR_FAIL(fgets_unlocked);
+        char* ret = CRUISE_REAL(fgets_unlocked)(s, n, stream);
+        return ret;
+    }
+}
 
-        /* TODO: need to call fputc size times? */
-        /* compute total number of bytes that we'll write */
-        size_t count = size * nitems;
+/* reads bytes from stream up to delim into *lineptr, caller holds the stream lock */
+static ssize_t cruise_getdelim(char** lineptr, size_t* n, int delim, FILE* stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* write data to file */
-        int write_rc = cruise_stream_write(stream, ptr, count);
-        if (write_rc != CRUISE_SUCCESS) {
-            /* stream write sets error indicator, EOF indicator,
+    /* TODO: check that stream is valid */
+
+    /* check that we have somewhere to store the line */
+    if (lineptr == NULL || n == NULL) {
+        cruise_stream_set_err(s, 1);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* allocate an initial buffer if caller didn't give us one */
+    if (*lineptr == NULL || *n == 0) {
+        size_t newsize = 128;
+        char* newbuf = (char*) realloc(*lineptr, newsize);
+        if (newbuf == NULL) {
+            cruise_stream_set_err(s, 1);
+            errno = ENOMEM;
+            return -1;
+        }
+        *lineptr = newbuf;
+        *n       = newsize;
+    }
+
+    /* read spans into the caller's buffer, doubling it each time we
+     * fill it without finding the delimiter, always leave room for
+     * the terminating NUL */
+    size_t len = 0;
+    while (1) {
+        size_t bytes;
+        int found;
+        int scan_rc = cruise_stream_scan(stream, delim, *lineptr + len, *n - len - 1, &bytes, &found);
+        len += bytes;
+        if (scan_rc != CRUISE_SUCCESS) {
+            /* stream read sets error indicator, EOF indicator,
              * and errno for us */
-            return 0;
+            return -1;
+        }
+
+        /* done if we found the delimiter or hit the end of file */
+        if (found || len < *n - 1) {
+            break;
+        }
+
+        /* check that we don't overflow the return value */
+        if (*n > SSIZE_MAX / 2) {
+            cruise_stream_set_err(s, 1);
+            errno = EOVERFLOW;
+            return -1;
         }
 
-        /* return number of items written */
+        /* double the size of the buffer */
+        size_t newsize = *n * 2;
+        char* newbuf = (char*) realloc(*lineptr, newsize);
+        if (newbuf == NULL) {
+            cruise_stream_set_err(s, 1);
+            errno = ENOMEM;
+            return -1;
+        }
+        *lineptr = newbuf;
+        *n       = newsize;
+    }
+
+    /* nothing to return if we're already at the end of file */
+    if (len == 0) {
+        return -1;
+    }
+
+    /* terminate string with a NUL */
+    (*lineptr)[len] = '\0';
+
+    return (ssize_t) len;
+}
+
+ssize_t CRUISE_WRAP(getdelim)(char** lineptr, size_t* n, int delim, FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        ssize_t ret = cruise_getdelim(lineptr, n, delim, stream);
+        cruise_stream_unlock(stream);
+        return ret;
+    } else {
+        MAP_OR_FAIL(getdelim);
+        ssize_t ret = CRUISE_REAL(getdelim)(lineptr, n, delim, stream);
+        return ret;
+    }
+}
+
+/* glibc inlines getline as a call to __getdelim when optimizing */
+ssize_t CRUISE_WRAP(__getdelim)(char** lineptr, size_t* n, int delim, FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        ssize_t ret = CRUISE_WRAP(getdelim)(lineptr, n, delim, stream);
+        return ret;
+    } else {
+        MAP_OR_FAIL(__getdelim);
+        ssize_t ret = CRUISE_REAL(__getdelim)(lineptr, n, delim, stream);
+        return ret;
+    }
+}
+
+ssize_t CRUISE_WRAP(getline)(char** lineptr, size_t* n, FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        /* getline is getdelim with a newline delimiter */
+        ssize_t ret = CRUISE_WRAP(getdelim)(lineptr, n, '\n', stream);
+        return ret;
+    } else {
+        MAP_OR_FAIL(getline);
+        ssize_t ret = CRUISE_REAL(getline)(lineptr, n, stream);
+        return ret;
+    }
+}
+
+/* writes string s to stream, caller holds the stream lock */
+static int cruise_fputs(const char* s, FILE* stream)
+{
+    /* TODO: check that s is not NULL */
+
+    /* get length of string, less the NUL-terminating byte */
+    size_t count = strlen(s);
+
+    /* write data to file */
+    int write_rc = cruise_stream_write(stream, (const void*)s, count);
+    if (write_rc != CRUISE_SUCCESS) {
+        /* stream write sets error indicator, EOF indicator,
+         * and errno for us */
+        return EOF;
+    }
+
+    /* return success */
+    return 0;
+}
+
+int CRUISE_WRAP(fputs)(const char* s, FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fputs(s, stream);
+        cruise_stream_unlock(stream);
+        return ret;
+    } else {
+        MAP_OR_FAIL(fputs);
+        int ret = CRUISE_REAL(fputs)(s, stream);
+        return ret;
+    }
+}
+
+int CRUISE_WRAP(fputs_unlocked)(const char* s, FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        return cruise_fputs(s, stream);
+    } else {
+        MAP_OR_FAIL(fputs_unlocked);
+        int ret = CRUISE_REAL(fputs_unlocked)(s, stream);
+        return ret;
+    }
+}
+
+/* reads nitems items of size bytes from stream, caller holds the stream lock */
+static size_t cruise_fread(void *ptr, size_t size, size_t nitems, FILE *stream)
+{
+    /* must return 0 and do nothing if size or nitems is zero */
+    if (size == 0 || nitems == 0) {
+        return 0;
+    }
+
+    /* TODO: need to call fgetc size times? */
+    /* compute total number of bytes that we'll write */
+    size_t count = size * nitems;
+
+    /* read next character from file */
+    size_t retcount;
+    int read_rc = cruise_stream_read(stream, ptr, count, &retcount);
+    if (read_rc != CRUISE_SUCCESS) {
+        /* stream read sets error indicator, EOF indicator,
+         * and errno for us */
+        return 0;
+    }
+
+    /* return number of items read */
+    if (retcount < count) {
+        /* adjust return value if read less data than requested */
+        size_t nitems_read = retcount / size;
+        return nitems_read;
+    } else {
         return nitems;
+    }
+}
+
+size_t CRUISE_WRAP(fread)(void *ptr, size_t size, size_t nitems, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        size_t ret = cruise_fread(ptr, size, nitems, stream);
+        cruise_stream_unlock(stream);
+        return ret;
+    } else {
+        MAP_OR_FAIL(fread);
+        size_t ret = CRUISE_REAL(fread)(ptr, size, nitems, stream);
+        return ret;
+    }
+}
+
+size_t CRUISE_WRAP(fread_unlocked)(void *ptr, size_t size, size_t nitems, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        return cruise_fread(ptr, size, nitems, stream);
+    } else {
+        MAP_OR_FAIL(fread_unlocked);
+        size_t ret = CRUISE_REAL(fread_unlocked)(ptr, size, nitems, stream);
+        return ret;
+    }
+}
+
+/* writes nitems items of size bytes to stream, caller holds the stream lock */
+static size_t cruise_fwrite(const void *ptr, size_t size, size_t nitems, FILE *stream)
+{
+    /* must return 0 and do nothing if size or nitems is zero */
+    if (size == 0 || nitems == 0) {
+        return 0;
+    }
+
+    /* TODO: need to call fputc size times? */
+    /* compute total number of bytes that we'll write */
+    size_t count = size * nitems;
+
+    /* write data to file */
+    int write_rc = cruise_stream_write(stream, ptr, count);
+    if (write_rc != CRUISE_SUCCESS) {
+        /* stream write sets error indicator, EOF indicator,
+         * and errno for us */
+        return 0;
+    }
+
+    /* return number of items written */
+    return nitems;
+}
+
+size_t CRUISE_WRAP(fwrite)(const void *ptr, size_t size, size_t nitems, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        size_t ret = cruise_fwrite(ptr, size, nitems, stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fwrite);
         size_t ret = CRUISE_REAL(fwrite)(ptr, size, nitems, stream);
@@ -1387,6 +2372,18 @@ size_t CRUISE_WRAP(fwrite)(const void *ptr, size_t size, size_t nitems, FILE *st
     }
 }
 
+size_t CRUISE_WRAP(fwrite_unlocked)(const void *ptr, size_t size, size_t nitems, FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        return cruise_fwrite(ptr, size, nitems, stream);
+    } else {
+        MAP_OR_FAIL(fwrite_unlocked);
+        size_t ret = CRUISE_REAL(fwrite_unlocked)(ptr, size, nitems, stream);
+        return ret;
+    }
+}
+
 int CRUISE_WRAP(fprintf)(FILE *stream, const char* format, ...)
 {
     /* check whether we should intercept this stream */
@@ -1407,27 +2404,77 @@ int CRUISE_WRAP(fprintf)(FILE *stream, const char* format, ...)
     }
 }
 
-int CRUISE_WRAP(vfprintf)(FILE *stream, const char* format, va_list ap)
+/* formats output to stream, caller holds the stream lock */
+static int cruise_vfprintf(FILE *stream, const char* format, va_list ap)
 {
-    /* check whether we should intercept this stream */
-    if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* TODO: check that stream is active */
+    /* TODO: check that stream is active */
 
-        
-        /* get length of component string */
+    /* format straight into the stream buffer if the pointer window
+     * is open for writing and everything after the pointer is free
+     * space, vsnprintf stores a terminating NUL after the string,
+     * which must not land on file data we still have to keep */
+    if (s->_w > 0 && (size_t) (s->_p - s->win) >= s->buflen) {
+        /* try our own formatter first, it handles the common
+         * conversions much faster than vsnprintf */
         va_list ap2;
         va_copy(ap2, ap);
-        size_t chars = (size_t) vsnprintf(NULL, 0, format, ap2);
+        int format_rc = cruise_format((char*) s->_p, s->_w, format, ap2);
+        va_end(ap2);
+        if (format_rc >= 0) {
+            s->_p += format_rc;
+            s->_w -= (size_t) format_rc;
+            return format_rc;
+        }
+
+        va_copy(ap2, ap);
+        int printf_rc = vsnprintf((char*) s->_p, s->_w, format, ap2);
+        va_end(ap2);
+        if (printf_rc < 0) {
+            cruise_stream_set_err(s, 1);
+            /* assuming that vsnprintf sets errno for us */
+            return printf_rc;
+        }
+
+        /* if the string fit, just advance the pointer past it,
+         * otherwise fall back below, the full string overwrites
+         * whatever prefix vsnprintf left in the buffer */
+        if ((size_t) printf_rc < s->_w) {
+            s->_p += printf_rc;
+            s->_w -= (size_t) printf_rc;
+            return printf_rc;
+        }
+    }
+
+    /* otherwise format into a small buffer on the stack, and only
+     * allocate a string if the output doesn't fit there */
+    char strbuf[CRUISE_STREAM_PRINTF_BUFSIZE];
+    char* str = strbuf;
+
+    va_list ap2;
+    va_copy(ap2, ap);
+    int printf_rc = cruise_format(str, sizeof(strbuf), format, ap2);
+    va_end(ap2);
+    if (printf_rc < 0) {
+        va_copy(ap2, ap);
+        printf_rc = vsnprintf(str, sizeof(strbuf), format, ap2);
         va_end(ap2);
+        if (printf_rc < 0) {
+            cruise_stream_set_err(s, 1);
+            /* assuming that vsnprintf sets errno for us */
+            return printf_rc;
+        }
+    }
+    size_t chars = (size_t) printf_rc;
 
+    if (chars >= sizeof(strbuf)) {
         /* allocate space to hold string, add one for the terminating NUL */
         size_t strlen = chars + 1;
-        char* str = (char*) malloc(strlen);
+        str = (char*) malloc(strlen);
         if (str == NULL) {
-            s->err = 1;
+            cruise_stream_set_err(s, 1);
             errno = ENOMEM;
             return -1;
         }
@@ -1435,27 +2482,42 @@ int CRUISE_WRAP(vfprintf)(FILE *stream, const char* format, va_list ap)
         /* copy formatted string into new memory */
         va_list ap3;
         va_copy(ap3, ap);
-        int printf_rc = vsnprintf(str, strlen, format, ap3);
+        printf_rc = vsnprintf(str, strlen, format, ap3);
         va_end(ap3);
-        if (printf_rc != chars) {
-            s->err = 1;
+        if (printf_rc != (int) chars) {
+            free(str);
+            cruise_stream_set_err(s, 1);
             /* assuming that vsnprintf sets errno for us */
-            return printf_rc;
-        }
-
-        /* write data to file */
-        int write_rc = cruise_stream_write(stream, str, chars);
-        if (write_rc != CRUISE_SUCCESS) {
-            /* stream write sets error indicator, EOF indicator,
-             * and errno for us */
             return -1;
         }
+    }
+
+    /* write data to file */
+    int write_rc = cruise_stream_write(stream, str, chars);
 
-        /* free the string */
+    /* free the string */
+    if (str != strbuf) {
         free(str);
+    }
 
-        /* return number of bytes written */
-        return chars;
+    if (write_rc != CRUISE_SUCCESS) {
+        /* stream write sets error indicator, EOF indicator,
+         * and errno for us */
+        return -1;
+    }
+
+    /* return number of bytes written */
+    return chars;
+}
+
+int CRUISE_WRAP(vfprintf)(FILE *stream, const char* format, va_list ap)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_vfprintf(stream, format, ap);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         va_list ap2;
         va_copy(ap2, ap);
@@ -1489,14 +2551,26 @@ int CRUISE_WRAP(fscanf)(FILE *stream, const char* format, ...)
 /* need to declare this before calling it */
 static int __svfscanf(cruise_stream_t *fp, const char *fmt0, va_list ap);
 
+/* scans input from stream, caller holds the stream lock */
+static int cruise_vfscanf(FILE *stream, const char* format, va_list ap)
+{
+    va_list args;
+    va_copy(args, ap);
+    int ret = __svfscanf((cruise_stream_t*)stream, format, args);
+    va_end(args);
+
+    /* commit what scanf consumed to the file position */
+    cruise_stream_sync((cruise_stream_t*)stream);
+    return ret;
+}
+
 int CRUISE_WRAP(vfscanf)(FILE *stream, const char* format, va_list ap)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        va_list args;
-        va_copy(args, ap);
-        int ret = __svfscanf((cruise_stream_t*)stream, format, args);
-        va_end(args);
+        cruise_stream_lock(stream);
+        int ret = cruise_vfscanf(stream, format, ap);
+        cruise_stream_unlock(stream);
         return ret;
     } else {
         va_list args;
@@ -1514,7 +2588,9 @@ int CRUISE_WRAP(fseek)(FILE *stream, long offset, int whence)
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
         off_t offset_offt = (off_t) offset;
+        cruise_stream_lock(stream);
         int rc = cruise_fseek(stream, offset_offt, whence);
+        cruise_stream_unlock(stream);
         return rc;
     } else {
         MAP_OR_FAIL(fseek);
@@ -1527,7 +2603,9 @@ int CRUISE_WRAP(fseeko)(FILE *stream, off_t offset, int whence)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
         int rc = cruise_fseek(stream, offset, whence);
+        cruise_stream_unlock(stream);
         return rc;
     } else {
         MAP_OR_FAIL(fseeko);
@@ -1536,26 +2614,38 @@ int CRUISE_WRAP(fseeko)(FILE *stream, off_t offset, int whence)
     }
 }
 
+/* returns current position of stream as a long, caller holds the stream lock */
+static long cruise_ftell(FILE *stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* get pointer to file descriptor structure */
+    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
+    if (filedesc == NULL) {
+        /* ERROR: invalid file descriptor */
+        cruise_stream_set_err(s, 1);
+        errno = EBADF;
+        return (long)-1;
+    }
+
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
+
+    /* get current position */
+    off_t current_pos = filedesc->pos;
+    return (long)current_pos;
+}
+
 /* TODO: set EOVERFLOW if position overflows long */
 long CRUISE_WRAP(ftell)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
-
-        /* get pointer to file descriptor structure */
-        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
-        if (filedesc == NULL) {
-            /* ERROR: invalid file descriptor */
-            s->err = 1;
-            errno = EBADF;
-            return (long)-1;
-        }
-
-        /* get current position */
-        off_t current_pos = filedesc->pos;
-        return (long)current_pos;
+        cruise_stream_lock(stream);
+        long ret = cruise_ftell(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(ftell);
         long ret = CRUISE_REAL(ftell)(stream);
@@ -1563,25 +2653,37 @@ long CRUISE_WRAP(ftell)(FILE *stream)
     }
 }
 
+/* returns current position of stream, caller holds the stream lock */
+static off_t cruise_ftello(FILE *stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* get pointer to file descriptor structure */
+    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
+    if (filedesc == NULL) {
+        /* ERROR: invalid file descriptor */
+        cruise_stream_set_err(s, 1);
+        errno = EBADF;
+        return (off_t)-1;
+    }
+
+    /* account for anything done through the pointer window */
+    cruise_stream_sync(s);
+
+    /* get current position */
+    off_t current_pos = filedesc->pos;
+    return current_pos;
+}
+
 off_t CRUISE_WRAP(ftello)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
-
-        /* get pointer to file descriptor structure */
-        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
-        if (filedesc == NULL) {
-            /* ERROR: invalid file descriptor */
-            s->err = 1;
-            errno = EBADF;
-            return (off_t)-1;
-        }
-
-        /* get current position */
-        off_t current_pos = filedesc->pos;
-        return current_pos;
+        cruise_stream_lock(stream);
+        off_t ret = cruise_ftello(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(ftello);
         off_t ret = CRUISE_REAL(ftello)(stream);
@@ -1589,28 +2691,37 @@ off_t CRUISE_WRAP(ftello)(FILE *stream)
     }
 }
 
-/* equivalent to fseek(stream, 0L, SEEK_SET) except shall also clear
- * error indicator */
-void CRUISE_WRAP(rewind)(FILE* stream)
+/* seeks stream to the start and clears its error indicator, caller holds the stream lock */
+static void cruise_rewind(FILE* stream)
 {
-    /* check whether we should intercept this stream */
-    if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* TODO: check that stream is active */
+    /* TODO: check that stream is active */
 
-        /* seek to front of file */
-        int rc = cruise_fseek(stream, (off_t) 0L, SEEK_SET);
+    /* seek to front of file */
+    int rc = cruise_fseek(stream, (off_t) 0L, SEEK_SET);
 
-        /* set errno */
-        errno = cruise_err_map_to_errno(rc);
+    /* set errno */
+    errno = cruise_err_map_to_errno(rc);
 
-        /* clear error indicator if seek successful */
-        if (rc == 0) {
-            s->err = 0;
-        }
+    /* clear error indicator if seek successful */
+    if (rc == 0) {
+        cruise_stream_set_err(s, 0);
+    }
 
+    return;
+}
+
+/* equivalent to fseek(stream, 0L, SEEK_SET) except shall also clear
+ * error indicator */
+void CRUISE_WRAP(rewind)(FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        cruise_rewind(stream);
+        cruise_stream_unlock(stream);
         return;
     } else {
         MAP_OR_FAIL(rewind);
@@ -1623,44 +2734,54 @@ struct cruise_fpos_t {
     off_t pos;
 };
 
-int CRUISE_WRAP(fgetpos)(FILE* stream, fpos_t* pos)
+/* records current position of stream in pos, caller holds the stream lock */
+static int cruise_fgetpos(FILE* stream, fpos_t* pos)
 {
-    /* check whether we should intercept this stream */
-    if (cruise_intercept_stream(stream)) {
-        /* check that we can store a pointer in fpos_t */
-        if (! cruise_fpos_enabled) {
-            errno = EOVERFLOW;
-            return 1;
-        }
+    /* check that we can store a pointer in fpos_t */
+    if (! cruise_fpos_enabled) {
+        errno = EOVERFLOW;
+        return 1;
+    }
 
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* TODO: check that stream is active */
+    /* TODO: check that stream is active */
 
-        /* get file descriptor for stream */
-        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
-        if (filedesc == NULL) {
-            /* ERROR: invalid file descriptor */
-            errno = EBADF;
-            return 1;
-        }
+    /* get file descriptor for stream */
+    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
+    if (filedesc == NULL) {
+        /* ERROR: invalid file descriptor */
+        errno = EBADF;
+        return 1;
+    }
 
-        /* allocate memory to hold state of stream */
-        struct cruise_fpos_t* state = malloc(sizeof(struct cruise_fpos_t));
-        if (state == NULL) {
-            errno = ENOMEM;
-            return 1;
-        }
+    /* allocate memory to hold state of stream */
+    struct cruise_fpos_t* state = malloc(sizeof(struct cruise_fpos_t));
+    if (state == NULL) {
+        errno = ENOMEM;
+        return 1;
+    }
 
-        /* record state */
-        state->pos = filedesc->pos;
+    /* record state */
+    cruise_stream_sync(s);
+    state->pos = filedesc->pos;
 
-        /* save pointer to state in output parameter */
-        void** ptr = (void**) pos;
-        *ptr = (void*) state;
+    /* save pointer to state in output parameter */
+    void** ptr = (void**) pos;
+    *ptr = (void*) state;
 
-        return 0;
+    return 0;
+}
+
+int CRUISE_WRAP(fgetpos)(FILE* stream, fpos_t* pos)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fgetpos(stream, pos);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fgetpos);
         int ret = CRUISE_REAL(fgetpos)(stream, pos);
@@ -1668,37 +2789,46 @@ int CRUISE_WRAP(fgetpos)(FILE* stream, fpos_t* pos)
     }
 }
 
-int CRUISE_WRAP(fsetpos)(FILE* stream, const fpos_t* pos)
+/* restores position of stream from pos, caller holds the stream lock */
+static int cruise_fsetpos(FILE* stream, const fpos_t* pos)
 {
-    /* check whether we should intercept this stream */
-    if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* TODO: check that stream is active */
+    /* TODO: check that stream is active */
 
-        /* check that we can store a pointer in fpos_t */
-        if (! cruise_fpos_enabled) {
-            s->err = 1;
-            errno = EOVERFLOW;
-            return -1;
-        }
+    /* check that we can store a pointer in fpos_t */
+    if (! cruise_fpos_enabled) {
+        cruise_stream_set_err(s, 1);
+        errno = EOVERFLOW;
+        return -1;
+    }
 
-        /* get pointer to state from pos input parameter,
-         * assumes pos is a pointer to void*, deference to get value
-         * of void*, which we then cast to a state pointer, ugh */
-        struct cruise_fpos_t* state = (struct cruise_fpos_t*) *(void**) pos;
+    /* get pointer to state from pos input parameter,
+     * assumes pos is a pointer to void*, deference to get value
+     * of void*, which we then cast to a state pointer, ugh */
+    struct cruise_fpos_t* state = (struct cruise_fpos_t*) *(void**) pos;
 
-        /* semantics of fsetpos seem to match a seek */
-        int seek_rc = cruise_fseek(stream, state->pos, SEEK_SET);
-        if (seek_rc != 0) {
-            return seek_rc;
-        }
+    /* semantics of fsetpos seem to match a seek */
+    int seek_rc = cruise_fseek(stream, state->pos, SEEK_SET);
+    if (seek_rc != 0) {
+        return seek_rc;
+    }
 
-        /* free memory */
-        free(state);
+    /* free memory */
+    free(state);
 
-        return 0;
+    return 0;
+}
+
+int CRUISE_WRAP(fsetpos)(FILE* stream, const fpos_t* pos)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fsetpos(stream, pos);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fsetpos);
         int ret = CRUISE_REAL(fsetpos)(stream, pos);
@@ -1706,6 +2836,21 @@ int CRUISE_WRAP(fsetpos)(FILE* stream, const fpos_t* pos)
     }
 }
 
+/* flushes output on stream, caller holds the stream lock */
+static int cruise_fflush(FILE* stream)
+{
+    /* TODO: check that stream is active */
+
+    /* flush output on stream */
+    int rc = cruise_stream_flush(stream);
+    if (rc != CRUISE_SUCCESS) {
+        /* ERROR: flush sets error indicator and errno */
+        return EOF;
+    }
+
+    return 0;
+}
+
 int CRUISE_WRAP(fflush)(FILE* stream)
 {
     /* if stream is NULL, flush output on all streams */
@@ -1717,13 +2862,15 @@ int CRUISE_WRAP(fflush)(FILE* stream)
         int ret = CRUISE_REAL(fflush)(NULL);
 
         /* flush each active cruise stream */
-        int fid;
-        for (fid = 0; fid < CRUISE_MAX_FILEDESCS; fid++) {
+        int fd;
+        for (fd = 0; fd < CRUISE_MAX_FILEDESCS; fd++) {
             /* get stream and check whether it's active */
-            cruise_stream_t* s = &(cruise_streams[fid]);
+            cruise_stream_t* s = &(cruise_streams[fd]);
             if (s->fd >= 0) {
                 /* attempt to flush stream */
+                cruise_stream_lock((FILE*)s);
                 int flush_rc = cruise_stream_flush((FILE*)s);
+                cruise_stream_unlock((FILE*)s);
                 if (flush_rc != CRUISE_SUCCESS) {
                     /* ERROR: flush sets error indicator and errno */
                     ret = EOF;
@@ -1736,19 +2883,10 @@ int CRUISE_WRAP(fflush)(FILE* stream)
 
     /* otherwise, check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
-
-        /* TODO: check that stream is active */
-
-        /* flush output on stream */
-        int rc = cruise_stream_flush(stream);
-        if (rc != CRUISE_SUCCESS) {
-            /* ERROR: flush sets error indicator and errno */
-            return EOF;
-        }
-
-        return 0;
+        cruise_stream_lock(stream);
+        int ret = cruise_fflush(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fflush);
         int ret = CRUISE_REAL(fflush)(stream);
@@ -1756,18 +2894,44 @@ int CRUISE_WRAP(fflush)(FILE* stream)
     }
 }
 
+int CRUISE_WRAP(fflush_unlocked)(FILE* stream)
+{
+    /* flushing all streams goes through fflush */
+    if (stream == NULL) {
+        return CRUISE_WRAP(fflush)(NULL);
+    }
+
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        return cruise_fflush(stream);
+    } else {
+        MAP_OR_FAIL(fflush_unlocked);
+        int ret = CRUISE_REAL(fflush_unlocked)(stream);
+        return ret;
+    }
+}
+
+/* returns end-of-file indicator of stream, caller holds the stream lock */
+static int cruise_feof(FILE *stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* TODO: ensure stream is active */
+
+    int ret = s->eof;
+    return ret;
+}
+
 /* return non-zero if and only if end-of-file indicator is set
  * for stream */
 int CRUISE_WRAP(feof)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
-
-        /* TODO: ensure stream is active */
-
-        int ret = s->eof;
+        cruise_stream_lock(stream);
+        int ret = cruise_feof(stream);
+        cruise_stream_unlock(stream);
         return ret;
     } else {
         MAP_OR_FAIL(feof);
@@ -1776,16 +2940,37 @@ int CRUISE_WRAP(feof)(FILE *stream)
     }
 }
 
-int CRUISE_WRAP(ferror)(FILE* stream)
+int CRUISE_WRAP(feof_unlocked)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream and file descriptor */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+        return cruise_feof(stream);
+    } else {
+        MAP_OR_FAIL(feof_unlocked);
+        int ret = CRUISE_REAL(feof_unlocked)(stream);
+        return ret;
+    }
+}
+
+/* returns error indicator of stream, caller holds the stream lock */
+static int cruise_ferror(FILE* stream)
+{
+    /* lookup stream and file descriptor */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
+
+    /* TODO: ensure stream is active */
 
-        /* TODO: ensure stream is active */
+    int ret = s->err;
+    return ret;
+}
 
-        int ret = s->err;
+int CRUISE_WRAP(ferror)(FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_ferror(stream);
+        cruise_stream_unlock(stream);
         return ret;
     } else {
         MAP_OR_FAIL(ferror);
@@ -1794,18 +2979,39 @@ int CRUISE_WRAP(ferror)(FILE* stream)
     }
 }
 
-void CRUISE_WRAP(clearerr)(FILE* stream)
+int CRUISE_WRAP(ferror_unlocked)(FILE* stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+        return cruise_ferror(stream);
+    } else {
+        MAP_OR_FAIL(ferror_unlocked);
+        int ret = CRUISE_REAL(ferror_unlocked)(stream);
+        return ret;
+    }
+}
+
+/* clears end-of-file and error indicators of stream, caller holds the stream lock */
+static void cruise_clearerr(FILE* stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* TODO: ensure stream is active */
+    /* TODO: ensure stream is active */
+
+    /* clear error and end-of-file indicators for stream */
+    cruise_stream_set_err(s, 0);
+    cruise_stream_set_eof(s, 0);
+    return;
+}
 
-        /* clear error and end-of-file indicators for stream */
-        s->err = 0;
-        s->eof = 0;
+void CRUISE_WRAP(clearerr)(FILE* stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        cruise_clearerr(stream);
+        cruise_stream_unlock(stream);
         return;
     } else {
         MAP_OR_FAIL(clearerr);
@@ -1815,22 +3021,49 @@ void CRUISE_WRAP(clearerr)(FILE* stream)
 
 }
 
-int CRUISE_WRAP(fileno)(FILE *stream)
+void CRUISE_WRAP(clearerr_unlocked)(FILE* stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+        cruise_clearerr(stream);
+        return;
+    } else {
+        MAP_OR_FAIL(clearerr_unlocked);
+        CRUISE_REAL(clearerr_unlocked)(stream);
+        return;
+    }
+}
 
-        /* TODO: check that stream is valid */
-        int fd = s->fd;
-        if (fd < 0) {
-            errno = EBADF;
-            return -1;
-        }
+/* returns file descriptor of stream, caller holds the stream lock */
+static int cruise_fileno(FILE *stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* return file descriptor associated with stream */
-        return fd;
+    /* TODO: check that stream is valid */
+    int fd = s->fd;
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* caller may use the file descriptor directly, so bring its
+     * position up to date */
+    cruise_stream_sync(s);
+
+    /* return file descriptor associated with stream, shifted past
+     * the system range like those returned from open */
+    return fd + cruise_fd_limit;
+}
+
+int CRUISE_WRAP(fileno)(FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fileno(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fileno);
         int ret = CRUISE_REAL(fileno)(stream);
@@ -1838,52 +3071,75 @@ int CRUISE_WRAP(fileno)(FILE *stream)
     }
 }
 
-int CRUISE_WRAP(fclose)(FILE *stream)
+int CRUISE_WRAP(fileno_unlocked)(FILE *stream)
 {
     /* check whether we should intercept this stream */
     if (cruise_intercept_stream(stream)) {
-        /* lookup stream */
-        cruise_stream_t* s = (cruise_stream_t*) stream;
+        return cruise_fileno(stream);
+    } else {
+        MAP_OR_FAIL(fileno_unlocked);
+        int ret = CRUISE_REAL(fileno_unlocked)(stream);
+        return ret;
+    }
+}
 
-        /* get the file id for this file descriptor */
-        int fid = cruise_get_fid_from_fd(s->fd);
-        if (fid < 0) {
-            errno = EBADF;
-            return EOF;
-        }
+/* flushes and closes stream, caller holds the stream lock */
+static int cruise_fclose(FILE *stream)
+{
+    /* lookup stream */
+    cruise_stream_t* s = (cruise_stream_t*) stream;
 
-        /* flush stream */
-        int flush_rc = cruise_stream_flush(stream);
-        if (flush_rc != CRUISE_SUCCESS) {
-            /* ERROR: flush sets error indicator and errno */
-            return EOF;
-        }
+    /* get the file id for this file descriptor */
+    int fid = cruise_get_fid_from_fd(s->fd);
+    if (fid < 0) {
+        errno = EBADF;
+        return EOF;
+    }
 
-        /* free the buffer */
-        if (s->buffree) {
-            free(s->buf);
-            s->buf = NULL;
-            s->buffree = 0;
-        }
+    /* flush stream and release its window */
+    int unmap_rc = cruise_stream_unmap(stream);
+    if (unmap_rc != CRUISE_SUCCESS) {
+        /* ERROR: unmap sets error indicator and errno */
+        return EOF;
+    }
 
-        /* free the push back buffer */
-        if (s->ubuf != NULL) {
-            free(s->ubuf);
-            s->ubuf = NULL;
-        }
+    /* return the buffer to our pool */
+    if (s->buffree) {
+        cruise_bufpool_put(s->buf, s->bufalloc);
+        s->buf = NULL;
+        s->buffree = 0;
+    }
 
-        /* close the file */
-        int close_rc = cruise_fid_close(fid);
-        if (close_rc != CRUISE_SUCCESS) {
-            errno = cruise_err_map_to_errno(close_rc);
-            return EOF;
-        }
+    /* free the push back buffer */
+    if (s->ubuf != NULL) {
+        free(s->ubuf);
+        s->ubuf = NULL;
+    }
 
-        /* set file descriptor to -1 to indicate stream is invalid */
-        s->fd = -1;
+    /* close the file descriptor, which closes the file once no other
+     * descriptor refers to it */
+    int close_rc = cruise_fd_free(s->fd);
 
-        /* currently a no-op */
-        return 0;
+    /* set file descriptor to -1 to indicate stream is invalid */
+    s->fd = -1;
+
+    if (close_rc != CRUISE_SUCCESS) {
+        errno = cruise_err_map_to_errno(close_rc);
+        return EOF;
+    }
+
+    /* currently a no-op */
+    return 0;
+}
+
+int CRUISE_WRAP(fclose)(FILE *stream)
+{
+    /* check whether we should intercept this stream */
+    if (cruise_intercept_stream(stream)) {
+        cruise_stream_lock(stream);
+        int ret = cruise_fclose(stream);
+        cruise_stream_unlock(stream);
+        return ret;
     } else {
         MAP_OR_FAIL(fclose);
         int ret = CRUISE_REAL(fclose)(stream);
@@ -1902,7 +3158,7 @@ int CRUISE_WRAP(fwprintf)(FILE *stream, const wchar_t* format, ...)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return -1;
     } else {
@@ -1924,7 +3180,7 @@ int CRUISE_WRAP(fwscanf)(FILE *stream, const wchar_t* format, ...)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return EOF;
     } else {
@@ -1946,7 +3202,7 @@ int CRUISE_WRAP(vfwprintf)(FILE *stream, const wchar_t* format, va_list arg)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return -1;
     } else {
@@ -1968,7 +3224,7 @@ int CRUISE_WRAP(vfwscanf)(FILE *stream, const wchar_t* format, va_list arg)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return EOF;
     } else {
@@ -1990,7 +3246,7 @@ wint_t CRUISE_WRAP(fgetwc)(FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return WEOF;
     } else {
@@ -2009,7 +3265,7 @@ wchar_t* CRUISE_WRAP(fgetws)(wchar_t* s, int n, FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return NULL;
     } else {
@@ -2028,7 +3284,7 @@ wint_t CRUISE_WRAP(fputwc)(wchar_t wc, FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return WEOF;
     } else {
@@ -2047,7 +3303,7 @@ int CRUISE_WRAP(fputws)(const wchar_t* s, FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return -1;
     } else {
@@ -2066,7 +3322,7 @@ int CRUISE_WRAP(fwide)(FILE *stream, int mode)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return 0;
     } else {
@@ -2085,7 +3341,7 @@ wint_t CRUISE_WRAP(getwc)(FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return WEOF;
     } else {
@@ -2104,7 +3360,7 @@ wint_t CRUISE_WRAP(putwc)(wchar_t c, FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return WEOF;
     } else {
@@ -2123,7 +3379,7 @@ wint_t CRUISE_WRAP(ungetwc)(wint_t c, FILE *stream)
 
         /* lookup stream */
         cruise_stream_t* s = (cruise_stream_t*) stream;
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EIO;
         return WEOF;
     } else {
@@ -2266,77 +3522,64 @@ static int __srefill(cruise_stream_t* stream)
     /* lookup stream */
     cruise_stream_t* s = (cruise_stream_t*) stream;
 
+    /* account for what we've consumed so far */
+    cruise_stream_sync(s);
+
     /* get pointer to file descriptor structure */
     cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(s->fd);
     if (filedesc == NULL) {
        /* ERROR: invalid file descriptor */
-       s->err = 1;
+       cruise_stream_set_err(s, 1);
        errno = EBADF;
        return 1;
     }
             
     /* bail with error if stream not open for reading */
     if (! filedesc->read) {
-        s->err = 1;
+        cruise_stream_set_err(s, 1);
         errno = EBADF;
         return 1;
     }
 
-    /* associate buffer with stream if we need to */
-    if (s->buf == NULL) {
-        int setvbuf_rc = cruise_setvbuf((FILE*)stream, NULL, s->buftype, CRUISE_STREAM_BUFSIZE);
-        if (setvbuf_rc != CRUISE_SUCCESS) {
-            /* ERROR: failed to associate buffer */
-            s->err = 1;
-            errno = cruise_err_map_to_errno(setvbuf_rc);
-            return 1;
-        }
-    }
-
     /* if we have anything on the push back buffer, that must be
      * our current file pointer, since any seek would have cleared
      * the buffer and each read/write/unget keeps it up-to-date */
     if (s->ubuflen > 0) {
-        s->_p = s->ubuf + s->ubufsize - s->ubuflen;
-        s->_r = s->ubuflen;
-        return 1;
+        s->_p    = s->ubuf + s->ubufsize - s->ubuflen;
+        s->_r    = s->ubuflen;
+        s->_mode = CRUISE_STREAM_PTR_UNGET;
+        return 0;
     }
 
-    /* check that current falls within buffer */
+    /* check that current falls within window */
     off_t current = filedesc->pos;
     off_t start  = s->bufpos;
     off_t length = s->buflen;
-    if (current < start || current >= start + length) {
-        /* current is outside the range of our buffer */
-
-        /* flush buffer if needed before read */
-        int flush_rc = cruise_stream_flush((FILE*)stream);
-        if (flush_rc != CRUISE_SUCCESS) {
-            /* ERROR: flush sets error indicator and errno */
+    if (s->win == NULL || current < start || current >= start + length) {
+        /* current is outside the range of our window, move it */
+        int map_rc = cruise_stream_map((FILE*)stream, current, 0, 1);
+        if (map_rc != CRUISE_SUCCESS) {
+            /* ERROR: map sets error indicator and errno */
             return 1;
         }
 
-        /* read data from file into buffer */
-        size_t bufcount;
-        int read_rc = cruise_fd_read(s->fd, current, s->buf, s->bufsize, &bufcount);
-        if (read_rc != CRUISE_SUCCESS) {
-            /* ERROR: read error, set error indicator and errno */
-            s->err = 1;
-            errno = cruise_err_map_to_errno(read_rc);
+        /* nothing left if window still doesn't cover current */
+        start  = s->bufpos;
+        length = s->buflen;
+        if (s->win == NULL || current < start || current >= start + length) {
+            s->_p = NULL;
+            s->_r = 0;
             return 1;
         }
-
-        /* record new buffer range within file */
-        s->bufpos = current;
-        s->buflen = bufcount;
     }
 
-    /* determine number of bytes to copy from stream buffer */
+    /* point at bytes remaining in window */
     size_t stream_offset    = (size_t) (current - s->bufpos);
     size_t stream_remaining = s->buflen - stream_offset;
-    unsigned char* stream_start = (unsigned char*)s->buf + stream_offset;
-    s->_p = stream_start;
-    s->_r = stream_remaining;
+    unsigned char* stream_start = s->win + stream_offset;
+    s->_p    = stream_start;
+    s->_r    = stream_remaining;
+    s->_mode = CRUISE_STREAM_PTR_READ;
 
     if (stream_remaining == 0) {
         return 1;
@@ -2653,14 +3896,14 @@ parseint(cruise_stream_t *fp, char * __restrict buf, int width, int base, int fl
 			break;		/* EOF */
 	}
 	/*
-	 * If we had only a sign, it is no good; push back the sign.
+	 * If we had only a sign, it is no good; the sign stays read,
+	 * as with glibc, since only the byte that stopped us goes back.
 	 * If the number ends in `x', it was [sign] '0' 'x', so push
 	 * back the x and treat it as [sign] '0'.
 	 */
 	if (flags & NDIGITS) {
-		if (p > buf)
-			//ATM (void) __ungetc(*(u_char *)--p, fp);
-			(void) ungetc(*(u_char *)--p, (FILE*)fp);
+		//ATM if (p > buf)
+		//ATM 	(void) __ungetc(*(u_char *)--p, fp);
 		return (0);
 	}
 	c = ((u_char *)p)[-1];
@@ -2672,6 +3915,204 @@ parseint(cruise_stream_t *fp, char * __restrict buf, int width, int base, int fl
 	return (p - buf);
 }
 
+/*
+ * Fast paths for %d, %u, and floating-point conversions that parse
+ * a number straight out of the stream's pointer window instead of
+ * copying it byte by byte into buf.  They only take numbers that end
+ * before the end of the window, so the byte following the number is
+ * in hand, and return 0 without consuming anything for anything they
+ * don't handle, which leaves it to parseint/parsefloat.
+ */
+
+/* true if all 8 bytes of v are ASCII digits, each byte must be 0x3X
+ * and stay 0x3X when 6 is added */
+#define CRUISE_SCAN_ALLDIGITS(v) \
+    ((((v) & 0xF0F0F0F0F0F0F0F0ULL) | \
+      ((((v) + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == \
+     0x3333333333333333ULL)
+
+/* converts 8 ASCII digits loaded little-endian into their value by
+ * combining pairs, then quads, then the two halves */
+static uint32_t cruise_scan_eight(uint64_t v)
+{
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t) v;
+}
+
+/* reads decimal digits starting at p and stopping before end, adds up
+ * to max of them to *value, counts them all in *count,
+ * returns pointer to the first byte that is not a digit */
+static const u_char* cruise_scan_digits(
+    const u_char* p,
+    const u_char* end,
+    uint64_t* value,
+    int* count,
+    int max)
+{
+    uint64_t v = *value;
+    int n = *count;
+
+    /* eight at a time while they all fit */
+    while (end - p >= 8 && n + 8 <= max) {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        if (! CRUISE_SCAN_ALLDIGITS(chunk)) {
+            break;
+        }
+        v = v * 100000000ULL + cruise_scan_eight(chunk);
+        n += 8;
+        p += 8;
+    }
+
+    /* then one at a time */
+    while (p < end && isdigit(*p)) {
+        if (n < max) {
+            v = v * 10 + (uint64_t) (*p - '0');
+        }
+        n++;
+        p++;
+    }
+
+    *value = v;
+    *count = n;
+    return p;
+}
+
+/* fast path for base 10 integers, sets *res like strtoimax/strtoumax
+ * would, returns number of bytes consumed or 0 */
+static int cruise_scan_int(cruise_stream_t* fp, uintmax_t* res)
+{
+    const u_char* p   = fp->_p;
+    const u_char* end = fp->_p + fp->_r;
+
+    int neg = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    /* up to 18 digits can't overflow, leave longer ones to strtoimax */
+    uint64_t value = 0;
+    int count = 0;
+    p = cruise_scan_digits(p, end, &value, &count, 18);
+    if (count == 0 || count > 18 || p == end) {
+        return 0;
+    }
+
+    *res = neg ? - (uintmax_t) value : (uintmax_t) value;
+    return (int) (p - fp->_p);
+}
+
+/* exact powers of ten as doubles */
+static const double cruise_scan_pow10[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* fast path for decimal floating point numbers, returns number of
+ * bytes consumed or 0, if the value can be computed exactly with one
+ * rounding (Clinger's fast path) sets *res and *exact, otherwise the
+ * caller converts the number in place with strtod */
+static int cruise_scan_float(cruise_stream_t* fp, double* res, int* exact)
+{
+    const u_char* p   = fp->_p;
+    const u_char* end = fp->_p + fp->_r;
+
+    int neg = 0;
+    if (p < end && (*p == '+' || *p == '-')) {
+        neg = (*p == '-');
+        p++;
+    }
+
+    /* skip leading zeros, they don't count against the 19 digits
+     * we can hold in a 64-bit mantissa */
+    int zeros = 0;
+    while (p < end && *p == '0') {
+        zeros++;
+        p++;
+    }
+
+    /* integer digits, then fraction digits */
+    uint64_t mant = 0;
+    int intdigits = 0;
+    p = cruise_scan_digits(p, end, &mant, &intdigits, 19);
+    int fracdigits = 0;
+    int fraczeros = 0;
+    if (p < end && *p == '.') {
+        p++;
+        if (intdigits == 0) {
+            /* zeros right after the point shift the exponent */
+            while (p < end && *p == '0') {
+                fraczeros++;
+                p++;
+            }
+        }
+        int sigdigits = intdigits;
+        p = cruise_scan_digits(p, end, &mant, &sigdigits, 19);
+        fracdigits = sigdigits - intdigits;
+    }
+    int sigdigits = intdigits + fracdigits;
+    if (zeros + sigdigits + fraczeros == 0) {
+        return 0;
+    }
+
+    /* exponent, with at least one digit */
+    int exp10 = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int expneg = 0;
+        if (p < end && (*p == '+' || *p == '-')) {
+            expneg = (*p == '-');
+            p++;
+        }
+        uint64_t expval = 0;
+        int expdigits = 0;
+        p = cruise_scan_digits(p, end, &expval, &expdigits, 9);
+        if (expdigits == 0) {
+            return 0;
+        }
+        if (expdigits > 9) {
+            expval = 1000000000ULL;
+        }
+        exp10 = expneg ? - (int) expval : (int) expval;
+    }
+
+    /* the number has to end before the window does, and on a byte
+     * that could not continue it */
+    if (p == end || isalnum(*p) || *p == '.' || *p == '+' || *p == '-' || *p == '_') {
+        return 0;
+    }
+
+    /* the value is mant * 10^e if all significant digits fit */
+    *exact = 0;
+    if (sigdigits <= 19) {
+        int e = exp10 - fracdigits - fraczeros;
+        double d = (double) mant;
+        if (mant == 0) {
+            d = 0.0;
+            *exact = 1;
+        } else if (mant <= (1ULL << 53) && e >= -22 && e <= 22) {
+            /* mant and 10^|e| are exact, so one rounding */
+            d = (e < 0) ? d / cruise_scan_pow10[-e] : d * cruise_scan_pow10[e];
+            *exact = 1;
+        } else if (mant <= (1ULL << 53) && e > 22 && e <= 22 + 15) {
+            /* move some of the exponent into the mantissa if it stays exact */
+            uint64_t scale = (uint64_t) cruise_scan_pow10[e - 22];
+            if (mant <= (1ULL << 53) / scale) {
+                d = (double) (mant * scale) * 1e22;
+                *exact = 1;
+            }
+        }
+        *res = neg ? -d : d;
+    }
+
+    return (int) (p - fp->_p);
+}
+
 //ATM
 #if 0
 /*
@@ -2719,6 +4160,10 @@ __svfscanf(cruise_stream_t *fp, const char *fmt0, va_list ap)
 	int base;		/* base argument to conversion function */
 	char ccltab[256];	/* character class table for %[...] */
 	char buf[BUF];		/* buffer for numeric conversions */
+	int fastwidth;		/* no field width, numbers may use fast path */
+	uintmax_t fastres;	/* integer from either path */
+	double fastdbl;		/* double from the float fast path */
+	int fastexact;		/* whether fastdbl is valid */
 
 	//ATM ORIENT(fp, -1);
 
@@ -2973,6 +4418,7 @@ literal:
 
 		case CT_INT:
 			/* scan an integer as if by the conversion function */
+			fastwidth = (width == 0);
 #ifdef hardway
 			if (width == 0 || width > sizeof(buf) - 1)
 				width = sizeof(buf) - 1;
@@ -2982,17 +4428,27 @@ literal:
 				width = sizeof(buf) - 2;
 			width++;
 #endif
-			nr = parseint(fp, buf, width, base, flags);
-			if (nr == 0)
-				goto match_failure;
+			if (fastwidth && base == 10 &&
+			    (nr = cruise_scan_int(fp, &fastres)) > 0) {
+				/* parsed in place, the number ends inside
+				 * the window so _r stays positive */
+				fp->_p += nr;
+				fp->_r -= nr;
+			} else {
+				nr = parseint(fp, buf, width, base, flags);
+				if (nr == 0)
+					goto match_failure;
+				if ((flags & SUPPRESS) == 0) {
+					buf[nr] = '\0';
+					if ((flags & UNSIGNED) == 0)
+					    fastres = strtoimax(buf, (char **)NULL, base);
+					else
+					    fastres = strtoumax(buf, (char **)NULL, base);
+				}
+			}
 			if ((flags & SUPPRESS) == 0) {
-				uintmax_t res;
+				uintmax_t res = fastres;
 
-				buf[nr] = '\0';
-				if ((flags & UNSIGNED) == 0)
-				    res = strtoimax(buf, (char **)NULL, base);
-				else
-				    res = strtoumax(buf, (char **)NULL, base);
 				if (flags & POINTER)
 					*va_arg(ap, void **) =
 							(void *)(uintptr_t)res;
@@ -3018,9 +4474,31 @@ literal:
 #ifndef NO_FLOATING_POINT
 		case CT_FLOAT:
 			/* scan a floating point number as if by strtod */
+			fastwidth = (width == 0);
 			if (width == 0 || width > sizeof(buf) - 1)
 				width = sizeof(buf) - 1;
 //ATM			nr = parsefloat(fp, buf, buf + width, locale);
+			if (fastwidth &&
+			    (nr = cruise_scan_float(fp, &fastdbl, &fastexact)) > 0) {
+				/* the number ends on a byte in the window that
+				 * stops strtod, so it can convert in place */
+				if ((flags & SUPPRESS) == 0) {
+					const char *num = (const char *)fp->_p;
+					if (flags & LONGDBL) {
+						long double res = strtold(num, NULL);
+						*va_arg(ap, long double *) = res;
+					} else if (flags & LONG) {
+						double res = fastexact ? fastdbl : strtod(num, NULL);
+						*va_arg(ap, double *) = res;
+					} else {
+						float res = strtof(num, NULL);
+						*va_arg(ap, float *) = res;
+					}
+				}
+				fp->_p += nr;
+				fp->_r -= nr;
+				goto fastdone;
+			}
 			nr = parsefloat(fp, buf, buf + width);
 			if (nr == 0)
 				goto match_failure;
@@ -3036,6 +4514,7 @@ literal:
 					*va_arg(ap, float *) = res;
 				}
 			}
+fastdone:
 			break;
 #endif /* !NO_FLOATING_POINT */
 		}
@@ -30,11 +30,25 @@
 #include <assert.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
 #define __USE_GNU
 #include <pthread.h>
 
 #include "cruise-internal.h"
 
+/* IOV_MAX is only defined for X/Open builds, fall back to the limit
+ * the kernel imposes on readv and writev */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* request to clone a whole file, from linux/fs.h, which clashes with
+ * the headers above */
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
 /* ---------------------------------------
  * POSIX wrappers: paths
  * --------------------------------------- */
@@ -64,6 +78,8 @@ CRUISE_DECL(read, ssize_t, (int fd, void *buf, size_t count));
 CRUISE_DECL(write, ssize_t, (int fd, const void *buf, size_t count));
 CRUISE_DECL(readv, ssize_t, (int fd, const struct iovec *iov, int iovcnt));
 CRUISE_DECL(writev, ssize_t, (int fd, const struct iovec *iov, int iovcnt));
+CRUISE_DECL(preadv, ssize_t, (int fd, const struct iovec *iov, int iovcnt, off_t offset));
+CRUISE_DECL(pwritev, ssize_t, (int fd, const struct iovec *iov, int iovcnt, off_t offset));
 CRUISE_DECL(pread, ssize_t, (int fd, void *buf, size_t count, off_t offset));
 CRUISE_DECL(pread64, ssize_t, (int fd, void *buf, size_t count, off64_t offset));
 CRUISE_DECL(pwrite, ssize_t, (int fd, const void *buf, size_t count, off_t offset));
@@ -82,6 +98,11 @@ CRUISE_DECL(msync, int, (void *addr, size_t length, int flags));
 CRUISE_DECL(__fxstat, int, (int vers, int fd, struct stat *buf));
 CRUISE_DECL(__fxstat64, int, (int vers, int fd, struct stat64 *buf));
 CRUISE_DECL(close, int, (int fd));
+CRUISE_DECL(dup, int, (int oldfd));
+CRUISE_DECL(dup2, int, (int oldfd, int newfd));
+CRUISE_DECL(fcntl, int, (int fd, int cmd, ...));
+CRUISE_DECL(ioctl, int, (int fd, unsigned long request, ...));
+CRUISE_DECL(copy_file_range, ssize_t, (int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags));
 
 /* ---------------------------------------
  * POSIX wrappers: paths
@@ -419,11 +440,32 @@ int CRUISE_WRAP(__lxstat64)(int vers, const char *path, struct stat64 *buf)
  * POSIX wrappers: file descriptors
  * --------------------------------------- */
 
-/* read count bytes info buf from file starting at offset pos,
- * returns number of bytes actually read in retcount,
- * retcount will be less than count only if an error occurs
- * or end of file is reached */
-int cruise_fd_read(int fd, off_t pos, void* buf, size_t count, size_t* retcount)
+/* check that iovcnt is in range and total the lengths of the buffers
+ * in iov into count, the total must fit in an ssize_t */
+static int cruise_iov_count(const struct iovec* iov, int iovcnt, size_t* count)
+{
+    if (iovcnt < 0 || iovcnt > IOV_MAX) {
+        return CRUISE_ERR_INVAL;
+    }
+
+    size_t total = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > (size_t) SSIZE_MAX - total) {
+            return CRUISE_ERR_INVAL;
+        }
+        total += iov[i].iov_len;
+    }
+
+    *count = total;
+    return CRUISE_SUCCESS;
+}
+
+/* read from file starting at offset pos into the buffers of iov in
+ * order, returns number of bytes actually read in retcount, which
+ * will be less than the vector total only if an error occurs or end
+ * of file is reached */
+int cruise_fd_readv(int fd, off_t pos, const struct iovec* iov, int iovcnt, size_t* retcount)
 {
     /* get the file id for this file descriptor */
     int fid = cruise_get_fid_from_fd(fd);
@@ -443,13 +485,31 @@ int cruise_fd_read(int fd, off_t pos, void* buf, size_t count, size_t* retcount)
         return CRUISE_ERR_BADF;
     }
 
+    /* total up the bytes requested */
+    size_t count;
+    int count_rc = cruise_iov_count(iov, iovcnt, &count);
+    if (count_rc != CRUISE_SUCCESS) {
+        return count_rc;
+    }
+
     /* TODO: is it safe to assume that off_t is bigger than size_t? */
     /* check that we don't overflow the file length */
     if (cruise_would_overflow_offt(pos, (off_t) count)) {
         return CRUISE_ERR_OVERFLOW;
     }
 
-    /* TODO: check that file is open for reading */
+    /* readers of a sealed file take no lock, so many threads can
+     * stream a finished checkpoint without touching shared state, a
+     * truncate racing such a read may hand back stale bytes but the
+     * chunk memory stays mapped, everyone else holds the file lock
+     * shared to keep the chunks in place while we copy, and so does
+     * everyone when the packer may compress the chunks of sealed
+     * files or dedup may swap them for those of other files, since
+     * either gives their memory back to be reused */
+    int locked = ! cruise_fid_is_sealed(fid) || cruise_compress_chunks || cruise_dedup_chunks;
+    if (locked) {
+        cruise_fid_rdlock(fid);
+    }
 
     /* check that we don't try to read past the end of the file */
     off_t lastread = pos + (off_t) count;
@@ -468,20 +528,22 @@ int cruise_fd_read(int fd, off_t pos, void* buf, size_t count, size_t* retcount)
     /* record number of bytes that we'll actually read */
     *retcount = count;
 
-    /* if we don't read any bytes, return success */
-    if (count == 0){
-        return CRUISE_SUCCESS;
+    /* scatter data from file across the buffers in one pass */
+    int read_rc = CRUISE_SUCCESS;
+    if (count > 0) {
+        read_rc = cruise_fid_readv(fid, pos, iov, iovcnt, count);
+    }
+
+    if (locked) {
+        cruise_fid_unlock(fid);
     }
 
-    /* read data from file */
-    int read_rc = cruise_fid_read(fid, pos, buf, count);
     return read_rc;
 }
 
-/* write count bytes from buf into file starting at offset pos,
- * allocates new bytes and updates file size as necessary,
- * fills any gaps with zeros */
-int cruise_fd_write(int fd, off_t pos, const void* buf, size_t count)
+/* look up the file behind fd and check that the buffers of iov can
+ * be written to it, sets fid and the total number of bytes in count */
+static int cruise_fd_write_check(int fd, const struct iovec* iov, int iovcnt, int* outfid, size_t* outcount)
 {
     /* get the file id for this file descriptor */
     int fid = cruise_get_fid_from_fd(fd);
@@ -500,6 +562,29 @@ int cruise_fd_write(int fd, off_t pos, const void* buf, size_t count)
         return CRUISE_ERR_BADF;
     }
 
+    /* total up the bytes to be written */
+    int count_rc = cruise_iov_count(iov, iovcnt, outcount);
+    if (count_rc != CRUISE_SUCCESS) {
+        return count_rc;
+    }
+
+    *outfid = fid;
+    return CRUISE_SUCCESS;
+}
+
+/* write the buffers of iov in order into file starting at offset pos,
+ * allocates new bytes and updates file size once for the whole
+ * vector, fills any gaps with zeros, returns number of bytes written
+ * in retcount */
+int cruise_fd_writev(int fd, off_t pos, const struct iovec* iov, int iovcnt, size_t* retcount)
+{
+    int fid;
+    size_t count;
+    int check_rc = cruise_fd_write_check(fd, iov, iovcnt, &fid, &count);
+    if (check_rc != CRUISE_SUCCESS) {
+        return check_rc;
+    }
+
     /* TODO: is it safe to assume that off_t is bigger than size_t? */
     /* check that our write won't overflow the length */
     if (cruise_would_overflow_offt(pos, (off_t) count)) {
@@ -507,34 +592,159 @@ int cruise_fd_write(int fd, off_t pos, const void* buf, size_t count)
         return CRUISE_ERR_OVERFLOW;
     }
 
-    /* TODO: check that file is open for writing */
+    *retcount = 0;
 
-    /* get current file size before extending the file */
+    /* writes that start within the file and end within its reserved
+     * space only need the file lock shared, so threads writing
+     * disjoint regions of one file proceed together */
+    off_t newpos = pos + (off_t) count;
+    cruise_fid_rdlock(fid);
     off_t filesize = cruise_fid_size(fid);
+    if (pos <= filesize && cruise_fid_write_shared(fid, pos, (off_t) count)) {
+        /* gather data from the buffers into the file in one pass */
+        int write_rc = cruise_fid_writev(fid, pos, iov, iovcnt, count);
+
+        /* raise the size only once the data is in place, so nobody
+         * reads bytes we haven't written yet */
+        if (write_rc == CRUISE_SUCCESS) {
+            cruise_fid_extend(fid, newpos);
+            *retcount = count;
+        }
 
-    /* extend file size and allocate chunks if needed */
-    off_t newpos = pos + (off_t) count;
-    int extend_rc = cruise_fid_extend(fid, newpos);
-    if (extend_rc != CRUISE_SUCCESS) {
-        return extend_rc;
+        cruise_fid_unlock(fid);
+        return write_rc;
     }
+    cruise_fid_unlock(fid);
+
+    /* otherwise we need new chunks or a zero filled gap, so take the
+     * file to ourselves and look at its size again */
+    cruise_fid_wrlock(fid);
+    filesize = cruise_fid_size(fid);
+
+    /* extend file size and allocate chunks once for the whole vector */
+    int write_rc = cruise_fid_extend(fid, newpos);
 
     /* fill any new bytes between old size and pos with zero values */
-    if (filesize < pos) {
+    if (write_rc == CRUISE_SUCCESS && filesize < pos) {
         off_t gap_size = pos - filesize;
-        int zero_rc = cruise_fid_write_zero(fid, filesize, gap_size);
-        if (zero_rc != CRUISE_SUCCESS) {
-            return zero_rc;
+        write_rc = cruise_fid_write_zero(fid, filesize, gap_size);
+    }
+
+    /* finally gather data from the buffers into the file in one pass */
+    if (write_rc == CRUISE_SUCCESS) {
+        debug("request to write %d bytes to position %d\n", count, pos);
+        write_rc = cruise_fid_writev(fid, pos, iov, iovcnt, count);
+        if (write_rc == CRUISE_SUCCESS) {
+            *retcount = count;
         }
     }
 
-    /* finally write specified data to file */
-    debug("request to write %d bytes to position %d\n", count, pos);
-    int write_rc = cruise_fid_write(fid, pos, buf, count);
+    cruise_fid_unlock(fid);
     
     return write_rc;
 }
 
+/* write the buffers of iov in order at the end of the file as one
+ * atomic append, concurrent appenders never overlap, sets retpos to
+ * the offset where the data landed and retcount to the number of
+ * bytes written */
+int cruise_fd_appendv(int fd, const struct iovec* iov, int iovcnt, off_t* retpos, size_t* retcount)
+{
+    int fid;
+    size_t count;
+    int check_rc = cruise_fd_write_check(fd, iov, iovcnt, &fid, &count);
+    if (check_rc != CRUISE_SUCCESS) {
+        return check_rc;
+    }
+
+    *retcount = 0;
+
+    /* while the end of the file stays within its reserved space,
+     * appenders claim their ranges by bumping the tail of the file
+     * and copy their data with the lock shared */
+    off_t pos;
+    cruise_fid_rdlock(fid);
+    int reserve_rc = cruise_fid_append_reserve(fid, (off_t) count, &pos);
+    if (reserve_rc == CRUISE_SUCCESS) {
+        int write_rc = cruise_fid_writev(fid, pos, iov, iovcnt, count);
+
+        /* raise the size past our range, like writes at a position
+         * we don't wait for appenders that claimed earlier ranges */
+        if (write_rc == CRUISE_SUCCESS) {
+            cruise_fid_extend(fid, pos + (off_t) count);
+            *retpos   = pos;
+            *retcount = count;
+        } else if (! cruise_fid_append_cancel(fid, pos, (off_t) count)) {
+            /* someone claimed space after our range, so it will end up
+             * inside the file, zero it so it reads as a hole rather
+             * than whatever the chunk held before */
+            cruise_fid_write_zero(fid, pos, (off_t) count);
+        }
+        cruise_fid_unlock(fid);
+        return write_rc;
+    }
+    cruise_fid_unlock(fid);
+    if (reserve_rc != CRUISE_ERR_NOSPC) {
+        return reserve_rc;
+    }
+
+    /* we need new chunks, take the file to ourselves, no appends are
+     * in flight now so the end of the file is its size, chunks come
+     * whole so the appenders after us run in the shared path until
+     * this chunk fills up */
+    cruise_fid_wrlock(fid);
+    pos = cruise_fid_size(fid);
+    int write_rc = CRUISE_ERR_OVERFLOW;
+    if (! cruise_would_overflow_offt(pos, (off_t) count)) {
+        write_rc = cruise_fid_extend(fid, pos + (off_t) count);
+    }
+    if (write_rc == CRUISE_SUCCESS) {
+        write_rc = cruise_fid_writev(fid, pos, iov, iovcnt, count);
+        if (write_rc == CRUISE_SUCCESS) {
+            *retpos   = pos;
+            *retcount = count;
+        }
+    }
+    cruise_fid_unlock(fid);
+
+    return write_rc;
+}
+
+/* read count bytes info buf from file starting at offset pos,
+ * returns number of bytes actually read in retcount,
+ * retcount will be less than count only if an error occurs
+ * or end of file is reached */
+int cruise_fd_read(int fd, off_t pos, void* buf, size_t count, size_t* retcount)
+{
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len  = count;
+    return cruise_fd_readv(fd, pos, &iov, 1, retcount);
+}
+
+/* write count bytes from buf into file starting at offset pos,
+ * allocates new bytes and updates file size as necessary,
+ * fills any gaps with zeros */
+int cruise_fd_write(int fd, off_t pos, const void* buf, size_t count)
+{
+    struct iovec iov;
+    iov.iov_base = (void*) buf;
+    iov.iov_len  = count;
+    size_t retcount;
+    return cruise_fd_writev(fd, pos, &iov, 1, &retcount);
+}
+
+/* write count bytes from buf at the end of the file as one atomic
+ * append, sets retpos to the offset where the data landed */
+int cruise_fd_append(int fd, const void* buf, size_t count, off_t* retpos)
+{
+    struct iovec iov;
+    iov.iov_base = (void*) buf;
+    iov.iov_len  = count;
+    size_t retcount;
+    return cruise_fd_appendv(fd, &iov, 1, retpos, &retcount);
+}
+
 int CRUISE_WRAP(creat)(const char* path, mode_t mode)
 {
     /* equivalent to open(path, O_WRONLY|O_CREAT|O_TRUNC, mode) */
@@ -546,22 +756,25 @@ int CRUISE_WRAP(creat)(const char* path, mode_t mode)
         /* create the file */
         int fid;
         off_t pos;
-        int rc = cruise_fid_open(path, O_WRONLY | O_CREAT | O_TRUNC, mode, &fid, &pos);
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        int rc = cruise_fid_open(path, flags, mode, &fid, &pos);
         if (rc != CRUISE_SUCCESS) {
             errno = cruise_err_map_to_errno(rc);
             return -1;
         }
 
-        /* TODO: allocate a free file descriptor and associate it with fid */
-        /* set in_use flag and file pointer, flags include O_WRONLY */
-        cruise_fd_t* filedesc = &(cruise_fds[fid]);
-        filedesc->pos   = pos;
-        filedesc->read  = 0;
-        filedesc->write = 1;
-        debug("CRUISE_open generated fd %d for file %s\n", fid, path);    
+        /* allocate a file descriptor with its own file pointer */
+        int fd;
+        rc = cruise_fd_alloc(fid, flags, pos, &fd);
+        if (rc != CRUISE_SUCCESS) {
+            cruise_fid_close(fid);
+            errno = cruise_err_map_to_errno(rc);
+            return -1;
+        }
+        debug("CRUISE_open generated fd %d for file %s\n", fd, path);    
 
         /* don't conflict with active system fds that range from 0 - (fd_limit) */
-        int ret = fid + cruise_fd_limit;
+        int ret = fd + cruise_fd_limit;
         return ret;
     } else {
         MAP_OR_FAIL(creat);
@@ -610,16 +823,19 @@ int CRUISE_WRAP(open)(const char *path, int flags, ...)
             return -1;
         }
 
-        /* TODO: allocate a free file descriptor and associate it with fid */
-        /* set in_use flag and file pointer */
-        cruise_fd_t* filedesc = &(cruise_fds[fid]);
-        filedesc->pos   = pos;
-        filedesc->read  = ((flags & O_RDONLY) == O_RDONLY) || ((flags & O_RDWR) == O_RDWR);
-        filedesc->write = ((flags & O_WRONLY) == O_WRONLY) || ((flags & O_RDWR) == O_RDWR);
-        debug("CRUISE_open generated fd %d for file %s\n", fid, path);    
+        /* allocate a file descriptor with its own file pointer, so
+         * each open of a file reads and writes independently */
+        int fd;
+        rc = cruise_fd_alloc(fid, flags, pos, &fd);
+        if (rc != CRUISE_SUCCESS) {
+            cruise_fid_close(fid);
+            errno = cruise_err_map_to_errno(rc);
+            return -1;
+        }
+        debug("CRUISE_open generated fd %d for file %s\n", fd, path);    
 
         /* don't conflict with active system fds that range from 0 - (fd_limit) */
-        ret = fid + cruise_fd_limit;
+        ret = fd + cruise_fd_limit;
         return ret;
     } else {
         MAP_OR_FAIL(open);
@@ -826,15 +1042,21 @@ ssize_t CRUISE_WRAP(write)(int fd, const void *buf, size_t count)
             return (ssize_t)-1;
         }
 
-        /* write data to file */
-        int write_rc = cruise_fd_write(fd, filedesc->pos, buf, count);
+        /* write data to file, or at its end if opened to append */
+        off_t pos = filedesc->pos;
+        int write_rc;
+        if (filedesc->flags & O_APPEND) {
+            write_rc = cruise_fd_append(fd, buf, count, &pos);
+        } else {
+            write_rc = cruise_fd_write(fd, pos, buf, count);
+        }
         if (write_rc != CRUISE_SUCCESS) {
             errno = cruise_err_map_to_errno(write_rc);
             return (ssize_t)-1;
         }
 
         /* update file position */
-        filedesc->pos += count;
+        filedesc->pos = pos + (off_t) count;
 
         /* return number of bytes read */
         ret = count;
@@ -850,10 +1072,27 @@ ssize_t CRUISE_WRAP(readv)(int fd, const struct iovec *iov, int iovcnt)
 {
     /* check whether we should intercept this file descriptor */
     if (cruise_intercept_fd(&fd)) {
-        /* ERROR: fn not yet supported */
-        fprintf(stderr, "Function not yet supported @ %s:%d\n", __FILE__, __LINE__);
-        errno = EBADF;
-        return -1;
+        /* get pointer to file descriptor structure */
+        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+        if (filedesc == NULL) {
+            /* ERROR: invalid file descriptor */
+            errno = EBADF;
+            return (ssize_t)-1;
+        }
+
+        /* read data from file into the buffers */
+        size_t retcount;
+        int read_rc = cruise_fd_readv(fd, filedesc->pos, iov, iovcnt, &retcount);
+        if (read_rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(read_rc);
+            return (ssize_t)-1;
+        }
+
+        /* update file position */
+        filedesc->pos += (off_t) retcount;
+
+        /* return number of bytes read */
+        return (ssize_t) retcount;
     } else {
         MAP_OR_FAIL(readv);
         ssize_t ret = CRUISE_REAL(readv)(fd, iov, iovcnt);
@@ -865,10 +1104,34 @@ ssize_t CRUISE_WRAP(writev)(int fd, const struct iovec *iov, int iovcnt)
 {
     /* check whether we should intercept this file descriptor */
     if (cruise_intercept_fd(&fd)) {
-        /* ERROR: fn not yet supported */
-        fprintf(stderr, "Function not yet supported @ %s:%d\n", __FILE__, __LINE__);
-        errno = EBADF;
-        return -1;
+        /* get pointer to file descriptor structure */
+        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+        if (filedesc == NULL) {
+            /* ERROR: invalid file descriptor */
+            errno = EBADF;
+            return (ssize_t)-1;
+        }
+
+        /* write data from the buffers to file, or at its end if
+         * opened to append */
+        off_t pos = filedesc->pos;
+        size_t retcount;
+        int write_rc;
+        if (filedesc->flags & O_APPEND) {
+            write_rc = cruise_fd_appendv(fd, iov, iovcnt, &pos, &retcount);
+        } else {
+            write_rc = cruise_fd_writev(fd, pos, iov, iovcnt, &retcount);
+        }
+        if (write_rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(write_rc);
+            return (ssize_t)-1;
+        }
+
+        /* update file position */
+        filedesc->pos = pos + (off_t) retcount;
+
+        /* return number of bytes written */
+        return (ssize_t) retcount;
     } else {
         MAP_OR_FAIL(writev);
         ssize_t ret = CRUISE_REAL(writev)(fd, iov, iovcnt);
@@ -876,6 +1139,70 @@ ssize_t CRUISE_WRAP(writev)(int fd, const struct iovec *iov, int iovcnt)
     }
 }
 
+ssize_t CRUISE_WRAP(preadv)(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+    /* equivalent to readv(), except that it reads from a given
+     * position in the file without changing the file pointer */
+
+    /* check whether we should intercept this file descriptor */
+    if (cruise_intercept_fd(&fd)) {
+        /* get pointer to file descriptor structure */
+        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+        if (filedesc == NULL) {
+            /* ERROR: invalid file descriptor */
+            errno = EBADF;
+            return (ssize_t)-1;
+        }
+
+        /* read data from file into the buffers */
+        size_t retcount;
+        int read_rc = cruise_fd_readv(fd, offset, iov, iovcnt, &retcount);
+        if (read_rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(read_rc);
+            return (ssize_t)-1;
+        }
+
+        /* return number of bytes read */
+        return (ssize_t) retcount;
+    } else {
+        MAP_OR_FAIL(preadv);
+        ssize_t ret = CRUISE_REAL(preadv)(fd, iov, iovcnt, offset);
+        return ret;
+    }
+}
+
+ssize_t CRUISE_WRAP(pwritev)(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+    /* equivalent to writev(), except that it writes into a given
+     * position without changing the file pointer */
+
+    /* check whether we should intercept this file descriptor */
+    if (cruise_intercept_fd(&fd)) {
+        /* get pointer to file descriptor structure */
+        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+        if (filedesc == NULL) {
+            /* ERROR: invalid file descriptor */
+            errno = EBADF;
+            return (ssize_t)-1;
+        }
+
+        /* write data from the buffers to file */
+        size_t retcount;
+        int write_rc = cruise_fd_writev(fd, offset, iov, iovcnt, &retcount);
+        if (write_rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(write_rc);
+            return (ssize_t)-1;
+        }
+
+        /* return number of bytes written */
+        return (ssize_t) retcount;
+    } else {
+        MAP_OR_FAIL(pwritev);
+        ssize_t ret = CRUISE_REAL(pwritev)(fd, iov, iovcnt, offset);
+        return ret;
+    }
+}
+
 ssize_t CRUISE_WRAP(pread)(int fd, void *buf, size_t count, off_t offset)
 {
     /* equivalent to read(), except that it shall read from a given
@@ -969,6 +1296,62 @@ ssize_t CRUISE_WRAP(pwrite64)(int fd, const void *buf, size_t count, off64_t off
     }
 }
 
+ssize_t CRUISE_WRAP(copy_file_range)(int fd_in, off64_t *off_in, int fd_out, off64_t *off_out, size_t len, unsigned int flags)
+{
+    /* between two of our files the chunks are shared rather than
+     * copied, we can't share with files outside the mount */
+    int intercept_in  = cruise_intercept_fd(&fd_in);
+    int intercept_out = cruise_intercept_fd(&fd_out);
+    if (intercept_in && intercept_out) {
+        cruise_fd_t* desc_in  = cruise_get_filedesc_from_fd(fd_in);
+        cruise_fd_t* desc_out = cruise_get_filedesc_from_fd(fd_out);
+        if (desc_in == NULL || desc_out == NULL ||
+            ! desc_in->read || ! desc_out->write || (desc_out->flags & O_APPEND))
+        {
+            errno = EBADF;
+            return (ssize_t)-1;
+        }
+        if (flags != 0) {
+            errno = EINVAL;
+            return (ssize_t)-1;
+        }
+
+        /* use and advance the file pointers unless given offsets */
+        off_t pos_in  = (off_in  != NULL) ? (off_t) *off_in  : desc_in->pos;
+        off_t pos_out = (off_out != NULL) ? (off_t) *off_out : desc_out->pos;
+        if (len > (size_t) SSIZE_MAX) {
+            len = (size_t) SSIZE_MAX;
+        }
+
+        off_t count;
+        int rc = cruise_fid_clone(desc_in->fid, pos_in, desc_out->fid, pos_out, (off_t) len, &count);
+        if (rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(rc);
+            return (ssize_t)-1;
+        }
+
+        if (off_in != NULL) {
+            *off_in += count;
+        } else {
+            desc_in->pos += count;
+        }
+        if (off_out != NULL) {
+            *off_out += count;
+        } else {
+            desc_out->pos += count;
+        }
+        return (ssize_t) count;
+    } else if (intercept_in || intercept_out) {
+        /* callers fall back to read and write on this */
+        errno = EXDEV;
+        return (ssize_t)-1;
+    } else {
+        MAP_OR_FAIL(copy_file_range);
+        ssize_t ret = CRUISE_REAL(copy_file_range)(fd_in, off_in, fd_out, off_out, len, flags);
+        return ret;
+    }
+}
+
 int CRUISE_WRAP(ftruncate)(int fd, off_t length)
 {
     /* check whether we should intercept this file descriptor */
@@ -1015,6 +1398,15 @@ int CRUISE_WRAP(fsync)(int fd)
             return -1;
         }
 
+        /* check the file against its checksums on the way out */
+        if (cruise_checksum_verify) {
+            int rc = cruise_fid_verify(fid);
+            if (rc != CRUISE_SUCCESS) {
+                errno = cruise_err_map_to_errno(rc);
+                return -1;
+            }
+        }
+
         /* Teng: if using spill over we may have some fsyncing to do */
 		if (cruise_use_spillover) {
 				int ret = fsync(cruise_spilloverblock);
@@ -1055,6 +1447,9 @@ int CRUISE_WRAP(flock)(int fd, int operation)
     if (cruise_intercept_fd(&fd)) {
      // KMM I removed the locking code because it was causing
      // hangs
+     // the spin lock it used is gone, don't bring this back on top
+     // of meta->rwlock, a thread holding LOCK_EX would then block
+     // its own reads and writes
       /*
         -- currently handling the blocking variants only 
         switch (operation)
@@ -1223,26 +1618,194 @@ int CRUISE_WRAP(close)(int fd)
 
         /* TODO: what to do if underlying file has been deleted? */
 
-        /* check that fd is actually in use */
-        int fid = cruise_get_fid_from_fd(fd);
-        if (fid < 0) {
+        /* free the file descriptor, this closes the file id once no
+         * other descriptor refers to the open file */
+        int close_rc = cruise_fd_free(fd);
+        if (close_rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(close_rc);
+            return -1;
+        }
+
+        return 0;
+    } else {
+        MAP_OR_FAIL(close);
+        int ret = CRUISE_REAL(close)(fd);
+        return ret;
+    }
+}
+
+int CRUISE_WRAP(dup)(int oldfd)
+{
+    /* check whether we should intercept this file descriptor */
+    if (cruise_intercept_fd(&oldfd)) {
+        /* get a new descriptor sharing the open file */
+        int newfd;
+        int rc = cruise_fd_dup(oldfd, 0, &newfd);
+        if (rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(rc);
+            return -1;
+        }
+        return newfd + cruise_fd_limit;
+    } else {
+        MAP_OR_FAIL(dup);
+        int ret = CRUISE_REAL(dup)(oldfd);
+        return ret;
+    }
+}
+
+int CRUISE_WRAP(dup2)(int oldfd, int newfd)
+{
+    /* remember the values the caller gave us, since checking whether
+     * to intercept shifts them */
+    int fd  = oldfd;
+    int fd2 = newfd;
+
+    /* check whether we should intercept this file descriptor */
+    if (cruise_intercept_fd(&fd)) {
+        if (! cruise_intercept_fd(&fd2)) {
+            /* ERROR: we can't place one of our files on a system
+             * file descriptor */
+            fprintf(stderr, "Function not yet supported @ %s:%d\n", __FILE__, __LINE__);
             errno = EBADF;
             return -1;
         }
 
-        /* close the file id */
-        int close_rc = cruise_fid_close(fid);
-        if (close_rc != CRUISE_SUCCESS) {
-            errno = EIO;
+        /* point newfd at the open file of oldfd */
+        int rc = cruise_fd_dup2(fd, fd2);
+        if (rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(rc);
+            return -1;
+        }
+        return newfd;
+    } else {
+        MAP_OR_FAIL(dup2);
+        int ret = CRUISE_REAL(dup2)(oldfd, newfd);
+        return ret;
+    }
+}
+
+int CRUISE_WRAP(fcntl)(int fd, int cmd, ...)
+{
+    /* every command takes at most one argument, either an int or a
+     * pointer, so pass it along as a pointer */
+    va_list args;
+    va_start(args, cmd);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+
+    /* check whether we should intercept this file descriptor */
+    if (cruise_intercept_fd(&fd)) {
+        /* check that the file descriptor is open */
+        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+        if (filedesc == NULL) {
+            errno = EBADF;
+            return -1;
+        }
+
+        int flags = (int) (intptr_t) arg;
+        switch (cmd) {
+            case F_DUPFD:
+#ifdef F_DUPFD_CLOEXEC
+            case F_DUPFD_CLOEXEC:
+#endif
+            {
+                if (flags < 0) {
+                    errno = EINVAL;
+                    return -1;
+                }
+
+                /* our descriptors all lie above the system range, so
+                 * only a minimum inside our range narrows the choice */
+                int minfd = 0;
+                if ((rlim_t) flags > cruise_fd_limit) {
+                    minfd = (int) ((rlim_t) flags - cruise_fd_limit);
+                }
+
+                int newfd;
+                int rc = cruise_fd_dup(fd, minfd, &newfd);
+                if (rc != CRUISE_SUCCESS) {
+                    errno = cruise_err_map_to_errno(rc);
+                    return -1;
+                }
+                return newfd + cruise_fd_limit;
+            }
+            case F_GETFD:
+                /* we don't track close-on-exec, nothing of ours
+                 * survives an exec anyway */
+                return 0;
+            case F_SETFD:
+                return 0;
+            case F_GETFL:
+                return filedesc->flags;
+            case F_SETFL:
+                /* of the flags we track, only O_APPEND may change */
+                filedesc->flags = (filedesc->flags & ~O_APPEND) | (flags & O_APPEND);
+                return 0;
+            default:
+                /* ERROR: fn not yet supported */
+                fprintf(stderr, "Function not yet supported @ %s:%d\n", __FILE__, __LINE__);
+                errno = EINVAL;
+                return -1;
+        }
+    } else {
+        MAP_OR_FAIL(fcntl);
+        int ret = CRUISE_REAL(fcntl)(fd, cmd, arg);
+        return ret;
+    }
+}
+
+int CRUISE_WRAP(ioctl)(int fd, unsigned long request, ...)
+{
+    /* requests take at most one argument, pass it along as a pointer */
+    va_list args;
+    va_start(args, request);
+    void* arg = va_arg(args, void*);
+    va_end(args);
+
+    /* check whether we should intercept this file descriptor */
+    if (cruise_intercept_fd(&fd)) {
+        cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+        if (filedesc == NULL) {
+            errno = EBADF;
             return -1;
         }
 
-        /* TODO: free file descriptor */
+        if (request != FICLONE) {
+            /* no other requests apply to our files */
+            errno = ENOTTY;
+            return -1;
+        }
 
+        /* clone the whole file open as the argument over the start of
+         * ours, both have to be in the mount */
+        int src_fd = (int) (intptr_t) arg;
+        if (! cruise_intercept_fd(&src_fd)) {
+            errno = EXDEV;
+            return -1;
+        }
+        cruise_fd_t* src_desc = cruise_get_filedesc_from_fd(src_fd);
+        if (src_desc == NULL || ! src_desc->read || ! filedesc->write ||
+            (filedesc->flags & O_APPEND))
+        {
+            errno = EBADF;
+            return -1;
+        }
+        if (src_desc->fid == filedesc->fid) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        off_t count;
+        int rc = cruise_fid_clone(src_desc->fid, 0, filedesc->fid, 0,
+                                  cruise_fid_size(src_desc->fid), &count);
+        if (rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(rc);
+            return -1;
+        }
         return 0;
     } else {
-        MAP_OR_FAIL(close);
-        int ret = CRUISE_REAL(close)(fd);
+        MAP_OR_FAIL(ioctl);
+        int ret = CRUISE_REAL(ioctl)(fd, request, arg);
         return ret;
     }
 }
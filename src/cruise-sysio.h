@@ -28,4 +28,26 @@ int cruise_fd_read(int fd, off_t pos, void* buf, size_t count, size_t* retcount)
  * fills any gaps with zeros */
 int cruise_fd_write(int fd, off_t pos, const void* buf, size_t count);
 
+/* read from file starting at offset pos into the buffers of iov in
+ * order, returns number of bytes actually read in retcount, which
+ * will be less than the vector total only if an error occurs or end
+ * of file is reached */
+int cruise_fd_readv(int fd, off_t pos, const struct iovec* iov, int iovcnt, size_t* retcount);
+
+/* write the buffers of iov in order into file starting at offset pos,
+ * allocates new bytes and updates file size once for the whole
+ * vector, fills any gaps with zeros, returns number of bytes written
+ * in retcount */
+int cruise_fd_writev(int fd, off_t pos, const struct iovec* iov, int iovcnt, size_t* retcount);
+
+/* write the buffers of iov in order at the end of the file as one
+ * atomic append, concurrent appenders never overlap, sets retpos to
+ * the offset where the data landed and retcount to the number of
+ * bytes written */
+int cruise_fd_appendv(int fd, const struct iovec* iov, int iovcnt, off_t* retpos, size_t* retcount);
+
+/* write count bytes from buf at the end of the file as one atomic
+ * append, sets retpos to the offset where the data landed */
+int cruise_fd_append(int fd, const void* buf, size_t count, off_t* retpos);
+
 #endif /* CRUISE_SYSIO_H */
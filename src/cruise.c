@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <libgen.h>
 #include <limits.h>
+#include <stdint.h>
 #define __USE_GNU
 #include <pthread.h>
 
@@ -61,6 +62,13 @@ static int cruise_fpos_enabled   = 1;  /* whether we can use fgetpos/fsetpos */
 
 int cruise_use_memfs      = 1;
 int cruise_use_spillover;
+int cruise_zero_chunks    = CRUISE_ZERO_CHUNKS;
+int cruise_compress_chunks = CRUISE_COMPRESS;
+int cruise_compress_free   = 0;
+int cruise_compress_spillover = CRUISE_COMPRESS_SPILLOVER;
+int cruise_dedup_chunks   = CRUISE_DEDUP;
+int cruise_checksum_chunks = CRUISE_CHECKSUM;
+int cruise_checksum_verify = CRUISE_CHECKSUM_VERIFY;
 static int cruise_use_single_shm = 0;
 static int cruise_page_size      = 0;
 
@@ -94,6 +102,10 @@ int cruise_initialized = 0;
 static void* cruise_superblock = NULL;
 static void* free_fid_stack = NULL;
 void* free_chunk_stack = NULL;
+unsigned int* cruise_pack_map = NULL;
+unsigned int* cruise_spill_pack_map = NULL;
+cruise_chunkref_t* cruise_chunk_refs = NULL;
+int* cruise_dedup_index = NULL;
 void* free_spillchunk_stack = NULL;
 cruise_filename_t* cruise_filelist    = NULL;
 static cruise_filemeta_t* cruise_filemetas   = NULL;
@@ -102,10 +114,21 @@ char* cruise_chunks = NULL;
 char external_data_dir[1024] = {0};
 int cruise_spilloverblock = 0;
 
-/* array of file descriptors */
+/* array of open files, each open takes its own entry and the file
+ * descriptors made from it by dup share the entry */
 cruise_fd_t cruise_fds[CRUISE_MAX_FILEDESCS];
 rlim_t cruise_fd_limit;
 
+/* maps each file descriptor to its entry in cruise_fds, or -1 if the
+ * descriptor is not open */
+int cruise_fd_files[CRUISE_MAX_FILEDESCS];
+
+/* free stacks of file descriptors and open file entries, the mutex
+ * guards these and changes to the descriptor map */
+static void* free_fd_stack = NULL;
+static void* free_openfile_stack = NULL;
+static pthread_mutex_t cruise_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* array of file streams */
 cruise_stream_t cruise_streams[CRUISE_MAX_FILEDESCS];
 
@@ -173,6 +196,7 @@ int cruise_err_map_to_errno(int rc)
     case CRUISE_ERR_FBIG:    return EFBIG;
     case CRUISE_ERR_BADF:    return EBADF;
     case CRUISE_ERR_ISDIR:   return EISDIR;
+    case CRUISE_ERR_MFILE:   return EMFILE;
     default:                 return EIO;
     }
 }
@@ -241,19 +265,6 @@ inline int cruise_would_overflow_long(long a, long b)
     return 0;
 }
 
-#if 0
-/* simple memcpy which compilers should be able to vectorize
- * from: http://software.intel.com/en-us/articles/memcpy-performance/
- * icc -restrict -O3 ... */
-static inline void* cruise_memcpy(void *restrict b, const void *restrict a, size_t n)
-{
-    char *s1 = b;
-    const char *s2 = a;
-    for(; 0<n; --n)*s1++ = *s2++;
-    return b;
-}
-#endif
-
 /* given an input mode, mask it with umask and return, can specify
  * an input mode==0 to specify all read/write bits */
 mode_t cruise_getmode(mode_t perms)
@@ -272,20 +283,16 @@ mode_t cruise_getmode(mode_t perms)
     return ret;
 }
 
+/* threads extending different files pop chunks concurrently, so the
+ * free stacks are always guarded */
 inline int cruise_stack_lock()
 {
-    if (cruise_use_single_shm) {
-        return pthread_mutex_lock(&cruise_stack_mutex);
-    }
-    return 0;
+    return pthread_mutex_lock(&cruise_stack_mutex);
 }
 
 inline int cruise_stack_unlock()
 {
-    if (cruise_use_single_shm) {
-        return pthread_mutex_unlock(&cruise_stack_mutex);
-    }
-    return 0;
+    return pthread_mutex_unlock(&cruise_stack_mutex);
 }
 
 /* sets flag if the path is a special path */
@@ -380,21 +387,256 @@ inline int cruise_get_fid_from_fd(int fd)
     return -1;
   }
 
-  /* right now, the file descriptor is equal to the file id */
-  return fd;
+  /* check that file descriptor is open */
+  int file = cruise_fd_files[fd];
+  if (file < 0) {
+    return -1;
+  }
+
+  /* return the file id of the open file it refers to */
+  return cruise_fds[file].fid;
 }
 
 /* return address of file descriptor structure or NULL if fd is out
- * of range */
+ * of range or not open */
 inline cruise_fd_t* cruise_get_filedesc_from_fd(int fd)
 {
     if (fd >= 0 && fd < CRUISE_MAX_FILEDESCS) {
-        cruise_fd_t* filedesc = &(cruise_fds[fd]);
-        return filedesc;
+        int file = cruise_fd_files[fd];
+        if (file >= 0) {
+            cruise_fd_t* filedesc = &(cruise_fds[file]);
+            return filedesc;
+        }
     }
     return NULL;
 }
 
+/* ---------------------------------------
+ * Operations on file descriptors
+ * --------------------------------------- */
+
+/* set up the descriptor table with every descriptor and stream free */
+static int cruise_fd_init()
+{
+    free_fd_stack       = malloc(cruise_stack_bytes(CRUISE_MAX_FILEDESCS));
+    free_openfile_stack = malloc(cruise_stack_bytes(CRUISE_MAX_FILEDESCS));
+    if (free_fd_stack == NULL || free_openfile_stack == NULL) {
+        free(free_fd_stack);
+        free(free_openfile_stack);
+        free_fd_stack       = NULL;
+        free_openfile_stack = NULL;
+        return CRUISE_ERR_NOMEM;
+    }
+
+    cruise_stack_init(free_fd_stack, CRUISE_MAX_FILEDESCS);
+    cruise_stack_init(free_openfile_stack, CRUISE_MAX_FILEDESCS);
+
+    int i;
+    for (i = 0; i < CRUISE_MAX_FILEDESCS; i++) {
+        cruise_fd_files[i]  = -1;
+        cruise_fds[i].fid   = -1;
+        cruise_fds[i].refs  = 0;
+        cruise_streams[i].fd = -1;
+    }
+
+    return CRUISE_SUCCESS;
+}
+
+/* drop one reference to an open file entry, closes its file id and
+ * frees the entry when the last one goes, caller holds the fd mutex */
+static int cruise_fd_release(int file)
+{
+    cruise_fd_t* filedesc = &(cruise_fds[file]);
+    filedesc->refs--;
+    if (filedesc->refs > 0) {
+        return CRUISE_SUCCESS;
+    }
+
+    int fid = filedesc->fid;
+    filedesc->fid = -1;
+    cruise_stack_push(free_openfile_stack, file);
+
+    /* the file is sealed once its last writer goes */
+    if (filedesc->write) {
+        cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+        __sync_sub_and_fetch(&meta->writers, 1);
+    }
+
+    return cruise_fid_close(fid);
+}
+
+/* allocate a file descriptor with its own file pointer set to pos
+ * for file id fid opened with flags, fills outfd with the descriptor,
+ * returns CRUISE_ERR_MFILE if all descriptors are in use */
+int cruise_fd_alloc(int fid, int flags, off_t pos, int* outfd)
+{
+    pthread_mutex_lock(&cruise_fd_mutex);
+
+    int fd = cruise_stack_pop(free_fd_stack);
+    if (fd < 0) {
+        pthread_mutex_unlock(&cruise_fd_mutex);
+        return CRUISE_ERR_MFILE;
+    }
+
+    /* there are as many entries as descriptors and each entry in use
+     * holds at least one descriptor, so this can't run out */
+    int file = cruise_stack_pop(free_openfile_stack);
+
+    /* record the file id, file pointer, and access mode */
+    int accmode = flags & O_ACCMODE;
+    cruise_fd_t* filedesc = &(cruise_fds[file]);
+    filedesc->pos   = pos;
+    filedesc->read  = (accmode == O_RDONLY) || (accmode == O_RDWR);
+    filedesc->write = (accmode == O_WRONLY) || (accmode == O_RDWR);
+    filedesc->fid   = fid;
+    filedesc->flags = flags & (O_ACCMODE | O_APPEND);
+    filedesc->refs  = 1;
+
+    /* a file open for write is no longer sealed */
+    if (filedesc->write) {
+        cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+        __sync_add_and_fetch(&meta->writers, 1);
+    }
+
+    cruise_fd_files[fd] = file;
+
+    pthread_mutex_unlock(&cruise_fd_mutex);
+
+    debug("allocated fd %d on open file %d for fid %d\n", fd, file, fid);
+    *outfd = fd;
+    return CRUISE_SUCCESS;
+}
+
+/* allocate a file descriptor referring to the same open file as fd,
+ * takes the lowest free descriptor at or above minfd, fills outfd
+ * with the descriptor, returns CRUISE error code */
+int cruise_fd_dup(int fd, int minfd, int* outfd)
+{
+    if (fd < 0 || fd >= CRUISE_MAX_FILEDESCS) {
+        return CRUISE_ERR_BADF;
+    }
+    if (minfd >= CRUISE_MAX_FILEDESCS) {
+        return CRUISE_ERR_INVAL;
+    }
+
+    pthread_mutex_lock(&cruise_fd_mutex);
+
+    int file = cruise_fd_files[fd];
+    if (file < 0) {
+        pthread_mutex_unlock(&cruise_fd_mutex);
+        return CRUISE_ERR_BADF;
+    }
+
+    /* dup and F_DUPFD must return the lowest free descriptor in
+     * range, which after closes in any order need not be the top of
+     * the free stack, so search for it and take it off the stack */
+    if (minfd < 0) {
+        minfd = 0;
+    }
+    int newfd = -1;
+    int i;
+    for (i = minfd; i < CRUISE_MAX_FILEDESCS; i++) {
+        if (cruise_fd_files[i] < 0) {
+            cruise_stack_remove(free_fd_stack, i);
+            newfd = i;
+            break;
+        }
+    }
+    if (newfd < 0) {
+        pthread_mutex_unlock(&cruise_fd_mutex);
+        return CRUISE_ERR_MFILE;
+    }
+
+    /* share the open file and its file pointer */
+    cruise_fds[file].refs++;
+    cruise_fd_files[newfd] = file;
+
+    pthread_mutex_unlock(&cruise_fd_mutex);
+
+    *outfd = newfd;
+    return CRUISE_SUCCESS;
+}
+
+/* make newfd refer to the same open file as fd, closing newfd first
+ * if it's open, returns CRUISE error code */
+int cruise_fd_dup2(int fd, int newfd)
+{
+    if (fd < 0 || fd >= CRUISE_MAX_FILEDESCS ||
+        newfd < 0 || newfd >= CRUISE_MAX_FILEDESCS)
+    {
+        return CRUISE_ERR_BADF;
+    }
+
+    pthread_mutex_lock(&cruise_fd_mutex);
+
+    int file = cruise_fd_files[fd];
+    if (file < 0) {
+        pthread_mutex_unlock(&cruise_fd_mutex);
+        return CRUISE_ERR_BADF;
+    }
+
+    /* nothing to do if both already refer to the same open file */
+    int rc = CRUISE_SUCCESS;
+    int oldfile = cruise_fd_files[newfd];
+    if (oldfile != file) {
+        if (oldfile >= 0) {
+            /* newfd is open, so close it, an error here doesn't stop
+             * newfd from being reused just as with close */
+            rc = cruise_fd_release(oldfile);
+        } else {
+            /* newfd is free, so take it off the free stack */
+            cruise_stack_remove(free_fd_stack, newfd);
+        }
+
+        cruise_fds[file].refs++;
+        cruise_fd_files[newfd] = file;
+    }
+
+    pthread_mutex_unlock(&cruise_fd_mutex);
+
+    return rc;
+}
+
+/* close file descriptor, closes its file id once the last
+ * descriptor referring to the open file is gone, returns CRUISE
+ * error code */
+int cruise_fd_free(int fd)
+{
+    if (fd < 0 || fd >= CRUISE_MAX_FILEDESCS) {
+        return CRUISE_ERR_BADF;
+    }
+
+    pthread_mutex_lock(&cruise_fd_mutex);
+
+    int file = cruise_fd_files[fd];
+    if (file < 0) {
+        pthread_mutex_unlock(&cruise_fd_mutex);
+        return CRUISE_ERR_BADF;
+    }
+
+    /* note whether this closes the last descriptor of an open file
+     * with write access, which may seal the file */
+    int sealed_fid = -1;
+    if (cruise_fds[file].refs == 1 && cruise_fds[file].write) {
+        sealed_fid = cruise_fds[file].fid;
+    }
+
+    /* the descriptor is free whether or not closing the file works */
+    cruise_fd_files[fd] = -1;
+    cruise_stack_push(free_fd_stack, fd);
+    int rc = cruise_fd_release(file);
+
+    pthread_mutex_unlock(&cruise_fd_mutex);
+
+    /* share the chunks of a file no one writes anymore, we do this
+     * outside the descriptor lock since it reads every chunk */
+    if (cruise_dedup_chunks && sealed_fid >= 0) {
+        cruise_fid_dedup(sealed_fid);
+    }
+
+    return rc;
+}
+
 /* given a file id, return a pointer to the meta data,
  * otherwise return NULL */
 cruise_filemeta_t* cruise_get_meta_from_fid(int fid)
@@ -491,6 +733,391 @@ off_t cruise_fid_size(int fid)
     return meta->size;
 }
 
+/* raise size of file to length if it's smaller, threads holding the
+ * file lock shared may call this at the same time */
+static void cruise_fid_size_raise(cruise_filemeta_t* meta, off_t length)
+{
+    off_t size = meta->size;
+    while (length > size) {
+        if (__sync_bool_compare_and_swap(&meta->size, size, length)) {
+            break;
+        }
+        size = meta->size;
+    }
+}
+
+/* return number of bytes of storage reserved for given file id,
+ * writes that end within this need no new chunks */
+off_t cruise_fid_reserved(int fid)
+{
+    /* get meta data for this file */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+
+    /* determine file storage type */
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        return meta->chunks << cruise_chunk_bits;
+    }
+    return 0;
+}
+
+/* returns 1 if count bytes at pos in file id can be written while
+ * holding the file lock shared, which needs the range to end within
+ * reserved space and to leave the chunks of the file as they are */
+int cruise_fid_write_shared(int fid, off_t pos, off_t count)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        return cruise_fid_store_fixed_shared(fid, meta, pos, count);
+    }
+    return 0;
+}
+
+/* lock file id shared, held to read or write data that lies within
+ * the reserved space of the file */
+int cruise_fid_rdlock(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    pthread_rwlock_rdlock(&meta->rwlock);
+    return CRUISE_SUCCESS;
+}
+
+/* lock file id exclusive, held to change the chunks of the file or
+ * to zero fill a gap before writing past the end */
+int cruise_fid_wrlock(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    pthread_rwlock_wrlock(&meta->rwlock);
+    return CRUISE_SUCCESS;
+}
+
+/* release the lock on file id taken with rdlock or wrlock */
+int cruise_fid_unlock(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    pthread_rwlock_unlock(&meta->rwlock);
+    return CRUISE_SUCCESS;
+}
+
+/* returns 1 if the file is sealed, which is when no open file has
+ * write access to it, and 0 otherwise */
+int cruise_fid_is_sealed(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    return (meta->writers == 0);
+}
+
+/* claim count bytes at the end of file id for an append, caller
+ * holds the file lock shared, concurrent appenders get disjoint
+ * ranges, sets outpos to the start of our range, returns
+ * CRUISE_ERR_NOSPC if the range would run past the reserved space,
+ * or can't be written with the lock shared, in which case the caller
+ * should take the lock exclusive and extend the file instead */
+int cruise_fid_append_reserve(int fid, off_t count, off_t* outpos)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+
+    /* move the tail past our range, the end of the file is the tail
+     * or the size, whichever is further, since writes at a position
+     * may have raised the size beyond the last append */
+    off_t tail = meta->tail;
+    while (1) {
+        off_t start = meta->size;
+        if (tail > start) {
+            start = tail;
+        }
+        if (cruise_would_overflow_offt(start, count)) {
+            return CRUISE_ERR_OVERFLOW;
+        }
+        if (! cruise_fid_write_shared(fid, start, count)) {
+            return CRUISE_ERR_NOSPC;
+        }
+        if (__sync_bool_compare_and_swap(&meta->tail, tail, start + count)) {
+            *outpos = start;
+            return CRUISE_SUCCESS;
+        }
+        tail = meta->tail;
+    }
+}
+
+/* gives back the range of count bytes at pos that an append claimed
+ * with cruise_fid_append_reserve but failed to write, returns 1 if the
+ * tail moved back and 0 if a later append claimed space after it, in
+ * which case the range stays part of the file and the caller must
+ * fill it */
+int cruise_fid_append_cancel(int fid, off_t pos, off_t count)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (__sync_bool_compare_and_swap(&meta->tail, pos + count, pos)) {
+        return 1;
+    }
+    return 0;
+}
+
+/* serializes passes over the files looking for chunks to compress */
+static pthread_mutex_t cruise_reclaim_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* compress chunks of closed files until at least want memory chunks
+ * are free or nothing is left to compress, files that are open for
+ * writing, pinned, or locked by someone else are skipped, so we never
+ * wait on a file lock and callers may hold one, returns the number of
+ * chunks freed */
+int cruise_fid_reclaim(int want)
+{
+    int freed = 0;
+
+    pthread_mutex_lock(&cruise_reclaim_mutex);
+    int fid;
+    for (fid = 0; fid < cruise_max_files; fid++) {
+        int free_chunks = cruise_stack_count(free_chunk_stack);
+        if (free_chunks >= want) {
+            break;
+        }
+
+        /* look for files no one is writing or holding chunks of */
+        cruise_filemeta_t* meta = &cruise_filemetas[fid];
+        if (! cruise_filelist[fid].in_use || meta->is_dir ||
+            meta->writers > 0 || meta->pins > 0)
+        {
+            continue;
+        }
+        if (pthread_rwlock_trywrlock(&meta->rwlock) != 0) {
+            continue;
+        }
+
+        /* check again now that we have the lock */
+        if (meta->writers == 0 && meta->pins == 0 &&
+            meta->storage == FILE_STORAGE_FIXED_CHUNK)
+        {
+            freed += cruise_fid_store_fixed_pack(fid, meta, want - free_chunks);
+        }
+        pthread_rwlock_unlock(&meta->rwlock);
+    }
+    pthread_mutex_unlock(&cruise_reclaim_mutex);
+
+    return freed;
+}
+
+/* fills crcs with the CRC32C of the data in each chunk of file id, at
+ * most max entries, and size with the file size they cover, takes the
+ * file lock exclusive since it may bring checksums up to date,
+ * returns the number of chunks holding data or a negative CRUISE
+ * error code */
+int cruise_fid_checksums(int fid, unsigned int* crcs, int max, off_t* size)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+    if (! cruise_checksum_chunks) {
+        return CRUISE_ERR_INVAL;
+    }
+
+    int rc;
+    cruise_fid_wrlock(fid);
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        rc = cruise_fid_store_fixed_checksums(fid, meta, crcs, max);
+        *size = meta->size;
+    } else {
+        rc = CRUISE_ERR_IO;
+    }
+    cruise_fid_unlock(fid);
+
+    return rc;
+}
+
+/* checks the data of file id against its chunk checksums, returns
+ * CRUISE_ERR_IO on a mismatch */
+int cruise_fid_verify(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+
+    int rc;
+    cruise_fid_rdlock(fid);
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        rc = cruise_fid_store_fixed_verify(fid, meta);
+    } else {
+        rc = CRUISE_ERR_IO;
+    }
+    cruise_fid_unlock(fid);
+
+    return rc;
+}
+
+/* clone up to count bytes at src_pos of file src_fid to dst_pos of
+ * file dst_fid, whole chunks are shared until either file writes to
+ * them and the rest is copied, a gap before dst_pos is zero filled,
+ * nothing past the end of src is cloned, takes both file locks
+ * exclusive, sets outcount to the number of bytes cloned, returns
+ * CRUISE error code */
+int cruise_fid_clone(int src_fid, off_t src_pos, int dst_fid, off_t dst_pos, off_t count, off_t* outcount)
+{
+    cruise_filemeta_t* src_meta = cruise_get_meta_from_fid(src_fid);
+    cruise_filemeta_t* dst_meta = cruise_get_meta_from_fid(dst_fid);
+    if (src_meta == NULL || dst_meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+    if (src_meta->is_dir || dst_meta->is_dir) {
+        return CRUISE_ERR_ISDIR;
+    }
+    if (src_pos < 0 || dst_pos < 0 || count < 0) {
+        return CRUISE_ERR_INVAL;
+    }
+
+    /* lock the lower file id first, so clones going both ways
+     * between two files can't deadlock */
+    int first  = (src_fid < dst_fid) ? src_fid : dst_fid;
+    int second = (src_fid < dst_fid) ? dst_fid : src_fid;
+    cruise_fid_wrlock(first);
+    if (second != first) {
+        cruise_fid_wrlock(second);
+    }
+
+    /* nothing to clone past the end of src */
+    off_t size = src_meta->size;
+    if (src_pos >= size) {
+        count = 0;
+    } else if (count > size - src_pos) {
+        count = size - src_pos;
+    }
+
+    /* dst must not grow past the largest offset, and a range can't
+     * be cloned over itself */
+    int rc = CRUISE_SUCCESS;
+    if (cruise_would_overflow_offt(dst_pos, count)) {
+        rc = CRUISE_ERR_OVERFLOW;
+    } else if (src_fid == dst_fid && src_pos < dst_pos + count && dst_pos < src_pos + count) {
+        rc = CRUISE_ERR_INVAL;
+    }
+
+    if (rc == CRUISE_SUCCESS && count > 0) {
+        if (src_meta->storage != FILE_STORAGE_FIXED_CHUNK ||
+            dst_meta->storage != FILE_STORAGE_FIXED_CHUNK)
+        {
+            rc = CRUISE_ERR_IO;
+        }
+
+        /* fill any gap between the end of dst and dst_pos with zeros */
+        off_t dst_size = dst_meta->size;
+        if (rc == CRUISE_SUCCESS && dst_pos > dst_size) {
+            rc = cruise_fid_extend(dst_fid, dst_pos);
+            if (rc == CRUISE_SUCCESS) {
+                rc = cruise_fid_write_zero(dst_fid, dst_size, dst_pos - dst_size);
+            }
+        }
+
+        if (rc == CRUISE_SUCCESS) {
+            rc = cruise_fid_store_fixed_clone(
+                src_fid, src_meta, src_pos, dst_fid, dst_meta, dst_pos, count
+            );
+        }
+        if (rc == CRUISE_SUCCESS) {
+            cruise_fid_size_raise(dst_meta, dst_pos + count);
+        }
+    }
+    *outcount = (rc == CRUISE_SUCCESS) ? count : 0;
+
+    if (second != first) {
+        cruise_fid_unlock(second);
+    }
+    cruise_fid_unlock(first);
+
+    return rc;
+}
+
+/* fills ranges with the ranges of file id written in epoch since or
+ * later, at most max entries, and epoch with the current epoch,
+ * returns the number of ranges or a negative CRUISE error code */
+int cruise_fid_dirty(int fid, unsigned long long since, cruise_range_t* ranges, int max, unsigned long long* epoch)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+    if (meta->is_dir) {
+        return CRUISE_ERR_ISDIR;
+    }
+
+    int rc;
+    cruise_fid_rdlock(fid);
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        rc = cruise_fid_store_fixed_dirty(fid, meta, since, ranges, max);
+    } else {
+        rc = 0;
+    }
+    *epoch = meta->epoch;
+    cruise_fid_unlock(fid);
+
+    return rc;
+}
+
+/* starts a new epoch for file id and sets epoch to it, takes the file
+ * lock exclusive so writes in flight finish in the old epoch */
+int cruise_fid_dirty_clear(int fid, unsigned long long* epoch)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+
+    cruise_fid_wrlock(fid);
+    meta->epoch++;
+    *epoch = meta->epoch;
+    cruise_fid_unlock(fid);
+
+    return CRUISE_SUCCESS;
+}
+
+/* marks the chunks holding count bytes at pos of file id as written
+ * in its current epoch */
+int cruise_fid_dirty_mark(int fid, off_t pos, off_t count)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+
+    cruise_fid_rdlock(fid);
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        cruise_fid_store_fixed_dirty_mark(fid, meta, pos, count);
+    }
+    cruise_fid_unlock(fid);
+
+    return CRUISE_SUCCESS;
+}
+
+/* share full chunks of file id with identical chunks of other files
+ * once it is sealed, files that are open for writing or pinned are
+ * left as they are, returns the number of memory chunks freed */
+int cruise_fid_dedup(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return 0;
+    }
+
+    int freed = 0;
+    cruise_fid_wrlock(fid);
+    if (cruise_filelist[fid].in_use && ! meta->is_dir &&
+        meta->writers == 0 && meta->pins == 0 &&
+        meta->storage == FILE_STORAGE_FIXED_CHUNK)
+    {
+        freed = cruise_fid_store_fixed_dedup(fid, meta);
+    }
+    cruise_fid_unlock(fid);
+
+    return freed;
+}
+
+/* run by the packer when free memory chunks run low, compresses
+ * until twice the low mark is free */
+static void cruise_fid_reclaim_background(void)
+{
+    cruise_fid_reclaim(2 * cruise_compress_free);
+}
+
 /* fill in limited amount of stat information */
 int cruise_fid_stat(int fid, struct stat* buf)
 {
@@ -574,12 +1201,23 @@ int cruise_fid_create_file(const char * path)
     /* initialize meta data */
     cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
     meta->size    = 0;
+    meta->tail    = 0;
     meta->chunks  = 0;
     meta->is_dir  = 0;
     meta->storage = FILE_STORAGE_NULL;
     meta->flock_status = UNLOCKED;
+    meta->pins     = 0;
+    meta->unlinked = 0;
+    meta->writers  = 0;
+    meta->shared   = 0;
+    meta->epoch    = 1;
+
     /* PTHREAD_PROCESS_SHARED allows Process-Shared Synchronization*/
-    pthread_spin_init(&meta->fspinlock, PTHREAD_PROCESS_SHARED);
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_rwlock_init(&meta->rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
 
     return fid;
 }
@@ -656,12 +1294,75 @@ int cruise_fid_write(int fid, off_t pos, const void* buf, size_t count)
     return rc;
 }
 
+/* read count bytes from file starting from pos into the buffers of
+ * iov in order, all bytes are assumed to exist */
+int cruise_fid_readv(int fid, off_t pos, const struct iovec* iov, int iovcnt, size_t count)
+{
+    int rc;
+
+    /* short-circuit a 0-byte read */
+    if (count == 0) {
+        return CRUISE_SUCCESS;
+    }
+
+    /* get meta for this file id */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+
+    /* determine storage type to read file data */
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        /* file stored in fixed-size chunks */
+        rc = cruise_fid_store_fixed_iov(fid, meta, pos, iov, iovcnt, count, 0);
+    } else {
+        /* unknown storage type */
+        rc = CRUISE_ERR_IO;
+    }
+
+    return rc;
+}
+
+/* write count bytes from the buffers of iov in order into file
+ * starting at offset pos, all bytes are assumed to be allocated */
+int cruise_fid_writev(int fid, off_t pos, const struct iovec* iov, int iovcnt, size_t count)
+{
+    int rc;
+
+    /* short-circuit a 0-byte write */
+    if (count == 0) {
+        return CRUISE_SUCCESS;
+    }
+
+    /* get meta for this file id */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+
+    /* determine storage type to write file data */
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        /* file stored in fixed-size chunks */
+        rc = cruise_fid_store_fixed_iov(fid, meta, pos, iov, iovcnt, count, 1);
+    } else {
+        /* unknown storage type */
+        rc = CRUISE_ERR_IO;
+    }
+
+    return rc;
+}
+
 /* given a file id, write zero bytes to region of specified offset
  * and length, assumes space is already reserved */
 int cruise_fid_write_zero(int fid, off_t pos, off_t count)
 {
     int rc = CRUISE_SUCCESS;
 
+    /* fixed-size chunks zero in place and may keep whole chunks as
+     * holes */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        rc = cruise_fid_store_fixed_zero(fid, meta, pos, count);
+        if (rc != CRUISE_SUCCESS) {
+            rc = CRUISE_ERR_IO;
+        }
+        return rc;
+    }
+
     /* allocate an aligned chunk of memory */
     size_t buf_size = 1024 * 1024;
     void* buf = (void*) malloc(buf_size);
@@ -703,7 +1404,8 @@ int cruise_fid_write_zero(int fid, off_t pos, off_t count)
 
 /* increase size of file if length is greater than current size,
  * and allocate additional chunks as needed to reserve space for
- * length bytes */
+ * length bytes, caller holds the file lock exclusive unless the
+ * space is already reserved */
 int cruise_fid_extend(int fid, off_t length)
 {
     int rc;
@@ -720,11 +1422,8 @@ int cruise_fid_extend(int fid, off_t length)
         rc = CRUISE_ERR_IO;
     }
 
-    /* TODO: move this statement elsewhere */
     /* increase file size up to length */
-    if (length > meta->size) {
-        meta->size = length;
-    }
+    cruise_fid_size_raise(meta, length);
 
     return rc;
 }
@@ -757,36 +1456,42 @@ int cruise_fid_truncate(int fid, off_t length)
     /* get meta data for this file */
     cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
 
+    /* we change the chunks and size, so keep everyone else out */
+    cruise_fid_wrlock(fid);
+
     /* get current size of file */
     off_t size = meta->size;
 
     /* drop data if length is less than current size,
      * allocate new space and zero fill it if bigger */
+    int rc = CRUISE_SUCCESS;
     if (length < size) {
         /* determine the number of chunks to leave after truncating */
-        int shrink_rc = cruise_fid_shrink(fid, length);
-        if (shrink_rc != CRUISE_SUCCESS) {
-            return shrink_rc;
-        }
+        rc = cruise_fid_shrink(fid, length);
     } else if (length > size) {
         /* file size has been extended, allocate space */
         int extend_rc = cruise_fid_extend(fid, length);
         if (extend_rc != CRUISE_SUCCESS) {
-            return CRUISE_ERR_NOSPC;
+            rc = CRUISE_ERR_NOSPC;
+        } else {
+            /* write zero values to new bytes */
+            off_t gap_size = length - size;
+            int zero_rc = cruise_fid_write_zero(fid, size, gap_size);
+            if (zero_rc != CRUISE_SUCCESS) {
+                rc = CRUISE_ERR_IO;
+            }
         }
+    }
 
-        /* write zero values to new bytes */
-        off_t gap_size = length - size;
-        int zero_rc = cruise_fid_write_zero(fid, size, gap_size);
-        if (zero_rc != CRUISE_SUCCESS) {
-            return CRUISE_ERR_IO;
-        }
+    /* set the new size, appends start over from there */
+    if (rc == CRUISE_SUCCESS) {
+        meta->size = length;
+        meta->tail = 0;
     }
 
-    /* set the new size */
-    meta->size = length;
+    cruise_fid_unlock(fid);
 
-    return CRUISE_SUCCESS;
+    return rc;
 }
 
 /* opens a new file id with specified path, access flags, and permissions,
@@ -865,22 +1570,68 @@ int cruise_fid_open(const char* path, int flags, mode_t mode, int* outfid, off_t
         }
     }
 
-    /* TODO: allocate a free file descriptor and associate it with fid */
-    /* set in_use flag and file pointer */
-    *outfid = fid;
-    *outpos = pos;
-    debug("CRUISE_open generated fd %d for file %s\n", fid, path);    
+    /* caller allocates a file descriptor for the file id */
+    *outfid = fid;
+    *outpos = pos;
+    debug("CRUISE_open opened fid %d for file %s\n", fid, path);    
+
+    return CRUISE_SUCCESS;
+}
+
+int cruise_fid_close(int fid)
+{
+    /* TODO: clear any held locks */
+
+    /* nothing to do here, just a place holder */
+    return CRUISE_SUCCESS;
+}
+
+/* return a pointer to the memory of the chunk holding pos in chunkbuf
+ * and the file offset of its first byte in chunkpos, if write is set
+ * the chunk is reserved and made our own so the caller may write into
+ * it, otherwise it must already be reserved and may be shared with
+ * other files, does not change the file size, returns CRUISE_ERR_IO
+ * if the chunk is not held in memory */
+int cruise_fid_chunk_map(int fid, off_t pos, int write, void** chunkbuf, off_t* chunkpos)
+{
+    int rc;
+
+    /* get meta data for this file */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+
+    /* compute offset of first byte in chunk */
+    off_t start = pos & ~cruise_chunk_mask;
 
-    /* don't conflict with active system fds that range from 0 - (fd_limit) */
-    return CRUISE_SUCCESS;
-}
+    /* a writer may add chunks or copy a shared one, so it keeps
+     * everyone else out */
+    if (write) {
+        cruise_fid_wrlock(fid);
+    } else {
+        cruise_fid_rdlock(fid);
+    }
 
-int cruise_fid_close(int fid)
-{
-    /* TODO: clear any held locks */
+    /* determine file storage type */
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        /* reserve the chunk without touching the file size */
+        rc = CRUISE_SUCCESS;
+        if (write) {
+            rc = cruise_fid_store_fixed_extend(fid, meta, start + cruise_chunk_size);
+        }
+        if (rc == CRUISE_SUCCESS) {
+            rc = cruise_fid_store_fixed_chunk(fid, meta, pos, write, chunkbuf);
+        }
+    } else {
+        /* unknown storage type */
+        rc = CRUISE_ERR_IO;
+    }
 
-    /* nothing to do here, just a place holder */
-    return CRUISE_SUCCESS;
+    cruise_fid_unlock(fid);
+
+    *chunkpos = start;
+    return rc;
 }
 
 /* delete a file id and return file its resources to free pools */
@@ -889,22 +1640,110 @@ int cruise_fid_unlink(int fid)
     /* return data to free pools */
     cruise_fid_truncate(fid, 0);
 
-    /* finalize the storage we're using for this file */
-    cruise_fid_store_free(fid);
-
     /* set this file id as not in use */
     cruise_filelist[fid].in_use = 0;
 
+    /* if a read view still holds this file, the last release
+     * finishes the job */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta->pins > 0) {
+        meta->unlinked = 1;
+        return CRUISE_SUCCESS;
+    }
+
+    /* finalize the storage we're using for this file */
+    cruise_fid_store_free(fid);
+
     /* add this id back to the free stack */
     cruise_fid_free(fid);
 
     return CRUISE_SUCCESS;
 }
 
+/* pin file id so that its chunks are not freed by truncate or unlink */
+int cruise_fid_pin(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+    __sync_add_and_fetch(&meta->pins, 1);
+    return CRUISE_SUCCESS;
+}
+
+/* drop a pin on file id, releases any chunks that were truncated or
+ * unlinked while the file was pinned */
+int cruise_fid_unpin(int fid)
+{
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+    if (meta == NULL) {
+        return CRUISE_ERR_BADF;
+    }
+
+    /* nothing else to do if someone else still holds the file */
+    if (__sync_sub_and_fetch(&meta->pins, 1) > 0) {
+        return CRUISE_SUCCESS;
+    }
+
+    /* give back chunks beyond the current size */
+    cruise_fid_wrlock(fid);
+    int rc = cruise_fid_shrink(fid, meta->size);
+    cruise_fid_unlock(fid);
+
+    /* complete an unlink that happened while we were pinned */
+    if (meta->unlinked) {
+        meta->unlinked = 0;
+        cruise_fid_store_free(fid);
+        cruise_fid_free(fid);
+    }
+
+    return rc;
+}
+
+/* fill in iov with pointers to file data for count bytes starting at
+ * pos, data held outside of memory is staged in a buffer returned in
+ * staged, all bytes are assumed to exist */
+int cruise_fid_view(int fid, off_t pos, size_t count, struct iovec* iov, int* iovcnt, void** staged)
+{
+    int rc;
+
+    /* get meta for this file id */
+    cruise_filemeta_t* meta = cruise_get_meta_from_fid(fid);
+
+    /* determine storage type to map file data */
+    if (meta->storage == FILE_STORAGE_FIXED_CHUNK) {
+        /* file stored in fixed-size chunks */
+        rc = cruise_fid_store_fixed_view(fid, meta, pos, count, iov, iovcnt, staged);
+    } else {
+        /* unknown storage type */
+        rc = CRUISE_ERR_IO;
+    }
+
+    return rc;
+}
+
 /* ---------------------------------------
  * Operations to mount file system
  * --------------------------------------- */
 
+/* each region of the superblock starts on its own cache line, so
+ * that atomic updates to file meta data never straddle two lines,
+ * which the processor handles with a bus lock (and which the kernel
+ * may trap) */
+#define CRUISE_SUPERBLOCK_ALIGN (64)
+
+/* number of regions we carve out of the superblock, we reserve
+ * enough slack to align each of them */
+#define CRUISE_SUPERBLOCK_REGIONS (11)
+
+/* round ptr up to the next multiple of CRUISE_SUPERBLOCK_ALIGN */
+static char* cruise_align_region(char* ptr)
+{
+    uintptr_t addr = (uintptr_t) ptr;
+    uintptr_t mask = (uintptr_t) (CRUISE_SUPERBLOCK_ALIGN - 1);
+    return (char*) ((addr + mask) & ~mask);
+}
+
 /* initialize our global pointers into the given superblock */
 static void* cruise_init_pointers(void* superblock)
 {
@@ -913,36 +1752,64 @@ static void* cruise_init_pointers(void* superblock)
     /* jump over header (right now just a uint32_t to record
      * magic value of 0xdeadbeef if initialized */
     ptr += sizeof(uint32_t);
+    ptr = cruise_align_region(ptr);
 
     /* stack to manage free file ids */
     free_fid_stack = ptr;
     ptr += cruise_stack_bytes(cruise_max_files);
+    ptr = cruise_align_region(ptr);
 
     /* record list of file names */
     cruise_filelist = (cruise_filename_t*) ptr;
     ptr += cruise_max_files * sizeof(cruise_filename_t);
+    ptr = cruise_align_region(ptr);
 
     /* array of file meta data structures */
     cruise_filemetas = (cruise_filemeta_t*) ptr;
     ptr += cruise_max_files * sizeof(cruise_filemeta_t);
+    ptr = cruise_align_region(ptr);
 
     /* array of chunk meta data strucutres for each file */
     cruise_chunkmetas = (cruise_chunkmeta_t*) ptr;
     ptr += cruise_max_files * cruise_max_chunks * sizeof(cruise_chunkmeta_t);
+    ptr = cruise_align_region(ptr);
 
     /* Teng: array of chunk meta data for spillover chunks of each file*/
     if (cruise_use_spillover) {
     	ptr += cruise_max_files * cruise_spillover_max_chunks * sizeof(cruise_chunkmeta_t);
+    	ptr = cruise_align_region(ptr);
     }
 
     /* stack to manage free memory data chunks */
     free_chunk_stack = ptr;
     ptr += cruise_stack_bytes(cruise_max_chunks);
+    ptr = cruise_align_region(ptr);
+
+    /* slots in use of memory chunks that hold compressed chunks */
+    cruise_pack_map = (unsigned int*) ptr;
+    ptr += cruise_max_chunks * sizeof(unsigned int);
+    ptr = cruise_align_region(ptr);
+
+    /* sharing state of memory chunks */
+    cruise_chunk_refs = (cruise_chunkref_t*) ptr;
+    ptr += cruise_max_chunks * sizeof(cruise_chunkref_t);
+    ptr = cruise_align_region(ptr);
+
+    /* buckets of the dedup index */
+    cruise_dedup_index = (int*) ptr;
+    ptr += cruise_max_chunks * sizeof(int);
+    ptr = cruise_align_region(ptr);
 
     if (cruise_use_spillover) {
         /* stack to manage free spill-over data chunks */
         free_spillchunk_stack = ptr;
         ptr += cruise_stack_bytes(cruise_spillover_max_chunks);
+        ptr = cruise_align_region(ptr);
+
+        /* slots in use of spill over chunks that hold compressed
+         * chunks */
+        cruise_spill_pack_map = (unsigned int*) ptr;
+        ptr += cruise_spillover_max_chunks * sizeof(unsigned int);
     }
 
     /* Only set this up if we're using memfs */
@@ -973,25 +1840,30 @@ static int cruise_init_structures()
         /* indicate that file id is not in use by setting flag to 0 */
         cruise_filelist[i].in_use = 0;
 
-        /* set pointer to array of chunkmeta data structures */
+        /* set pointer to array of chunkmeta data structures, with
+         * spill over a file may hold chunks in both places */
         cruise_filemeta_t* filemeta = &cruise_filemetas[i];
-        cruise_chunkmeta_t* chunkmetas = &(cruise_chunkmetas[cruise_max_chunks * i]);
-        filemeta->chunk_meta = chunkmetas;
-
-        /* Teng: add support for spillover*/
+        cruise_chunkmeta_t* chunkmetas;
         if (!cruise_use_spillover)
         	chunkmetas = &(cruise_chunkmetas[cruise_max_chunks * i]);
         else
         	chunkmetas = &(cruise_chunkmetas[ (cruise_max_chunks + \
         			cruise_spillover_max_chunks)*i]);
+        filemeta->chunk_meta = chunkmetas;
     }
 
     cruise_stack_init(free_fid_stack, cruise_max_files);
 
     cruise_stack_init(free_chunk_stack, cruise_max_chunks);
+    memset(cruise_pack_map, 0, cruise_max_chunks * sizeof(unsigned int));
+    memset(cruise_chunk_refs, 0, cruise_max_chunks * sizeof(cruise_chunkref_t));
+    for (i = 0; i < cruise_max_chunks; i++) {
+        cruise_dedup_index[i] = -1;
+    }
 
     if (cruise_use_spillover) {
         cruise_stack_init(free_spillchunk_stack, cruise_spillover_max_chunks);
+        memset(cruise_spill_pack_map, 0, cruise_spillover_max_chunks * sizeof(unsigned int));
     }
 
     debug("Meta-stacks initialized!\n");
@@ -1318,6 +2190,14 @@ static int cruise_init(int rank)
 
         debug("are we using spillover? %d\n", cruise_use_spillover);
 
+        /* will we keep whole chunks of zeros as holes? */
+        cruise_zero_chunks = CRUISE_ZERO_CHUNKS;
+        env = getenv("CRUISE_ZERO_CHUNKS");
+        if (env) {
+            int val = atoi(env);
+            cruise_zero_chunks = (val != 0);
+        }
+
         /* determine max number of files to store in file system */
         cruise_max_files = CRUISE_MAX_FILES;
         env = getenv("CRUISE_MAX_FILES");
@@ -1381,6 +2261,107 @@ static int cruise_init(int rank)
 
 #endif
 
+        /* determine number of threads to split large reads and writes,
+         * and how large they must be */
+        int copy_threads = CRUISE_COPY_THREADS;
+        env = getenv("CRUISE_COPY_THREADS");
+        if (env) {
+            int val = atoi(env);
+            if (val >= 0) {
+                copy_threads = val;
+            }
+        }
+
+        size_t copy_threshold = CRUISE_COPY_THRESHOLD;
+        env = getenv("CRUISE_COPY_THRESHOLD");
+        if (env) {
+            cruise_abtoull(env, &bytes);
+            copy_threshold = (size_t) bytes;
+        }
+
+        /* keep copy threads near the chunk memory */
+        int copy_node = CRUISE_COPYPOOL_NODE_ANY;
+#ifdef ENABLE_NUMA_POLICY
+        if (cruise_numa_bank >= 0) {
+            copy_node = cruise_numa_bank;
+        } else if (strcmp(cruise_numa_policy, "interleaved") == 0) {
+            copy_node = CRUISE_COPYPOOL_NODE_SPREAD;
+        } else if (strcmp(cruise_numa_policy, "local") == 0 && numa_available() >= 0) {
+            copy_node = numa_node_of_cpu(sched_getcpu());
+        }
+#endif
+        cruise_copypool_init(copy_threads, copy_threshold, copy_node);
+
+        /* pick the kernel for large writes into chunk memory */
+        size_t stream_min = CRUISE_STREAM_COPY_MIN;
+        env = getenv("CRUISE_STREAM_COPY_MIN");
+        if (env) {
+            cruise_abtoull(env, &bytes);
+            stream_min = (size_t) bytes;
+        }
+        cruise_memcpy_init(getenv("CRUISE_COPY_KERNEL"), stream_min);
+        debug("copy kernel for large writes: %s\n", cruise_memcpy_kernel());
+
+        /* will we compress chunks of closed files when memory runs
+         * low, and how many chunks should we keep free? */
+        cruise_compress_chunks = CRUISE_COMPRESS;
+        env = getenv("CRUISE_COMPRESS");
+        if (env) {
+            int val = atoi(env);
+            cruise_compress_chunks = (val != 0);
+        }
+
+        int compress_pct = CRUISE_COMPRESS_FREE;
+        env = getenv("CRUISE_COMPRESS_FREE");
+        if (env) {
+            int val = atoi(env);
+            if (val >= 0 && val <= 100) {
+                compress_pct = val;
+            }
+        }
+        cruise_compress_free = (int) ((long) cruise_max_chunks * compress_pct / 100);
+        if (cruise_compress_free < 1) {
+            cruise_compress_free = 1;
+        }
+        if (cruise_compress_chunks) {
+            cruise_compress_init(cruise_fid_reclaim_background);
+        }
+
+        /* will we compress whole chunks on their way to spill over? */
+        cruise_compress_spillover = CRUISE_COMPRESS_SPILLOVER;
+        env = getenv("CRUISE_COMPRESS_SPILLOVER");
+        if (env) {
+            int val = atoi(env);
+            cruise_compress_spillover = (val != 0);
+        }
+
+        /* will we share full chunks of closed files with identical
+         * chunks of other files? */
+        cruise_dedup_chunks = CRUISE_DEDUP;
+        env = getenv("CRUISE_DEDUP");
+        if (env) {
+            int val = atoi(env);
+            cruise_dedup_chunks = (val != 0);
+        }
+
+        /* will we keep a checksum of each chunk, and check data
+         * against it? */
+        cruise_checksum_chunks = CRUISE_CHECKSUM;
+        env = getenv("CRUISE_CHECKSUM");
+        if (env) {
+            int val = atoi(env);
+            cruise_checksum_chunks = (val != 0);
+        }
+        cruise_checksum_verify = CRUISE_CHECKSUM_VERIFY;
+        env = getenv("CRUISE_CHECKSUM_VERIFY");
+        if (env) {
+            int val = atoi(env);
+            cruise_checksum_verify = (val != 0);
+        }
+        if (cruise_checksum_verify) {
+            cruise_checksum_chunks = 1;
+        }
+
         /* record the max fd for the system */
         /* RLIMIT_NOFILE specifies a value one greater than the maximum
          * file descriptor number that can be opened by this process */
@@ -1398,6 +2379,12 @@ static int cruise_init(int rank)
         free(r_limit);
         debug("FD limit for system = %ld\n", cruise_fd_limit);
 
+        /* all of our file descriptors start out free */
+        if (cruise_fd_init() != CRUISE_SUCCESS) {
+            debug("cruise_fd_init() failed\n");
+            return CRUISE_FAILURE;
+        }
+
         /* determine the size of the superblock */
         /* generous allocation for chunk map (one file can take entire space)*/
         size_t superblock_size = 0;
@@ -1412,6 +2399,9 @@ static int cruise_init(int rank)
 																		/*  Teng: spillover chunk meta data struct array for each file */
 		}
         superblock_size += cruise_stack_bytes(cruise_max_chunks);        /* free chunk stack */
+        superblock_size += cruise_max_chunks * sizeof(unsigned int);     /* pack chunk slot map */
+        superblock_size += cruise_max_chunks * sizeof(cruise_chunkref_t); /* chunk sharing state */
+        superblock_size += cruise_max_chunks * sizeof(int);              /* dedup index buckets */
         if (cruise_use_memfs) {
            superblock_size += cruise_page_size + 
                (cruise_max_chunks * cruise_chunk_size);         /* memory chunks */
@@ -1419,7 +2409,11 @@ static int cruise_init(int rank)
         if (cruise_use_spillover) {
            superblock_size +=
                cruise_stack_bytes(cruise_spillover_max_chunks);     /* free spill over chunk stack */
+           superblock_size +=
+               cruise_spillover_max_chunks * sizeof(unsigned int); /* spill over pack chunk slot map */
         }
+        superblock_size += CRUISE_SUPERBLOCK_REGIONS *
+            CRUISE_SUPERBLOCK_ALIGN;                             /* padding to align each region */
 
         /* get a superblock of persistent memory and initialize our
          * global variables for this block */
@@ -1519,6 +2513,291 @@ size_t cruise_get_data_region(void **ptr)
     return cruise_chunk_mem;
 }
 
+/* pin count bytes of file open as fd starting at pos and return
+ * pointers to the data in view, count is clipped at end of file */
+int cruise_read_view(int fd, off_t pos, size_t count, cruise_read_view_t* view)
+{
+    /* clear the view so a release after a failed call is harmless */
+    view->fid    = -1;
+    view->iovcnt = 0;
+    view->iov    = NULL;
+    view->staged = NULL;
+
+    /* check that this is one of our file descriptors */
+    if (! cruise_intercept_fd(&fd)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* get the file id for this file descriptor */
+    int fid = cruise_get_fid_from_fd(fd);
+    cruise_fd_t* filedesc = cruise_get_filedesc_from_fd(fd);
+    if (fid < 0 || filedesc == NULL || ! filedesc->read) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* can't map a directory */
+    if (cruise_fid_is_dir(fid)) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    /* pin the file before we look at its size so a truncate can't
+     * free chunks out from under us */
+    cruise_fid_pin(fid);
+    view->fid = fid;
+
+    /* clip range at end of file */
+    off_t filesize = cruise_fid_size(fid);
+    if (pos < 0 || pos >= filesize) {
+        count = 0;
+    } else if ((off_t) count > filesize - pos) {
+        count = (size_t) (filesize - pos);
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    /* we need at most one entry per chunk spanned by the range */
+    off_t first = pos >> cruise_chunk_bits;
+    off_t last  = (pos + (off_t) count - 1) >> cruise_chunk_bits;
+    int entries = (int) (last - first + 1);
+    view->iov = (struct iovec*) malloc(entries * sizeof(struct iovec));
+    if (view->iov == NULL) {
+        cruise_read_view_release(view);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* fill in pointers to file data */
+    int rc = cruise_fid_view(fid, pos, count, view->iov, &view->iovcnt, &view->staged);
+    if (rc != CRUISE_SUCCESS) {
+        cruise_read_view_release(view);
+        errno = cruise_err_map_to_errno(rc);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* release a view obtained from cruise_read_view, pointers in the view
+ * may not be used after this call */
+int cruise_read_view_release(cruise_read_view_t* view)
+{
+    /* free memory associated with view */
+    free(view->iov);
+    free(view->staged);
+    view->iov    = NULL;
+    view->staged = NULL;
+    view->iovcnt = 0;
+
+    /* drop our pin on the file */
+    if (view->fid >= 0) {
+        int rc = cruise_fid_unpin(view->fid);
+        view->fid = -1;
+        if (rc != CRUISE_SUCCESS) {
+            errno = cruise_err_map_to_errno(rc);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* fill in stats with the current counters */
+int cruise_get_stats(cruise_stats_t* stats)
+{
+    if (stats == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(cruise_stats_t));
+    stats->chunk_size = (size_t) cruise_chunk_size;
+    cruise_fid_store_fixed_stats(stats);
+    return 0;
+}
+
+/* look up the file id of a path within the mount for the calls
+ * below, returns -1 and sets errno if there is none */
+static int cruise_get_path_fid(const char* path)
+{
+    if (path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fid = -1;
+    if (cruise_intercept_path(path)) {
+        fid = cruise_get_fid_from_path(path);
+    }
+    if (fid < 0) {
+        errno = ENOENT;
+    }
+    return fid;
+}
+
+/* fills crcs with the CRC32C of the data in each chunk of the file at
+ * path, at most max entries, returns the number of chunks holding
+ * data, or -1 and sets errno on error */
+int cruise_get_checksums(const char* path, unsigned int* crcs, int max)
+{
+    if (crcs == NULL && max > 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fid = cruise_get_path_fid(path);
+    if (fid < 0) {
+        return -1;
+    }
+
+    off_t size;
+    int rc = cruise_fid_checksums(fid, crcs, max, &size);
+    if (rc < 0) {
+        errno = cruise_err_map_to_errno(rc);
+        return -1;
+    }
+    return rc;
+}
+
+/* sets crc to the CRC32C of the whole file at path, combined from the
+ * chunk checksums, returns 0 on success, -1 and sets errno on error */
+int cruise_get_checksum(const char* path, unsigned int* crc)
+{
+    if (crc == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fid = cruise_get_path_fid(path);
+    if (fid < 0) {
+        return -1;
+    }
+
+    /* get the checksum of every chunk, trying again with more room if
+     * the file grew in between */
+    unsigned int* crcs = NULL;
+    int max = 0;
+    int count = 0;
+    off_t size = 0;
+    do {
+        if (count > max) {
+            max = count;
+            unsigned int* list = (unsigned int*) realloc(crcs, max * sizeof(unsigned int));
+            if (list == NULL) {
+                free(crcs);
+                errno = ENOMEM;
+                return -1;
+            }
+            crcs = list;
+        }
+        count = cruise_fid_checksums(fid, crcs, max, &size);
+        if (count < 0) {
+            free(crcs);
+            errno = cruise_err_map_to_errno(count);
+            return -1;
+        }
+    } while (count > max);
+
+    /* each chunk is full but the last */
+    unsigned int total = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        off_t len = size - ((off_t) i << cruise_chunk_bits);
+        if (len > cruise_chunk_size) {
+            len = cruise_chunk_size;
+        }
+        total = cruise_crc32c_combine(total, crcs[i], (size_t) len);
+    }
+    free(crcs);
+
+    *crc = total;
+    return 0;
+}
+
+/* makes the file at dst a copy of the file at src that shares its
+ * chunks until either file writes to them, returns 0 on success, -1
+ * and sets errno on error */
+int cruise_clone(const char* src, const char* dst)
+{
+    if (src == NULL || dst == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* chunks can only be shared within the mount */
+    if (! cruise_intercept_path(src) || ! cruise_intercept_path(dst)) {
+        errno = EXDEV;
+        return -1;
+    }
+    int src_fid = cruise_get_fid_from_path(src);
+    if (src_fid < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (cruise_get_fid_from_path(dst) == src_fid) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* start dst over, as a copy would */
+    int dst_fid;
+    off_t pos;
+    int rc = cruise_fid_open(dst, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR, &dst_fid, &pos);
+    if (rc == CRUISE_SUCCESS) {
+        off_t count;
+        rc = cruise_fid_clone(src_fid, 0, dst_fid, 0, cruise_fid_size(src_fid), &count);
+    }
+    if (rc != CRUISE_SUCCESS) {
+        errno = cruise_err_map_to_errno(rc);
+        return -1;
+    }
+    return 0;
+}
+
+/* fills ranges with the ranges of the file at path written in epoch
+ * since or later, at most max entries, sets epoch to the current
+ * epoch of the file, returns the number of ranges, or -1 and sets
+ * errno on error */
+int cruise_get_dirty(const char* path, unsigned long long since, cruise_range_t* ranges, int max, unsigned long long* epoch)
+{
+    if ((ranges == NULL && max > 0) || epoch == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fid = cruise_get_path_fid(path);
+    if (fid < 0) {
+        return -1;
+    }
+
+    int rc = cruise_fid_dirty(fid, since, ranges, max, epoch);
+    if (rc < 0) {
+        errno = cruise_err_map_to_errno(rc);
+        return -1;
+    }
+    return rc;
+}
+
+/* starts a new epoch for the file at path and sets epoch to it,
+ * returns 0 on success, -1 and sets errno on error */
+int cruise_clear_dirty(const char* path, unsigned long long* epoch)
+{
+    if (epoch == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fid = cruise_get_path_fid(path);
+    if (fid < 0) {
+        return -1;
+    }
+
+    int rc = cruise_fid_dirty_clear(fid, epoch);
+    if (rc != CRUISE_SUCCESS) {
+        errno = cruise_err_map_to_errno(rc);
+        return -1;
+    }
+    return 0;
+}
+
 /* get a list of chunks for a given file (useful for RDMA, etc.) */
 chunk_list_t* cruise_get_chunk_list(char* path)
 {
@@ -17,6 +17,9 @@
 
 /* TODO: namespace C */
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 /* linked list of chunk information given to an external library wanting
  * to RDMA out a file from CRUISE */
 typedef struct {
@@ -27,6 +30,35 @@ typedef struct {
     struct chunk_list_t *next;
 } chunk_list_t;
 
+/* zero-copy view of a range of file data, entries in iov point
+ * directly into chunk memory, chunks that have spilled over are
+ * staged into memory owned by the view */
+typedef struct {
+    int fid;           /* file id pinned by this view */
+    int iovcnt;        /* number of valid entries in iov */
+    struct iovec* iov; /* regions holding file data, in file order */
+    void* staged;      /* staging memory for spilled chunks */
+} cruise_read_view_t;
+
+/* counters kept by the file system */
+typedef struct {
+    unsigned long long zero_chunks;         /* chunks of zeros held as holes */
+    unsigned long long zero_bytes;          /* bytes of zeros written as holes */
+    unsigned long long packed_chunks;       /* chunks held compressed in memory */
+    unsigned long long packed_bytes;        /* bytes of memory holding compressed chunks */
+    unsigned long long spill_packed_chunks; /* chunks held compressed in spill over */
+    unsigned long long spill_packed_bytes;  /* bytes of spill over holding compressed chunks */
+    unsigned long long dedup_chunks;        /* memory chunks saved by sharing chunks, by dedup or clones */
+    unsigned long long dedup_bytes;         /* bytes of memory saved by sharing chunks, by dedup or clones */
+    size_t chunk_size;                      /* size of a chunk in bytes */
+} cruise_stats_t;
+
+/* a range of bytes in a file */
+typedef struct {
+    off_t offset; /* file offset of first byte */
+    off_t length; /* number of bytes */
+} cruise_range_t;
+
 /* mount memfs at some prefix location */
 int cruise_mount(const char prefix[], size_t size, int rank);
 
@@ -37,6 +69,54 @@ size_t cruise_get_data_region(void **ptr);
 /* get a list of chunks for a given file (useful for RDMA, etc.) */
 chunk_list_t* cruise_get_chunk_list(char* path);
 
+/* pin count bytes of the file open as fd starting at pos and fill in
+ * view with pointers to the data, count is clipped at end of file,
+ * truncate and unlink leave the data in place until the view is
+ * released, returns 0 on success, -1 and sets errno on error */
+int cruise_read_view(int fd, off_t pos, size_t count, cruise_read_view_t* view);
+
+/* release a view filled in by cruise_read_view */
+int cruise_read_view_release(cruise_read_view_t* view);
+
+/* fill in stats with the current counters, returns 0 on success,
+ * -1 and sets errno on error */
+int cruise_get_stats(cruise_stats_t* stats);
+
+/* returns crc updated with count bytes at buf, start from 0, this is
+ * the CRC32C the file system keeps for each chunk */
+unsigned int cruise_crc32c(unsigned int crc, const void* buf, size_t count);
+
+/* fills crcs with the CRC32C of the data in each chunk of the file at
+ * path, at most max entries, the last chunk counts only the bytes up
+ * to the end of the file, needs CRUISE_CHECKSUM, returns the number
+ * of chunks holding data, or -1 and sets errno on error */
+int cruise_get_checksums(const char* path, unsigned int* crcs, int max);
+
+/* sets crc to the CRC32C of the whole file at path, combined from the
+ * chunk checksums without reading the data, needs CRUISE_CHECKSUM,
+ * returns 0 on success, -1 and sets errno on error */
+int cruise_get_checksum(const char* path, unsigned int* crc);
+
+/* makes the file at dst a copy of the file at src that shares its
+ * chunks until either file writes to them, dst is created or
+ * truncated first, both must be within the mount, returns 0 on
+ * success, -1 and sets errno on error */
+int cruise_clone(const char* src, const char* dst);
+
+/* fills ranges with the ranges of the file at path written in epoch
+ * since or later, at most max entries, ranges cover whole chunks up
+ * to the end of the file and neighbours are merged, sets epoch to the
+ * current epoch of the file, since 0 gives the whole file, returns
+ * the number of ranges, which may be more than max, or -1 and sets
+ * errno on error */
+int cruise_get_dirty(const char* path, unsigned long long since, cruise_range_t* ranges, int max, unsigned long long* epoch);
+
+/* starts a new epoch for the file at path and sets epoch to it, a
+ * copier calls this before asking for the ranges written since the
+ * epoch it got last time, so a write that races the copy shows up in
+ * the next round, returns 0 on success, -1 and sets errno on error */
+int cruise_clear_dirty(const char* path, unsigned long long* epoch);
+
 /* debug function to print list of chunks constituting a file
  * and to test above function*/
 void cruise_print_chunk_list(char* path);
@@ -0,0 +1,281 @@
+// build:  make test_append
+// run:    ./test_append [threads] [records]
+
+// has several threads append fixed size records to one shared file,
+// first with write on their own O_APPEND descriptors and then with
+// fputs on their own "a" streams, checks that every record landed
+// whole and exactly once, and reports the append rate for one thread
+// and for all of them, before that it checks that an append that fails
+// after claiming its range doesn't leave a hole for the next one
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#define RECORD 64
+
+int threads = 4;
+int records = 100000;
+int rank    = 0;
+
+char name[256];
+int nthreads;
+int use_stream;
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* fills rec with the record for thread id and sequence number seq,
+ * ending in a newline so streams can be line buffered */
+void fill_record(char* rec, long id, long seq)
+{
+  memset(rec, 'a' + (int) (id % 26), RECORD);
+  snprintf(rec, RECORD, "%8ld %12ld ", id, seq);
+  rec[strlen(rec)] = '.';
+  rec[RECORD - 1] = '\n';
+}
+
+void* appender(void* arg)
+{
+  long id = (long) arg;
+  char rec[RECORD + 1];
+  long rc = 0;
+  long seq;
+
+  if (use_stream) {
+    FILE* fp = fopen(name, "a");
+    if (fp == NULL) {
+      return (void*) 1;
+    }
+    for (seq = 0; seq < records; seq++) {
+      fill_record(rec, id, seq);
+      rec[RECORD] = '\0';
+      if (fputs(rec, fp) == EOF) {
+        rc = 1;
+        break;
+      }
+    }
+    if (fclose(fp) != 0) {
+      rc = 1;
+    }
+  } else {
+    int fd = open(name, O_WRONLY | O_APPEND);
+    if (fd < 0) {
+      return (void*) 1;
+    }
+    for (seq = 0; seq < records; seq++) {
+      fill_record(rec, id, seq);
+      if (write(fd, rec, RECORD) != RECORD) {
+        rc = 1;
+        break;
+      }
+    }
+    close(fd);
+  }
+  return (void*) rc;
+}
+
+/* reads the file back and checks that each thread's records are all
+ * there, whole, and in the order it wrote them */
+int verify(int n)
+{
+  long total = (long) n * records;
+  int fd = open(name, O_RDONLY);
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size != (off_t) total * RECORD) {
+    printf("ERROR: File size is %ld expected %ld\n", (long) size, total * RECORD);
+    close(fd);
+    return 1;
+  }
+
+  char* data = (char*) malloc(size);
+  long* next = (long*) calloc(n, sizeof(long));
+  int rc = 0;
+  if (pread(fd, data, size, 0) != size) {
+    printf("ERROR: Failed to read back %s\n", name);
+    rc = 1;
+  }
+  close(fd);
+
+  char expected[RECORD];
+  long i;
+  for (i = 0; i < total && rc == 0; i++) {
+    char* rec = data + i * RECORD;
+    long id = atol(rec);
+    if (id < 0 || id >= n) {
+      printf("ERROR: Bad record at offset %ld\n", i * RECORD);
+      rc = 1;
+      break;
+    }
+    fill_record(expected, id, next[id]);
+    if (memcmp(rec, expected, RECORD) != 0) {
+      printf("ERROR: Torn or out of order record at offset %ld\n", i * RECORD);
+      rc = 1;
+      break;
+    }
+    next[id]++;
+  }
+
+  free(next);
+  free(data);
+  return rc;
+}
+
+int run_pass(int n, int stream)
+{
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  close(fd);
+
+  nthreads   = n;
+  use_stream = stream;
+  pthread_t* tids = (pthread_t*) malloc(n * sizeof(pthread_t));
+  double start = now();
+  long t;
+  for (t = 0; t < n; t++) {
+    pthread_create(&tids[t], NULL, appender, (void*) t);
+  }
+  int rc = 0;
+  for (t = 0; t < n; t++) {
+    void* ret;
+    pthread_join(tids[t], &ret);
+    if (ret != NULL) {
+      rc = 1;
+    }
+  }
+  double secs = now() - start;
+  free(tids);
+
+  if (rc) {
+    printf("ERROR: Append failed with %d threads\n", n);
+    return 1;
+  }
+  if (verify(n)) {
+    return 1;
+  }
+
+  printf("%d threads %s: %.2f Mrecords/s\n", n, stream ? "fputs" : "write",
+         (double) n * records / secs / 1000000.0);
+  unlink(name);
+  return 0;
+}
+
+/* keeps chunks small and all but the first in spillover, where a bad
+ * buffer makes the write fail instead of faulting, appends a record,
+ * fails to append one from a bad buffer, appends another, and checks
+ * the second good record follows the first with nothing in between */
+int run_failed_append(void)
+{
+  setenv("CRUISE_CHUNK_BITS", "16", 1);
+  setenv("CRUISE_CHUNK_MEM", "64KB", 1);
+  setenv("CRUISE_USE_SPILLOVER", "1", 1);
+  setenv("CRUISE_SPILLOVER_SIZE", "1MB", 1);
+  cruise_mount("/tmp", 4*1024*1024, rank);
+
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+
+  /* fill the chunk in memory so the records go to spillover */
+  char* fill = (char*) calloc(1, 64 * 1024);
+  if (write(fd, fill, 64 * 1024) != 64 * 1024) {
+    printf("ERROR: Failed to fill first chunk errno=%d\n", errno);
+    return 1;
+  }
+  free(fill);
+
+  char first[RECORD], second[RECORD];
+  fill_record(first, 0, 0);
+  fill_record(second, 0, 1);
+  if (write(fd, first, RECORD) != RECORD) {
+    printf("ERROR: First append failed errno=%d\n", errno);
+    return 1;
+  }
+  if (write(fd, (void*) 1, RECORD) != -1) {
+    printf("ERROR: Append from a bad buffer didn't fail\n");
+    return 1;
+  }
+  if (write(fd, second, RECORD) != RECORD) {
+    printf("ERROR: Append after failed append failed errno=%d\n", errno);
+    return 1;
+  }
+
+  off_t end = 64 * 1024 + 2 * RECORD;
+  char check[2 * RECORD];
+  int rc = 0;
+  if (lseek(fd, 0, SEEK_END) != end) {
+    printf("ERROR: File size is %ld expected %ld after failed append\n",
+           (long) lseek(fd, 0, SEEK_END), (long) end);
+    rc = 1;
+  } else if (pread(fd, check, 2 * RECORD, 64 * 1024) != 2 * RECORD ||
+             memcmp(check, first, RECORD) != 0 ||
+             memcmp(check + RECORD, second, RECORD) != 0)
+  {
+    printf("ERROR: Records around failed append read back wrong\n");
+    rc = 1;
+  }
+  close(fd);
+  unlink(name);
+  return rc;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 3) {
+    printf("Usage: test_append [threads] [records]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    threads = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    records = atoi(argv[2]);
+  }
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  /* the failed append needs its own file system settings, so it runs
+   * in a child process of its own */
+  int rc = 0;
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    exit(run_failed_append());
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  if (! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    rc = 1;
+  }
+
+  cruise_mount("/tmp", 256*1024*1024, rank);
+
+  int stream;
+  for (stream = 0; stream < 2; stream++) {
+    rc |= run_pass(1, stream);
+    rc |= run_pass(threads, stream);
+  }
+
+  return rc;
+}
@@ -0,0 +1,166 @@
+// build:  make test_checksum
+// run:    ./test_checksum
+
+// mounts with chunk checksums and verification on and 1MB chunks,
+// writes a file with appends of odd sizes, an overwrite, a write past
+// the end that zero fills a gap, and writes out of order, and checks
+// after each step that the chunk and file checksums match CRC32C of
+// the data, then flips a byte of chunk memory behind our back and
+// checks that reads and fsync fail with EIO until it is flipped back
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#define CHUNK (1024*1024)
+#define MAX_SIZE (6*CHUNK)
+
+int rank = 0;
+
+char name[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* checks the chunk and file checksums against the expected data */
+int check_sums(const char* what, const char* expected, size_t len)
+{
+  unsigned int crcs[MAX_SIZE / CHUNK + 1];
+  int count = cruise_get_checksums(name, crcs, MAX_SIZE / CHUNK + 1);
+  int want = (int) ((len + CHUNK - 1) / CHUNK);
+  CHECK(count == want, "%s: %d chunk checksums expected %d errno=%d", what, count, want, errno);
+
+  int i;
+  for (i = 0; i < count; i++) {
+    size_t num = len - (size_t) i * CHUNK;
+    if (num > CHUNK) {
+      num = CHUNK;
+    }
+    unsigned int crc = cruise_crc32c(0, expected + (size_t) i * CHUNK, num);
+    CHECK(crcs[i] == crc, "%s: checksum of chunk %d is %08x expected %08x",
+          what, i, crcs[i], crc);
+  }
+
+  unsigned int total;
+  CHECK(cruise_get_checksum(name, &total) == 0, "%s: cruise_get_checksum failed errno=%d", what, errno);
+  unsigned int crc = cruise_crc32c(0, expected, len);
+  CHECK(total == crc, "%s: file checksum is %08x expected %08x", what, total, crc);
+  return 0;
+}
+
+/* reads the file back and compares */
+int check_file(const char* what, const char* expected, size_t len)
+{
+  char* buf = (char*) malloc(len + 1);
+  int fd = open(name, O_RDONLY);
+  CHECK(fd >= 0, "%s: open failed errno=%d", what, errno);
+  ssize_t n = read(fd, buf, len + 1);
+  close(fd);
+  CHECK(n == (ssize_t) len, "%s: read %ld bytes expected %lu errno=%d",
+        what, (long) n, (unsigned long) len, errno);
+  CHECK(memcmp(buf, expected, len) == 0, "%s: data differs", what);
+  free(buf);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_CHECKSUM_VERIFY", "1", 1);
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  int rc = 0;
+  CHECK(cruise_crc32c(0, "123456789", 9) == 0xe3069283,
+        "CRC32C of 123456789 is %08x expected e3069283", cruise_crc32c(0, "123456789", 9));
+
+  char* expected = (char*) calloc(1, MAX_SIZE);
+  size_t i;
+  for (i = 0; i < MAX_SIZE; i++) {
+    expected[i] = (char) (rand() & 0xff);
+  }
+
+  /* appends of odd sizes that cross chunks */
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  size_t len = 0;
+  while (len < 3 * CHUNK + CHUNK / 2) {
+    size_t num = 100003;
+    if (len + num > 3 * CHUNK + CHUNK / 2) {
+      num = 3 * CHUNK + CHUNK / 2 - len;
+    }
+    CHECK(write(fd, expected + len, num) == (ssize_t) num, "write failed errno=%d", errno);
+    len += num;
+  }
+  rc |= check_sums("append", expected, len);
+
+  /* overwrite across a chunk boundary */
+  memset(expected + CHUNK - 10, 'x', 20);
+  CHECK(pwrite(fd, expected + CHUNK - 10, 20, CHUNK - 10) == 20, "pwrite failed errno=%d", errno);
+  rc |= check_sums("overwrite", expected, len);
+
+  /* past the end, the gap reads as zeros */
+  size_t end = 5 * CHUNK + 100;
+  memset(expected + len, 0, end - len);
+  CHECK(pwrite(fd, expected + end - 50, 50, end - 50) == 50, "pwrite past end failed errno=%d", errno);
+  len = end;
+  rc |= check_sums("gap", expected, len);
+
+  /* out of order, the second write lands first */
+  memset(expected + 4 * CHUNK + 200, 'b', 100);
+  memset(expected + 4 * CHUNK + 100, 'a', 100);
+  CHECK(pwrite(fd, expected + 4 * CHUNK + 200, 100, 4 * CHUNK + 200) == 100, "pwrite failed errno=%d", errno);
+  CHECK(pwrite(fd, expected + 4 * CHUNK + 100, 100, 4 * CHUNK + 100) == 100, "pwrite failed errno=%d", errno);
+  rc |= check_sums("out of order", expected, len);
+
+  /* shorter */
+  len = 2 * CHUNK + 12345;
+  CHECK(ftruncate(fd, len) == 0, "ftruncate failed errno=%d", errno);
+  rc |= check_sums("truncate", expected, len);
+  rc |= check_file("truncate", expected, len);
+  CHECK(fsync(fd) == 0, "fsync failed errno=%d", errno);
+  close(fd);
+
+  /* flip a byte in every memory chunk behind our back */
+  char* region;
+  size_t region_size = cruise_get_data_region((void**) &region);
+  CHECK(region != NULL && region_size >= CHUNK, "no data region");
+  for (i = 0; i + CHUNK <= region_size; i += CHUNK) {
+    region[i + 77] ^= 0x01;
+  }
+
+  char buf[100];
+  fd = open(name, O_RDONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  errno = 0;
+  CHECK(read(fd, buf, sizeof(buf)) < 0 && errno == EIO, "read of corrupt data gave errno=%d", errno);
+  errno = 0;
+  CHECK(fsync(fd) < 0 && errno == EIO, "fsync of corrupt data gave errno=%d", errno);
+  close(fd);
+
+  /* and back */
+  for (i = 0; i + CHUNK <= region_size; i += CHUNK) {
+    region[i + 77] ^= 0x01;
+  }
+  rc |= check_file("repaired", expected, len);
+
+  unlink(name);
+  free(expected);
+  return rc;
+}
@@ -0,0 +1,207 @@
+// build:  make test_clone
+// run:    ./test_clone
+
+// mounts with 1MB chunks and dedup off, clones a file with
+// cruise_clone, copy_file_range, and ioctl(FICLONE), checks that the
+// stats count the shared chunks and that reading a clone through a
+// stream leaves them shared, then writes into the middle and the
+// end of both sides of a clone and checks that each file reads back
+// its own data, and that unlinking them gives the chunks back
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#define CHUNK (1024*1024)
+#define FILE_SIZE (4*CHUNK + CHUNK/2)
+
+int rank = 0;
+
+char name[256];
+char name2[256];
+char name3[256];
+char name4[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* reads path back and compares */
+int check_file(const char* what, const char* path, const char* expected, size_t len)
+{
+  char* buf = (char*) malloc(len + 1);
+  int fd = open(path, O_RDONLY);
+  CHECK(fd >= 0, "%s: open %s failed errno=%d", what, path, errno);
+  ssize_t n = read(fd, buf, len + 1);
+  close(fd);
+  CHECK(n == (ssize_t) len, "%s: read %ld bytes of %s expected %lu",
+        what, (long) n, path, (unsigned long) len);
+  CHECK(memcmp(buf, expected, len) == 0, "%s: data of %s differs", what, path);
+  free(buf);
+  return 0;
+}
+
+/* reads path back through a stream in small pieces and compares */
+int check_stream(const char* what, const char* path, const char* expected, size_t len)
+{
+  char buf[4096];
+  FILE* fp = fopen(path, "r");
+  CHECK(fp != NULL, "%s: fopen %s failed errno=%d", what, path, errno);
+  size_t total = 0;
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    CHECK(total + n <= len && memcmp(buf, &expected[total], n) == 0,
+          "%s: data of %s differs near byte %lu", what, path, (unsigned long) total);
+    total += n;
+  }
+  fclose(fp);
+  CHECK(total == len, "%s: read %lu bytes of %s expected %lu",
+        what, (unsigned long) total, path, (unsigned long) len);
+  return 0;
+}
+
+/* checks that the stats count shared chunks */
+int check_shared(const char* what, unsigned long long chunks)
+{
+  cruise_stats_t stats;
+  CHECK(cruise_get_stats(&stats) == 0, "%s: cruise_get_stats failed errno=%d", what, errno);
+  CHECK(stats.dedup_chunks == chunks, "%s: %llu chunks saved expected %llu",
+        what, stats.dedup_chunks, chunks);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+
+  sprintf(name,  "/tmp/rank.%d", rank);
+  sprintf(name2, "/tmp/rank.%d.clone", rank);
+  sprintf(name3, "/tmp/rank.%d.range", rank);
+  sprintf(name4, "/tmp/rank.%d.ficlone", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  char* data  = (char*) malloc(FILE_SIZE + CHUNK);
+  char* data2 = (char*) malloc(FILE_SIZE + CHUNK);
+  char* data3 = (char*) malloc(3 * CHUNK);
+  size_t i;
+  for (i = 0; i < FILE_SIZE; i++) {
+    data[i] = (char) (rand() & 0xff);
+  }
+
+  int rc = 0;
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(write(fd, data, FILE_SIZE) == FILE_SIZE, "write failed errno=%d", errno);
+  close(fd);
+
+  /* every chunk is shared, the partial last one too since it lands
+   * at the end of the clone */
+  CHECK(cruise_clone(name, name2) == 0, "cruise_clone failed errno=%d", errno);
+  rc |= check_shared("clone", 5);
+  rc |= check_file("clone", name2, data, FILE_SIZE);
+  memcpy(data2, data, FILE_SIZE);
+
+  /* reading both sides through streams shares the chunks as they are */
+  rc |= check_stream("stream", name2, data, FILE_SIZE);
+  rc |= check_stream("stream", name, data, FILE_SIZE);
+  rc |= check_shared("stream", 5);
+
+  /* a few bytes into a shared chunk copy it for the writer only, and
+   * so does a whole chunk */
+  fd = open(name2, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memcpy(&data2[CHUNK + 100], "hello", 5);
+  CHECK(pwrite(fd, "hello", 5, CHUNK + 100) == 5, "pwrite failed errno=%d", errno);
+  close(fd);
+  fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memset(&data[2 * CHUNK], 'z', CHUNK);
+  CHECK(pwrite(fd, &data[2 * CHUNK], CHUNK, 2 * CHUNK) == CHUNK, "pwrite failed errno=%d", errno);
+  close(fd);
+  rc |= check_shared("writes", 3);
+  rc |= check_file("writes", name, data, FILE_SIZE);
+  rc |= check_file("writes", name2, data2, FILE_SIZE);
+
+  /* appending to one side and growing the other leave the shared
+   * last chunk to the other file */
+  fd = open(name2, O_WRONLY | O_APPEND);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memcpy(&data2[FILE_SIZE], "tail", 4);
+  CHECK(write(fd, "tail", 4) == 4, "append failed errno=%d", errno);
+  close(fd);
+  fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memset(&data[FILE_SIZE], 0, 100);
+  CHECK(ftruncate(fd, FILE_SIZE + 100) == 0, "ftruncate failed errno=%d", errno);
+  close(fd);
+  rc |= check_shared("grow", 2);
+  rc |= check_file("grow", name, data, FILE_SIZE + 100);
+  rc |= check_file("grow", name2, data2, FILE_SIZE + 4);
+
+  /* copy_file_range shares chunks at chunk boundaries and copies the
+   * rest, and moves the file pointers */
+  int fd_in = open(name, O_RDONLY);
+  int fd_out = open(name3, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd_in >= 0 && fd_out >= 0, "open failed errno=%d", errno);
+  ssize_t n = copy_file_range(fd_in, NULL, fd_out, NULL, 2 * CHUNK, 0);
+  CHECK(n == 2 * CHUNK, "copy_file_range gave %ld errno=%d", (long) n, errno);
+  rc |= check_shared("copy_file_range", 4);
+  off64_t off_in = 100;
+  n = copy_file_range(fd_in, &off_in, fd_out, NULL, 1000, 0);
+  CHECK(n == 1000 && off_in == 1100, "copy_file_range gave %ld off_in=%ld errno=%d",
+        (long) n, (long) off_in, errno);
+  CHECK(lseek(fd_out, 0, SEEK_CUR) == 2 * CHUNK + 1000, "file pointer not moved");
+  memcpy(data3, data, 2 * CHUNK);
+  memcpy(data3 + 2 * CHUNK, data + 100, 1000);
+  close(fd_out);
+  rc |= check_file("copy_file_range", name3, data3, 2 * CHUNK + 1000);
+
+  /* we can't share chunks with files outside the mount */
+  int fd_null = open("/dev/null", O_WRONLY);
+  CHECK(fd_null >= 0, "open /dev/null failed errno=%d", errno);
+  errno = 0;
+  n = copy_file_range(fd_in, NULL, fd_null, NULL, 10, 0);
+  CHECK(n < 0 && errno == EXDEV, "copy_file_range out of the mount gave %ld errno=%d", (long) n, errno);
+  close(fd_null);
+
+  /* FICLONE clones the whole file */
+  fd_out = open(name4, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd_out >= 0, "open failed errno=%d", errno);
+  CHECK(ioctl(fd_out, FICLONE, fd_in) == 0, "FICLONE failed errno=%d", errno);
+  close(fd_out);
+  close(fd_in);
+  rc |= check_file("FICLONE", name4, data, FILE_SIZE + 100);
+
+  /* unlinking all but one file leaves it its chunks, unlinking that
+   * one too gives them all back */
+  unlink(name);
+  unlink(name2);
+  unlink(name3);
+  rc |= check_file("unlink", name4, data, FILE_SIZE + 100);
+  unlink(name4);
+  rc |= check_shared("unlink", 0);
+
+  free(data3);
+  free(data2);
+  free(data);
+  return rc;
+}
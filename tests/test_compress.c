@@ -0,0 +1,129 @@
+// build:  make test_compress
+// run:    ./test_compress
+
+// mounts with 8 chunks of 1MB in memory, no spill over, and
+// compression on, writes and closes a compressible file of 6MB and
+// then writes another 6MB of random data, which only fits if chunks
+// of the first file get compressed, then reads both back, rewrites
+// part of the first file, which has to decompress it, and checks
+// that the stats count the packed chunks
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#define CHUNK (1024*1024)
+#define FILE_SIZE (6*CHUNK)
+
+int rank = 0;
+
+char name[256];
+char name2[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* writes len bytes of data to path */
+int write_file(const char* path, const char* data, size_t len)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open %s failed errno=%d", path, errno);
+  CHECK(write(fd, data, len) == (ssize_t) len, "write %s failed errno=%d", path, errno);
+  CHECK(close(fd) == 0, "close %s failed errno=%d", path, errno);
+  return 0;
+}
+
+/* reads path back in reads of step bytes and compares */
+int check_file(const char* what, const char* path, const char* expected, size_t len, size_t step)
+{
+  char* buf = (char*) malloc(step);
+  int fd = open(path, O_RDONLY);
+  CHECK(fd >= 0, "%s: open failed errno=%d", what, errno);
+  size_t done = 0;
+  while (done < len) {
+    size_t want = len - done < step ? len - done : step;
+    ssize_t n = read(fd, buf, want);
+    CHECK(n == (ssize_t) want, "%s: read %ld bytes at %lu expected %lu",
+          what, (long) n, (unsigned long) done, (unsigned long) want);
+    CHECK(memcmp(buf, expected + done, want) == 0, "%s: data differs near byte %lu",
+          what, (unsigned long) done);
+    done += want;
+  }
+  close(fd);
+  free(buf);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_COMPRESS", "1", 1);
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+  setenv("CRUISE_CHUNK_MEM", "8388608", 1);
+  setenv("CRUISE_USE_SPILLOVER", "0", 1);
+
+  sprintf(name, "/tmp/rank.%d", rank);
+  sprintf(name2, "/tmp/rank.%d.random", rank);
+
+  cruise_mount("/tmp", 8*1024*1024, rank);
+
+  /* text that compresses well, and random data that doesn't */
+  char* text = (char*) malloc(FILE_SIZE);
+  char* random_data = (char*) malloc(FILE_SIZE);
+  size_t i;
+  for (i = 0; i < FILE_SIZE; i++) {
+    text[i] = (char) ('a' + (i / 7 + i / 4096) % 26);
+    random_data[i] = (char) (rand() & 0xff);
+  }
+
+  int rc = 0;
+  if (write_file(name, text, FILE_SIZE) ||
+      write_file(name2, random_data, FILE_SIZE))
+  {
+    return 1;
+  }
+
+  cruise_stats_t stats;
+  CHECK(cruise_get_stats(&stats) == 0, "cruise_get_stats failed errno=%d", errno);
+  CHECK(stats.packed_chunks > 0, "no chunks were compressed");
+  CHECK(stats.packed_bytes < stats.packed_chunks * CHUNK,
+        "%llu packed chunks take %llu bytes", stats.packed_chunks, stats.packed_bytes);
+
+  /* compressed chunks read back in small and large reads */
+  rc |= check_file("small reads", name, text, FILE_SIZE, 4096);
+  rc |= check_file("large reads", name, text, FILE_SIZE, 3*CHUNK);
+  rc |= check_file("random", name2, random_data, FILE_SIZE, CHUNK);
+
+  /* writing into a compressed chunk decompresses it, which needs a
+   * free chunk */
+  unlink(name2);
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memcpy(&text[2 * CHUNK + 100], "hello", 5);
+  CHECK(pwrite(fd, "hello", 5, 2 * CHUNK + 100) == 5, "pwrite failed errno=%d", errno);
+  close(fd);
+  rc |= check_file("rewrite", name, text, FILE_SIZE, 65536);
+
+  /* removing the file gives back the compressed chunks */
+  unlink(name);
+  CHECK(cruise_get_stats(&stats) == 0, "cruise_get_stats failed errno=%d", errno);
+  CHECK(stats.packed_chunks == 0 && stats.packed_bytes == 0,
+        "%llu packed chunks left after unlink", stats.packed_chunks);
+
+  free(random_data);
+  free(text);
+  return rc;
+}
@@ -0,0 +1,136 @@
+// build:  make test_copy_bw
+// run:    ./test_copy_bw [max_threads] [mb]
+
+// writes a file with a single write and reads it back with a single
+// read, once for each number of copy threads from 1 up to
+// max_threads, doubling each time, each pass runs in its own process
+// since the copy threads are set when the file system is mounted,
+// checks the data and reports the write and read rates
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <string.h>
+
+int max_threads = 8;
+int mb          = 512;
+int rank        = 0;
+
+char name[256];
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* mounts with the given number of copy threads, writes and reads
+ * back the file, returns 0 on success */
+int run_pass(int threads)
+{
+  char value[64];
+  snprintf(value, sizeof(value), "%d", threads);
+  setenv("CRUISE_COPY_THREADS", value, 1);
+
+  /* leave room for a chunk or two past the end of the file */
+  snprintf(value, sizeof(value), "%d", (mb + 64) * 1024 * 1024);
+  setenv("CRUISE_CHUNK_MEM", value, 1);
+
+  cruise_mount("/tmp", (size_t) (mb + 64) * 1024 * 1024, rank);
+
+  size_t size = (size_t) mb * 1024 * 1024;
+  long* buf = (long*) malloc(size);
+  long* check = (long*) malloc(size);
+  if (buf == NULL || check == NULL) {
+    printf("ERROR: Failed to allocate %d MB\n", mb);
+    return 1;
+  }
+  size_t i;
+  for (i = 0; i < size / sizeof(long); i++) {
+    buf[i] = (long) i;
+  }
+  memset(check, 0, size);
+
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  double start = now();
+  ssize_t n = write(fd, buf, size);
+  double wsecs = now() - start;
+  close(fd);
+  if (n != (ssize_t) size) {
+    printf("ERROR: Write returned %ld expected %lu\n", (long) n, (unsigned long) size);
+    return 1;
+  }
+
+  fd = open(name, O_RDONLY);
+  start = now();
+  n = read(fd, check, size);
+  double rsecs = now() - start;
+  close(fd);
+  if (n != (ssize_t) size) {
+    printf("ERROR: Read returned %ld expected %lu\n", (long) n, (unsigned long) size);
+    return 1;
+  }
+  if (memcmp(buf, check, size) != 0) {
+    printf("ERROR: Read back wrong data with %d threads\n", threads);
+    return 1;
+  }
+
+  printf("%2d threads: write %8.2f MB/s read %8.2f MB/s\n", threads,
+         (double) mb / wsecs, (double) mb / rsecs);
+
+  unlink(name);
+  free(check);
+  free(buf);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 3) {
+    printf("Usage: test_copy_bw [max_threads] [mb]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    max_threads = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    mb = atoi(argv[2]);
+  }
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  /* split every transfer of the file, whatever its size */
+  setenv("CRUISE_COPY_THRESHOLD", "0", 1);
+
+  int rc = 0;
+  int threads;
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      exit(run_pass(threads));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      rc = 1;
+    }
+  }
+
+  return rc;
+}
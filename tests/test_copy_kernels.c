@@ -0,0 +1,205 @@
+// build:  make test_copy_kernels
+// run:    ./test_copy_kernels [mb] [working_set_kb] [seconds]
+
+// measures each copy kernel the processor supports for writes into
+// chunk memory, one process per kernel since the kernel is picked when
+// the file system is mounted, a co-running thread sums a working set
+// that fits in cache while the main thread first sleeps and then
+// rewrites a file in 1MB writes, we report the write rate and how much
+// the co-runner slowed down, which shows how much of its working set
+// the writes pushed out of the cache
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#define WRITE_SIZE (1024*1024)
+
+int mb      = 128;
+int ws_kb   = 2048;
+double secs = 1.0;
+int rank    = 0;
+
+char name[256];
+
+volatile int stop = 0;
+volatile unsigned long passes = 0;
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* sums the working set over and over, counting passes */
+void* corunner(void* arg)
+{
+  size_t n = (size_t) ws_kb * 1024 / sizeof(long);
+  long* ws = (long*) malloc(n * sizeof(long));
+  size_t i;
+  for (i = 0; i < n; i++) {
+    ws[i] = (long) i;
+  }
+  volatile long sum = 0;
+  while (! stop) {
+    long s = 0;
+    for (i = 0; i < n; i += 8) {
+      s += ws[i];
+    }
+    sum += s;
+    passes++;
+  }
+  free(ws);
+  return NULL;
+}
+
+/* mounts with the given kernel, measures, returns 0 on success */
+int run_pass(const char* kernel)
+{
+  setenv("CRUISE_COPY_KERNEL", kernel, 1);
+
+  /* leave room for a chunk or two past the end of the file */
+  char value[64];
+  snprintf(value, sizeof(value), "%d", (mb + 64) * 1024 * 1024);
+  setenv("CRUISE_CHUNK_MEM", value, 1);
+
+  cruise_mount("/tmp", (size_t) (mb + 64) * 1024 * 1024, rank);
+
+  char* buf = (char*) malloc(WRITE_SIZE);
+  memset(buf, 'a', WRITE_SIZE);
+
+  /* write the file once so its chunks are allocated and touched */
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  long writes = (long) mb * 1024 * 1024 / WRITE_SIZE;
+  long w;
+  for (w = 0; w < writes; w++) {
+    if (write(fd, buf, WRITE_SIZE) != WRITE_SIZE) {
+      printf("ERROR: Write failed errno=%d\n", errno);
+      return 1;
+    }
+  }
+
+  pthread_t tid;
+  pthread_create(&tid, NULL, corunner, NULL);
+
+  /* co-runner on its own */
+  usleep(100000);
+  unsigned long start_passes = passes;
+  double start = now();
+  usleep((useconds_t) (secs * 1000000.0));
+  double solo = (double) (passes - start_passes) / (now() - start);
+
+  /* co-runner while we rewrite the file */
+  long bytes = 0;
+  start_passes = passes;
+  start = now();
+  double elapsed = 0.0;
+  while (elapsed < secs) {
+    lseek(fd, 0, SEEK_SET);
+    for (w = 0; w < writes; w++) {
+      if (write(fd, buf, WRITE_SIZE) != WRITE_SIZE) {
+        printf("ERROR: Write failed errno=%d\n", errno);
+        return 1;
+      }
+      bytes += WRITE_SIZE;
+    }
+    elapsed = now() - start;
+  }
+  double shared = (double) (passes - start_passes) / elapsed;
+
+  stop = 1;
+  pthread_join(tid, NULL);
+  close(fd);
+
+  /* check that the kernels wrote what we gave them */
+  char* check = (char*) malloc(WRITE_SIZE);
+  int rc = 0;
+  fd = open(name, O_RDONLY);
+  for (w = 0; w < writes; w++) {
+    if (read(fd, check, WRITE_SIZE) != WRITE_SIZE || memcmp(buf, check, WRITE_SIZE) != 0) {
+      printf("ERROR: Read back wrong data with %s\n", kernel);
+      rc = 1;
+      break;
+    }
+  }
+  close(fd);
+
+  printf("%-7s: write %8.2f MB/s, co-runner %10.0f passes/s alone, %10.0f while writing (%.1f%%)\n",
+         kernel, (double) bytes / (1024.0 * 1024.0) / elapsed, solo, shared,
+         solo > 0.0 ? 100.0 * shared / solo : 0.0);
+
+  unlink(name);
+  free(check);
+  free(buf);
+  return rc;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 4) {
+    printf("Usage: test_copy_kernels [mb] [working_set_kb] [seconds]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    mb = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    ws_kb = atoi(argv[2]);
+  }
+  if (argc > 3) {
+    secs = atof(argv[3]);
+  }
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  /* list the kernels this processor can run */
+  const char* kernels[4];
+  int nkernels = 0;
+  kernels[nkernels++] = "memcpy";
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    kernels[nkernels++] = "sse2";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[nkernels++] = "avx2";
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels[nkernels++] = "avx512";
+  }
+#endif
+
+  int rc = 0;
+  int k;
+  for (k = 0; k < nkernels; k++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      exit(run_pass(kernels[k]));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (! WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      rc = 1;
+    }
+  }
+
+  return rc;
+}
@@ -0,0 +1,192 @@
+// build:  make test_dedup
+// run:    ./test_dedup
+
+// mounts with dedup on and 1MB chunks, writes a file whose first two
+// chunks hold the same data and a second file that starts with the
+// same chunks as the first, checks after each close that the stats
+// count the shared chunks, reads one through a stream, which must
+// leave them shared, then writes into shared chunks of both files
+// through a stream and pwrite, which has to copy them, and checks
+// that each file reads back its own data and that unlinking gives
+// the chunks back
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#define CHUNK (1024*1024)
+#define FILE_SIZE (4*CHUNK + CHUNK/2)
+
+int rank = 0;
+
+char name[256];
+char name2[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* writes len bytes of data to path */
+int write_file(const char* path, const char* data, size_t len)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open %s failed errno=%d", path, errno);
+  CHECK(write(fd, data, len) == (ssize_t) len, "write %s failed errno=%d", path, errno);
+  CHECK(close(fd) == 0, "close %s failed errno=%d", path, errno);
+  return 0;
+}
+
+/* reads path back and compares */
+int check_file(const char* what, const char* path, const char* expected, size_t len)
+{
+  char* buf = (char*) malloc(len + 1);
+  int fd = open(path, O_RDONLY);
+  CHECK(fd >= 0, "%s: open %s failed errno=%d", what, path, errno);
+  ssize_t n = read(fd, buf, len + 1);
+  close(fd);
+  CHECK(n == (ssize_t) len, "%s: read %ld bytes of %s expected %lu",
+        what, (long) n, path, (unsigned long) len);
+  size_t i;
+  for (i = 0; i < len; i++) {
+    CHECK(buf[i] == expected[i], "%s: byte %lu of %s is %d expected %d",
+          what, (unsigned long) i, path, (int) buf[i], (int) expected[i]);
+  }
+  free(buf);
+  return 0;
+}
+
+/* reads path back through a stream in small pieces and compares */
+int check_stream(const char* what, const char* path, const char* expected, size_t len)
+{
+  char buf[4096];
+  FILE* fp = fopen(path, "r");
+  CHECK(fp != NULL, "%s: fopen %s failed errno=%d", what, path, errno);
+  size_t total = 0;
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    CHECK(total + n <= len && memcmp(buf, &expected[total], n) == 0,
+          "%s: data of %s differs near byte %lu", what, path, (unsigned long) total);
+    total += n;
+  }
+  fclose(fp);
+  CHECK(total == len, "%s: read %lu bytes of %s expected %lu",
+        what, (unsigned long) total, path, (unsigned long) len);
+  return 0;
+}
+
+/* checks that the stats count shared chunks */
+int check_shared(const char* what, unsigned long long chunks)
+{
+  cruise_stats_t stats;
+  CHECK(cruise_get_stats(&stats) == 0, "%s: cruise_get_stats failed errno=%d", what, errno);
+  CHECK(stats.dedup_chunks == chunks, "%s: %llu chunks saved expected %llu",
+        what, stats.dedup_chunks, chunks);
+  CHECK(stats.dedup_bytes == chunks * CHUNK, "%s: %llu bytes saved expected %llu",
+        what, stats.dedup_bytes, chunks * CHUNK);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_DEDUP", "1", 1);
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+
+  sprintf(name, "/tmp/rank.%d", rank);
+  sprintf(name2, "/tmp/rank.%d.copy", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  /* chunks 0 and 1 are the same, chunk 2 differs, chunk 3 and the
+   * partial chunk after it are random */
+  char* data = (char*) malloc(FILE_SIZE);
+  char* data2 = (char*) malloc(FILE_SIZE);
+  size_t i;
+  for (i = 0; i < FILE_SIZE; i++) {
+    if (i < 2 * CHUNK) {
+      data[i] = (char) ('a' + (i % CHUNK) % 26);
+    } else if (i < 3 * CHUNK) {
+      data[i] = (char) ('A' + i % 26);
+    } else {
+      data[i] = (char) (rand() & 0xff);
+    }
+  }
+
+  /* the second file starts with the first three chunks of the first */
+  memcpy(data2, data, FILE_SIZE);
+  for (i = 3 * CHUNK; i < FILE_SIZE; i++) {
+    data2[i] = (char) (rand() & 0xff);
+  }
+
+  int rc = 0;
+  if (write_file(name, data, FILE_SIZE)) {
+    return 1;
+  }
+  rc |= check_shared("first close", 1);
+  if (write_file(name2, data2, FILE_SIZE)) {
+    return 1;
+  }
+  rc |= check_shared("second close", 4);
+  rc |= check_file("shared", name, data, FILE_SIZE);
+  rc |= check_file("shared", name2, data2, FILE_SIZE);
+
+  /* a stream reads shared chunks in place */
+  rc |= check_stream("stream read", name2, data2, FILE_SIZE);
+  rc |= check_shared("stream read", 4);
+
+  /* a stream that reads and then writes into a shared chunk copies
+   * it, and only for its own file */
+  FILE* fp = fopen(name2, "r+");
+  CHECK(fp != NULL, "fopen failed errno=%d", errno);
+  char head[100];
+  CHECK(fread(head, 1, sizeof(head), fp) == sizeof(head), "fread failed errno=%d", errno);
+  CHECK(fseek(fp, 0, SEEK_CUR) == 0, "fseek failed errno=%d", errno);
+  CHECK(fwrite("world", 1, 5, fp) == 5, "fwrite failed errno=%d", errno);
+  CHECK(fclose(fp) == 0, "fclose failed errno=%d", errno);
+  memcpy(&data2[100], "world", 5);
+  rc |= check_shared("stream write", 3);
+  rc |= check_file("stream write", name, data, FILE_SIZE);
+  rc |= check_stream("stream write", name2, data2, FILE_SIZE);
+
+  /* a few bytes into a shared chunk copy it for the writer only */
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memcpy(&data[CHUNK + 100], "hello", 5);
+  CHECK(pwrite(fd, "hello", 5, CHUNK + 100) == 5, "pwrite failed errno=%d", errno);
+  rc |= check_shared("partial write", 2);
+  close(fd);
+  rc |= check_file("partial write", name, data, FILE_SIZE);
+  rc |= check_file("partial write", name2, data2, FILE_SIZE);
+
+  /* a whole chunk replaces a shared one without copying it */
+  fd = open(name2, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memset(&data2[2 * CHUNK], 'z', CHUNK);
+  CHECK(pwrite(fd, &data2[2 * CHUNK], CHUNK, 2 * CHUNK) == CHUNK, "pwrite failed errno=%d", errno);
+  close(fd);
+  rc |= check_file("whole write", name, data, FILE_SIZE);
+  rc |= check_file("whole write", name2, data2, FILE_SIZE);
+
+  /* unlinking one file leaves the other its chunks, unlinking both
+   * gives them all back */
+  unlink(name);
+  rc |= check_file("unlink", name2, data2, FILE_SIZE);
+  unlink(name2);
+  rc |= check_shared("unlink", 0);
+
+  free(data2);
+  free(data);
+  return rc;
+}
@@ -0,0 +1,150 @@
+// build:  make test_dirty
+// run:    ./test_dirty
+
+// mounts with 1MB chunks, writes a file, starts a new epoch, and then
+// checks that the dirty ranges since each epoch cover just the chunks
+// written since, through pwrite, writes past the end, a stream, a
+// truncate that grows the file, and a clone
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#define CHUNK (1024*1024)
+#define FILE_SIZE (6*CHUNK)
+#define MAX_RANGES 8
+
+int rank = 0;
+
+char name[256];
+char name2[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* checks that the dirty ranges of path since the given epoch are the
+ * count pairs of offset and length in expected */
+int check_dirty(const char* what, const char* path, unsigned long long since, int count, const off_t* expected)
+{
+  cruise_range_t ranges[MAX_RANGES];
+  unsigned long long epoch;
+  int n = cruise_get_dirty(path, since, ranges, MAX_RANGES, &epoch);
+  CHECK(n == count, "%s: %d dirty ranges expected %d errno=%d", what, n, count, errno);
+  int i;
+  for (i = 0; i < n; i++) {
+    CHECK(ranges[i].offset == expected[2 * i] && ranges[i].length == expected[2 * i + 1],
+          "%s: range %d is %ld+%ld expected %ld+%ld", what, i,
+          (long) ranges[i].offset, (long) ranges[i].length,
+          (long) expected[2 * i], (long) expected[2 * i + 1]);
+  }
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+
+  sprintf(name,  "/tmp/rank.%d", rank);
+  sprintf(name2, "/tmp/rank.%d.clone", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  char* data = (char*) malloc(FILE_SIZE);
+  memset(data, 'a', FILE_SIZE);
+
+  int rc = 0;
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(write(fd, data, FILE_SIZE) == FILE_SIZE, "write failed errno=%d", errno);
+
+  /* everything is dirty since the start */
+  off_t all[] = { 0, FILE_SIZE };
+  rc |= check_dirty("start", name, 0, 1, all);
+
+  /* a new epoch starts clean */
+  unsigned long long e1;
+  CHECK(cruise_clear_dirty(name, &e1) == 0, "cruise_clear_dirty failed errno=%d", errno);
+  rc |= check_dirty("clear", name, e1, 0, NULL);
+
+  /* a write in chunk 1 and one across chunks 3 and 4 */
+  CHECK(pwrite(fd, "x", 1, CHUNK + 10) == 1, "pwrite failed errno=%d", errno);
+  CHECK(pwrite(fd, "yy", 2, 4 * CHUNK - 1) == 2, "pwrite failed errno=%d", errno);
+  off_t writes[] = { CHUNK, CHUNK, 3 * CHUNK, 2 * CHUNK };
+  rc |= check_dirty("pwrite", name, e1, 2, writes);
+
+  /* too little room still counts every range */
+  cruise_range_t one;
+  unsigned long long epoch;
+  int n = cruise_get_dirty(name, e1, &one, 1, &epoch);
+  CHECK(n == 2 && one.offset == CHUNK && epoch == e1,
+        "%d ranges in epoch %llu with room for one", n, epoch);
+
+  /* in the next epoch, a write in chunk 5 and past the end, which zero
+   * fills chunk 6 and part of chunk 7 */
+  unsigned long long e2;
+  CHECK(cruise_clear_dirty(name, &e2) == 0 && e2 > e1, "cruise_clear_dirty failed errno=%d", errno);
+  CHECK(pwrite(fd, "z", 1, 5 * CHUNK + 5) == 1, "pwrite failed errno=%d", errno);
+  CHECK(pwrite(fd, "end", 3, 7 * CHUNK + 100) == 3, "pwrite past end failed errno=%d", errno);
+  off_t size = 7 * CHUNK + 103;
+  off_t grown[] = { 5 * CHUNK, size - 5 * CHUNK };
+  rc |= check_dirty("past end", name, e2, 1, grown);
+
+  /* since the earlier epoch the runs from both merge */
+  off_t both[] = { CHUNK, CHUNK, 3 * CHUNK, size - 3 * CHUNK };
+  rc |= check_dirty("both epochs", name, e1, 2, both);
+  close(fd);
+
+  /* a stream writes into chunk 0, after a read so that its window
+   * points into chunk memory */
+  unsigned long long e3;
+  CHECK(cruise_clear_dirty(name, &e3) == 0, "cruise_clear_dirty failed errno=%d", errno);
+  FILE* fp = fopen(name, "r+");
+  CHECK(fp != NULL, "fopen failed errno=%d", errno);
+  char buf[100];
+  CHECK(fread(buf, 1, sizeof(buf), fp) == sizeof(buf), "fread failed errno=%d", errno);
+  CHECK(fseek(fp, 0, SEEK_CUR) == 0, "fseek failed errno=%d", errno);
+  CHECK(fwrite("stream", 1, 6, fp) == 6, "fwrite failed errno=%d", errno);
+  CHECK(fclose(fp) == 0, "fclose failed errno=%d", errno);
+  off_t stream[] = { 0, CHUNK };
+  rc |= check_dirty("stream", name, e3, 1, stream);
+
+  /* shrinking changes no data, growing again zero fills */
+  unsigned long long e4;
+  CHECK(cruise_clear_dirty(name, &e4) == 0, "cruise_clear_dirty failed errno=%d", errno);
+  CHECK(truncate(name, 2 * CHUNK + CHUNK / 2) == 0, "truncate failed errno=%d", errno);
+  rc |= check_dirty("shrink", name, e4, 0, NULL);
+  CHECK(truncate(name, 3 * CHUNK + CHUNK / 2) == 0, "truncate failed errno=%d", errno);
+  off_t zeros[] = { 2 * CHUNK, CHUNK + CHUNK / 2 };
+  rc |= check_dirty("grow", name, e4, 1, zeros);
+
+  /* a clone is dirty all through in its own epoch */
+  CHECK(cruise_clone(name, name2) == 0, "cruise_clone failed errno=%d", errno);
+  CHECK(cruise_get_dirty(name2, 0, NULL, 0, &epoch) == 1, "cruise_get_dirty failed errno=%d", errno);
+  off_t cloned[] = { 0, 3 * CHUNK + CHUNK / 2 };
+  rc |= check_dirty("clone", name2, epoch, 1, cloned);
+  rc |= check_dirty("clone source", name, e4 + 1, 0, NULL);
+
+  /* we only know about files in the mount */
+  errno = 0;
+  CHECK(cruise_get_dirty("/tmp/rank.none", 0, NULL, 0, &epoch) < 0 && errno == ENOENT,
+        "cruise_get_dirty of missing file gave errno=%d", errno);
+
+  unlink(name2);
+  unlink(name);
+  free(data);
+  return rc;
+}
@@ -0,0 +1,224 @@
+// build:  make test_dup
+// run:    ./test_dup [threads] [mb]
+
+// checks that each open of a file gets its own file pointer while
+// dup, dup2, and fcntl(F_DUPFD) share one, then has several threads
+// each open the same file and stream through their own share of it,
+// reporting the aggregate read rate
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BLOCK (64*1024)
+
+int threads = 4;
+int mb      = 32;
+int rank    = 0;
+
+char name[256];
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* value of byte at offset i in the test file */
+char byte_at(long i)
+{
+  return (char) ((i * 7 + i / 4096) & 0xff);
+}
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+int run_semantics(void)
+{
+  char c;
+
+  /* two opens of the same file read from their own positions */
+  int a = open(name, O_RDONLY);
+  int b = open(name, O_RDONLY);
+  CHECK(a >= 0 && b >= 0 && a != b, "open gave %d and %d errno=%d", a, b, errno);
+  CHECK(lseek(a, 1000, SEEK_SET) == 1000, "lseek failed errno=%d", errno);
+  CHECK(read(b, &c, 1) == 1 && c == byte_at(0), "second open doesn't start at 0");
+  CHECK(read(a, &c, 1) == 1 && c == byte_at(1000), "first open lost its position");
+
+  /* dup shares the file pointer */
+  int d = dup(a);
+  CHECK(d >= 0 && d != a, "dup gave %d errno=%d", d, errno);
+  CHECK(read(d, &c, 1) == 1 && c == byte_at(1001), "dup doesn't share the position");
+  CHECK(lseek(a, 0, SEEK_CUR) == 1002, "dup read didn't move the original");
+
+  /* closing the original leaves the duplicate usable */
+  CHECK(close(a) == 0, "close failed errno=%d", errno);
+  CHECK(read(d, &c, 1) == 1 && c == byte_at(1002), "dup lost the file after close");
+
+  /* dup2 onto an open descriptor closes it first and shares ours */
+  CHECK(dup2(d, b) == b, "dup2 failed errno=%d", errno);
+  CHECK(read(b, &c, 1) == 1 && c == byte_at(1003), "dup2 doesn't share the position");
+
+  /* fcntl reports the access mode and duplicates at or above a
+   * minimum */
+  CHECK((fcntl(b, F_GETFL) & O_ACCMODE) == O_RDONLY, "F_GETFL gave wrong access mode");
+  int e = fcntl(b, F_DUPFD, b + 3);
+  CHECK(e >= b + 3, "F_DUPFD gave %d below %d errno=%d", e, b + 3, errno);
+  CHECK(lseek(e, 0, SEEK_CUR) == 1004, "F_DUPFD doesn't share the position");
+
+  /* descriptors opened write only can't be read */
+  int w = open(name, O_WRONLY);
+  CHECK(read(w, &c, 1) == -1 && errno == EBADF, "read on write only fd didn't fail");
+
+  close(b);
+  close(d);
+  close(e);
+  close(w);
+  CHECK(close(d) == -1 && errno == EBADF, "second close didn't fail");
+
+  /* dup and F_DUPFD take the lowest free descriptor even after
+   * closes out of order, so never the higher of the two we closed */
+  int x = open(name, O_RDONLY);
+  int y = open(name, O_RDONLY);
+  int z = open(name, O_RDONLY);
+  CHECK(x >= 0 && y >= 0 && z >= 0, "open failed errno=%d", errno);
+  int lowest = (x < y) ? x : y;
+  close(lowest);
+  close((x < y) ? y : x);
+  int f = dup(z);
+  CHECK(f >= 0 && f <= lowest, "dup gave %d above lowest free %d", f, lowest);
+  close(f);
+  f = fcntl(z, F_DUPFD, 0);
+  CHECK(f >= 0 && f <= lowest, "F_DUPFD gave %d above lowest free %d", f, lowest);
+  close(f);
+  close(z);
+
+  /* two streams on the same file keep their own positions, and
+   * fileno gives a descriptor the other calls understand */
+  FILE* fa = fopen(name, "r");
+  FILE* fb = fopen(name, "r");
+  CHECK(fa != NULL && fb != NULL && fa != fb, "fopen failed errno=%d", errno);
+  CHECK(fseek(fa, 5000, SEEK_SET) == 0, "fseek failed");
+  CHECK(fgetc(fb) == (unsigned char) byte_at(0), "second stream doesn't start at 0");
+  CHECK(fgetc(fa) == (unsigned char) byte_at(5000), "first stream lost its position");
+  CHECK(lseek(fileno(fa), 0, SEEK_CUR) == 5001, "fileno doesn't track the stream");
+  fclose(fa);
+  fclose(fb);
+
+  return 0;
+}
+
+void* reader(void* arg)
+{
+  long id = (long) arg;
+  long bytes = (long) mb * 1024 * 1024;
+  long share = bytes / threads;
+  long start = id * share;
+
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    return (void*) 1;
+  }
+  lseek(fd, start, SEEK_SET);
+
+  char* buf = (char*) malloc(BLOCK);
+  long done = 0;
+  long rc = 0;
+  while (done < share) {
+    long want = share - done < BLOCK ? share - done : BLOCK;
+    ssize_t n = read(fd, buf, want);
+    if (n != want || buf[0] != byte_at(start + done)) {
+      rc = 1;
+      break;
+    }
+    done += n;
+  }
+  free(buf);
+  close(fd);
+  return (void*) rc;
+}
+
+int run_readers(void)
+{
+  pthread_t* tids = (pthread_t*) malloc(threads * sizeof(pthread_t));
+  double start = now();
+  long t;
+  for (t = 0; t < threads; t++) {
+    pthread_create(&tids[t], NULL, reader, (void*) t);
+  }
+  int rc = 0;
+  for (t = 0; t < threads; t++) {
+    void* ret;
+    pthread_join(tids[t], &ret);
+    if (ret != NULL) {
+      printf("ERROR: Reader %ld read wrong data\n", t);
+      rc = 1;
+    }
+  }
+  double secs = now() - start;
+  free(tids);
+
+  if (rc == 0) {
+    printf("%d readers: %.2f MB/s\n", threads, (double) mb / secs);
+  }
+  return rc;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 3) {
+    printf("Usage: test_dup [threads] [mb]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    threads = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    mb = atoi(argv[2]);
+  }
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  /* write the test file */
+  long bytes = (long) mb * 1024 * 1024;
+  char* data = (char*) malloc(bytes);
+  long i;
+  for (i = 0; i < bytes; i++) {
+    data[i] = byte_at(i);
+  }
+  int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0 || write(fd, data, bytes) != bytes) {
+    printf("ERROR: Failed to write %s errno=%d\n", name, errno);
+    return 1;
+  }
+  close(fd);
+  free(data);
+
+  int rc = 0;
+  rc |= run_semantics();
+  rc |= run_readers();
+
+  unlink(name);
+  return rc;
+}
@@ -0,0 +1,173 @@
+// build:  make test_fgets
+// run:    srun -n64 -N4 ./test_fgets [lines times]
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include "mpi.h"
+
+size_t lines = 1000000;
+int times = 5;
+int rank  = -1;
+int ranks = 0;
+
+/* write a text deck of lines holding an index and a value,
+ * return number of bytes written */
+size_t write_deck(char* file, size_t count)
+{
+  FILE* fp = fopen(file, "w");
+  if (fp == NULL) {
+    printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+    MPI_Abort(MPI_COMM_WORLD, 0);
+  }
+
+  size_t n;
+  for (n = 0; n < count; n++) {
+    fprintf(fp, "%lu %.6f\n", (unsigned long) n, (double) n * 0.5);
+  }
+
+  size_t size = (size_t) ftell(fp);
+  fclose(fp);
+
+  return size;
+}
+
+/* check that line n parsed to the expected index and value */
+void check_line(size_t n, const char* line)
+{
+  char* end;
+  unsigned long idx = strtoul(line, &end, 10);
+  double val = strtod(end, NULL);
+  if (idx != (unsigned long) n || val != (double) n * 0.5) {
+    printf("%d: ERROR: Line %lu is %s", rank, (unsigned long) n, line);
+    MPI_Abort(MPI_COMM_WORLD, 0);
+  }
+}
+
+/* read deck back one line at a time with fgets, return bandwidth in MB/s */
+double fgets_bw(char* file, size_t size, size_t count, int times)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "r");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    char line[256];
+    size_t n = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      check_line(n, line);
+      n++;
+    }
+    if (n != count) {
+      printf("%d: ERROR: Read %lu lines expected %lu\n", rank, (unsigned long) n, (unsigned long) count);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    fclose(fp);
+  }
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((double) size * times / (1024*1024)) / (time_end - time_start);
+}
+
+/* read deck back one line at a time with getline, return bandwidth in MB/s */
+double getline_bw(char* file, size_t size, size_t count, int times)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  char* line = NULL;
+  size_t linesize = 0;
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "r");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    size_t n = 0;
+    while (getline(&line, &linesize, fp) != -1) {
+      check_line(n, line);
+      n++;
+    }
+    if (n != count) {
+      printf("%d: ERROR: Read %lu lines expected %lu\n", rank, (unsigned long) n, (unsigned long) count);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    fclose(fp);
+  }
+
+  free(line);
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((double) size * times / (1024*1024)) / (time_end - time_start);
+}
+
+void print_stats(const char* name, double bw)
+{
+  double bwmin, bwmax, bwsum;
+  MPI_Reduce(&bw, &bwmin, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&bw, &bwmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&bw, &bwsum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("%s: Min %7.2f MB/s\tMax %7.2f MB/s\tAvg %7.2f MB/s\tAgg %7.2f MB/s\n",
+           name, bwmin, bwmax, bwsum/ranks, bwsum
+    );
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc != 1 && argc != 3) {
+    printf("Usage: test_fgets [lines times]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    lines = (size_t) atol(argv[1]);
+    times = atoi(argv[2]);
+  }
+
+  MPI_Init(&argc, &argv);
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  size_t size = write_deck(name, lines);
+
+  print_stats("fgets", fgets_bw(name, size, lines, times));
+  print_stats("getline", getline_bw(name, size, lines, times));
+
+  unlink(name);
+
+  MPI_Finalize();
+
+  return 0;
+}
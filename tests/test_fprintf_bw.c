@@ -0,0 +1,170 @@
+// build:  make test_fprintf_bw
+// run:    srun -n64 -N4 ./test_fprintf_bw [records times]
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include "mpi.h"
+
+size_t records = 1024*1024;
+int times = 5;
+int rank  = -1;
+int ranks = 0;
+
+/* write a text deck of small fprintf records, return rate in records/s */
+double fprintf_rate(char* file, size_t count, int times)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "w");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    size_t n;
+    for (n = 0; n < count; n++) {
+      int rc = fprintf(fp, "%8lu %6d %s\n", (unsigned long) n, rank, "cell");
+      if (rc < 0) {
+        printf("%d: ERROR: fprintf failed on record %lu errno=%d\n", rank, (unsigned long) n, errno);
+        MPI_Abort(MPI_COMM_WORLD, 0);
+      }
+    }
+
+    fclose(fp);
+  }
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((double) count * times) / (time_end - time_start);
+}
+
+/* write a text dump of doubles with fprintf, return rate in values/s */
+double fprintf_double_rate(char* file, size_t count, int times)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "w");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    size_t n;
+    for (n = 0; n < count; n++) {
+      double value = (double) n * 1.0e-3 + 1.0 / (double) (n + 1);
+      int rc = fprintf(fp, "%.17g %e\n", value, -value);
+      if (rc < 0) {
+        printf("%d: ERROR: fprintf failed on value %lu errno=%d\n", rank, (unsigned long) n, errno);
+        MPI_Abort(MPI_COMM_WORLD, 0);
+      }
+    }
+
+    fclose(fp);
+  }
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((double) count * times) / (time_end - time_start);
+}
+
+/* read the deck back and check each record */
+void check_records(char* file, size_t count)
+{
+  FILE* fp = fopen(file, "r");
+  if (fp == NULL) {
+    printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+    MPI_Abort(MPI_COMM_WORLD, 0);
+  }
+
+  char line[256];
+  char expect[256];
+  size_t n = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    snprintf(expect, sizeof(expect), "%8lu %6d %s\n", (unsigned long) n, rank, "cell");
+    if (strcmp(line, expect) != 0) {
+      printf("%d: ERROR: Record %lu is %s expected %s\n", rank, (unsigned long) n, line, expect);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+    n++;
+  }
+  if (n != count) {
+    printf("%d: ERROR: Read %lu records expected %lu\n", rank, (unsigned long) n, (unsigned long) count);
+    MPI_Abort(MPI_COMM_WORLD, 0);
+  }
+
+  fclose(fp);
+}
+
+void print_stats(const char* name, double rate)
+{
+  double ratemin, ratemax, ratesum;
+  MPI_Reduce(&rate, &ratemin, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&rate, &ratemax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&rate, &ratesum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("%s: Min %10.0f rec/s\tMax %10.0f rec/s\tAvg %10.0f rec/s\tAgg %10.0f rec/s\n",
+           name, ratemin, ratemax, ratesum/ranks, ratesum
+    );
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc != 1 && argc != 3) {
+    printf("Usage: test_fprintf_bw [records times]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    records = (size_t) atol(argv[1]);
+    times = atoi(argv[2]);
+  }
+
+  MPI_Init(&argc, &argv);
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  /* files under /tmp go through cruise, files under /dev/shm
+   * go through glibc to tmpfs for comparison */
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+  char shmname[256];
+  sprintf(shmname, "/dev/shm/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  /* prime system once before timing */
+  fprintf_rate(name, records, 1);
+  check_records(name, records);
+
+  print_stats("cruise fprintf", fprintf_rate(name, records, times));
+  print_stats("tmpfs  fprintf", fprintf_rate(shmname, records, times));
+  print_stats("cruise doubles", fprintf_double_rate(name, records, times));
+  print_stats("tmpfs  doubles", fprintf_double_rate(shmname, records, times));
+
+  unlink(name);
+  unlink(shmname);
+
+  MPI_Finalize();
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+// build:  make test_fprintf_fmt
+// run:    ./test_fprintf_fmt [records]
+
+// writes records through fprintf into a cruise file and checks that
+// the file holds exactly what glibc's snprintf produces for the same
+// formats and values
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+size_t records = 1000000;
+int rank  = 0;
+
+/* floating-point formats, each takes one double */
+const char* double_formats[] = {
+  "%f", "%e", "%g", "%E", "%G", "%F", "%lf",
+  "%.0f", "%.1f", "%.3f", "%.10f", "%.17f", "%.19f",
+  "%.0e", "%.3e", "%.16e", "%.17e",
+  "%.0g", "%.1g", "%.3g", "%.15g", "%.17g", "%.18g",
+  "%12.4f", "%-12.4e|", "%+g", "% e", "%012.3f", "%-+015.2e|",
+  "%#.0f", "%#.0e", "%#g", "%#.3g", "%20.10g", "%010g",
+};
+
+/* integer formats, each takes one int */
+const char* int_formats[] = {
+  "%d", "%5d", "%-5d|", "%05d", "%+d", "% d", "%.3d", "%.0d", "%8.3d",
+  "%x", "%#x", "%#X", "%o", "%#o", "%#.0o", "%.0x", "%#08x", "%u",
+  "%hhd", "%hd", "%hu", "%hhu",
+};
+
+#define NUM_DOUBLE_FORMATS (sizeof(double_formats) / sizeof(double_formats[0]))
+#define NUM_INT_FORMATS    (sizeof(int_formats) / sizeof(int_formats[0]))
+
+/* returns a random 64-bit value */
+uint64_t random64(void)
+{
+  return ((uint64_t) random() << 42) ^ ((uint64_t) random() << 21) ^ (uint64_t) random();
+}
+
+/* returns a double from a mix of distributions, including ties
+ * and values near powers of ten */
+double random_double(void)
+{
+  uint64_t bits = random64();
+  double d;
+  switch (random() % 5) {
+  case 0:
+    /* any bit pattern, including nan and inf */
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+  case 1:
+    return (double) ((long) (random() % 2000001) - 1000000) / 1000.0;
+  case 2:
+    return ldexp((double) (bits >> 11), (int) (random() % 200) - 150);
+  case 3:
+    return (double) (random() % 1000) + 0.5 * (double) (random() % 3);
+  default:
+    return (double) (random() % 100000) * pow(10.0, (double) ((int) (random() % 60) - 30));
+  }
+}
+
+/* formats record i into buf with snprintf and into fp with fprintf,
+ * returns number of bytes in buf */
+size_t write_record(FILE* fp, size_t i, char* buf, size_t size)
+{
+  int n, rc;
+  if (i % 3 == 0) {
+    int value = (int) (random() - (1L << 30)) >> (random() % 31);
+    const char* format = int_formats[i % NUM_INT_FORMATS];
+    n  = snprintf(buf, size, format, value);
+    rc = fprintf(fp, format, value);
+  } else if (i % 3 == 1) {
+    double value = random_double();
+    const char* format = double_formats[i % NUM_DOUBLE_FORMATS];
+    n  = snprintf(buf, size, format, value);
+    rc = fprintf(fp, format, value);
+  } else {
+    long long value = (long long) random64() >> (random() % 63);
+    n  = snprintf(buf, size, "%lld %llx %#llo %s %c %*d %.*s|",
+                  value, value, value, "str", 'c', 6, 42, 2, "abc");
+    rc = fprintf(fp, "%lld %llx %#llo %s %c %*d %.*s|",
+                  value, value, value, "str", 'c', 6, 42, 2, "abc");
+  }
+
+  if (rc != n) {
+    printf("ERROR: fprintf returned %d for record %lu expected %d\n", rc, (unsigned long) i, n);
+    exit(1);
+  }
+  buf[n] = '\n';
+  fputc('\n', fp);
+  return (size_t) n + 1;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc != 1 && argc != 2) {
+    printf("Usage: test_fprintf_fmt [records]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    records = (size_t) atol(argv[1]);
+  }
+
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  /* write the records, keeping what snprintf makes of them */
+  size_t expected_size = 1024*1024;
+  char* expected = (char*) malloc(expected_size);
+  size_t expected_len = 0;
+
+  FILE* fp = fopen(name, "w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  srandom(1);
+  size_t i;
+  for (i = 0; i < records; i++) {
+    /* %f of a large double takes a few hundred bytes */
+    if (expected_size - expected_len < 512) {
+      expected_size *= 2;
+      expected = (char*) realloc(expected, expected_size);
+    }
+    expected_len += write_record(fp, i, expected + expected_len, 512);
+  }
+  fclose(fp);
+
+  /* read the file back and compare */
+  char* actual = (char*) malloc(expected_len + 1);
+  fp = fopen(name, "r");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  size_t actual_len = fread(actual, 1, expected_len + 1, fp);
+  fclose(fp);
+
+  int rc = 0;
+  if (actual_len != expected_len || memcmp(actual, expected, expected_len) != 0) {
+    /* find the first record that differs */
+    size_t offset = 0;
+    while (offset < actual_len && offset < expected_len && actual[offset] == expected[offset]) {
+      offset++;
+    }
+    size_t start = offset;
+    while (start > 0 && expected[start - 1] != '\n') {
+      start--;
+    }
+    char* end = memchr(expected + start, '\n', expected_len - start);
+    int len = (end != NULL) ? (int) (end - (expected + start)) : (int) (expected_len - start);
+    printf("ERROR: File differs at byte %lu, expected record: %.*s\n", (unsigned long) offset, len, expected + start);
+    rc = 1;
+  } else {
+    printf("Verified %lu records, %lu bytes\n", (unsigned long) records, (unsigned long) expected_len);
+  }
+
+  unlink(name);
+
+  free(actual);
+  free(expected);
+
+  return rc;
+}
@@ -0,0 +1,175 @@
+// build:  make test_fscanf_bw
+// run:    srun -n64 -N4 ./test_fscanf_bw [records times]
+
+// reads a text deck of numbers back with fscanf, checks that every
+// double is bit-identical to what strtod makes of the same text, and
+// reports the parse rate against glibc reading from tmpfs
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+
+size_t records = 1024*1024;
+int times = 5;
+int rank  = -1;
+int ranks = 0;
+
+/* returns the double stored in record n, a mix of magnitudes,
+ * long mantissas, and values that need correct rounding */
+double record_value(size_t n)
+{
+  switch (n % 4) {
+  case 0:
+    return (double) n * 1.0e-3 + 1.0 / (double) (n + 1);
+  case 1:
+    return ldexp((double) (n * 2654435761UL % 9007199254740992UL), (int) (n % 200) - 150);
+  case 2:
+    return (double) (n % 100000) * pow(10.0, (double) ((int) (n % 50) - 25));
+  default:
+    return -1.0 / (double) (n + 3);
+  }
+}
+
+/* write the deck, each record as text we can hand to strtod */
+void write_deck(char* file, size_t count)
+{
+  FILE* fp = fopen(file, "w");
+  if (fp == NULL) {
+    printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+    MPI_Abort(MPI_COMM_WORLD, 0);
+  }
+
+  size_t n;
+  for (n = 0; n < count; n++) {
+    double value = record_value(n);
+    fprintf(fp, "%d %.17g %e %.25f\n", (int) n - (int) (count / 2), value, value, value);
+  }
+
+  fclose(fp);
+}
+
+/* checks a double parsed by fscanf against strtod on its text */
+void check_value(double value, const char* format, double source, size_t n)
+{
+  char text[512];
+  snprintf(text, sizeof(text), format, source);
+  double expected = strtod(text, NULL);
+  if (memcmp(&value, &expected, sizeof(double)) != 0) {
+    printf("%d: ERROR: Record %lu parsed %s as %.17g expected %.17g\n",
+           rank, (unsigned long) n, text, value, expected
+    );
+    MPI_Abort(MPI_COMM_WORLD, 0);
+  }
+}
+
+/* read the deck with fscanf, return rate in records/s */
+double fscanf_rate(char* file, size_t count, int times, int check)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "r");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    size_t n = 0;
+    int ival;
+    double d1, d2, d3;
+    while (fscanf(fp, "%d %lf %lf %lf", &ival, &d1, &d2, &d3) == 4) {
+      if (ival != (int) n - (int) (count / 2)) {
+        printf("%d: ERROR: Record %lu has integer %d\n", rank, (unsigned long) n, ival);
+        MPI_Abort(MPI_COMM_WORLD, 0);
+      }
+      if (check) {
+        double source = record_value(n);
+        check_value(d1, "%.17g", source, n);
+        check_value(d2, "%e", source, n);
+        check_value(d3, "%.25f", source, n);
+      }
+      n++;
+    }
+    if (n != count) {
+      printf("%d: ERROR: Read %lu records expected %lu\n", rank, (unsigned long) n, (unsigned long) count);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    fclose(fp);
+  }
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((double) count * times) / (time_end - time_start);
+}
+
+void print_stats(const char* name, double rate)
+{
+  double ratemin, ratemax, ratesum;
+  MPI_Reduce(&rate, &ratemin, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&rate, &ratemax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&rate, &ratesum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("%s: Min %10.0f rec/s\tMax %10.0f rec/s\tAvg %10.0f rec/s\tAgg %10.0f rec/s\n",
+           name, ratemin, ratemax, ratesum/ranks, ratesum
+    );
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc != 1 && argc != 3) {
+    printf("Usage: test_fscanf_bw [records times]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    records = (size_t) atol(argv[1]);
+    times = atoi(argv[2]);
+  }
+
+  MPI_Init(&argc, &argv);
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  /* files under /tmp go through cruise, files under /dev/shm
+   * go through glibc to tmpfs for comparison */
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+  char shmname[256];
+  sprintf(shmname, "/dev/shm/rank.%d", rank);
+
+  cruise_mount("/tmp", 512*1024*1024, rank);
+
+  write_deck(name, records);
+  write_deck(shmname, records);
+
+  /* check every value once before timing */
+  fscanf_rate(name, records, 1, 1);
+
+  print_stats("cruise fscanf", fscanf_rate(name, records, times, 0));
+  print_stats("tmpfs  fscanf", fscanf_rate(shmname, records, times, 0));
+
+  unlink(name);
+  unlink(shmname);
+
+  MPI_Finalize();
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+// build:  make test_getc
+// run:    srun -n64 -N4 ./test_getc [filesize times]
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include "mpi.h"
+
+size_t filesize = 100*1024*1024;
+int times = 5;
+int rank  = -1;
+int ranks = 0;
+
+/* write file one byte at a time with putc, return bandwidth in MB/s */
+double putc_bw(char* file, size_t size, int times)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "w");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    size_t n;
+    for (n = 0; n < size; n++) {
+      putc((int) (n & 0xff), fp);
+    }
+
+    fclose(fp);
+  }
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((size * times) / (1024*1024)) / (time_end - time_start);
+}
+
+/* read file one byte at a time with getc, return bandwidth in MB/s */
+double getc_bw(char* file, size_t size, int times)
+{
+  MPI_Barrier(MPI_COMM_WORLD);
+  double time_start = MPI_Wtime();
+
+  int i;
+  for (i = 0; i < times; i++) {
+    FILE* fp = fopen(file, "r");
+    if (fp == NULL) {
+      printf("%d: ERROR: Failed to open %s errno=%d\n", rank, file, errno);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    /* check data as we go so the loop can't be optimized away */
+    size_t n = 0;
+    int c;
+    while ((c = getc(fp)) != EOF) {
+      if (c != (int) (n & 0xff)) {
+        printf("%d: ERROR: Byte %lu is %d expected %d\n", rank, (unsigned long) n, c, (int) (n & 0xff));
+        MPI_Abort(MPI_COMM_WORLD, 0);
+      }
+      n++;
+    }
+    if (n != size) {
+      printf("%d: ERROR: Read %lu bytes expected %lu\n", rank, (unsigned long) n, (unsigned long) size);
+      MPI_Abort(MPI_COMM_WORLD, 0);
+    }
+
+    fclose(fp);
+  }
+
+  double time_end = MPI_Wtime();
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  return ((size * times) / (1024*1024)) / (time_end - time_start);
+}
+
+void print_stats(const char* name, double bw)
+{
+  double bwmin, bwmax, bwsum;
+  MPI_Reduce(&bw, &bwmin, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&bw, &bwmax, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&bw, &bwsum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("%s: Min %7.2f MB/s\tMax %7.2f MB/s\tAvg %7.2f MB/s\tAgg %7.2f MB/s\n",
+           name, bwmin, bwmax, bwsum/ranks, bwsum
+    );
+  }
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc != 1 && argc != 3) {
+    printf("Usage: test_getc [filesize times]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    filesize = (size_t) atol(argv[1]);
+    times = atoi(argv[2]);
+  }
+
+  MPI_Init(&argc, &argv);
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  /* prime system once before timing */
+  putc_bw(name, filesize, 1);
+
+  print_stats("putc", putc_bw(name, filesize, times));
+  print_stats("getc", getc_bw(name, filesize, times));
+
+  unlink(name);
+
+  MPI_Finalize();
+
+  return 0;
+}
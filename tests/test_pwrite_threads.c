@@ -0,0 +1,178 @@
+// build:  make test_pwrite_threads
+// run:    ./test_pwrite_threads [threads] [mb]
+
+// has several threads pwrite interleaved blocks of one shared file,
+// so that they race to grow it, then checks every byte and has the
+// threads read the file back through their own opens, reporting the
+// write and read rates for one thread and for all of them
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BLOCK (256*1024)
+
+int threads = 4;
+int mb      = 64;
+int rank    = 0;
+
+char name[256];
+int shared_fd;
+int nthreads;
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* fills buf with the contents expected for block b */
+void fill_block(char* buf, long b)
+{
+  long* p = (long*) buf;
+  long i;
+  for (i = 0; i < (long) (BLOCK / sizeof(long)); i++) {
+    p[i] = b * BLOCK + i;
+  }
+}
+
+/* thread id writes blocks id, id + n, id + 2n, ... */
+void* writer(void* arg)
+{
+  long id = (long) arg;
+  long blocks = (long) mb * 1024 * 1024 / BLOCK;
+  char* buf = (char*) malloc(BLOCK);
+  long rc = 0;
+  long b;
+  for (b = id; b < blocks; b += nthreads) {
+    fill_block(buf, b);
+    if (pwrite(shared_fd, buf, BLOCK, (off_t) b * BLOCK) != BLOCK) {
+      rc = 1;
+      break;
+    }
+  }
+  free(buf);
+  return (void*) rc;
+}
+
+/* thread id opens the file and reads back the same blocks it wrote */
+void* reader(void* arg)
+{
+  long id = (long) arg;
+  long blocks = (long) mb * 1024 * 1024 / BLOCK;
+  int fd = open(name, O_RDONLY);
+  if (fd < 0) {
+    return (void*) 1;
+  }
+  char* buf = (char*) malloc(BLOCK);
+  char* expected = (char*) malloc(BLOCK);
+  long rc = 0;
+  long b;
+  for (b = id; b < blocks; b += nthreads) {
+    fill_block(expected, b);
+    if (pread(fd, buf, BLOCK, (off_t) b * BLOCK) != BLOCK ||
+        memcmp(buf, expected, BLOCK) != 0)
+    {
+      rc = 1;
+      break;
+    }
+  }
+  free(expected);
+  free(buf);
+  close(fd);
+  return (void*) rc;
+}
+
+/* runs fn on n threads, returns elapsed seconds or -1 on error */
+double run(void* (*fn)(void*), int n)
+{
+  nthreads = n;
+  pthread_t* tids = (pthread_t*) malloc(n * sizeof(pthread_t));
+  double start = now();
+  long t;
+  for (t = 0; t < n; t++) {
+    pthread_create(&tids[t], NULL, fn, (void*) t);
+  }
+  int rc = 0;
+  for (t = 0; t < n; t++) {
+    void* ret;
+    pthread_join(tids[t], &ret);
+    if (ret != NULL) {
+      rc = 1;
+    }
+  }
+  double secs = now() - start;
+  free(tids);
+  return rc ? -1.0 : secs;
+}
+
+int run_pass(int n)
+{
+  shared_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (shared_fd < 0) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  double wsecs = run(writer, n);
+  close(shared_fd);
+  if (wsecs < 0) {
+    printf("ERROR: pwrite failed with %d threads\n", n);
+    return 1;
+  }
+
+  /* the file is sealed now, so readers take no lock */
+  double rsecs = run(reader, n);
+  if (rsecs < 0) {
+    printf("ERROR: Read back wrong data with %d threads\n", n);
+    return 1;
+  }
+
+  int fd = open(name, O_RDONLY);
+  off_t size = lseek(fd, 0, SEEK_END);
+  close(fd);
+  if (size != (off_t) mb * 1024 * 1024) {
+    printf("ERROR: File size is %ld expected %ld\n", (long) size, (long) mb * 1024 * 1024);
+    return 1;
+  }
+
+  printf("%d threads: pwrite %.2f MB/s pread %.2f MB/s\n", n,
+         (double) mb / wsecs, (double) mb / rsecs);
+  unlink(name);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 3) {
+    printf("Usage: test_pwrite_threads [threads] [mb]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    threads = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    mb = atoi(argv[2]);
+  }
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 256*1024*1024, rank);
+
+  int rc = 0;
+  rc |= run_pass(1);
+  rc |= run_pass(threads);
+
+  return rc;
+}
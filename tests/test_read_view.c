@@ -0,0 +1,141 @@
+// build:  make test_read_view
+// run:    ./test_read_view
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+int rank  = -1;
+int ranks = 0;
+
+/* compare data referenced by view against expected pattern */
+int check_view(cruise_read_view_t* view, off_t pos, size_t count)
+{
+  size_t n = 0;
+  int i;
+  for (i = 0; i < view->iovcnt; i++) {
+    char* data = (char*) view->iov[i].iov_base;
+    size_t j;
+    for (j = 0; j < view->iov[i].iov_len; j++) {
+      if (data[j] != (char) ((pos + n) % 251)) {
+        printf("ERROR: byte %lu differs\n", (unsigned long) (pos + n));
+        return 1;
+      }
+      n++;
+    }
+  }
+  if (n != count) {
+    printf("ERROR: view covers %lu bytes, expected %lu\n", (unsigned long) n, (unsigned long) count);
+    return 1;
+  }
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  char name[256];
+  char name2[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+  sprintf(name2, "/tmp/rank.%d.other", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  /* write a file spanning several chunks */
+  size_t filesize = 40*1024*1024;
+  char* buf = (char*) malloc(filesize);
+  size_t i;
+  for (i = 0; i < filesize; i++) {
+    buf[i] = (char) (i % 251);
+  }
+
+  /* data written to other files while the view is held */
+  char* other = (char*) malloc(filesize);
+  memset(other, 0xff, filesize);
+
+  int rc = 0;
+
+  unlink(name);
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    printf("ERROR: Failed to open %s\n", name);
+    return 1;
+  }
+  if (write(fd, buf, filesize) != (ssize_t) filesize) {
+    printf("ERROR: Failed to write %s errno=%d\n", name, errno);
+    return 1;
+  }
+
+  /* map a range crossing a chunk boundary */
+  cruise_read_view_t view;
+  off_t pos = 16*1024*1024 - 100;
+  if (cruise_read_view(fd, pos, 200, &view) != 0) {
+    printf("ERROR: cruise_read_view: %s\n", strerror(errno));
+    return 1;
+  }
+  printf("view entries=%d\n", view.iovcnt);
+  rc |= check_view(&view, pos, 200);
+
+  /* truncate must leave pinned data in place, even when another file
+   * grows into the space it gave up */
+  if (ftruncate(fd, 0) != 0) {
+    printf("ERROR: ftruncate failed errno=%d\n", errno);
+    rc = 1;
+  }
+  rc |= check_view(&view, pos, 200);
+  int fd2 = open(name2, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd2 < 0 || write(fd2, other, filesize) != (ssize_t) filesize) {
+    printf("ERROR: Failed to write %s errno=%d\n", name2, errno);
+    rc = 1;
+  }
+  close(fd2);
+  rc |= check_view(&view, pos, 200);
+  close(fd);
+
+  /* so must unlink, even when a new file takes the space */
+  if (unlink(name) != 0) {
+    printf("ERROR: unlink failed errno=%d\n", errno);
+    rc = 1;
+  }
+  rc |= check_view(&view, pos, 200);
+  unlink(name2);
+  fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0 || write(fd, other, filesize) != (ssize_t) filesize) {
+    printf("ERROR: Failed to write new %s errno=%d\n", name, errno);
+    rc = 1;
+  }
+  rc |= check_view(&view, pos, 200);
+  close(fd);
+  unlink(name);
+  if (cruise_read_view_release(&view) != 0) {
+    printf("ERROR: cruise_read_view_release failed errno=%d\n", errno);
+    rc = 1;
+  }
+
+  /* range past end of file is clipped */
+  fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0 || write(fd, buf, 1000) != 1000) {
+    printf("ERROR: Failed to write short %s errno=%d\n", name, errno);
+    rc = 1;
+  }
+  if (cruise_read_view(fd, 900, 500, &view) != 0) {
+    printf("ERROR: cruise_read_view: %s\n", strerror(errno));
+    rc = 1;
+  } else {
+    rc |= check_view(&view, 900, 100);
+    cruise_read_view_release(&view);
+  }
+  close(fd);
+  unlink(name);
+
+  free(other);
+  free(buf);
+  return rc;
+}
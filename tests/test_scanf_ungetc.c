@@ -0,0 +1,105 @@
+// build:  make test_scanf_ungetc
+// run:    ./test_scanf_ungetc
+
+// scans numbers from streams after bytes were pushed back with
+// ungetc, either by the caller or by fscanf itself when a conversion
+// stops at a byte it can't use, and checks that each call returns
+// the same count and values as glibc reading the same text from a
+// file outside the mount
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+int rank = 0;
+
+char name[256];
+char real_name[256];
+
+/* writes text to path with a stream */
+int write_text(const char* path, const char* text)
+{
+  FILE* fp = fopen(path, "w");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s errno=%d\n", path, errno);
+    return 1;
+  }
+  fputs(text, fp);
+  fclose(fp);
+  return 0;
+}
+
+/* scans text twice with fmt1 and then fmt2, after pushing back the
+ * first byte if unget is set, records the counts and values */
+int scan_text(const char* path, const char* text, int unget,
+              const char* fmt1, const char* fmt2, int* rc, long* val)
+{
+  if (write_text(path, text)) {
+    return 1;
+  }
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s errno=%d\n", path, errno);
+    return 1;
+  }
+  if (unget) {
+    ungetc(fgetc(fp), fp);
+  }
+  val[0] = 0;
+  val[1] = 0;
+  rc[0] = fscanf(fp, fmt1, &val[0]);
+  rc[1] = fscanf(fp, fmt2, &val[1]);
+  fclose(fp);
+  return 0;
+}
+
+/* runs one case against cruise and glibc and compares */
+int run_case(const char* text, int unget, const char* fmt1, const char* fmt2)
+{
+  int rc[2], real_rc[2];
+  long val[2], real_val[2];
+  if (scan_text(name, text, unget, fmt1, fmt2, rc, val) ||
+      scan_text(real_name, text, unget, fmt1, fmt2, real_rc, real_val))
+  {
+    return 1;
+  }
+
+  int i;
+  for (i = 0; i < 2; i++) {
+    if (rc[i] != real_rc[i] || (rc[i] == 1 && val[i] != real_val[i])) {
+      printf("ERROR: \"%s\" with %s then %s%s: call %d gave %d (%ld) expected %d (%ld)\n",
+             text, fmt1, fmt2, unget ? " after ungetc" : "", i + 1,
+             rc[i], val[i], real_rc[i], real_val[i]);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  sprintf(name, "/tmp/rank.%d", rank);
+  sprintf(real_name, "./test_scanf_ungetc.%d", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  int rc = 0;
+
+  /* a sign followed by something other than a digit fails the
+   * conversion and leaves the byte after the sign to be read next */
+  rc |= run_case("+ 7", 0, "%ld", "%ld");
+  rc |= run_case("--1 5", 0, "%lu", "%ld");
+  rc |= run_case("-x 3", 0, "%ld", "%lx");
+
+  /* bytes the caller pushed back are scanned like any other */
+  rc |= run_case("42 17", 1, "%ld", "%ld");
+  rc |= run_case("7", 1, "%ld", "%ld");
+
+  unlink(name);
+  unlink(real_name);
+  return rc;
+}
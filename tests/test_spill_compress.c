@@ -0,0 +1,145 @@
+// build:  make test_spill_compress
+// run:    ./test_spill_compress
+
+// mounts with 2 chunks of 1MB in memory and 8MB of spill over with
+// compression of spilled chunks on, writes a compressible file of 8MB,
+// most of which has to go to spill over and only fits because it is
+// compressed, and a file of random data, which spills as is, then
+// reads both back, rewrites part of a compressed chunk and all of
+// another, and checks that the stats count the compressed chunks
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#define CHUNK (1024*1024)
+#define TEXT_SIZE (8*CHUNK)
+#define RANDOM_SIZE (2*CHUNK)
+
+int rank = 0;
+
+char name[256];
+char name2[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* writes len bytes of data to path */
+int write_file(const char* path, const char* data, size_t len)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open %s failed errno=%d", path, errno);
+  CHECK(write(fd, data, len) == (ssize_t) len, "write %s failed errno=%d", path, errno);
+  CHECK(close(fd) == 0, "close %s failed errno=%d", path, errno);
+  return 0;
+}
+
+/* reads path back in reads of step bytes and compares */
+int check_file(const char* what, const char* path, const char* expected, size_t len, size_t step)
+{
+  char* buf = (char*) malloc(step);
+  int fd = open(path, O_RDONLY);
+  CHECK(fd >= 0, "%s: open failed errno=%d", what, errno);
+  size_t done = 0;
+  while (done < len) {
+    size_t want = len - done < step ? len - done : step;
+    ssize_t n = read(fd, buf, want);
+    CHECK(n == (ssize_t) want, "%s: read %ld bytes at %lu expected %lu",
+          what, (long) n, (unsigned long) done, (unsigned long) want);
+    CHECK(memcmp(buf, expected + done, want) == 0, "%s: data differs near byte %lu",
+          what, (unsigned long) done);
+    done += want;
+  }
+  close(fd);
+  free(buf);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_COMPRESS_SPILLOVER", "1", 1);
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+  setenv("CRUISE_CHUNK_MEM", "2MB", 1);
+  setenv("CRUISE_USE_SPILLOVER", "1", 1);
+  setenv("CRUISE_SPILLOVER_SIZE", "8MB", 1);
+
+  sprintf(name, "/tmp/rank.%d", rank);
+  sprintf(name2, "/tmp/rank.%d.random", rank);
+
+  cruise_mount("/tmp", 2*1024*1024, rank);
+
+  /* text that compresses well, and random data that doesn't */
+  char* text = (char*) malloc(TEXT_SIZE);
+  char* random_data = (char*) malloc(RANDOM_SIZE);
+  size_t i;
+  for (i = 0; i < TEXT_SIZE; i++) {
+    text[i] = (char) ('a' + (i / 7 + i / 4096) % 26);
+  }
+  for (i = 0; i < RANDOM_SIZE; i++) {
+    random_data[i] = (char) (rand() & 0xff);
+  }
+
+  int rc = 0;
+  if (write_file(name, text, TEXT_SIZE) ||
+      write_file(name2, random_data, RANDOM_SIZE))
+  {
+    return 1;
+  }
+
+  /* the chunks that didn't fit in memory went out compressed */
+  cruise_stats_t stats;
+  CHECK(cruise_get_stats(&stats) == 0, "cruise_get_stats failed errno=%d", errno);
+  CHECK(stats.spill_packed_chunks == TEXT_SIZE / CHUNK - 2,
+        "%llu chunks compressed in spill over expected %d",
+        stats.spill_packed_chunks, TEXT_SIZE / CHUNK - 2);
+  CHECK(stats.spill_packed_bytes < stats.spill_packed_chunks * CHUNK,
+        "%llu compressed chunks take %llu bytes",
+        stats.spill_packed_chunks, stats.spill_packed_bytes);
+
+  rc |= check_file("small reads", name, text, TEXT_SIZE, 4096);
+  rc |= check_file("large reads", name, text, TEXT_SIZE, 3*CHUNK);
+  rc |= check_file("random", name2, random_data, RANDOM_SIZE, CHUNK);
+
+  /* a few bytes into a compressed chunk decompress it, a whole
+   * chunk replaces it */
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  memcpy(&text[5 * CHUNK + 100], "hello", 5);
+  CHECK(pwrite(fd, "hello", 5, 5 * CHUNK + 100) == 5, "pwrite failed errno=%d", errno);
+  memset(&text[6 * CHUNK], 'z', CHUNK);
+  CHECK(pwrite(fd, &text[6 * CHUNK], CHUNK, 6 * CHUNK) == CHUNK, "pwrite failed errno=%d", errno);
+  close(fd);
+  rc |= check_file("rewrite", name, text, TEXT_SIZE, 65536);
+
+  /* removing the files gives back the compressed chunks */
+  unlink(name);
+  unlink(name2);
+  CHECK(cruise_get_stats(&stats) == 0, "cruise_get_stats failed errno=%d", errno);
+  CHECK(stats.spill_packed_chunks == 0 && stats.spill_packed_bytes == 0,
+        "%llu compressed chunks left after unlink", stats.spill_packed_chunks);
+
+  /* and the space in spill over can be used again */
+  if (write_file(name, text, TEXT_SIZE)) {
+    return 1;
+  }
+  rc |= check_file("again", name, text, TEXT_SIZE, CHUNK);
+  unlink(name);
+
+  free(random_data);
+  free(text);
+  return rc;
+}
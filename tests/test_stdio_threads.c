@@ -0,0 +1,211 @@
+// build:  make test_stdio_threads
+// run:    ./test_stdio_threads [threads] [lines]
+
+// has several threads write fixed-size lines to one shared stream,
+// once with fputs and once holding flockfile around putc_unlocked,
+// then checks that no line was torn and none went missing, and
+// reports the rate of locked and unlocked calls, build it with
+// optimization too, where glibc inlines the *_unlocked calls
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#define LINE_LEN 16
+
+int threads = 4;
+long lines  = 100000;
+int rank    = 0;
+
+FILE* shared_fp;
+int use_unlocked;
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* formats line i of thread id into buf, "tttt iiiiiiiiii\n" */
+void make_line(char* buf, int id, long i)
+{
+  snprintf(buf, LINE_LEN + 1, "%04d %010ld\n", id, i);
+}
+
+void* writer(void* arg)
+{
+  int id = (int) (long) arg;
+  char line[LINE_LEN + 1];
+  long i;
+  for (i = 0; i < lines; i++) {
+    make_line(line, id, i);
+    if (use_unlocked) {
+      int j;
+      flockfile(shared_fp);
+      for (j = 0; j < LINE_LEN; j++) {
+        putc_unlocked(line[j], shared_fp);
+      }
+      funlockfile(shared_fp);
+    } else {
+      fputs(line, shared_fp);
+    }
+  }
+  return NULL;
+}
+
+/* reads back the file and checks that it holds every line of every
+ * thread whole and in per-thread order */
+int verify(const char* name)
+{
+  FILE* fp = fopen(name, "r");
+  if (fp == NULL) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+
+  long* next = (long*) calloc(threads, sizeof(long));
+  char line[LINE_LEN + 1];
+  char expected[LINE_LEN + 1];
+  long count = 0;
+  int rc = 0;
+  while (fread(line, 1, LINE_LEN, fp) == LINE_LEN) {
+    int id = atoi(line);
+    if (id < 0 || id >= threads) {
+      printf("ERROR: Bad line %ld: %.*s\n", count, LINE_LEN, line);
+      rc = 1;
+      break;
+    }
+    make_line(expected, id, next[id]);
+    if (memcmp(line, expected, LINE_LEN) != 0) {
+      printf("ERROR: Line %ld is %.*s expected %.*s\n", count, LINE_LEN - 1, line, LINE_LEN - 1, expected);
+      rc = 1;
+      break;
+    }
+    next[id]++;
+    count++;
+  }
+
+  /* at the end getc_unlocked gives EOF and feof_unlocked sees it until
+   * it is cleared, glibc inlines both when optimizing */
+  if (getc_unlocked(fp) != EOF || ! feof_unlocked(fp) || ferror_unlocked(fp)) {
+    printf("ERROR: No end-of-file indicator after the last line\n");
+    rc = 1;
+  }
+  clearerr_unlocked(fp);
+  if (feof_unlocked(fp)) {
+    printf("ERROR: End-of-file indicator still set after clearerr_unlocked\n");
+    rc = 1;
+  }
+  fclose(fp);
+
+  if (rc == 0 && count != threads * lines) {
+    printf("ERROR: Found %ld lines expected %ld\n", count, threads * lines);
+    rc = 1;
+  }
+
+  free(next);
+  return rc;
+}
+
+/* writes lines from all threads to name, verifies, and reports rate */
+int run_threads(const char* name, int unlocked)
+{
+  shared_fp = fopen(name, "w");
+  if (shared_fp == NULL) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+  use_unlocked = unlocked;
+
+  pthread_t* tids = (pthread_t*) malloc(threads * sizeof(pthread_t));
+  double start = now();
+  long t;
+  for (t = 0; t < threads; t++) {
+    pthread_create(&tids[t], NULL, writer, (void*) t);
+  }
+  for (t = 0; t < threads; t++) {
+    pthread_join(tids[t], NULL);
+  }
+  fclose(shared_fp);
+  double secs = now() - start;
+  free(tids);
+
+  int rc = verify(name);
+  if (rc == 0) {
+    printf("%d threads %s: %.2f Mlines/s\n", threads,
+           unlocked ? "flockfile+putc_unlocked" : "fputs",
+           (double) (threads * lines) / secs / 1000000.0);
+  }
+  unlink(name);
+  return rc;
+}
+
+/* times single-threaded putc against putc_unlocked */
+int run_single(const char* name)
+{
+  long bytes = threads * lines * LINE_LEN;
+  int unlocked;
+  for (unlocked = 0; unlocked < 2; unlocked++) {
+    FILE* fp = fopen(name, "w");
+    if (fp == NULL) {
+      printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+      return 1;
+    }
+    double start = now();
+    long i;
+    if (unlocked) {
+      flockfile(fp);
+      for (i = 0; i < bytes; i++) {
+        putc_unlocked('a' + (int) (i % 26), fp);
+      }
+      funlockfile(fp);
+    } else {
+      for (i = 0; i < bytes; i++) {
+        putc('a' + (int) (i % 26), fp);
+      }
+    }
+    fclose(fp);
+    double secs = now() - start;
+    printf("1 thread %s: %.2f MB/s\n", unlocked ? "putc_unlocked" : "putc",
+           (double) bytes / secs / (1024.0 * 1024.0));
+    unlink(name);
+  }
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 3) {
+    printf("Usage: test_stdio_threads [threads] [lines]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    threads = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    lines = atol(argv[2]);
+  }
+
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  int rc = 0;
+  rc |= run_single(name);
+  rc |= run_threads(name, 0);
+  rc |= run_threads(name, 1);
+
+  return rc;
+}
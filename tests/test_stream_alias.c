@@ -0,0 +1,131 @@
+// build:  make test_stream_alias
+// run:    ./test_stream_alias
+
+// writes through a fully buffered stream, whose window points straight
+// at chunk memory, while a second descriptor on the same file writes
+// past the end or extends it with truncate before the stream is closed,
+// and checks that the file reads back the way it does with glibc, the
+// bytes the stream wrote are kept and only the gap between is zero
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+
+int rank = 0;
+
+char name[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* reads the file and compares it to the expected bytes */
+int check_file(const char* what, const char* expected, size_t len)
+{
+  char buf[16384];
+  int fd = open(name, O_RDONLY);
+  CHECK(fd >= 0, "%s: open failed errno=%d", what, errno);
+  ssize_t n = read(fd, buf, sizeof(buf));
+  close(fd);
+  CHECK(n == (ssize_t) len, "%s: read %ld bytes expected %ld", what, (long) n, (long) len);
+  size_t i;
+  for (i = 0; i < len; i++) {
+    CHECK(buf[i] == expected[i], "%s: byte %ld is %d expected %d",
+          what, (long) i, (int) buf[i], (int) expected[i]);
+  }
+  return 0;
+}
+
+/* stream writes hello, another descriptor writes X at offset 10 */
+int run_pwrite(void)
+{
+  FILE* f = fopen(name, "w");
+  CHECK(f != NULL, "fopen failed errno=%d", errno);
+  CHECK(fputs("hello", f) != EOF, "fputs failed");
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(pwrite(fd, "X", 1, 10) == 1, "pwrite failed errno=%d", errno);
+  close(fd);
+  CHECK(fclose(f) == 0, "fclose failed errno=%d", errno);
+  return check_file("pwrite", "hello\0\0\0\0\0X", 11);
+}
+
+/* stream writes hello, another descriptor extends the file to 8 */
+int run_truncate(void)
+{
+  FILE* f = fopen(name, "w");
+  CHECK(f != NULL, "fopen failed errno=%d", errno);
+  CHECK(fwrite("hello", 1, 5, f) == 5, "fwrite failed");
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(ftruncate(fd, 8) == 0, "ftruncate failed errno=%d", errno);
+  close(fd);
+  CHECK(fclose(f) == 0, "fclose failed errno=%d", errno);
+  return check_file("truncate", "hello\0\0\0", 8);
+}
+
+/* stream writes a block large enough to go straight into the chunk,
+ * another descriptor writes X past it */
+int run_fwrite(void)
+{
+  static char expected[10001];
+  memset(expected, 'a', 8192);
+  expected[10000] = 'X';
+
+  FILE* f = fopen(name, "w");
+  CHECK(f != NULL, "fopen failed errno=%d", errno);
+  CHECK(fwrite(expected, 1, 8192, f) == 8192, "fwrite failed");
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(pwrite(fd, "X", 1, 10000) == 1, "pwrite failed errno=%d", errno);
+  close(fd);
+  CHECK(fclose(f) == 0, "fclose failed errno=%d", errno);
+  return check_file("fwrite", expected, sizeof(expected));
+}
+
+/* stream writes hello one byte at a time, then more after the other
+ * descriptor wrote past it */
+int run_putc(void)
+{
+  FILE* f = fopen(name, "w+");
+  CHECK(f != NULL, "fopen failed errno=%d", errno);
+  const char* p;
+  for (p = "hello"; *p != '\0'; p++) {
+    CHECK(fputc(*p, f) == *p, "fputc failed");
+  }
+  int fd = open(name, O_WRONLY);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(pwrite(fd, "X", 1, 8) == 1, "pwrite failed errno=%d", errno);
+  close(fd);
+  CHECK(fputc('!', f) == '!', "fputc failed");
+  CHECK(fclose(f) == 0, "fclose failed errno=%d", errno);
+  return check_file("putc", "hello!\0\0X", 9);
+}
+
+int main (int argc, char* argv[])
+{
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  int rc = 0;
+  rc |= run_pwrite();
+  rc |= run_truncate();
+  rc |= run_fwrite();
+  rc |= run_putc();
+
+  unlink(name);
+  return rc;
+}
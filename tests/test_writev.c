@@ -0,0 +1,246 @@
+// build:  make test_writev
+// run:    ./test_writev [iterations]
+
+// writes and reads a file with random writev/pwritev/readv/preadv
+// vectors whose segments straddle chunk boundaries, mirrors every
+// operation in a memory buffer, and checks that the file and buffer
+// agree, then reports the rate of writev against write per segment
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+
+#define FILE_SIZE (40*1024*1024)
+#define MAX_SEGS  16
+
+int iterations = 2000;
+int rank       = 0;
+
+char* mirror;
+off_t mirror_size = 0;
+
+double now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double) tv.tv_sec + (double) tv.tv_usec / 1000000.0;
+}
+
+/* builds a random vector of up to MAX_SEGS segments over buf, some
+ * of them empty, returns the number of segments and sets total */
+int make_iov(struct iovec* iov, char* buf, size_t max, size_t* total)
+{
+  int iovcnt = 1 + rand() % MAX_SEGS;
+  size_t offset = 0;
+  int i;
+  for (i = 0; i < iovcnt; i++) {
+    size_t len = 0;
+    if (rand() % 8 != 0) {
+      len = (size_t) (rand() % (max / MAX_SEGS));
+    }
+    iov[i].iov_base = buf + offset;
+    iov[i].iov_len  = len;
+    offset += len;
+  }
+  *total = offset;
+  return iovcnt;
+}
+
+/* checks that the file holds exactly what the mirror does */
+int verify(int fd)
+{
+  char* check = (char*) malloc(FILE_SIZE);
+  ssize_t n = pread(fd, check, FILE_SIZE, 0);
+  int rc = 0;
+  if (n != (ssize_t) mirror_size) {
+    printf("ERROR: Read %ld bytes expected %ld\n", (long) n, (long) mirror_size);
+    rc = 1;
+  } else if (memcmp(check, mirror, mirror_size) != 0) {
+    printf("ERROR: File contents differ from mirror\n");
+    rc = 1;
+  }
+  free(check);
+  return rc;
+}
+
+int run_random(const char* name)
+{
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+    return 1;
+  }
+
+  size_t max = 4*1024*1024;
+  char* buf  = (char*) malloc(max);
+  struct iovec iov[MAX_SEGS];
+  off_t pos = 0;
+  int it;
+  for (it = 0; it < iterations; it++) {
+    size_t total;
+    ssize_t moved;
+    int iovcnt = make_iov(iov, buf, max, &total);
+
+    /* pick a spot that may lie past the end to leave a gap */
+    off_t offset = (off_t) (rand() % (FILE_SIZE - max));
+    int positional = rand() % 2;
+    if (! positional) {
+      offset = lseek(fd, offset, SEEK_SET);
+    }
+
+    if (rand() % 2) {
+      size_t i;
+      for (i = 0; i < total; i++) {
+        buf[i] = (char) rand();
+      }
+
+      ssize_t n;
+      if (positional) {
+        n = pwritev(fd, iov, iovcnt, offset);
+      } else {
+        n = writev(fd, iov, iovcnt);
+      }
+      if (n != (ssize_t) total) {
+        printf("ERROR: writev returned %ld expected %ld errno=%d\n", (long) n, (long) total, errno);
+        return 1;
+      }
+      moved = n;
+
+      /* mirror the write, zero filling any gap */
+      if (offset > mirror_size) {
+        memset(mirror + mirror_size, 0, offset - mirror_size);
+      }
+      memcpy(mirror + offset, buf, total);
+      if (offset + (off_t) total > mirror_size) {
+        mirror_size = offset + (off_t) total;
+      }
+    } else {
+      memset(buf, 0xff, total);
+
+      ssize_t n;
+      if (positional) {
+        n = preadv(fd, iov, iovcnt, offset);
+      } else {
+        n = readv(fd, iov, iovcnt);
+      }
+
+      /* reads stop at the end of the file */
+      size_t expected = 0;
+      if (offset < mirror_size) {
+        expected = (size_t) (mirror_size - offset);
+        if (expected > total) {
+          expected = total;
+        }
+      }
+      if (n != (ssize_t) expected) {
+        printf("ERROR: readv returned %ld expected %ld errno=%d\n", (long) n, (long) expected, errno);
+        return 1;
+      }
+      moved = n;
+      if (memcmp(buf, mirror + offset, expected) != 0) {
+        printf("ERROR: readv data differs at offset %ld\n", (long) offset);
+        return 1;
+      }
+    }
+
+    /* readv and writev advance the file pointer, preadv and
+     * pwritev leave it alone */
+    off_t expected_pos = positional ? pos : offset + moved;
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos != expected_pos) {
+      printf("ERROR: File pointer at %ld expected %ld\n", (long) pos, (long) expected_pos);
+      return 1;
+    }
+  }
+
+  int rc = verify(fd);
+
+  /* an out of range vector count is rejected */
+  if (writev(fd, iov, -1) != -1 || errno != EINVAL) {
+    printf("ERROR: writev with iovcnt=-1 did not fail with EINVAL\n");
+    rc = 1;
+  }
+
+  close(fd);
+  unlink(name);
+  free(buf);
+  return rc;
+}
+
+/* times writing many small records with one writev per batch against
+ * one write per record */
+int run_rate(const char* name)
+{
+  char rec[64];
+  memset(rec, 'x', sizeof(rec));
+
+  struct iovec iov[MAX_SEGS];
+  int i;
+  for (i = 0; i < MAX_SEGS; i++) {
+    iov[i].iov_base = rec;
+    iov[i].iov_len  = sizeof(rec);
+  }
+
+  long batches = FILE_SIZE / (MAX_SEGS * sizeof(rec)) / 2;
+  int vector;
+  for (vector = 0; vector < 2; vector++) {
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      printf("ERROR: Failed to open %s errno=%d\n", name, errno);
+      return 1;
+    }
+    double start = now();
+    long b;
+    for (b = 0; b < batches; b++) {
+      if (vector) {
+        writev(fd, iov, MAX_SEGS);
+      } else {
+        for (i = 0; i < MAX_SEGS; i++) {
+          write(fd, rec, sizeof(rec));
+        }
+      }
+    }
+    double secs = now() - start;
+    close(fd);
+    printf("%s: %.2f Mrecords/s\n", vector ? "writev" : "write",
+           (double) (batches * MAX_SEGS) / secs / 1000000.0);
+    unlink(name);
+  }
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  /* check that we got an appropriate number of arguments */
+  if (argc > 2) {
+    printf("Usage: test_writev [iterations]\n");
+    return 1;
+  }
+
+  /* read parameters from command line, if any */
+  if (argc > 1) {
+    iterations = atoi(argv[1]);
+  }
+
+  char name[256];
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 100*1024*1024, rank);
+
+  mirror = (char*) malloc(FILE_SIZE);
+
+  int rc = 0;
+  rc |= run_random(name);
+  rc |= run_rate(name);
+
+  free(mirror);
+  return rc;
+}
@@ -0,0 +1,112 @@
+// build:  make test_zero_chunks
+// run:    ./test_zero_chunks
+
+// mounts with zero chunks kept as holes and 1MB chunks, writes a file
+// where every other chunk is all zeros, then writes data into one of
+// the holes and leaves a gap past the end, and checks both that the
+// file reads back right and that the stats count the holes
+
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+#include "cruise.h"
+
+#define CHUNK (1024*1024)
+#define CHUNKS 8
+
+int rank = 0;
+
+char name[256];
+
+#define CHECK(cond, ...) \
+  do { \
+    if (! (cond)) { \
+      printf("ERROR: "); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      return 1; \
+    } \
+  } while (0)
+
+/* checks that the stats count holes */
+int check_holes(const char* what, unsigned long long holes)
+{
+  cruise_stats_t stats;
+  CHECK(cruise_get_stats(&stats) == 0, "%s: cruise_get_stats failed errno=%d", what, errno);
+  CHECK(stats.chunk_size == CHUNK, "%s: chunk size is %lu expected %d",
+        what, (unsigned long) stats.chunk_size, CHUNK);
+  CHECK(stats.zero_chunks == holes, "%s: %llu holes expected %llu",
+        what, stats.zero_chunks, holes);
+  return 0;
+}
+
+/* reads the file and compares it to the expected bytes */
+int check_file(const char* what, const char* expected, size_t len)
+{
+  char* buf = (char*) malloc(len + 1);
+  int fd = open(name, O_RDONLY);
+  CHECK(fd >= 0, "%s: open failed errno=%d", what, errno);
+  ssize_t n = read(fd, buf, len + 1);
+  close(fd);
+  CHECK(n == (ssize_t) len, "%s: read %ld bytes expected %ld", what, (long) n, (long) len);
+  size_t i;
+  for (i = 0; i < len; i++) {
+    CHECK(buf[i] == expected[i], "%s: byte %ld is %d expected %d",
+          what, (long) i, (int) buf[i], (int) expected[i]);
+  }
+  free(buf);
+  return 0;
+}
+
+int main (int argc, char* argv[])
+{
+  setenv("CRUISE_ZERO_CHUNKS", "1", 1);
+  setenv("CRUISE_CHUNK_BITS", "20", 1);
+
+  sprintf(name, "/tmp/rank.%d", rank);
+
+  cruise_mount("/tmp", 64*1024*1024, rank);
+
+  /* odd chunks hold data, even chunks zeros, with room for a gap */
+  size_t len = (CHUNKS + 4) * CHUNK + 1;
+  char* expected = (char*) calloc(1, len);
+  size_t i;
+  for (i = 0; i < CHUNKS * CHUNK; i++) {
+    if ((i / CHUNK) % 2 == 1) {
+      expected[i] = (char) ('a' + i % 26);
+    }
+  }
+
+  int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK(fd >= 0, "open failed errno=%d", errno);
+  CHECK(write(fd, expected, CHUNKS * CHUNK) == CHUNKS * CHUNK, "write failed errno=%d", errno);
+  int rc = 0;
+  rc |= check_holes("write", CHUNKS / 2);
+  rc |= check_file("write", expected, CHUNKS * CHUNK);
+
+  /* a few bytes into a hole give it storage again */
+  memcpy(&expected[2 * CHUNK + 10], "hello", 5);
+  CHECK(pwrite(fd, "hello", 5, 2 * CHUNK + 10) == 5, "pwrite failed errno=%d", errno);
+  rc |= check_holes("fill", CHUNKS / 2 - 1);
+  rc |= check_file("fill", expected, CHUNKS * CHUNK);
+
+  /* writing past the end zero fills whole chunks as holes */
+  expected[len - 1] = 'X';
+  CHECK(pwrite(fd, "X", 1, len - 1) == 1, "pwrite past end failed errno=%d", errno);
+  rc |= check_holes("gap", CHUNKS / 2 - 1 + 4);
+  rc |= check_file("gap", expected, len);
+  close(fd);
+
+  /* removing the file gives back its holes */
+  unlink(name);
+  rc |= check_holes("unlink", 0);
+
+  free(expected);
+  return rc;
+}